@@ -0,0 +1,416 @@
+/* File that contains the admin listener of the server. Only the first shard
+ * runs it, so its state needs no lock. A client sends one request, which
+ * is read as it arrives until the blank line that ends its headers, and is
+ * sent back one response built from the metrics of every shard, after
+ * which the connection is closed. Whatever the socket does not take at
+ * once is sent when the event loop reports it writable. Every response is
+ * built from scratch, so an admin listener nobody scrapes does no work.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "admin.h"
+#include "event_loop.h"
+#include "metrics.h"
+#include "output.h"
+#include "chat_log.h"
+#include "user_utils.h"
+#include "client_server_utils.h"
+
+/* A connection to the admin listener. fd is -1 if the slot is free.
+ * response is NULL until the whole request has been read. */
+struct admin_client {
+	fd_t fd;
+	unsigned received;
+	char request[ADMIN_REQUEST_SIZE];
+	char *response;
+	unsigned length;
+	unsigned sent;
+};
+
+/* Text that grows as it is appended to. */
+struct admin_text {
+	char *data;
+	unsigned length;
+	unsigned capacity;
+};
+
+fd_t create_admin_socket ();
+
+void accept_admin_clients ();
+
+void read_admin_request (struct admin_client *client);
+
+void write_admin_response (struct admin_client *client);
+
+void close_admin_client (struct admin_client *client);
+
+void build_admin_response (struct admin_client *client);
+
+void render_exposition (struct admin_text *text);
+
+void append_text (struct admin_text *text, char *format, ...);
+
+void append_family (struct admin_text *text, char *name, char *type, char *help);
+
+void append_histogram (struct admin_text *text, char *name, char *help, struct histogram *histogram,
+	unsigned first, unsigned last, double scale);
+
+void admin_error ();
+
+/* The size of the response buffer when it is first allocated. */
+#define ADMIN_TEXT_CAPACITY 8192
+
+/* The port or Unix socket path given with -A, NULL if there is no admin
+ * listener. */
+char *admin_address = NULL;
+
+/* The admin listener, -1 if there is none. */
+fd_t admin_socket = -1;
+
+/* The connections to the admin listener. */
+struct admin_client admin_clients[ADMIN_CLIENT_LIMIT];
+
+/*
+ * Function: admin_init
+ * --------------------
+ * creates the admin listener if -A was given and has the event loop of the
+ * calling shard watch it.
+ *
+ * returns: void
+ */
+void admin_init () {
+	if (admin_address == NULL) {
+		return;
+	}
+	for (unsigned i = 0; i < ADMIN_CLIENT_LIMIT; i++) {
+		admin_clients[i].fd = -1;
+	}
+	admin_socket = create_admin_socket ();
+	event_loop_add_admin (admin_socket);
+}
+
+/* Function that creates the nonblocking admin listener, on the loopback
+ * address if admin_address is a port and on a Unix socket at that path
+ * otherwise, replacing whatever socket was left there. */
+fd_t create_admin_socket () {
+	bool numeric = admin_address[0] != 0;
+	for (int i = 0; admin_address[i] != 0; i++) {
+		numeric = numeric && isdigit ((unsigned char) admin_address[i]);
+	}
+	fd_t listener = socket (numeric ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listener == -1) {
+		admin_error ();
+	}
+	int result;
+	if (numeric) {
+		int reuse = 1;
+		setsockopt (listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+		struct sockaddr_in info;
+		memset (&info, 0, sizeof (info));
+		info.sin_family = AF_INET;
+		info.sin_port = htons (atoi (admin_address));
+		info.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+		result = bind (listener, (struct sockaddr *) &info, sizeof (info));
+	} else {
+		struct sockaddr_un info;
+		memset (&info, 0, sizeof (info));
+		info.sun_family = AF_UNIX;
+		if (strlen (admin_address) >= sizeof (info.sun_path)) {
+			admin_error ();
+		}
+		strcpy (info.sun_path, admin_address);
+		unlink (admin_address);
+		result = bind (listener, (struct sockaddr *) &info, sizeof (info));
+	}
+	if (result == -1 || listen (listener, ADMIN_CLIENT_LIMIT) == -1) {
+		admin_error ();
+	}
+	return listener;
+}
+
+/*
+ * Function: handle_admin
+ * ----------------------
+ * handles activity on an admin socket. The listener accepts every pending
+ * connection, a client that is still sending its request is read from and
+ * one that is being answered is written to. The socket is then watched
+ * again, for writability if a response is waiting.
+ *
+ * fd: the admin socket the event loop reported
+ *
+ * returns: void
+ */
+void handle_admin (fd_t fd) {
+	if (fd == admin_socket) {
+		accept_admin_clients ();
+		event_loop_watch_admin (admin_socket, false);
+		return;
+	}
+	struct admin_client *client = NULL;
+	for (unsigned i = 0; i < ADMIN_CLIENT_LIMIT && client == NULL; i++) {
+		if (admin_clients[i].fd == fd) {
+			client = &admin_clients[i];
+		}
+	}
+	if (client == NULL) {
+		return;
+	}
+	if (client->response == NULL) {
+		read_admin_request (client);
+	}
+	if (client->fd != -1 && client->response != NULL) {
+		write_admin_response (client);
+	}
+	if (client->fd != -1) {
+		event_loop_watch_admin (client->fd, client->response != NULL);
+	}
+}
+
+/* Function that accepts every pending connection to the admin listener,
+ * closing those that find every slot taken. */
+void accept_admin_clients () {
+	while (true) {
+		fd_t fd = accept4 (admin_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) {
+			return;
+		}
+		struct admin_client *client = NULL;
+		for (unsigned i = 0; i < ADMIN_CLIENT_LIMIT && client == NULL; i++) {
+			if (admin_clients[i].fd == -1) {
+				client = &admin_clients[i];
+			}
+		}
+		if (client == NULL) {
+			close (fd);
+			continue;
+		}
+		client->fd = fd;
+		client->received = 0;
+		client->response = NULL;
+		event_loop_add_admin (fd);
+	}
+}
+
+/* Function that reads what has arrived of a client's request and builds
+ * the response once the headers have ended or the request fills its
+ * buffer. A client that closes or fails first is closed. */
+void read_admin_request (struct admin_client *client) {
+	ssize_t length = read (client->fd, client->request + client->received,
+		ADMIN_REQUEST_SIZE - 1 - client->received);
+	if (length == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return;
+	}
+	if (length <= 0) {
+		close_admin_client (client);
+		return;
+	}
+	client->received += length;
+	client->request[client->received] = 0;
+	if (strstr (client->request, "\r\n\r\n") != NULL || strstr (client->request, "\n\n") != NULL
+			|| client->received == ADMIN_REQUEST_SIZE - 1) {
+		build_admin_response (client);
+	}
+}
+
+/* Function that writes as much of a client's response as its socket
+ * takes, closing the client once all of it has been sent or the write
+ * failed. */
+void write_admin_response (struct admin_client *client) {
+	ssize_t written = write (client->fd, client->response + client->sent, client->length - client->sent);
+	if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return;
+	}
+	if (written > 0) {
+		client->sent += written;
+	}
+	if (written <= 0 || client->sent == client->length) {
+		close_admin_client (client);
+	}
+}
+
+/* Function that stops watching a client, closes it and frees its slot. */
+void close_admin_client (struct admin_client *client) {
+	event_loop_remove_admin (client->fd);
+	close (client->fd);
+	free (client->response);
+	client->fd = -1;
+	client->response = NULL;
+}
+
+/*
+ * Function: build_admin_response
+ * ------------------------------
+ * builds the HTTP response to a client's request: the exposition of the
+ * metrics for a GET, whatever its path, and an empty 405 for anything
+ * else. Every response closes the connection.
+ *
+ * client: the client whose request has been read
+ *
+ * returns: void
+ */
+void build_admin_response (struct admin_client *client) {
+	struct admin_text body = {NULL, 0, 0};
+	char *status = "405 Method Not Allowed";
+	if (strncmp (client->request, "GET ", 4) == 0) {
+		status = "200 OK";
+		render_exposition (&body);
+	}
+	struct admin_text response = {NULL, 0, 0};
+	append_text (&response, "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %u\r\nConnection: close\r\n\r\n%s", status, body.length, body.data == NULL ? "" : body.data);
+	free (body.data);
+	client->response = response.data;
+	client->length = response.length;
+	client->sent = 0;
+}
+
+/*
+ * Function: render_exposition
+ * ---------------------------
+ * appends the metrics of every shard combined in the Prometheus text
+ * format: the room, the traffic and system calls, the commands, the output
+ * queues, the log, the outbound pool and the histograms. Times are in
+ * seconds as Prometheus expects, and the histogram buckets are the powers
+ * of two, which the buckets of struct histogram split exactly.
+ *
+ * text: where the exposition is appended
+ *
+ * returns: void
+ */
+void render_exposition (struct admin_text *text) {
+	struct metrics *total = calloc (1, sizeof (struct metrics));
+	if (total == NULL) {
+		allocation_failed ();
+	}
+	collect_metrics (total);
+	struct output_statistics output;
+	collect_output_statistics (&output);
+	append_family (text, "chat_connected_users", "gauge", "Users in the room.");
+	append_text (text, "chat_connected_users %u\n", room_total);
+	append_family (text, "chat_messages_received_total", "counter", "Lines read from clients.");
+	append_text (text, "chat_messages_received_total %lu\n", total->messages_in);
+	append_family (text, "chat_received_bytes_total", "counter", "Bytes read from clients.");
+	append_text (text, "chat_received_bytes_total %lu\n", total->bytes_in);
+	append_family (text, "chat_messages_sent_total", "counter", "Messages written to clients.");
+	append_text (text, "chat_messages_sent_total %lu\n", output.written_messages);
+	append_family (text, "chat_sent_bytes_total", "counter", "Bytes written to clients.");
+	append_text (text, "chat_sent_bytes_total %lu\n", total->bytes_out);
+	append_family (text, "chat_broadcasts_total", "counter", "Messages sent to the room.");
+	append_text (text, "chat_broadcasts_total %lu\n", total->broadcasts);
+	append_family (text, "chat_system_calls_total", "counter", "Reads, sends and waits for events.");
+	append_text (text, "chat_system_calls_total{call=\"read\"} %lu\n", total->read_calls);
+	append_text (text, "chat_system_calls_total{call=\"send\"} %lu\n", output.write_calls);
+	append_text (text, "chat_system_calls_total{call=\"poll\"} %lu\n", total->poll_calls);
+	append_family (text, "chat_commands_total", "counter", "Commands handled, by name.");
+	for (unsigned c = 0; c < COMMAND_COUNT; c++) {
+		append_text (text, "chat_commands_total{command=\"%s\"} %lu\n", commands[c], total->commands[c]);
+	}
+	append_family (text, "chat_command_errors_total", "counter", "Commands that were unknown or malformed.");
+	append_text (text, "chat_command_errors_total{error=\"unknown\"} %lu\n", total->unknown_commands);
+	append_text (text, "chat_command_errors_total{error=\"invalid\"} %lu\n", total->invalid_commands);
+	append_family (text, "chat_output_queued_bytes", "gauge", "Bytes waiting to be sent to clients.");
+	append_text (text, "chat_output_queued_bytes %lu\n", output.queued_bytes);
+	append_family (text, "chat_output_queue_peak_bytes", "gauge", "Deepest output queue of a client.");
+	append_text (text, "chat_output_queue_peak_bytes %u\n", output.peak_bytes);
+	append_family (text, "chat_output_dropped_messages_total", "counter", "Messages dropped for slow clients.");
+	append_text (text, "chat_output_dropped_messages_total %lu\n", output.dropped_messages);
+	append_family (text, "chat_slow_disconnects_total", "counter", "Clients disconnected for reading too slowly.");
+	append_text (text, "chat_slow_disconnects_total %lu\n", output.slow_disconnects);
+	append_family (text, "chat_log_pending_bytes", "gauge", "Bytes of the chat log waiting to be written.");
+	append_text (text, "chat_log_pending_bytes %lu\n", log_pending_bytes ());
+	append_family (text, "chat_log_dropped_records_total", "counter", "Chat log records dropped while it was full.");
+	append_text (text, "chat_log_dropped_records_total %lu\n", log_dropped_records ());
+	append_family (text, "chat_outbound_allocations_total", "counter", "Outbound messages taken from the pool or the heap.");
+	append_text (text, "chat_outbound_allocations_total{source=\"pool\"} %lu\n", output.pooled_outbounds);
+	append_text (text, "chat_outbound_allocations_total{source=\"heap\"} %lu\n", output.allocated_outbounds);
+	append_family (text, "chat_outbound_spare", "gauge", "Outbound messages waiting in the pools.");
+	append_text (text, "chat_outbound_spare %u\n", output.spare_outbounds);
+	append_histogram (text, "chat_broadcast_fan_out", "Clients a shard delivered a broadcast to.",
+		&total->fan_out, 0, 16, 1);
+	append_histogram (text, "chat_delivery_latency_seconds", "Time from reading a line to writing it to its last recipient.",
+		&total->delivery_latency, 10, 34, 1e-9);
+	append_histogram (text, "chat_loop_iteration_seconds", "Time spent handling one event loop wakeup.",
+		&total->loop_time, 10, 34, 1e-9);
+	free (total);
+}
+
+/* Function that appends the HELP and TYPE lines of a metric. */
+void append_family (struct admin_text *text, char *name, char *type, char *help) {
+	append_text (text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/*
+ * Function: append_histogram
+ * --------------------------
+ * appends a histogram with a bucket for every value up to 2^k - 1 for k
+ * from first to last, which ends exactly at a bucket of struct histogram,
+ * followed by its sum and count.
+ *
+ * text: where the histogram is appended
+ * name: the name of the metric
+ * help: the description of the metric
+ * histogram: the values
+ * first: the power of two of the first bucket
+ * last: the power of two of the last bucket
+ * scale: what the values are multiplied by to give the unit of the metric
+ *
+ * returns: void
+ */
+void append_histogram (struct admin_text *text, char *name, char *help, struct histogram *histogram,
+		unsigned first, unsigned last, double scale) {
+	append_family (text, name, "histogram", help);
+	unsigned long cumulative = 0;
+	unsigned bucket = 0;
+	for (unsigned k = first; k <= last; k++) {
+		unsigned long bound = (1UL << k) - 1;
+		unsigned end = histogram_bucket (bound);
+		while (bucket <= end) {
+			cumulative += histogram->counts[bucket];
+			bucket++;
+		}
+		append_text (text, "%s_bucket{le=\"%.9g\"} %lu\n", name, bound * scale, cumulative);
+	}
+	append_text (text, "%s_bucket{le=\"+Inf\"} %lu\n", name, histogram->total);
+	append_text (text, "%s_sum %.9g\n%s_count %lu\n", name, histogram->sum * scale, name, histogram->total);
+}
+
+/* Function that appends formatted text, doubling the buffer until it
+ * fits. */
+void append_text (struct admin_text *text, char *format, ...) {
+	while (true) {
+		unsigned room = text->capacity - text->length;
+		va_list arguments;
+		va_start (arguments, format);
+		int length = text->data == NULL ? -1 : vsnprintf (text->data + text->length, room, format, arguments);
+		va_end (arguments);
+		if (length >= 0 && (unsigned) length < room) {
+			text->length += length;
+			return;
+		}
+		text->capacity = text->capacity == 0 ? ADMIN_TEXT_CAPACITY : text->capacity * 2;
+		text->data = realloc (text->data, text->capacity);
+		if (text->data == NULL) {
+			allocation_failed ();
+		}
+	}
+}
+
+/* Function that terminates the server when the admin listener cannot be
+ * created. */
+void admin_error () {
+	fprintf (stderr, "Unable to create admin socket\n");
+	exit (1);
+}
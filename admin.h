@@ -0,0 +1,42 @@
+/* File that contains the admin listener of the server, which serves its
+ * metrics to monitoring systems that do not speak the chat protocol. With
+ * -A the first shard listens on a second port, bound to the loopback
+ * address only, or on a Unix socket if the argument is not a number, and
+ * answers every HTTP GET with the Prometheus text exposition of the
+ * connected users, the output queues, the log, the outbound pool and the
+ * histograms of metrics.h. The listener and its clients are watched by
+ * the first shard's event loop like any other socket, so a scrape never
+ * blocks the chat and an admin listener nobody connects to costs nothing.
+ * Author: Yuriy Bash */
+
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include "client_server_utils.h"
+
+/* The index stored in the event data of an admin socket by the epoll
+ * backend, which keeps the socket itself in the other half. */
+#define ADMIN_INDEX 0xfffffffe
+
+/* The most scrapes served at once. Further connections are closed as soon
+ * as they are accepted. */
+#define ADMIN_CLIENT_LIMIT 16
+
+/* The most bytes of a request that are read. A request that does not end
+ * within them is answered as it is. */
+#define ADMIN_REQUEST_SIZE 2048
+
+/* The port or Unix socket path given with -A, NULL if there is no admin
+ * listener. */
+extern char *admin_address;
+
+/* Function that creates the admin listener, if one was asked for, and has
+ * the event loop of the calling shard watch it. Called by the first shard
+ * once its event loop is ready. */
+void admin_init ();
+
+/* Function that handles activity on the admin socket fd, either the
+ * listener or a client, accepting, reading or writing without blocking. */
+void handle_admin (fd_t fd);
+
+#endif
@@ -0,0 +1,399 @@
+/* File that contains how the server writes the room's log to stdout. Every
+ * shard appends the joins and lines of its users to a ring of its own and
+ * a writer thread drains all of the rings with one writev whenever it is
+ * woken, so a shard never makes a system call to log unless the writer was
+ * idle and has to be woken, which a busy room rarely needs. The writer is
+ * woken through an eventfd the same way a shard is woken for its mailbox,
+ * with log_signalled keeping a burst of records to a single wakeup.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include "chat_log.h"
+#include "shards.h"
+#include "client_server_utils.h"
+
+void append_log (enum LOG_RECORD type, char *text, unsigned length);
+
+bool wait_for_room (struct log_ring *ring, unsigned size);
+
+void copy_to_ring (struct log_ring *ring, unsigned long position, char *bytes, unsigned length);
+
+void wake_log_writer ();
+
+void *run_log_writer (void *argument);
+
+bool drain_rings ();
+
+void write_log (struct iovec *parts, int count);
+
+void stop_log ();
+
+void log_error (char *reason);
+
+/* What the text log adds to the name of a user who joined. */
+#define JOINED_TEXT " has joined\n"
+#define JOINED_LENGTH (sizeof (JOINED_TEXT) - 1)
+
+/* The bytes before the text of a record in the binary format. */
+#define RECORD_HEADER_LENGTH 3
+
+/* What a shard does when its ring is full. */
+enum LOG_POLICY log_policy = Block_Log;
+
+/* How the log is written. */
+enum LOG_FORMAT log_format = Text_Log;
+
+/* The ring of every shard, indexed by the id of the shard. */
+struct log_ring *log_rings;
+
+/* The writer thread and the eventfd it waits on. log_signalled is set by
+ * the first shard to wake the writer and cleared by the writer before it
+ * looks at the rings. log_stopping is set once the server exits. */
+pthread_t log_writer;
+fd_t log_event_fd;
+int log_signalled;
+int log_stopping;
+
+/* Set once a write to stdout failed, after which the writer discards what
+ * it drains so that no shard waits on it. */
+bool log_failed;
+
+/*
+ * Function: select_log_policy
+ * ---------------------------
+ * sets log_policy from the name given on the command line.
+ *
+ * name: either "drop" or "block"
+ *
+ * returns: false if the name is not a known policy
+ */
+bool select_log_policy (char *name) {
+	if (strcmp (name, "drop") == 0) {
+		log_policy = Drop_Log;
+	} else if (strcmp (name, "block") == 0) {
+		log_policy = Block_Log;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Function: select_log_format
+ * ---------------------------
+ * sets log_format from the name given on the command line.
+ *
+ * name: either "text" or "binary"
+ *
+ * returns: false if the name is not a known format
+ */
+bool select_log_format (char *name) {
+	if (strcmp (name, "text") == 0) {
+		log_format = Text_Log;
+	} else if (strcmp (name, "binary") == 0) {
+		log_format = Binary_Log;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Function: start_log
+ * -------------------
+ * creates the ring of every shard and the eventfd of the writer, writes
+ * the line that starts the text log and starts the writer thread. The
+ * writer is stopped once the server exits, after it has written every
+ * record left in the rings.
+ *
+ * returns: void
+ */
+void start_log () {
+	log_rings = calloc (shard_count, sizeof (struct log_ring));
+	if (log_rings == NULL) {
+		allocation_failed ();
+	}
+	for (unsigned i = 0; i < shard_count; i++) {
+		log_rings[i].data = malloc (LOG_RING_SIZE);
+		if (log_rings[i].data == NULL) {
+			allocation_failed ();
+		}
+	}
+	log_event_fd = eventfd (0, EFD_CLOEXEC);
+	if (log_event_fd == -1) {
+		log_error ("Unable to create log eventfd");
+	}
+	if (log_format == Text_Log) {
+		char start[] = "Server messages:\n";
+		struct iovec part = {start, sizeof (start) - 1};
+		write_log (&part, 1);
+	}
+	if (pthread_create (&log_writer, NULL, run_log_writer, NULL) != 0) {
+		log_error ("Unable to start log writer");
+	}
+	atexit (stop_log);
+}
+
+/* Function that logs that the user with the null terminated name joined. */
+void log_join (char *name) {
+	append_log (Join_Record, name, strlen (name));
+}
+
+/* Function that logs the line of length bytes a user sent, up to its first
+ * null byte. The binary format leaves out the newline. */
+void log_line (char *line, unsigned length) {
+	length = strnlen (line, length);
+	if (log_format == Binary_Log && length > 0 && line[length - 1] == '\n') {
+		length--;
+	}
+	append_log (Line_Record, line, length);
+}
+
+/*
+ * Function: append_log
+ * --------------------
+ * appends a record to the ring of the current shard in the format of the
+ * log and wakes the writer if it is idle. If the ring has no room for the
+ * record, the shard either waits for the writer or drops the record,
+ * depending on log_policy.
+ *
+ * type: whether the record is a join or a line
+ * text: the name of the user who joined or the line that was sent
+ * length: the number of bytes of text
+ *
+ * returns: void
+ */
+void append_log (enum LOG_RECORD type, char *text, unsigned length) {
+	struct log_ring *ring = &log_rings[current_shard->id];
+	char header[RECORD_HEADER_LENGTH];
+	unsigned size = length;
+	if (log_format == Binary_Log) {
+		header[0] = type;
+		header[1] = length & 0xff;
+		header[2] = length >> 8;
+		size += RECORD_HEADER_LENGTH;
+	} else if (type == Join_Record) {
+		size += JOINED_LENGTH;
+	}
+	if (!wait_for_room (ring, size)) {
+		ring->dropped_records++;
+		ring->dropped_bytes += size;
+		return;
+	}
+	unsigned long head = ring->head;
+	if (log_format == Binary_Log) {
+		copy_to_ring (ring, head, header, RECORD_HEADER_LENGTH);
+		copy_to_ring (ring, head + RECORD_HEADER_LENGTH, text, length);
+	} else {
+		copy_to_ring (ring, head, text, length);
+		if (type == Join_Record) {
+			copy_to_ring (ring, head + length, JOINED_TEXT, JOINED_LENGTH);
+		}
+	}
+	ring->records++;
+	/* The writer clears log_signalled before it reads head, so either it
+	 * sees the record or this sees the flag cleared and wakes it. */
+	__atomic_store_n (&ring->head, head + size, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&log_signalled, __ATOMIC_SEQ_CST) == 0) {
+		wake_log_writer ();
+	}
+}
+
+/* Function that returns whether ring has room for size more bytes. If it
+ * does not and the policy is to block, the shard sleeps until the writer
+ * has made room, so this only returns false when records are dropped. */
+bool wait_for_room (struct log_ring *ring, unsigned size) {
+	bool waited = false;
+	while (ring->head + size - __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE) > LOG_RING_SIZE) {
+		if (log_policy == Drop_Log) {
+			return false;
+		}
+		if (!waited) {
+			ring->waits++;
+			waited = true;
+		}
+		wake_log_writer ();
+		struct timespec pause = {0, LOG_WAIT_NS};
+		nanosleep (&pause, NULL);
+	}
+	return true;
+}
+
+/* Function that copies length bytes into ring starting at the absolute
+ * position, wrapping around the end of its data. */
+void copy_to_ring (struct log_ring *ring, unsigned long position, char *bytes, unsigned length) {
+	unsigned offset = position & (LOG_RING_SIZE - 1);
+	unsigned first = LOG_RING_SIZE - offset < length ? LOG_RING_SIZE - offset : length;
+	memcpy (ring->data + offset, bytes, first);
+	memcpy (ring->data, bytes + first, length - first);
+}
+
+/* Function that wakes the writer unless another shard already did. */
+void wake_log_writer () {
+	if (__atomic_exchange_n (&log_signalled, 1, __ATOMIC_SEQ_CST) == 0) {
+		uint64_t one = 1;
+		if (write (log_event_fd, &one, sizeof (one)) == -1) {
+			log_error ("Unable to wake log writer");
+		}
+	}
+}
+
+/*
+ * Function: run_log_writer
+ * ------------------------
+ * runs the writer thread, which drains the rings whenever it is woken and
+ * sleeps on its eventfd once they are empty. Once the server exits it
+ * drains the rings until they stay empty and returns.
+ *
+ * argument: unused
+ *
+ * returns: NULL
+ */
+void *run_log_writer (void *argument) {
+	while (true) {
+		__atomic_store_n (&log_signalled, 0, __ATOMIC_SEQ_CST);
+		if (drain_rings ()) {
+			continue;
+		}
+		if (__atomic_load_n (&log_stopping, __ATOMIC_SEQ_CST)) {
+			return NULL;
+		}
+		uint64_t count;
+		if (read (log_event_fd, &count, sizeof (count)) == -1 && errno != EINTR) {
+			log_error ("Unable to wait for log records");
+		}
+	}
+}
+
+/* Function that writes everything waiting in every ring to stdout with a
+ * single writev, if stdout takes it all at once, and then hands the space
+ * back to the shards. Returns false if every ring was empty. */
+bool drain_rings () {
+	struct iovec parts[2 * MAX_SHARDS];
+	unsigned long heads[MAX_SHARDS];
+	int count = 0;
+	for (unsigned i = 0; i < shard_count; i++) {
+		struct log_ring *ring = &log_rings[i];
+		heads[i] = __atomic_load_n (&ring->head, __ATOMIC_SEQ_CST);
+		unsigned long length = heads[i] - ring->tail;
+		if (length == 0) {
+			continue;
+		}
+		unsigned offset = ring->tail & (LOG_RING_SIZE - 1);
+		unsigned long first = LOG_RING_SIZE - offset < length ? LOG_RING_SIZE - offset : length;
+		parts[count].iov_base = ring->data + offset;
+		parts[count].iov_len = first;
+		count++;
+		if (first < length) {
+			parts[count].iov_base = ring->data;
+			parts[count].iov_len = length - first;
+			count++;
+		}
+	}
+	if (count == 0) {
+		return false;
+	}
+	write_log (parts, count);
+	for (unsigned i = 0; i < shard_count; i++) {
+		__atomic_store_n (&log_rings[i].tail, heads[i], __ATOMIC_RELEASE);
+	}
+	return true;
+}
+
+/* Function that writes all of the count parts to stdout, continuing after
+ * partial writes. If stdout fails the log is given up on. */
+void write_log (struct iovec *parts, int count) {
+	while (count > 0 && !log_failed) {
+		ssize_t written = writev (STDOUT_FILENO, parts, count);
+		if (written == -1) {
+			if (errno != EINTR) {
+				log_failed = true;
+			}
+			continue;
+		}
+		while (count > 0 && (size_t) written >= parts->iov_len) {
+			written -= parts->iov_len;
+			parts++;
+			count--;
+		}
+		if (count > 0) {
+			parts->iov_base = (char *) parts->iov_base + written;
+			parts->iov_len -= written;
+		}
+	}
+}
+
+/* Function that has the writer write whatever is left in the rings and
+ * waits for it to finish. Called when the server exits. */
+void stop_log () {
+	__atomic_store_n (&log_stopping, 1, __ATOMIC_SEQ_CST);
+	uint64_t one = 1;
+	if (write (log_event_fd, &one, sizeof (one)) == -1) {
+		return;
+	}
+	if (!pthread_equal (pthread_self (), log_writer)) {
+		pthread_join (log_writer, NULL);
+	}
+}
+
+/* Function that returns the number of bytes of records waiting for the
+ * writer thread in all of the rings. */
+unsigned long log_pending_bytes () {
+	unsigned long pending = 0;
+	for (unsigned i = 0; log_rings != NULL && i < shard_count; i++) {
+		pending += __atomic_load_n (&log_rings[i].head, __ATOMIC_RELAXED)
+			- __atomic_load_n (&log_rings[i].tail, __ATOMIC_RELAXED);
+	}
+	return pending;
+}
+
+/* Function that returns the number of records dropped because a ring was
+ * full. */
+unsigned long log_dropped_records () {
+	unsigned long dropped = 0;
+	for (unsigned i = 0; log_rings != NULL && i < shard_count; i++) {
+		dropped += log_rings[i].dropped_records;
+	}
+	return dropped;
+}
+
+/*
+ * Function: report_log_statistics
+ * -------------------------------
+ * outputs the log counters of all shards combined to stderr. The counters
+ * of other shards are read while they may be changing, which can only make
+ * the report slightly stale.
+ *
+ * returns: void
+ */
+void report_log_statistics () {
+	unsigned long records = 0;
+	unsigned long dropped_records = 0;
+	unsigned long dropped_bytes = 0;
+	unsigned long waits = 0;
+	for (unsigned i = 0; log_rings != NULL && i < shard_count; i++) {
+		records += log_rings[i].records;
+		dropped_records += log_rings[i].dropped_records;
+		dropped_bytes += log_rings[i].dropped_bytes;
+		waits += log_rings[i].waits;
+	}
+	fprintf (stderr, "Logged %lu records, dropped %lu records (%lu bytes) and waited for the log writer %lu times\n",
+		records, dropped_records, dropped_bytes, waits);
+}
+
+/* Function that terminates the server when the log cannot be set up. */
+void log_error (char *reason) {
+	fprintf (stderr, "%s\n", reason);
+	exit (1);
+}
@@ -0,0 +1,95 @@
+/* File that contains how the server writes the room's log to stdout. Every
+ * join and every line a user sends is logged, and writing each of them to
+ * stdout as it happens would make the shards wait on whoever reads the
+ * log. Instead every shard appends its records to a ring of its own, which
+ * has a single producer and a single consumer and needs no lock, and a
+ * writer thread copies whatever the rings hold to stdout in as few system
+ * calls as it can. What happens when a ring is full is chosen with -o: the
+ * shard either waits for the writer or drops the record and counts it.
+ * The log is written as text by default, the same lines the server always
+ * printed, or with -f binary as records of a type byte, the length of the
+ * text in two bytes, least significant first, and the text itself: the
+ * name of the user for a join and the line without its newline otherwise.
+ * Author: Yuriy Bash */
+
+#ifndef CHAT_LOG_H
+#define CHAT_LOG_H
+
+#include <stdbool.h>
+
+/* The number of bytes of records each shard may have waiting for the
+ * writer thread, a power of two. */
+#define LOG_RING_SIZE (1 << 20)
+
+/* The time a shard sleeps between checks for room in a full ring when
+ * waiting for the writer thread, in ns. */
+#define LOG_WAIT_NS 50000
+
+/* What a shard does with a record its ring has no room for. */
+enum LOG_POLICY {Block_Log=0, Drop_Log=1};
+
+/* How the log is written. */
+enum LOG_FORMAT {Text_Log=0, Binary_Log=1};
+
+/* The type byte of a record in the binary format. */
+enum LOG_RECORD {Join_Record=1, Line_Record=2};
+
+/* The records one shard has waiting for the writer thread. The shard only
+ * moves head and the writer only moves tail, each of which counts every
+ * byte ever passed through the ring, so the bytes waiting are head - tail
+ * and start at tail modulo LOG_RING_SIZE. The counters are kept by the
+ * shard. The padding keeps the two indices off each other's cache line. */
+struct log_ring {
+	char *data;
+	unsigned long head;
+	char head_padding[64];
+	unsigned long tail;
+	char tail_padding[64];
+	unsigned long records;
+	unsigned long dropped_records;
+	unsigned long dropped_bytes;
+	unsigned long waits;
+};
+
+/* What a shard does when its ring is full. */
+extern enum LOG_POLICY log_policy;
+
+/* How the log is written. */
+extern enum LOG_FORMAT log_format;
+
+/* Function that takes the name of a policy from the command line, either
+ * "drop" or "block", and sets log_policy accordingly. Returns false if the
+ * name is unknown. */
+bool select_log_policy (char *name);
+
+/* Function that takes the name of a format from the command line, either
+ * "text" or "binary", and sets log_format accordingly. Returns false if the
+ * name is unknown. */
+bool select_log_format (char *name);
+
+/* Function that creates a ring for each of shard_count shards, writes the
+ * start of the log and starts the writer thread. Whatever is in the rings
+ * when the server exits is written before it does. */
+void start_log ();
+
+/* Function that logs that the user with the null terminated name joined. */
+void log_join (char *name);
+
+/* Function that logs the line of length bytes, ending in a newline, that a
+ * user sent. Like the text printed before, the line ends at its first null
+ * byte, if any. */
+void log_line (char *line, unsigned length);
+
+/* Function that returns the number of bytes of records waiting for the
+ * writer thread in all of the rings. */
+unsigned long log_pending_bytes ();
+
+/* Function that returns the number of records dropped because a ring was
+ * full. */
+unsigned long log_dropped_records ();
+
+/* Function that outputs the log counters of all shards combined to
+ * stderr. */
+void report_log_statistics ();
+
+#endif
@@ -33,12 +33,14 @@
 #include "student_client.h"
 #include "client_utils.h"
 #include "client_server_utils.h"
+#include "line_scan.h"
 
 /* File descriptor for the socket that connects to the server. */
 fd_t socket_fd;
 
-/* Buffer to hold the messages being received from the server. */ 
-char server_message [MAX_MESSAGE_LENGTH];
+/* Buffer to hold the messages being received from the server. The extra
+ * byte lets every message be null terminated in place. */ 
+char server_message [MAX_MESSAGE_LENGTH + 1];
 
 /* Variable to hold next available location in server_message. */
 unsigned server_offset;
@@ -197,20 +199,33 @@ void receive_messages () {
 	 * different value depending on the reason for failure. This are all
 	 * stored as macros which can be checked directly for the specific error
 	 * reason. */
-	int send_len;
 	errno = 0;
 	int length = read (socket_fd, server_message + server_offset, MAX_MESSAGE_LENGTH - server_offset);
 	if (length > 0) {
-		server_message[length + server_offset] = 0;
 		/* Message could contain more than one message or not a complete message
-		 * so each message end should be checked. */
-		while ((send_len = find_message_end (server_message, server_offset)) != -1) {
-			char *msg = generate_message (server_message, send_len + 1);
-			handle_server_message (msg);
-			free (msg);
-			server_offset = 0;
-		}
-		server_offset = strlen (server_message);
+		 * so the new bytes are searched for every message end at once. Each
+		 * message is handled where it lies, terminated by borrowing the byte
+		 * after it, and the incomplete remainder is moved to the front. */
+		int end = server_offset + length;
+		int start = 0;
+		int scan = server_offset;
+		int positions[LINE_BATCH];
+		int found;
+		do {
+			found = find_line_ends (server_message, scan, end, positions, LINE_BATCH);
+			for (int i = 0; i < found; i++) {
+				char *msg = server_message + start;
+				int msg_length = positions[i] + 1 - start;
+				char next = msg[msg_length];
+				msg[msg_length] = 0;
+				handle_server_message (msg);
+				msg[msg_length] = next;
+				start = positions[i] + 1;
+			}
+			scan = start;
+		} while (found == LINE_BATCH);
+		memmove (server_message, server_message + start, end - start);
+		server_offset = end - start;
 	/* If the read fails because of a nonblocking reason the error should be ignored because
 	 * this is the intended behavior. */
 	} else if (length == 0 || (errno && errno != EAGAIN && errno != EWOULDBLOCK)) {
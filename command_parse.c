@@ -0,0 +1,157 @@
+/* File that contains how the server splits a command into its name and
+ * arguments and finds the command with that name. The message is read in
+ * a single pass and never modified: the name and the arguments are copied
+ * into a buffer the caller provides, so parsing keeps no state between
+ * calls and may run on any number of shards at once. The name is looked up
+ * with a perfect hash over the names in commands, one table access and one
+ * comparison instead of a comparison with every name.
+ * Author: Yuriy Bash */
+
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include "command_parse.h"
+
+unsigned identifier_length (struct command_token *token);
+
+bool istokenword (struct command_token *token);
+
+char *copy_token (struct command_token *token, unsigned length, char **end);
+
+/* List of commands the server recognizes. */
+char* commands[COMMAND_COUNT] = {"exit", "server_exit", "set_nickname", "clear_nickname",
+"rename", "mute", "unmute", "show_status", "show_all_statuses", "stats"};
+
+/* The perfect hash over the names in commands: the index of the only
+ * command a name can be, by the slot command_slot gives it, or -1 for a
+ * slot no command has. The multiplier in command_slot was picked as the
+ * smallest that gives every command a slot of its own, so both must be
+ * updated together when a command is added, along with COMMAND_SLOTS if
+ * no multiplier does. */
+signed char command_table[COMMAND_SLOTS] = {-1, -1, -1, -1, -1, 0, -1, 7, 1, 4, -1, -1, 6, -1, -1, -1,
+-1, -1, 3, -1, -1, 9, -1, -1, -1, 8, -1, -1, 2, -1, 5, -1};
+
+/* Function that returns the slot of the perfect hash for the length
+ * characters at name, from its length and its first and last character. */
+unsigned command_slot (char *name, unsigned length) {
+	return (3 * length + (unsigned char) name[0] + (unsigned char) name[length - 1]) & (COMMAND_SLOTS - 1);
+}
+
+/*
+ * Function: split_command
+ * -----------------------
+ * splits a command into its name and arguments with next_token, copying
+ * each into parsed->words as it goes so that the message is left as it
+ * was. Lookup and checks happen in the order the server always made them,
+ * so the same reply is given for every malformed command.
+ *
+ * message: the null terminated message, which contains a backslash
+ * parsed: where the parts of the command are stored
+ *
+ * returns: Parsed_Command, Unknown_Command or Invalid_Arguments
+ */
+enum COMMAND_PARSE split_command (char *message, struct parsed_command *parsed) {
+	char *cursor = strchr (message, '\\') + 1;
+	char *end = parsed->words;
+	struct command_token token;
+	next_token (&cursor, &token);
+	unsigned length = identifier_length (&token);
+	parsed->name = copy_token (&token, length, &end);
+	parsed->command = find_command (token.start, length);
+	parsed->count = 0;
+	if (parsed->command == -1) {
+		return Unknown_Command;
+	}
+	if (length != token.length) {
+		return Invalid_Arguments;
+	}
+	while (parsed->count < ARGUMENT_LIMIT && next_token (&cursor, &token)) {
+		if (!istokenword (&token)) {
+			return Invalid_Arguments;
+		}
+		parsed->args[parsed->count] = copy_token (&token, token.length, &end);
+		parsed->count++;
+	}
+	if (parsed->count == ARGUMENT_LIMIT) {
+		return Invalid_Arguments;
+	}
+	return Parsed_Command;
+}
+
+/*
+ * Function: next_token
+ * --------------------
+ * skips the whitespace at *cursor and stores the run of characters that
+ * follows as token. All state lives in the cursor, so any number of
+ * messages can be tokenized at once.
+ *
+ * cursor: the position to continue from, moved past the token
+ * token: where the token is stored
+ *
+ * returns: false if the message has no more tokens
+ */
+bool next_token (char **cursor, struct command_token *token) {
+	char *position = *cursor;
+	while (*position != 0 && isspace ((unsigned char) *position)) {
+		position++;
+	}
+	if (*position == 0) {
+		*cursor = position;
+		return false;
+	}
+	token->start = position;
+	while (*position != 0 && !isspace ((unsigned char) *position)) {
+		position++;
+	}
+	token->length = position - token->start;
+	*cursor = position;
+	return true;
+}
+
+/*
+ * Function: find_command
+ * ----------------------
+ * looks a command name up in the perfect hash, confirming the only
+ * candidate with a single comparison.
+ *
+ * name: the name, which need not be null terminated
+ * length: the number of characters in the name
+ *
+ * returns: the index of the command in commands, -1 if there is none
+ */
+int find_command (char *name, unsigned length) {
+	if (length == 0) {
+		return -1;
+	}
+	int command = command_table[command_slot (name, length)];
+	if (command == -1 || strncmp (commands[command], name, length) != 0 || commands[command][length] != 0) {
+		return -1;
+	}
+	return command;
+}
+
+/* Function that returns how many characters at the start of token can be
+ * part of a c identifier. */
+unsigned identifier_length (struct command_token *token) {
+	unsigned length = 0;
+	while (length < token->length && (isalnum ((unsigned char) token->start[length]) || token->start[length] == '_')) {
+		length++;
+	}
+	return length;
+}
+
+/* Function to determine if a token is a word, consisting only of
+ * characters which can be part of a c identifier. */
+bool istokenword (struct command_token *token) {
+	return identifier_length (token) == token->length;
+}
+
+/* Function that copies the first length characters of token to *end with
+ * a null terminator, moves *end past them and returns the copy. */
+char *copy_token (struct command_token *token, unsigned length, char **end) {
+	char *copy = *end;
+	memcpy (copy, token->start, length);
+	copy[length] = 0;
+	*end += length + 1;
+	return copy;
+}
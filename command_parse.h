@@ -0,0 +1,62 @@
+/* File that contains how the server splits a command into its name and
+ * arguments and finds the command with that name. The message is read in
+ * a single pass and never modified: the name and the arguments are copied
+ * into a buffer the caller provides, so parsing keeps no state between
+ * calls and may run on any number of shards at once. The name is looked up
+ * with a perfect hash over the names in commands, one table access and one
+ * comparison instead of a comparison with every name.
+ * Author: Yuriy Bash */
+
+#ifndef COMMAND_PARSE_H
+#define COMMAND_PARSE_H
+
+#include <stdbool.h>
+#include "client_server_utils.h"
+
+#define COMMAND_COUNT 10
+
+/* The number of arguments at which a command is rejected. */
+#define ARGUMENT_LIMIT 3
+
+/* The number of slots of the perfect hash over the command names, a power
+ * of two. */
+#define COMMAND_SLOTS 32
+
+extern char *commands[COMMAND_COUNT];
+
+enum COMMAND_PARSE {Parsed_Command=0, Unknown_Command=1, Invalid_Arguments=2};
+
+/* A run of characters of a message that are not whitespace. */
+struct command_token {
+	char *start;
+	unsigned length;
+};
+
+/* A command split into its parts. command is the index of the command in
+ * commands, or -1 if the name is not known. name and args point into
+ * words, where each is stored with a null terminator. */
+struct parsed_command {
+	int command;
+	char *name;
+	char *args[ARGUMENT_LIMIT];
+	unsigned count;
+	char words[MAX_MESSAGE_LENGTH + 1];
+};
+
+/* Function that splits the null terminated message, whose first backslash
+ * starts a command name, into parsed. A name with characters that cannot
+ * be part of an identifier is cut at the first of them. Returns
+ * Unknown_Command if the name is not a known command and Invalid_Arguments
+ * if it is but the name was cut, an argument is not a word or there are
+ * ARGUMENT_LIMIT arguments or more. */
+enum COMMAND_PARSE split_command (char *message, struct parsed_command *parsed);
+
+/* Function that finds the next token of a message at or after *cursor and
+ * moves *cursor past it. Returns false if only whitespace is left. */
+bool next_token (char **cursor, struct command_token *token);
+
+/* Function that returns the index in commands of the command whose name is
+ * the length characters at name, or -1 if there is none. */
+int find_command (char *name, unsigned length);
+
+#endif
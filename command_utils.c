@@ -6,12 +6,13 @@
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
-#include <time.h>
 #include "server.h"
 #include "command_utils.h"
 #include "server_utils.h"
 #include "commands.h"
-#include "server_utils.h"
+#include "output.h"
+
+void render_status (struct user_info *user);
 
 /* Function to determine if a message is a command. */
 bool iscommand (char *message) {
@@ -22,132 +23,73 @@ bool iscommand (char *message) {
         return message[i] == '\\' && (message[i] != 0 && (isidentifierpart (message[i + 1])));
 }
 
-/* Function to determine if a name is the name of a command. */
-bool isknowncommand (char *name) {
-        for (int i = 0; i < COMMAND_COUNT; i++) {
-                if (strcmp (name, commands[i]) == 0) {
-                        return true;
-                }
-        }
-        return false;
-}
-
 /* Function that takes in a name and determines if it can be selected as a name
  * for a nickname or a name. */
 bool isvalidname (char *name) {
         return isword (name) && strlen (name) <= MAX_NAME_LENGTH && !istaken_name (name) && !istaken_nickname (name);
 }
 
-/* Function that sorts the Users based upon alphabetical order of names. This 
- * function is called in coordination with the show_all_statuses command. Since
- * this is called by a specific user in location n, n needs to be updated to
- * ensure the correct user receives the message. */
-void sort_users (unsigned *n) {
-        remove_holes (n);
-        int lower = 1;
-        int upper = socket_total - 1;
-        quick_sort (lower, upper, n);
-}
-
-/* A simple quicksort implementation to assist sorting users. */
-void quick_sort (int lower, int upper, unsigned *n) {
-	if (lower >= upper) {
+/* Helper function to output the information about user to
+ * the user in socket location n. This should be used for
+ * the show_status and show_all_statuses commands. The first
+ * two lines of the status, each starting with the Standard_Message
+ * character, are the same for every viewer and are rendered
+ * once, kept with the user until its name or nickname changes,
+ * so showing a status is a copy of them followed by the line
+ * telling whether the viewer muted the user. */
+void output_user_status (struct user_info *user, unsigned n) {
+        if (sockets[n] == -1) {
                 return;
         }
-        srand ((unsigned) time (NULL));
-        int pivot = lower + (rand () % (upper - lower));
-        swap_information (pivot, lower, n);
-        pivot = lower;
-        unsigned i = lower + 1;
-        while (i < upper + 1) {
-                if (strcmp (users[i]->name_info->name, users[pivot]->name_info->name) < 0) {
-                        swap_information (pivot, i, n);
-                        pivot++;
-                        swap_information (pivot, i, n);
-                        if (pivot == i) {
-                                i++;
-                        }
-                } else {
-                        i++;
-                }
+        if (user->status_length == 0) {
+                render_status (user);
         }
-        quick_sort (lower, pivot - 1, n);
-        quick_sort (pivot + 1, upper, n);
+        char *muted = ismuted (users[n], user) ? "User is muted\n" : "User is not muted\n";
+        int muted_length = strlen (muted);
+        struct outbound *message = allocate_outbound (user->status_length + muted_length);
+        memcpy (message->data, user->status, user->status_length);
+        memcpy (message->data + user->status_length, muted, muted_length);
+        reply_message (message, n);
+        release_outbound (message);
 }
 
-/* Function to update the array of users by removing any gaps that developed
- * from users disconnecting. */
-void remove_holes (unsigned *n) {
-        int start = 1;
-        int ctr;
-        while (start < socket_total) {
-                ctr = start + 1;
-                while (sockets[start] == -1) {
-                        if (sockets[ctr] == -1) {
-                                ctr++;
-                        } else {
-                                swap_information (start, ctr, n);
-                        }
-                }
-                start++;
+/* Function that renders the first two lines of the status of user into its
+ * status buffer, growing the buffer if they do not fit, and leaves the
+ * Standard_Message character the third line starts with at their end. */
+void render_status (struct user_info *user) {
+        char separator[2] = {Standard_Message, 0};
+        char *parts[8];
+        parts[0] = "User ";
+        parts[1] = user->name_info->name;
+        parts[2] = "\n";
+        parts[3] = separator;
+        if (has_nickname (user)) {
+                parts[4] = "Nickname ";
+                parts[5] = *(user->nickname);
+        } else {
+                parts[4] = "User has no ";
+                parts[5] = "nickname";
         }
-}
-
-/* A swap function to swap all of the information about two
- * users. This will allow for sorting users. */
-void swap_information (int a, int b, unsigned *n) {
-        int fd_temp = sockets[b];
-        sockets[b] = sockets[a];
-        sockets[a] = fd_temp;
-        char *message_temp = messages[b];
-        messages[b] = messages[a];
-        messages[a] = message_temp;
-        unsigned offset_temp = offsets[b];
-        offsets[b] = offsets[a];
-        offsets[a] = offset_temp;
-        struct user_info *user_temp = users[b];
-        users[b] = users[a];
-        users[a] = user_temp;
-        if (a == *n) {
-                *n = b;
-        } else if (b == *n) {
-                *n = a;
+        parts[6] = "\n";
+        parts[7] = separator;
+        unsigned lengths[8];
+        unsigned length = 1;
+        for (unsigned i = 0; i < 8; i++) {
+                lengths[i] = strlen (parts[i]);
+                length += lengths[i];
         }
-}
-
-/* Helper function to output the information about user to 
- * the user in socket location n. This should be used for
- * the show_status and show_all_statuses commands. */
-void output_user_status (struct user_info *user, unsigned n) {
-        char *messages[3];
-        messages[0] = "User ";
-        messages[1] = user->name_info->name;
-        messages[2] = "\n";
-        char *message1 = create_message (messages, 3);
-        if (sockets[n] != -1 && has_nickname (user)) {
-                messages[0] = "Nickname ";
-                messages[1] = *(user->nickname);
-                messages[2] = "\n";
-        } else {
-                messages[0] = "User has no ";
-                messages[1] = "nickname";
-                messages[2] = "\n";
+        if (length > user->status_capacity) {
+                user->status_capacity = length;
+                user->status = realloc (user->status, length);
+                if (user->status == NULL) {
+                        allocation_failed ();
+                }
         }
-        char *message2 = create_message (messages, 3);
-        if (sockets[n] != -1 && ismuted (users[n], user)) {
-                messages[0] = "User is muted\n";
-        } else {
-                messages[0] = "User is not muted\n";
+        user->status[0] = Standard_Message;
+        unsigned offset = 1;
+        for (unsigned i = 0; i < 8; i++) {
+                memcpy (user->status + offset, parts[i], lengths[i]);
+                offset += lengths[i];
         }
-        char *message3 = create_message (messages, 1);
-	messages[0] = message1 + 1;
-	messages[1] = message2;
-	messages[2] = message3;
-	char *message = create_message (messages, 3);
-	free (message1);
-	free (message2);
-	free (message3);
-        reply (message, n);
-        free (message);
+        user->status_length = length;
 }
-
@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <limits.h>
 #include <unistd.h>
 #include "server.h"
 #include "commands.h"
@@ -13,108 +15,47 @@
 #include "server_utils.h"
 #include "user_utils.h"
 #include "client_server_utils.h"
-
-/* List of commands the server recognizes. */
-char* commands[COMMAND_COUNT] = {"exit", "server_exit", "set_nickname", "clear_nickname",
-"rename", "mute", "unmute", "show_status", "show_all_statuses"};
+#include "output.h"
+#include "metrics.h"
 
 /* List of functions to handle each command. Each function is at the same index
  * as the command is in the previous list to allow a command name search to
- * give easy access to a function with an extended if else. */
-void (*command_functions[COMMAND_COUNT]) (char **args, unsigned count, unsigned n) =
+ * give easy access to a function with an extended if else. Each returns
+ * whether it accepted the arguments it was called with. */
+bool (*command_functions[COMMAND_COUNT]) (char **args, unsigned count, unsigned n) =
 {handle_exit, handle_server_exit, handle_set_nickname, handle_clear_nickname, handle_rename,
-handle_mute, handle_unmute, handle_show_status, handle_show_all_statuses};
+handle_mute, handle_unmute, handle_show_status, handle_show_all_statuses, handle_stats};
 
 
 /*
  * Function: parse_command
  * -----------------------
  * takes in a message that is a command sent by user at index n (in `users`)
- * and parses the message into a command name and its arguments. It then calls
- * the appropriate function to handle the command.
+ * and parses the message into a command name and its arguments with
+ * split_command, which leaves the message untouched. It then calls the
+ * appropriate function to handle the command. A use of the command is
+ * counted only if the function returns that it accepted its arguments,
+ * which it checks itself, since handle_invalid_arguments counts the rest.
  *
  * message: the message sent by the user
  *
  * returns: void
  */
 void parse_command (char *message, unsigned n) {
-        int i = 0;
-        while (message[i] != '\\') {
-                i++;
-        }
-        char *name = strtok (message + i + 1, WHITESPACE_SET);
-        if (!isword (name)) {
-                int end = 0;
-                while (isidentifierpart (name[end])) {
-                        end++;
-                }
-                name[end] = 0;
-                if (isknowncommand (name)) {
-                        handle_invalid_arguments (name, n);
-                        return;
-
-                } else {
-                        handle_unknown_command (name, n);
-                        return;
-                }
-        }
-        if (!isknowncommand (name)) {
-                handle_unknown_command (name, n);
+        struct parsed_command parsed;
+        enum COMMAND_PARSE result = split_command (message, &parsed);
+        if (result == Unknown_Command) {
+                shard_metrics.unknown_commands++;
+                handle_unknown_command (parsed.name, n);
+        } else if (result == Invalid_Arguments) {
+                handle_invalid_arguments (parsed.name, n);
         } else {
-                unsigned arg_limit = 3;
-                char *args[3];
-                char *arg;
-                unsigned count = 0;
-                while (count < arg_limit && (arg = strtok (NULL, WHITESPACE_SET)) != NULL) {
-                        args[count] = arg;
-                        count++;
-                        if (!isword (arg)) {
-                                handle_invalid_arguments (name, n);
-                                return;
-                        }
-                }
-                if (count == arg_limit) {
-                        handle_invalid_arguments (name, n);
-                        return;
-                }
-                handle_command (name, args, count, n, message);
-        }
-
-}
-
-/*
- * Function: handle_command
- * -----------------------
- * takes a command name, the arguments, the number of arguments, and the index
- * of the user who gave the command and calls the appropriate the appropriate
- * function to handle the command. If the command is a "server_exit",  frees
- * msg.
- *
- * name: the command name
- * args: arguments the command is called with
- * count: the number of arguments
- * n: the index (in `users`) of the user that issues the command
- * msg: the message
- *
- * returns: void
- */
-void handle_command (char *name, char **args, unsigned count, unsigned n, char *msg) {
-        unsigned ctr = 0;
-        while (ctr < COMMAND_COUNT) {
-                if (strcmp (name, commands[ctr]) == 0) {
-			if (strcmp (name, "server_exit") == 0 && count == 0) {
-                               free (msg);
-                        }
-                        command_functions [ctr] (args, count, n);
-                        return;
+                if (command_functions [parsed.command] (parsed.args, parsed.count, n)) {
+                        shard_metrics.commands[parsed.command]++;
                 }
-                ctr++;
         }
-        handle_unknown_command (name, n);
-
 }
 
-
 /*
  * Function: handle_exit
  * ----------------------
@@ -128,19 +69,20 @@ void handle_command (char *name, char **args, unsigned count, unsigned n, char *
  * count: number of arguments the command was called with
  * n: index (in `users`) of connecting client.
  *
- * returns: void
+ * returns: whether the arguments were accepted
  *
  */
-void handle_exit (char **args, unsigned count, unsigned n) {
+bool handle_exit (char **args, unsigned count, unsigned n) {
         if (count != 0) {
                 handle_invalid_arguments ("exit", n);
-        } else {
-                char message [3];
-                message[0] = Exit_Message;
-                message[1] = '\n';
-                message[2] = 0;
-                reply (message, n);
+                return false;
         }
+        char message [3];
+        message[0] = Exit_Message;
+        message[1] = '\n';
+        message[2] = 0;
+        reply (message, n);
+        return true;
 }
 
 
@@ -155,29 +97,25 @@ void handle_exit (char **args, unsigned count, unsigned n) {
  * count: number of arguments the command was called with
  * n: index (in `users`) of connecting client.
  *
- * returns: void
+ * returns: whether the arguments were accepted
  *
  */
-void handle_server_exit (char **args, unsigned count, unsigned n) {
+bool handle_server_exit (char **args, unsigned count, unsigned n) {
         if (count != 0) {
                 handle_invalid_arguments ("server_exit", n);
+                return false;
         } else {
                 close (sockets[0]);
-                socket_total--;
 		free (messages[0]);
-                int start = 0;
-                int ctr = 1;
-                while (start < socket_total) {
-                        if (sockets[ctr] != -1) {
-                                start++;
-                                close (sockets[ctr]);
-                                sockets[ctr] = -1;
-                                free (messages[ctr]);
-                                if (users[ctr] != NULL) {
-                                        cleanup_user (users[ctr]);
-                                }
+                for (unsigned i = 0; i < socket_total - 1; i++) {
+                        unsigned ctr = active_connections[i];
+                        close (sockets[ctr]);
+                        sockets[ctr] = -1;
+                        free (messages[ctr]);
+                        if (users[ctr] != NULL) {
+                                cleanup_user (users[ctr]);
+                                users[ctr] = NULL;
                         }
-                        ctr++;
                 }
                 exit (0);
         }
@@ -196,18 +134,29 @@ void handle_server_exit (char **args, unsigned count, unsigned n) {
  * count: number of arguments the command was called with
  * n: index (in `users`) of connecting client.
  *
- * returns: void
+ * returns: whether the arguments were accepted
  *
  */
-void handle_set_nickname (char **args, unsigned count, unsigned n) {
+bool handle_set_nickname (char **args, unsigned count, unsigned n) {
 
+	if (count != 2) {
+		handle_invalid_arguments ("set_nickname", n);
+		return false;
+	}
 	struct user_info *user = find_user(args[0]);
 	if(user == NULL){
 	    reply("Cannot set nickname, user doesn't exist!\n\0", n);
-	    return;
+	    return true;
+	}
+	unindex_nickname(user);
+	invalidate_status(user);
+	release_nickname(user);
+	user->nickname = (char **) malloc(sizeof(char *));
+	if (user->nickname == NULL) {
+		allocation_failed();
 	}
-    user->nickname = (char **) malloc(sizeof(char *));
-	*user->nickname = args[1];
+	*user->nickname = create_name(args[1]);
+	index_nickname(user);
 
 	char *other_messages[6];
 	other_messages[0] = users[n]->name_info->name;
@@ -216,9 +165,9 @@ void handle_set_nickname (char **args, unsigned count, unsigned n) {
 	other_messages[3] = "'s nickname to ";
 	other_messages[4] = args[1];
 	other_messages[5] = "\n";
-	char *message = create_message (other_messages, 6);
+	struct outbound *message = create_message (other_messages, 6);
 	share_message (message, n, false);
-	free (message);
+	release_outbound (message);
 	other_messages[0] = "You set ";
 	if (user == users[n]) {
 		other_messages[1] = "your";
@@ -230,9 +179,9 @@ void handle_set_nickname (char **args, unsigned count, unsigned n) {
 	other_messages[3] = other_messages[4];
 	other_messages[4] = other_messages[5];
 	message = create_message (other_messages, 5);
-	reply (message, n);
-	free (message);
-
+	reply_message (message, n);
+	release_outbound (message);
+	return true;
 }
 
 /*
@@ -245,27 +194,35 @@ void handle_set_nickname (char **args, unsigned count, unsigned n) {
  * count: number of arguments the command was called with
  * n: index (in `users`) of connecting client.
  *
- * returns: void
+ * returns: whether the arguments were accepted
  *
  */
-void handle_clear_nickname (char **args, unsigned count, unsigned n) {
+bool handle_clear_nickname (char **args, unsigned count, unsigned n) {
 
+	if (count != 1) {
+		handle_invalid_arguments ("clear_nickname", n);
+		return false;
+	}
 	struct user_info *user = find_user(args[0]);
     if(user == NULL){
         reply("Cannot clear nickname, user doesn't exist!\n\0", n);
-        return;
+        return true;
     }
 
+	unindex_nickname(user);
+	invalidate_status(user);
+	release_nickname(user);
 	user->nickname = &user->name_info->name;
+	index_nickname(user);
 
 	char *other_messages[4];
 	other_messages[0] = users[n]->name_info->name;
 	other_messages[1] = " has cleared ";
 	other_messages[2] = user->name_info->name;
 	other_messages[3] = "'s nickname\n";
-	char *message = create_message (other_messages, 4);
+	struct outbound *message = create_message (other_messages, 4);
 	share_message (message, n, false);
-	free (message);
+	release_outbound (message);
 	other_messages[0] = "You have cleared ";
 	if (user == users[n]) {
 		other_messages[1] = "your";
@@ -275,9 +232,9 @@ void handle_clear_nickname (char **args, unsigned count, unsigned n) {
 		other_messages[2] = other_messages[3];
 	}
 	message = create_message (other_messages, 3);
-	reply (message, n);
-	free (message);
-
+	reply_message (message, n);
+	release_outbound (message);
+	return true;
 }
 
 /*
@@ -291,30 +248,38 @@ void handle_clear_nickname (char **args, unsigned count, unsigned n) {
  * count: number of arguments the command was called with
  * n: index (in `users`) of connecting client.
  *
- * returns: void
+ * returns: whether the arguments were accepted
  *
  */
-void handle_rename (char **args, unsigned count, unsigned n) {
+bool handle_rename (char **args, unsigned count, unsigned n) {
+	if (count != 1) {
+		handle_invalid_arguments ("rename", n);
+		return false;
+	}
 	char *name = args[0];
 	struct user_info *user = users[n];
 	char *old_name = user->name_info->name;
-	user->name_info->name = name;
+	unindex_user(user);
+	invalidate_status(user);
+	user->name_info->name = create_name(name);
+	index_user(user);
 
 	char *other_messages[4];
 	other_messages[0] = old_name;
 	other_messages[1] =" changed their name to ";
 	other_messages[2] = name;
 	other_messages[3] = "\n";
-	char *message = create_message (other_messages, 4);
+	struct outbound *message = create_message (other_messages, 4);
 	share_message (message, n, false);
-	free (message);
+	release_outbound (message);
 	other_messages[0] = "You have changed your name to ";
 	other_messages[1] = name;
 	other_messages[2] = "\n";
 	message = create_message (other_messages, 3);
-	reply (message, n);
-	free (message);
-
+	reply_message (message, n);
+	release_outbound (message);
+	free (old_name);
+	return true;
 }
 
 /*
@@ -330,42 +295,33 @@ void handle_rename (char **args, unsigned count, unsigned n) {
  * count: number of arguments the command was called with
  * n: index (in `users`) of connecting client.
  *
- *  returns: void
+ *  returns: whether the arguments were accepted
  */
-void handle_mute (char **args, unsigned count, unsigned n) {
-    struct user_info muter = *users[n];
-
-    if (*muter.muted_total >= MAX_CONNECTIONS){
-        reply("Maximum number of users already muted\n", n);
-        return;
-    }
-
+bool handle_mute (char **args, unsigned count, unsigned n) {
+	if (count != 1) {
+		handle_invalid_arguments ("mute", n);
+		return false;
+	}
+    struct user_info *muter = users[n];
     struct user_info *mutee = find_user(args[0]);
 
-    for(int i = 0; i < MAX_CONNECTIONS; i++){
-        if (muter.muted[i] == mutee->name_info){
-            reply("User already muted\n", n);
-            return;
-        }
+    if (mutee == NULL || mutee == muter){
+        handle_invalid_arguments("mute", n);
+        return false;
     }
 
-    for(int i = 0; i < MAX_CONNECTIONS; i++){
-        if(muter.muted[i] == NULL){
-            muter.muted[i] = mutee->name_info;
-            break;
-        }
+    if (!ismuted(muter, mutee)){
+        add_muted(muter, mutee->name_info);
     }
 
-    (*muter.muted_total)++;
-
 	char *messages[3];
 	messages[0] = "User ";
 	messages[1] = args[0];
 	messages[2] = " is now muted\n";
-	char *message = create_message (messages, 3);
-	reply (message, n);
-	free (message);
-
+	struct outbound *message = create_message (messages, 3);
+	reply_message (message, n);
+	release_outbound (message);
+	return true;
 }
 
 /*
@@ -380,41 +336,32 @@ void handle_mute (char **args, unsigned count, unsigned n) {
  * count: number of arguments the command was called with
  * n: index (in `users`) of connecting client.
  *
- * returns: void
+ * returns: whether the arguments were accepted
  */
-void handle_unmute (char **args, unsigned count, unsigned n) {
-
-    struct user_info muter = *users[n];
-
-    if(*muter.muted_total < 1){
-        reply("User doesn't have anyone muted yet!\n", n);
-        return;
-    }
+bool handle_unmute (char **args, unsigned count, unsigned n) {
 
+	if (count != 1) {
+		handle_invalid_arguments ("unmute", n);
+		return false;
+	}
+    struct user_info *muter = users[n];
     struct user_info *mutee = find_user(args[0]);
-    bool mutee_found = false;
 
-    for(int i = 0; i < MAX_CONNECTIONS; i++){
-        if (muter.muted[i] == mutee->name_info){
-            muter.muted[i] = NULL;
-            (*muter.muted_total)--;
-            mutee_found = true;
-        }
+    if (mutee == NULL || mutee == muter){
+        handle_invalid_arguments("unmute", n);
+        return false;
     }
 
-    if(!mutee_found){
-        reply("User is not muted!\n", n);
-        return;
-    }
+    remove_muted(muter, mutee->name_info);
 
 	char *other_messages[3];
 	other_messages[0] = "User ";
 	other_messages[1] = args[0];
 	other_messages[2] = " is no longer muted\n";
-	char *message = create_message (other_messages, 3);
-	reply (message, n);
-	free (message);
-
+	struct outbound *message = create_message (other_messages, 3);
+	reply_message (message, n);
+	release_outbound (message);
+	return true;
 }
 
 
@@ -429,17 +376,22 @@ void handle_unmute (char **args, unsigned count, unsigned n) {
  * count: number of arguments the command was called with
  * n: index (in `users`) of connecting client.
  *
- * returns: void
+ * returns: whether the arguments were accepted
  *
  */
-void handle_show_status (char **args, unsigned count, unsigned n) {
+bool handle_show_status (char **args, unsigned count, unsigned n) {
+	if (count != 1) {
+		handle_invalid_arguments ("show_status", n);
+		return false;
+	}
     struct user_info *user = find_user(args[0]);
 
     if(user == NULL){
         reply("Sorry, user doesn't exist!\n", n);
-        return;
+        return true;
     }
     output_user_status(user, n);
+    return true;
 }
 
 
@@ -447,32 +399,74 @@ void handle_show_status (char **args, unsigned count, unsigned n) {
  * Function: handle_show_all_statuses
  * ----------------------
  * handles the show_all_statuses command. It returns the status information of
- * all connected users in alphabetical order. It takes no arguments.
- *
- * args: arguments the command was called with (should be 0)
+ * all connected users in alphabetical order. It takes no arguments, or the
+ * number of a page, counting from 1, in which case only the STATUS_PAGE_SIZE
+ * users on that page are shown so a client of a very large room can ask
+ * for them a page at a time. A page past the last user shows nothing. The
+ * users are walked in the order of the sorted index, which is found at the
+ * start of the page without visiting the users before it.
+ *
+ * args: arguments the command was called with (0, or 1 arg: the page)
  * count: number of arguments the command was called with
  * n: index (in `users`) of connecting client.
  *
- * returns: void
+ * returns: whether the arguments were accepted
  *
  */
-void handle_show_all_statuses (char **args, unsigned count, unsigned n) {
-	if (count != 0) {
-                handle_invalid_arguments ("show_all_statuses", n);
-        } else {
-                sort_users(&n);
-                for (int i = 1; i < socket_total; i++) {
-                        output_user_status (users[i], n);
+bool handle_show_all_statuses (char **args, unsigned count, unsigned n) {
+        unsigned long page = 0;
+        if (count == 1) {
+                char *end;
+                page = strtoul (args[0], &end, 10);
+                if (!isdigit (args[0][0]) || *end != 0 || page == 0 || page > UINT_MAX / STATUS_PAGE_SIZE) {
+                        handle_invalid_arguments ("show_all_statuses", n);
+                        return false;
                 }
+        } else if (count != 0) {
+                handle_invalid_arguments ("show_all_statuses", n);
+                return false;
+        }
+        unsigned shown = page == 0 ? room_total : STATUS_PAGE_SIZE;
+        struct sorted_node *node = sorted_user_at (page == 0 ? 0 : (page - 1) * STATUS_PAGE_SIZE);
+        for (unsigned i = 0; i < shown && node != NULL && sockets[n] != -1; i++) {
+                struct sorted_node *next = node->links[0].next;
+                output_user_status (node->user, n);
+                node = next;
+        }
+        return true;
+}
+
+/*
+ * Function: handle_stats
+ * ----------------------
+ * handles the stats command. It replies with the metrics of the whole
+ * server, see metrics.h: the traffic, the system calls, the fan-out of
+ * broadcasts, the delivery and event loop latencies and how often every
+ * command was used. It takes no arguments.
+ *
+ * args: arguments the command was called with
+ * count: number of arguments the command was called with
+ * n: index (in `users`) of connecting client.
+ *
+ * returns: whether the arguments were accepted
+ *
+ */
+bool handle_stats (char **args, unsigned count, unsigned n) {
+        if (count != 0) {
+                handle_invalid_arguments ("stats", n);
+                return false;
         }
+        output_metrics (n);
+        return true;
 }
 
 
 /*
  * Function: handle_invalid_arguments
  * ----------------------------------
- * Called when a command is called with the wrong arguments. It replies to the
- * user at index that the command name was called with the wrong arguments.
+ * Called when a command is called with the wrong arguments. It counts the
+ * invalid command and replies to the user at index that the command name was
+ * called with the wrong arguments.
  *
  * name: name of user that executed the command
  * n: index (in `users`) of user that executed the command
@@ -480,12 +474,13 @@ void handle_show_all_statuses (char **args, unsigned count, unsigned n) {
  * returns: void
  */
 void handle_invalid_arguments (char *name, unsigned n) {
+        shard_metrics.invalid_commands++;
         char *start = "Incorrect arguments for ";
         char *end = " command\n";
         char *messages[] = {start, name, end};
-        char *new_message = create_message (messages, 3);
-        reply (new_message, n);
-        free (new_message);
+        struct outbound *new_message = create_message (messages, 3);
+        reply_message (new_message, n);
+        release_outbound (new_message);
 }
 
 /*
@@ -503,7 +498,7 @@ void handle_unknown_command (char *name, unsigned n) {
         char *start = "Unknown command ";
         char *end = "\n";
         char *messages[] = {start, name, end};
-        char *new_message = create_message (messages, 3);
-        reply (new_message, n);
-        free (new_message);
+        struct outbound *new_message = create_message (messages, 3);
+        reply_message (new_message, n);
+        release_outbound (new_message);
 }
@@ -0,0 +1,278 @@
+/* File that contains the table of connections the server keeps. The table
+ * is a set of parallel arrays indexed by connection. It starts small and
+ * doubles whenever a connection arrives while every index is in use, up to
+ * room for max_connections clients, so an idle server only pays for the
+ * connections it has actually seen. Free indices are tracked in a bitmap so
+ * that a new connection finds one with a find first set instead of a scan,
+ * and the indices in use are kept densely in active_connections so that
+ * loops over every client never have to skip holes. Every shard has a table
+ * of its own, so the arrays are thread local.
+ * Author: Yuriy Bash */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "connections.h"
+#include "client_server_utils.h"
+
+/* Array of sockets that will be used to send information.
+ * A socket will be initialized and reset to -1 if there
+ * is not active connection and index 0 will always contain
+ * the socket the server uses to receive connections. */
+__thread fd_t *sockets;
+
+/* Array of messages that have been received from each user but
+ * are not yet complete. */
+__thread char **messages;
+
+/* Array of user information about users who have connected. */
+__thread struct user_info **users;
+
+/* Array of offsets into the messages at which the next read is
+ * placed. */
+__thread unsigned *offsets;
+
+/* Array of offsets into the messages at which the first byte that
+ * has not been handled is found. */
+__thread unsigned *starts;
+
+/* Array of the messages queued for each connection until its socket
+ * becomes writable. */
+__thread struct output_queue *outputs;
+
+/* The number have sockets that have currently connected. Includes
+ * the servers socket that receives connections. */
+__thread unsigned socket_total;
+
+/* The number of indices currently allocated in each of the arrays. */
+__thread unsigned connection_capacity;
+
+/* A number that changes whenever a connection is claimed or released. It
+ * is never 0. */
+__thread unsigned long connection_generation = 1;
+
+/* The maximum number of clients that may be connected at once. */
+unsigned max_connections = DEFAULT_MAX_CONNECTIONS;
+
+/* The number of clients connected to any shard. */
+unsigned connected_clients;
+
+/* Array holding the index of every connected client in no particular
+ * order. The first socket_total - 1 entries are valid. */
+__thread unsigned *active_connections;
+
+/* Array holding, for every index in use, its position in
+ * active_connections. */
+__thread unsigned *active_positions;
+
+/* Bitmap with one bit per index which is set while the index is free.
+ * Index 0 is never free. */
+__thread uint64_t *free_connections;
+
+/* The lowest word of free_connections that may have a bit set. Every word
+ * before it is known to be zero. */
+__thread unsigned free_hint;
+
+void mark_free (unsigned n, bool free);
+
+/*
+ * Function: init_connections
+ * --------------------------
+ * allocates the table at its initial capacity, capped at room for
+ * max_connections clients, and stores the server socket in index 0.
+ *
+ * main_socket: the socket the server receives connections on
+ *
+ * returns: void
+ */
+void init_connections (fd_t main_socket) {
+	connection_capacity = 0;
+	sockets = NULL;
+	messages = NULL;
+	users = NULL;
+	offsets = NULL;
+	starts = NULL;
+	outputs = NULL;
+	active_connections = NULL;
+	active_positions = NULL;
+	free_connections = NULL;
+	free_hint = 0;
+	grow_connections ();
+	mark_free (0, false);
+	sockets[0] = main_socket;
+	messages[0] = malloc (sizeof (char) * (MAX_MESSAGE_LENGTH + 1));
+	if (messages[0] == NULL) {
+		allocation_failed ();
+	}
+	socket_total = 1;
+}
+
+/*
+ * Function: connections_full
+ * --------------------------
+ * determines if max_connections clients are connected across all shards.
+ *
+ * returns: bool
+ */
+bool connections_full () {
+	return __atomic_load_n (&connected_clients, __ATOMIC_RELAXED) >= max_connections;
+}
+
+/*
+ * Function: claim_connection
+ * --------------------------
+ * finds the lowest free index with a find first set over the bitmap,
+ * starting at the first word that may have a free bit. If every index is in
+ * use the table is grown first. The index is marked as in use and appended
+ * to active_connections, and connection_generation changes.
+ *
+ * returns: the claimed index
+ */
+unsigned claim_connection () {
+	unsigned words = (connection_capacity + CONNECTION_WORD_BITS - 1) / CONNECTION_WORD_BITS;
+	while (free_hint < words && free_connections[free_hint] == 0) {
+		free_hint++;
+	}
+	if (free_hint == words) {
+		grow_connections ();
+	}
+	unsigned n = free_hint * CONNECTION_WORD_BITS + __builtin_ctzll (free_connections[free_hint]);
+	mark_free (n, false);
+	active_positions[n] = socket_total - 1;
+	active_connections[socket_total - 1] = n;
+	socket_total++;
+	connection_generation++;
+	__atomic_add_fetch (&connected_clients, 1, __ATOMIC_RELAXED);
+	return n;
+}
+
+/*
+ * Function: release_connection
+ * ----------------------------
+ * marks index n as free and removes it from active_connections by moving
+ * the last entry into its position, and changes connection_generation.
+ *
+ * n: the index being released
+ *
+ * returns: void
+ */
+void release_connection (unsigned n) {
+	__atomic_sub_fetch (&connected_clients, 1, __ATOMIC_RELAXED);
+	socket_total--;
+	unsigned last = active_connections[socket_total - 1];
+	active_connections[active_positions[n]] = last;
+	active_positions[last] = active_positions[n];
+	connection_generation++;
+	mark_free (n, true);
+}
+
+/* Function that sets or clears the free bit of index n, moving free_hint
+ * back if n is now the lowest free index. */
+void mark_free (unsigned n, bool free) {
+	uint64_t bit = (uint64_t) 1 << (n % CONNECTION_WORD_BITS);
+	if (free) {
+		free_connections[n / CONNECTION_WORD_BITS] |= bit;
+		if (n / CONNECTION_WORD_BITS < free_hint) {
+			free_hint = n / CONNECTION_WORD_BITS;
+		}
+	} else {
+		free_connections[n / CONNECTION_WORD_BITS] &= ~bit;
+	}
+}
+
+/*
+ * Function: grow_connections
+ * --------------------------
+ * doubles the number of indices in every array of the table, capped at room
+ * for max_connections clients plus the server socket. New indices hold no
+ * socket, message or user and are marked as free.
+ *
+ * returns: void
+ */
+void grow_connections () {
+	unsigned capacity = connection_capacity == 0 ? INITIAL_CONNECTION_CAPACITY : connection_capacity * 2;
+	if (capacity > max_connections + 1) {
+		capacity = max_connections + 1;
+	}
+	sockets = realloc (sockets, sizeof (fd_t) * capacity);
+	messages = realloc (messages, sizeof (char *) * capacity);
+	users = realloc (users, sizeof (struct user_info *) * capacity);
+	offsets = realloc (offsets, sizeof (unsigned) * capacity);
+	starts = realloc (starts, sizeof (unsigned) * capacity);
+	outputs = realloc (outputs, sizeof (struct output_queue) * capacity);
+	active_connections = realloc (active_connections, sizeof (unsigned) * capacity);
+	active_positions = realloc (active_positions, sizeof (unsigned) * capacity);
+	unsigned old_words = (connection_capacity + CONNECTION_WORD_BITS - 1) / CONNECTION_WORD_BITS;
+	unsigned words = (capacity + CONNECTION_WORD_BITS - 1) / CONNECTION_WORD_BITS;
+	free_connections = realloc (free_connections, sizeof (uint64_t) * words);
+	if (sockets == NULL || messages == NULL || users == NULL || offsets == NULL
+			|| starts == NULL || outputs == NULL || active_connections == NULL || active_positions == NULL || free_connections == NULL) {
+		allocation_failed ();
+	}
+	unsigned added = capacity - connection_capacity;
+	memset (sockets + connection_capacity, -1, sizeof (fd_t) * added);
+	memset (messages + connection_capacity, 0, sizeof (char *) * added);
+	memset (users + connection_capacity, 0, sizeof (struct user_info *) * added);
+	memset (offsets + connection_capacity, 0, sizeof (unsigned) * added);
+	memset (starts + connection_capacity, 0, sizeof (unsigned) * added);
+	memset (outputs + connection_capacity, 0, sizeof (struct output_queue) * added);
+	memset (free_connections + old_words, 0, sizeof (uint64_t) * (words - old_words));
+	for (unsigned n = connection_capacity; n < capacity; n++) {
+		mark_free (n, true);
+	}
+	connection_capacity = capacity;
+}
+
+/*
+ * Function: receive_space
+ * -----------------------
+ * finds how many bytes can be received into messages[n] at offsets[n]. The
+ * buffer is used from front to back and only once the back is reached are
+ * the bytes that have not been handled, which are part of a single
+ * incomplete message, moved to the front. The extra byte at the end of each
+ * buffer is never received into so that a line view can always be
+ * terminated.
+ *
+ * n: index (in `sockets`) of the connection
+ *
+ * returns: the number of bytes that can be received, 0 if the buffer holds
+ * nothing but an incomplete message that is too long
+ */
+int receive_space (unsigned n) {
+	if (offsets[n] == MAX_MESSAGE_LENGTH && starts[n] > 0) {
+		memmove (messages[n], messages[n] + starts[n], offsets[n] - starts[n]);
+		offsets[n] -= starts[n];
+		starts[n] = 0;
+	}
+	return MAX_MESSAGE_LENGTH - offsets[n];
+}
+
+/*
+ * Function: idle_connection_memory
+ * --------------------------------
+ * computes the bytes the server spends on a connected client that has
+ * nothing buffered: one entry in each array of the table plus the buffer
+ * that holds incomplete messages. The single bit it takes in the free bitmap
+ * and memory the kernel keeps for the socket are not included.
+ *
+ * returns: the number of bytes
+ */
+size_t idle_connection_memory () {
+	return sizeof (fd_t) + sizeof (char *) + sizeof (struct user_info *) + sizeof (unsigned) * 2
+		+ sizeof (struct output_queue) + sizeof (unsigned) * 2 + sizeof (char) * (MAX_MESSAGE_LENGTH + 1);
+}
+
+/*
+ * Function: report_connection_memory
+ * ----------------------------------
+ * outputs the connection limit and the memory used per idle connection to
+ * stderr, leaving stdout for the chat log.
+ *
+ * returns: void
+ */
+void report_connection_memory () {
+	fprintf (stderr, "Accepting up to %u connections, %zu bytes per idle connection\n",
+		max_connections, idle_connection_memory ());
+}
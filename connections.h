@@ -0,0 +1,122 @@
+/* File that contains the table of connections the server keeps. The table
+ * is a set of parallel arrays indexed by connection. It starts small and
+ * doubles whenever a connection arrives while every index is in use, up to
+ * room for max_connections clients, so an idle server only pays for the
+ * connections it has actually seen. Free indices are tracked in a bitmap so
+ * that a new connection finds one with a find first set instead of a scan,
+ * and the indices in use are kept densely in active_connections so that
+ * loops over every client never have to skip holes. Every shard has a table
+ * of its own, so the arrays are thread local.
+ * Author: Yuriy Bash */
+
+#ifndef CONNECTIONS_H
+#define CONNECTIONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "client_server_utils.h"
+#include "output.h"
+
+/* The number of clients allowed when none is given on the command line. */
+#define DEFAULT_MAX_CONNECTIONS 10
+
+/* The number of indices the table starts with, including index 0. */
+#define INITIAL_CONNECTION_CAPACITY 16
+
+/* The number of indices tracked by each word of the free bitmap. */
+#define CONNECTION_WORD_BITS 64
+
+/* Array of sockets that will be used to send information.
+ * A socket will be initialized and reset to -1 if there
+ * is not active connection and index 0 will always contain
+ * the socket the server uses to receive connections. */
+extern __thread fd_t *sockets;
+
+/* Array of receive buffers, one per connection. The bytes from
+ * starts[n] up to offsets[n] of messages[n] have been received from
+ * the client in index n but not yet handled. */
+extern __thread char **messages;
+
+/* Array of user information about users who have connected. */
+extern __thread struct user_info **users;
+
+/* Array of offsets into the messages at which the next read is
+ * placed. */
+extern __thread unsigned *offsets;
+
+/* Array of offsets into the messages at which the first byte that
+ * has not been handled is found. */
+extern __thread unsigned *starts;
+
+/* Array of the messages queued for each connection until its socket
+ * becomes writable. */
+extern __thread struct output_queue *outputs;
+
+/* The number have sockets that have currently connected. Includes
+ * the servers socket that receives connections. */
+extern __thread unsigned socket_total;
+
+/* The number of indices currently allocated in each of the arrays. */
+extern __thread unsigned connection_capacity;
+
+/* A number that changes whenever a connection is claimed or released, so
+ * that anything derived from active_connections can tell it is stale. It
+ * is never 0. */
+extern __thread unsigned long connection_generation;
+
+/* Array holding the index of every connected client in no particular
+ * order. The first socket_total - 1 entries are valid. */
+extern __thread unsigned *active_connections;
+
+/* Array holding, for every index in use, its position in
+ * active_connections. */
+extern __thread unsigned *active_positions;
+
+/* Bitmap with one bit per index which is set while the index is free.
+ * Index 0 is never free. */
+extern __thread uint64_t *free_connections;
+
+/* The maximum number of clients that may be connected at once. */
+extern unsigned max_connections;
+
+/* The number of clients connected to any shard. */
+extern unsigned connected_clients;
+
+/* Function that allocates the table at its initial capacity and stores the
+ * server socket in index 0. */
+void init_connections (fd_t main_socket);
+
+/* Function that determines if max_connections clients are connected
+ * across all shards. */
+bool connections_full ();
+
+/* Function that returns the lowest index that does not hold a connection,
+ * growing the table if every index is in use, and marks it as in use. The
+ * index is added to active_connections and counted in socket_total. Must
+ * not be called when connections_full returns true. */
+unsigned claim_connection ();
+
+/* Function that marks the index n as free again, removing it from
+ * active_connections and socket_total. */
+void release_connection (unsigned n);
+
+/* Function that returns how many bytes can be received into messages[n]
+ * at offsets[n]. The unhandled bytes are moved to the front of the buffer
+ * only when the end of the buffer has been reached. Returns 0 if the
+ * buffer is full of a single incomplete message. */
+int receive_space (unsigned n);
+
+/* Function that doubles the capacity of the table, capped at room for
+ * max_connections clients. New indices are marked as free. */
+void grow_connections ();
+
+/* Function that returns the number of bytes the server spends on a client
+ * that is connected but has nothing buffered. */
+size_t idle_connection_memory ();
+
+/* Function that outputs the connection limit and the memory used per idle
+ * connection to stderr. */
+void report_connection_memory ();
+
+#endif
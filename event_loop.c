@@ -0,0 +1,550 @@
+/* File that contains the backends the server can use to wait for activity on
+ * its sockets. The select backend rebuilds its descriptor sets on every
+ * wakeup while the epoll backend registers each socket once when it is
+ * accepted and only hands the ready sockets back to the server. The io_uring
+ * backend lives in uring_loop.c and falls back to epoll when the kernel
+ * lacks the features it needs.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include "server.h"
+#include "event_loop.h"
+#include "uring_loop.h"
+#include "client_server_utils.h"
+#include "shards.h"
+#include "output.h"
+#include "metrics.h"
+#include "admin.h"
+#include "connections.h"
+
+void event_loop_error ();
+
+void select_wait ();
+
+void epoll_wait_events ();
+
+void epoll_register (unsigned n, int operation);
+
+void epoll_register_admin (fd_t fd, bool output, int operation);
+
+void epoll_stall_accept ();
+
+void epoll_rearm_listener (struct shard *shard);
+
+void select_admin (fd_set *read_set, fd_set *write_set);
+
+/* The backend used to wait for activity by the calling shard. */
+__thread enum EVENT_BACKEND event_backend = Epoll_Backend;
+
+/* Whether the epoll backend uses edge triggered notifications. */
+bool edge_triggered = false;
+
+/* File descriptor of the shard's epoll instance, -1 if the select backend
+ * is used. */
+__thread fd_t epoll_fd = -1;
+
+/* The admin sockets watched by the select backend, and whether each is
+ * watched for writability rather than readability. */
+__thread fd_t admin_sockets[ADMIN_CLIENT_LIMIT + 1];
+__thread bool admin_output[ADMIN_CLIENT_LIMIT + 1];
+__thread unsigned admin_total = 0;
+
+/*
+ * Function: select_backend
+ * ------------------------
+ * sets event_backend from the name given on the command line.
+ *
+ * name: either "select", "epoll" or "uring"
+ *
+ * returns: false if the name is not a known backend
+ */
+bool select_backend (char *name) {
+	if (strcmp (name, "select") == 0) {
+		event_backend = Select_Backend;
+	} else if (strcmp (name, "epoll") == 0) {
+		event_backend = Epoll_Backend;
+	} else if (strcmp (name, "uring") == 0) {
+		event_backend = Uring_Backend;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Function: event_loop_init
+ * -------------------------
+ * prepares the selected backend. For epoll this creates the epoll instance
+ * and registers the server socket in index 0 along with the shard's mailbox
+ * when there are several shards. If io_uring was selected but the kernel
+ * does not support it, epoll is used instead.
+ *
+ * returns: void
+ */
+void event_loop_init () {
+	if (event_backend == Uring_Backend) {
+		if (uring_init ()) {
+			return;
+		}
+		fprintf (stderr, "io_uring is not supported, falling back to epoll\n");
+		event_backend = Epoll_Backend;
+		current_shard->backend = Epoll_Backend;
+	}
+	if (event_backend == Select_Backend) {
+		return;
+	}
+	epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		event_loop_error ();
+	}
+	epoll_register (0, EPOLL_CTL_ADD);
+	current_shard->epoll_fd = epoll_fd;
+	current_shard->listener = sockets[0];
+	if (shard_count > 1) {
+		struct epoll_event event;
+		memset (&event, 0, sizeof (event));
+		event.events = EPOLLIN;
+		event.data.u64 = MAILBOX_INDEX;
+		if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, current_shard->mailbox.event_fd, &event) == -1) {
+			event_loop_error ();
+		}
+	}
+}
+
+/*
+ * Function: event_loop_add
+ * ------------------------
+ * starts watching the socket in index n. The select backend picks sockets up
+ * from the sockets array on its own so only epoll needs to do work here.
+ *
+ * n: index (in `sockets`) of the new connection
+ *
+ * returns: void
+ */
+void event_loop_add (unsigned n) {
+	if (event_backend == Epoll_Backend) {
+		epoll_register (n, EPOLL_CTL_ADD);
+	} else if (event_backend == Uring_Backend) {
+		uring_add (n);
+	}
+}
+
+/*
+ * Function: event_loop_remove
+ * ---------------------------
+ * stops watching the socket in index n.
+ *
+ * n: index (in `sockets`) of the connection being closed
+ *
+ * returns: void
+ */
+void event_loop_remove (unsigned n) {
+	if (event_backend == Epoll_Backend) {
+		epoll_ctl (epoll_fd, EPOLL_CTL_DEL, sockets[n], NULL);
+	} else if (event_backend == Uring_Backend) {
+		uring_remove (n);
+	}
+}
+
+/*
+ * Function: event_loop_released
+ * -----------------------------
+ * resumes accepting on every shard that stopped because the server was
+ * full. An edge triggered server socket is modified so that epoll reports
+ * the connections still pending on it, and an io_uring shard resumes its
+ * accept itself, right away if it is the current shard and otherwise once
+ * it is woken. The connection may have been released on any shard since
+ * the limit is shared by all of them.
+ *
+ * returns: void
+ */
+void event_loop_released () {
+	for (unsigned i = 0; i < shard_count; i++) {
+		if (!__atomic_load_n (&shards[i].accept_stalled, __ATOMIC_SEQ_CST)) {
+			continue;
+		}
+		if (shards[i].backend == Uring_Backend) {
+			if (&shards[i] == current_shard) {
+				uring_resume_accept ();
+			} else {
+				wake_shard (&shards[i]);
+			}
+		} else if (__atomic_exchange_n (&shards[i].accept_stalled, false, __ATOMIC_SEQ_CST)) {
+			epoll_rearm_listener (&shards[i]);
+		}
+	}
+}
+
+/*
+ * Function: event_loop_watch_output
+ * ---------------------------------
+ * starts or stops watching the socket in index n for writability, which is
+ * needed while a flush has left output queued. Whether it is watched is
+ * taken from has_output, which epoll_register reads for every socket. The
+ * select backend checks the queues on its own and io_uring keeps its own
+ * queues.
+ *
+ * n: index (in `sockets`) of the connection
+ *
+ * returns: void
+ */
+void event_loop_watch_output (unsigned n) {
+	if (event_backend == Epoll_Backend && sockets[n] != -1) {
+		epoll_register (n, EPOLL_CTL_MOD);
+	}
+}
+
+/*
+ * Function: event_loop_add_admin
+ * ------------------------------
+ * starts watching the admin socket fd for readability. The epoll backend
+ * registers it with ADMIN_INDEX in place of an index and io_uring arms a
+ * one shot poll, both of which handle_admin renews through
+ * event_loop_watch_admin.
+ *
+ * fd: the admin listener or an admin client
+ *
+ * returns: void
+ */
+void event_loop_add_admin (fd_t fd) {
+	if (event_backend == Epoll_Backend) {
+		epoll_register_admin (fd, false, EPOLL_CTL_ADD);
+	} else if (event_backend == Uring_Backend) {
+		uring_watch_admin (fd, false);
+	} else {
+		admin_sockets[admin_total] = fd;
+		admin_output[admin_total] = false;
+		admin_total++;
+	}
+}
+
+/*
+ * Function: event_loop_watch_admin
+ * --------------------------------
+ * watches the admin socket fd, which has just been handled, for
+ * writability if output is true and for readability otherwise.
+ *
+ * fd: the admin listener or an admin client
+ * output: whether a response is waiting to be written to fd
+ *
+ * returns: void
+ */
+void event_loop_watch_admin (fd_t fd, bool output) {
+	if (event_backend == Epoll_Backend) {
+		epoll_register_admin (fd, output, EPOLL_CTL_MOD);
+	} else if (event_backend == Uring_Backend) {
+		uring_watch_admin (fd, output);
+	} else {
+		for (unsigned i = 0; i < admin_total; i++) {
+			if (admin_sockets[i] == fd) {
+				admin_output[i] = output;
+			}
+		}
+	}
+}
+
+/*
+ * Function: event_loop_remove_admin
+ * ---------------------------------
+ * stops watching the admin socket fd. io_uring has nothing to cancel since
+ * a client is only closed while handling the completion of its poll.
+ *
+ * fd: the admin client being closed
+ *
+ * returns: void
+ */
+void event_loop_remove_admin (fd_t fd) {
+	if (event_backend == Epoll_Backend) {
+		epoll_ctl (epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	} else if (event_backend == Select_Backend) {
+		for (unsigned i = 0; i < admin_total; i++) {
+			if (admin_sockets[i] == fd) {
+				admin_total--;
+				admin_sockets[i] = admin_sockets[admin_total];
+				admin_output[i] = admin_output[admin_total];
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Function: event_loop_wait
+ * -------------------------
+ * waits for activity with the selected backend and dispatches it, then
+ * flushes the output produced along the way.
+ *
+ * returns: void
+ */
+void event_loop_wait () {
+	if (event_backend == Epoll_Backend) {
+		epoll_wait_events ();
+	} else if (event_backend == Uring_Backend) {
+		uring_wait ();
+	} else {
+		select_wait ();
+	}
+	flush_scheduled_output ();
+	end_iteration ();
+}
+
+/*
+ * Function: select_wait
+ * ---------------------
+ * rebuilds the read and exception sets from every open socket, and the
+ * write set from those with queued output, waits with select and then
+ * walks the connected clients again to find the ones that are ready. The
+ * ready clients are collected before any is handled since handling one may
+ * close others and reorder active_connections. Mail from other shards is
+ * handled before the clients. select reports the completions of zerocopy
+ * writes as readability, so they are read from every ready socket that
+ * has some outstanding. Admin sockets are handled after the mail.
+ *
+ * returns: void
+ */
+void select_wait () {
+	fd_set read_set;
+	fd_set write_set;
+	fd_set except_set;
+	FD_ZERO (&read_set);
+	FD_ZERO (&write_set);
+	FD_ZERO (&except_set);
+	fd_t socket = sockets[0];
+	fd_t fd_max = socket;
+	FD_SET (socket, &read_set);
+	fd_t mailbox = -1;
+	if (shard_count > 1) {
+		mailbox = current_shard->mailbox.event_fd;
+		FD_SET (mailbox, &read_set);
+		if (mailbox > fd_max) {
+			fd_max = mailbox;
+		}
+	}
+	for (unsigned i = 0; i < admin_total; i++) {
+		FD_SET (admin_sockets[i], admin_output[i] ? &write_set : &read_set);
+		if (admin_sockets[i] > fd_max) {
+			fd_max = admin_sockets[i];
+		}
+	}
+	unsigned clients = socket_total - 1;
+	for (unsigned i = 0; i < clients; i++) {
+		socket = sockets[active_connections[i]];
+		FD_SET (socket, &read_set);
+		FD_SET (socket, &except_set);
+		if (has_output (active_connections[i])) {
+			FD_SET (socket, &write_set);
+		}
+		if (socket > fd_max) {
+			fd_max = socket;
+		}
+	}
+	int selected = select (fd_max + 1, &read_set, &write_set, &except_set, NULL);
+	shard_metrics.poll_calls++;
+	begin_iteration ();
+	if (selected == -1) {
+		return;
+	}
+	if (mailbox != -1 && FD_ISSET (mailbox, &read_set)) {
+		handle_mailbox ();
+	}
+	if (admin_total > 0) {
+		select_admin (&read_set, &write_set);
+	}
+	unsigned ready[FD_SETSIZE];
+	fd_t ready_sockets[FD_SETSIZE];
+	unsigned ready_total = 0;
+	for (unsigned i = 0; i < clients; i++) {
+		unsigned n = active_connections[i];
+		if (FD_ISSET (sockets[n], &read_set) || FD_ISSET (sockets[n], &write_set)
+				|| FD_ISSET (sockets[n], &except_set)) {
+			ready[ready_total] = n;
+			ready_sockets[ready_total] = sockets[n];
+			ready_total++;
+		}
+	}
+	for (unsigned i = 0; i < ready_total; i++) {
+		if (sockets[ready[i]] == ready_sockets[i] && (FD_ISSET (ready_sockets[i], &except_set)
+				|| (has_zerocopy (ready[i]) && !reap_zerocopy (ready[i])))) {
+			close_connection (ready[i]);
+		}
+	}
+	for (unsigned i = 0; i < ready_total; i++) {
+		if (sockets[ready[i]] == ready_sockets[i] && FD_ISSET (ready_sockets[i], &write_set)
+				&& !flush_output (ready[i])) {
+			close_connection (ready[i]);
+		}
+	}
+	if (FD_ISSET (sockets[0], &read_set)) {
+		establish_connection ();
+	}
+	for (unsigned i = 0; i < ready_total; i++) {
+		if (sockets[ready[i]] == ready_sockets[i] && FD_ISSET (ready_sockets[i], &read_set)) {
+			handle_client (ready[i]);
+		}
+	}
+}
+
+/* Function that hands every ready admin socket to handle_admin. They are
+ * collected first since handling one changes admin_sockets. */
+void select_admin (fd_set *read_set, fd_set *write_set) {
+	fd_t ready[ADMIN_CLIENT_LIMIT + 1];
+	unsigned ready_total = 0;
+	for (unsigned i = 0; i < admin_total; i++) {
+		if (FD_ISSET (admin_sockets[i], read_set) || FD_ISSET (admin_sockets[i], write_set)) {
+			ready[ready_total] = admin_sockets[i];
+			ready_total++;
+		}
+	}
+	for (unsigned i = 0; i < ready_total; i++) {
+		handle_admin (ready[i]);
+	}
+}
+
+/*
+ * Function: epoll_wait_events
+ * ---------------------------
+ * waits with epoll and dispatches only the sockets that are ready. Each
+ * event carries both the index and the file descriptor it was registered
+ * with so that events for a connection closed earlier in the same batch
+ * are skipped. When edge triggered, every socket is drained until it would
+ * block since no further event is raised for data that is already queued.
+ * The server socket is drained by establish_connection up to its budget.
+ * The mailbox is registered with MAILBOX_INDEX and no descriptor, and the
+ * admin sockets with ADMIN_INDEX and their descriptor. An error
+ * on a socket with zerocopy writes is usually their completions, which are
+ * read before anything else. Queued output is flushed before a socket is
+ * read from.
+ *
+ * returns: void
+ */
+void epoll_wait_events () {
+	struct epoll_event events[MAX_EVENTS];
+	int ready = epoll_wait (epoll_fd, events, MAX_EVENTS, -1);
+	shard_metrics.poll_calls++;
+	begin_iteration ();
+	for (int i = 0; i < ready; i++) {
+		unsigned n = (uint32_t) events[i].data.u64;
+		fd_t socket = (fd_t) (events[i].data.u64 >> 32);
+		if (n == MAILBOX_INDEX) {
+			handle_mailbox ();
+			continue;
+		}
+		if (n == ADMIN_INDEX) {
+			handle_admin (socket);
+			continue;
+		}
+		if (sockets[n] != socket) {
+			continue;
+		}
+		if (n == 0) {
+			/* An edge triggered server socket that still has connections
+			 * pending after the budget ran out is modified so that epoll
+			 * reports it again on the next wakeup. If the server is full
+			 * it is modified once a connection is released instead. */
+			if (establish_connection () && edge_triggered) {
+				if (connections_full ()) {
+					epoll_stall_accept ();
+				} else {
+					epoll_register (0, EPOLL_CTL_MOD);
+				}
+			}
+			continue;
+		}
+		uint32_t ready_events = events[i].events;
+		if ((ready_events & EPOLLERR) && has_zerocopy (n)) {
+			if (!reap_zerocopy (n)) {
+				close_connection (n);
+				continue;
+			}
+			ready_events &= ~EPOLLERR;
+		}
+		if ((ready_events & EPOLLOUT) && !flush_output (n)) {
+			close_connection (n);
+		} else if (ready_events & EPOLLIN) {
+			while (handle_client (n) && edge_triggered && sockets[n] == socket);
+		} else if (ready_events & (EPOLLERR | EPOLLHUP)) {
+			close_connection (n);
+		}
+	}
+}
+
+/*
+ * Function: epoll_register
+ * ------------------------
+ * adds or modifies the registration of the socket in index n, storing the
+ * index in the low and the file descriptor in the high half of the event
+ * data. The socket is watched for writability while it has queued output.
+ *
+ * n: index (in `sockets`) of the connection
+ * operation: EPOLL_CTL_ADD or EPOLL_CTL_MOD
+ *
+ * returns: void
+ */
+void epoll_register (unsigned n, int operation) {
+	struct epoll_event event;
+	memset (&event, 0, sizeof (event));
+	event.events = EPOLLIN;
+	if (n != 0 && has_output (n)) {
+		event.events |= EPOLLOUT;
+	}
+	if (edge_triggered) {
+		event.events |= EPOLLET;
+	}
+	event.data.u64 = ((uint64_t) (uint32_t) sockets[n] << 32) | n;
+	if (epoll_ctl (epoll_fd, operation, sockets[n], &event) == -1) {
+		event_loop_error ();
+	}
+}
+
+/* Function that marks the edge triggered server socket of the shard as
+ * stalled because the server is full. If a connection was released before
+ * the mark was seen it is modified right away instead. */
+void epoll_stall_accept () {
+	__atomic_store_n (&current_shard->accept_stalled, true, __ATOMIC_SEQ_CST);
+	if (!connections_full () && __atomic_exchange_n (&current_shard->accept_stalled, false, __ATOMIC_SEQ_CST)) {
+		epoll_register (0, EPOLL_CTL_MOD);
+	}
+}
+
+/* Function that modifies the registration of the server socket of shard,
+ * which may belong to another thread, so that epoll reports it again if
+ * connections are pending. */
+void epoll_rearm_listener (struct shard *shard) {
+	struct epoll_event event;
+	memset (&event, 0, sizeof (event));
+	event.events = EPOLLIN | EPOLLET;
+	event.data.u64 = (uint64_t) (uint32_t) shard->listener << 32;
+	if (epoll_ctl (shard->epoll_fd, EPOLL_CTL_MOD, shard->listener, &event) == -1) {
+		event_loop_error ();
+	}
+}
+
+/* Function that adds or modifies the registration of the admin socket fd,
+ * which is level triggered whatever the other sockets use and watched for
+ * either readability or writability. */
+void epoll_register_admin (fd_t fd, bool output, int operation) {
+	struct epoll_event event;
+	memset (&event, 0, sizeof (event));
+	event.events = output ? EPOLLOUT : EPOLLIN;
+	event.data.u64 = ((uint64_t) (uint32_t) fd << 32) | ADMIN_INDEX;
+	if (epoll_ctl (epoll_fd, operation, fd, &event) == -1) {
+		event_loop_error ();
+	}
+}
+
+/* Function to handle an error that occurs when setting up the backend. */
+void event_loop_error () {
+	fprintf (stderr, "Unable to register socket with the event loop\n");
+	exit (1);
+}
@@ -0,0 +1,73 @@
+/* File that contains the backends the server can use to wait for activity on
+ * its sockets. The select backend rebuilds its descriptor sets on every
+ * wakeup while the epoll backend registers each socket once when it is
+ * accepted and only hands the ready sockets back to the server. The io_uring
+ * backend lives in uring_loop.c and falls back to epoll when the kernel
+ * lacks the features it needs.
+ * Author: Yuriy Bash */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdbool.h>
+#include "client_server_utils.h"
+
+/* The maximum number of events the epoll backend collects per wakeup. */
+#define MAX_EVENTS 64
+
+enum EVENT_BACKEND {Select_Backend=0, Epoll_Backend=1, Uring_Backend=2};
+
+/* The backend used to wait for activity. Chosen from the command line
+ * before handle_connections is called and copied by every shard. */
+extern __thread enum EVENT_BACKEND event_backend;
+
+/* If true the epoll backend registers sockets as edge triggered, in which
+ * case every ready socket is drained until it would block. */
+extern bool edge_triggered;
+
+/* Function that takes the name of a backend from the command line and
+ * sets event_backend accordingly. Returns false if the name is unknown. */
+bool select_backend (char *name);
+
+/* Function that prepares the selected backend to watch the server socket,
+ * which must already be stored in sockets[0]. If io_uring is selected but
+ * not usable, event_backend is changed to epoll. */
+void event_loop_init ();
+
+/* Function that starts watching the socket stored in index n. Called once
+ * when a connection is established. */
+void event_loop_add (unsigned n);
+
+/* Function that stops watching the socket stored in index n. Must be called
+ * before the socket is closed. */
+void event_loop_remove (unsigned n);
+
+/* Function that is called once a connection has been released, which
+ * lets an edge triggered server socket that stopped accepting because the
+ * server was full accept again. */
+void event_loop_released ();
+
+/* Function that starts or stops watching the socket in index n for
+ * writability, depending on whether a flush left output queued, which
+ * has_output tells. */
+void event_loop_watch_output (unsigned n);
+
+/* Function that starts watching the admin socket fd for readability. */
+void event_loop_add_admin (fd_t fd);
+
+/* Function that watches the admin socket fd again once it has been
+ * handled, for writability if output is true and readability otherwise. */
+void event_loop_watch_admin (fd_t fd, bool output);
+
+/* Function that stops watching the admin socket fd. Must be called before
+ * it is closed. */
+void event_loop_remove_admin (fd_t fd);
+
+/* Function that waits until at least one socket has activity and then
+ * dispatches each ready socket to establish_connection, handle_client or
+ * close_connection. The io_uring backend dispatches completed requests to
+ * add_connection, handle_received or close_connection instead. The output
+ * queued while dispatching is flushed before it returns. */
+void event_loop_wait ();
+
+#endif
@@ -0,0 +1,94 @@
+/* File that contains the histograms the server keeps its latencies and
+ * fan-out widths in. Values below HISTOGRAM_SUB_BUCKETS each have a bucket
+ * of their own, and every larger power of two is split into
+ * HISTOGRAM_SUB_BUCKETS buckets, whose width doubles from one power to the
+ * next.
+ * Author: Yuriy Bash */
+
+#include "histogram.h"
+
+/*
+ * Function: histogram_bucket
+ * --------------------------
+ * finds the bucket of a value from the position of its highest set bit,
+ * which picks the power of two, and the HISTOGRAM_SUB_BITS bits below it,
+ * which pick the bucket within it.
+ *
+ * value: the value to find the bucket of
+ *
+ * returns: the index of the bucket
+ */
+unsigned histogram_bucket (unsigned long value) {
+	if (value < HISTOGRAM_SUB_BUCKETS) {
+		return value;
+	}
+	unsigned shift = 63 - __builtin_clzl (value) - HISTOGRAM_SUB_BITS;
+	return ((shift + 1) << HISTOGRAM_SUB_BITS) + ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/* Function that returns the largest value counted in bucket. */
+unsigned long bucket_limit (unsigned bucket) {
+	if (bucket < HISTOGRAM_SUB_BUCKETS) {
+		return bucket;
+	}
+	unsigned shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+	unsigned long lowest = (unsigned long) (HISTOGRAM_SUB_BUCKETS + (bucket & (HISTOGRAM_SUB_BUCKETS - 1))) << shift;
+	return lowest + ((1UL << shift) - 1);
+}
+
+/* Function that adds value to histogram. */
+void record_value (struct histogram *histogram, unsigned long value) {
+	histogram->counts[histogram_bucket (value)]++;
+	histogram->total++;
+	histogram->sum += value;
+	if (value > histogram->max) {
+		histogram->max = value;
+	}
+}
+
+/* Function that adds every value recorded in from to into. */
+void merge_histogram (struct histogram *into, struct histogram *from) {
+	if (from->total == 0) {
+		return;
+	}
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		into->counts[i] += from->counts[i];
+	}
+	into->total += from->total;
+	into->sum += from->sum;
+	if (from->max > into->max) {
+		into->max = from->max;
+	}
+}
+
+/*
+ * Function: histogram_percentile
+ * ------------------------------
+ * walks the buckets in order until the given fraction of the values has
+ * been passed. The largest value of that bucket is returned, capped at the
+ * largest value recorded, so the result is never below the true
+ * percentile and above it by less than the width of one bucket.
+ *
+ * histogram: the histogram to read
+ * fraction: the fraction of values, such as 0.99 for the 99th percentile
+ *
+ * returns: the percentile, or 0 if nothing was recorded
+ */
+unsigned long histogram_percentile (struct histogram *histogram, double fraction) {
+	if (histogram->total == 0) {
+		return 0;
+	}
+	unsigned long rank = fraction * histogram->total;
+	if (rank < fraction * histogram->total || rank == 0) {
+		rank++;
+	}
+	unsigned long passed = 0;
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		passed += histogram->counts[i];
+		if (passed >= rank) {
+			unsigned long limit = bucket_limit (i);
+			return limit < histogram->max ? limit : histogram->max;
+		}
+	}
+	return histogram->max;
+}
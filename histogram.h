@@ -0,0 +1,46 @@
+/* File that contains the histograms the server keeps its latencies and
+ * fan-out widths in. Like an HDR histogram, every power of two is split
+ * into HISTOGRAM_SUB_BUCKETS buckets of equal width, so a value is kept to
+ * within one part in HISTOGRAM_SUB_BUCKETS of itself whether it is a few
+ * ns or several seconds, in a fixed amount of memory, and recording one
+ * takes a count of leading zeros and an increment.
+ * Author: Yuriy Bash */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+/* The number of bits of a value kept exactly, and the number of buckets
+ * every power of two is split into. */
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+
+/* The number of buckets needed for any 64 bit value. */
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/* The counts of the values recorded in each bucket along with how many
+ * there were, their sum and the largest. */
+struct histogram {
+	unsigned long counts[HISTOGRAM_BUCKETS];
+	unsigned long total;
+	unsigned long sum;
+	unsigned long max;
+};
+
+/* Function that adds value to histogram. */
+void record_value (struct histogram *histogram, unsigned long value);
+
+/* Function that adds every value recorded in from to into. */
+void merge_histogram (struct histogram *into, struct histogram *from);
+
+/* Function that returns the value below which the given fraction of the
+ * values of histogram fall, as the largest value of its bucket, or 0 if
+ * nothing was recorded. */
+unsigned long histogram_percentile (struct histogram *histogram, double fraction);
+
+/* Function that returns the index of the bucket value is counted in. */
+unsigned histogram_bucket (unsigned long value);
+
+/* Function that returns the largest value counted in bucket. */
+unsigned long bucket_limit (unsigned bucket);
+
+#endif
@@ -0,0 +1,160 @@
+/* File that contains the scanner the server and the client use to split
+ * received bytes into messages. Every newline in a chunk is found in one
+ * pass, 32 or 16 bytes at a time with AVX2 or SSE2 when the processor has
+ * them and one byte at a time otherwise. The implementation is chosen the
+ * first time the scanner is used.
+ * Author: Yuriy Bash */
+
+#include <stdbool.h>
+#include <string.h>
+#include "line_scan.h"
+
+#if defined (__x86_64__) || defined (__i386__)
+#define LINE_SCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef int (*line_scanner) (char *buffer, int start, int end, int *positions, int capacity);
+
+int resolve_line_scanner (char *buffer, int start, int end, int *positions, int capacity);
+
+/* The implementation used by find_line_ends. It starts out as the resolver,
+ * which replaces itself with the best implementation on its first call.
+ * Every thread that races to resolve stores the same value. */
+line_scanner chosen_scanner = resolve_line_scanner;
+
+/* The name of the chosen implementation. */
+char *chosen_name = "scalar";
+
+/*
+ * Function: find_line_ends
+ * ------------------------
+ * finds the newlines from start up to, but not including, end with the
+ * best implementation for this processor.
+ *
+ * buffer: pointer to the start of the buffer
+ * start: index at which to start search
+ * end: index one past the last byte to search
+ * positions: array receiving the index of each newline
+ * capacity: the number of entries in positions
+ *
+ * returns: the number of newlines stored in positions
+ */
+int find_line_ends (char *buffer, int start, int end, int *positions, int capacity) {
+	line_scanner scanner = __atomic_load_n (&chosen_scanner, __ATOMIC_RELAXED);
+	return scanner (buffer, start, end, positions, capacity);
+}
+
+/* Function that returns the name of the implementation find_line_ends
+ * uses on this processor. */
+char *line_scan_implementation () {
+	int position;
+	find_line_ends ("", 0, 0, &position, 1);
+	return chosen_name;
+}
+
+/* Function that determines if the processor can run the implementation
+ * with the given name. */
+bool line_scan_supports (char *name) {
+	if (strcmp (name, "scalar") == 0) {
+		return true;
+	}
+#ifdef LINE_SCAN_X86
+	__builtin_cpu_init ();
+	if (strcmp (name, "sse2") == 0) {
+		return __builtin_cpu_supports ("sse2");
+	}
+	if (strcmp (name, "avx2") == 0) {
+		return __builtin_cpu_supports ("avx2");
+	}
+#endif
+	return false;
+}
+
+/* Function that picks the implementation for this processor on the first
+ * call of find_line_ends and then runs it. */
+int resolve_line_scanner (char *buffer, int start, int end, int *positions, int capacity) {
+	line_scanner scanner = find_line_ends_scalar;
+	if (line_scan_supports ("avx2")) {
+		scanner = find_line_ends_avx2;
+		chosen_name = "avx2";
+	} else if (line_scan_supports ("sse2")) {
+		scanner = find_line_ends_sse2;
+		chosen_name = "sse2";
+	}
+	__atomic_store_n (&chosen_scanner, scanner, __ATOMIC_RELAXED);
+	return scanner (buffer, start, end, positions, capacity);
+}
+
+/* Function that finds the newlines one byte at a time. Also finishes the
+ * bytes the vector implementations leave over. */
+int find_line_ends_scalar (char *buffer, int start, int end, int *positions, int capacity) {
+	int found = 0;
+	for (int i = start; i < end && found < capacity; i++) {
+		if (buffer[i] == '\n') {
+			positions[found] = i;
+			found++;
+		}
+	}
+	return found;
+}
+
+#ifdef LINE_SCAN_X86
+
+/* Function that finds the newlines 16 bytes at a time. Each block is
+ * compared against a register full of newlines and the resulting mask is
+ * walked bit by bit. */
+__attribute__ ((target ("sse2")))
+int find_line_ends_sse2 (char *buffer, int start, int end, int *positions, int capacity) {
+	__m128i newlines = _mm_set1_epi8 ('\n');
+	int found = 0;
+	int i = start;
+	for (; i + 16 <= end; i += 16) {
+		__m128i block = _mm_loadu_si128 ((__m128i *) (buffer + i));
+		unsigned mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (block, newlines));
+		while (mask != 0) {
+			if (found == capacity) {
+				return found;
+			}
+			positions[found] = i + __builtin_ctz (mask);
+			found++;
+			mask &= mask - 1;
+		}
+	}
+	return found + find_line_ends_scalar (buffer, i, end, positions + found, capacity - found);
+}
+
+/* Function that finds the newlines 32 bytes at a time. */
+__attribute__ ((target ("avx2")))
+int find_line_ends_avx2 (char *buffer, int start, int end, int *positions, int capacity) {
+	__m256i newlines = _mm256_set1_epi8 ('\n');
+	int found = 0;
+	int i = start;
+	for (; i + 32 <= end; i += 32) {
+		__m256i block = _mm256_loadu_si256 ((__m256i *) (buffer + i));
+		unsigned mask = _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (block, newlines));
+		while (mask != 0) {
+			if (found == capacity) {
+				return found;
+			}
+			positions[found] = i + __builtin_ctz (mask);
+			found++;
+			mask &= mask - 1;
+		}
+	}
+	return found + find_line_ends_sse2 (buffer, i, end, positions + found, capacity - found);
+}
+
+#else
+
+/* Without x86 vector instructions both vector implementations are the
+ * scalar one, and line_scan_supports never selects them. */
+int find_line_ends_sse2 (char *buffer, int start, int end, int *positions, int capacity) {
+	return find_line_ends_scalar (buffer, start, end, positions, capacity);
+}
+
+int find_line_ends_avx2 (char *buffer, int start, int end, int *positions, int capacity) {
+	return find_line_ends_scalar (buffer, start, end, positions, capacity);
+}
+
+#endif
@@ -0,0 +1,40 @@
+/* File that contains the scanner the server and the client use to split
+ * received bytes into messages. Every newline in a chunk is found in one
+ * pass, 32 or 16 bytes at a time with AVX2 or SSE2 when the processor has
+ * them and one byte at a time otherwise. The implementation is chosen the
+ * first time the scanner is used.
+ * Author: Yuriy Bash */
+
+#ifndef LINE_SCAN_H
+#define LINE_SCAN_H
+
+#include <stdbool.h>
+
+/* The number of newline positions callers collect per call. */
+#define LINE_BATCH 64
+
+/* Function that finds the newlines from start up to, but not including,
+ * end and stores their indices in positions in increasing order, stopping
+ * once capacity have been found. The buffer need not be null terminated.
+ * Returns the number stored, so a result of capacity means the search
+ * should continue after the last position. */
+int find_line_ends (char *buffer, int start, int end, int *positions, int capacity);
+
+/* Function that returns the name of the implementation find_line_ends
+ * uses on this processor. */
+char *line_scan_implementation ();
+
+/* The implementations find_line_ends chooses between, which behave exactly
+ * like it. The vector ones must only be called when line_scan_supports
+ * says the processor has the instructions they need. */
+int find_line_ends_scalar (char *buffer, int start, int end, int *positions, int capacity);
+
+int find_line_ends_sse2 (char *buffer, int start, int end, int *positions, int capacity);
+
+int find_line_ends_avx2 (char *buffer, int start, int end, int *positions, int capacity);
+
+/* Function that determines if the processor can run the implementation
+ * with the given name, one of "scalar", "sse2" or "avx2". */
+bool line_scan_supports (char *name);
+
+#endif
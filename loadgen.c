@@ -0,0 +1,750 @@
+/* This is a load generator for the chat server. It is started with the
+ * address and port of the server like ./client, takes no input and
+ * connects -u users named after -n followed by their index, of which the
+ * first -a send and the rest only receive. Each sender sends lines of -s
+ * bytes, and with -k that percentage of its messages are commands
+ * instead: \show_status of a random user, a random page of
+ * \show_all_statuses or \mute and \unmute of a random user in turn. With
+ * -r the senders take turns sending that many messages per second in
+ * total. Without it every sender keeps -w lines in flight, sending the
+ * next one as soon as the user after it has received one, so the rate is
+ * whatever the server sustains. -x closes and connects again that many of
+ * the receivers per second. A run lasts -d seconds and -j prints its
+ * results as JSON.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "loadgen.h"
+#include "client_server_utils.h"
+#include "line_scan.h"
+#include "histogram.h"
+
+unsigned long load_clock ();
+
+unsigned long next_random ();
+
+void raise_user_limit ();
+
+void start_connect (unsigned n);
+
+void finish_connect (unsigned n);
+
+void handle_user_event (unsigned n, uint32_t events);
+
+void read_user (unsigned n);
+
+void handle_load_message (unsigned n, char *msg, int length, unsigned long now);
+
+void handle_delivery (unsigned n, char *text, unsigned long now);
+
+void drop_user (unsigned n);
+
+bool queue_text (unsigned n, char *text, int length);
+
+void flush_user (unsigned n);
+
+void watch_user (unsigned n, int operation, uint32_t events);
+
+void send_line (unsigned n, unsigned long stamp);
+
+void send_command (unsigned n);
+
+void send_next (unsigned n, unsigned long now);
+
+void send_scheduled (unsigned long now);
+
+void check_losses (unsigned long now);
+
+void churn_users (unsigned long now);
+
+void reconnect_user (unsigned n);
+
+unsigned wait_events (int timeout);
+
+void wait_quiet ();
+
+void load_error (char *reason);
+
+void usage_error ();
+
+/* The simulated users. */
+struct load_user *users;
+
+unsigned user_count = DEFAULT_USERS;
+
+/* The messages sent per second by all users together, 0 for a closed
+ * loop. */
+unsigned long rate = 0;
+
+/* The number of users that send, the first ones, while the rest only
+ * receive. */
+unsigned sender_count = 0;
+
+/* The users closed and connected again per second. */
+unsigned long churn_rate = 0;
+
+/* The lines each user keeps in flight in a closed loop. */
+unsigned window = 1;
+
+unsigned duration = DEFAULT_SECONDS;
+
+/* The percentage of messages that are commands. */
+unsigned command_percent = 0;
+
+/* The length of every line without its newline. */
+unsigned line_size = DEFAULT_LINE_SIZE;
+
+char *name_prefix = "load";
+
+bool json_output = false;
+
+struct sockaddr_in server_address;
+
+fd_t epoll_fd;
+
+/* The end-to-end latency of every line delivered, in ns. */
+struct histogram latency;
+
+/* Whether the users are still sending, which stops once the run is over
+ * while the lines in flight are collected. */
+bool sending = false;
+
+/* The users whose connects failed and are waiting to be tried again. */
+unsigned *retries;
+unsigned retry_total = 0;
+
+unsigned connecting = 0;
+unsigned connected_total = 0;
+unsigned live_users = 0;
+
+/* The next user whose turn it is to send in an open loop, and the number
+ * of messages sent so far on its schedule. */
+unsigned next_sender = 0;
+unsigned long scheduled = 0;
+
+/* The next user to be reconnected and the number reconnected so far. */
+unsigned next_churned = 0;
+unsigned long churned = 0;
+
+unsigned long run_start;
+unsigned long run_end;
+
+unsigned long lines_sent = 0;
+unsigned long commands_sent = 0;
+unsigned long delivered = 0;
+unsigned long expected_deliveries = 0;
+unsigned long lost_lines = 0;
+unsigned long skipped_sends = 0;
+unsigned long disconnects = 0;
+unsigned long joins_seen = 0;
+unsigned long replies = 0;
+
+unsigned long random_state = 0x9e3779b97f4a7c15UL;
+
+int main (int argc, char *argv[]) {
+	int option;
+	while ((option = getopt (argc, argv, "u:a:r:x:w:d:k:s:n:j")) != -1) {
+		if (option == 'u' && atoi (optarg) > 0) {
+			user_count = atoi (optarg);
+		} else if (option == 'a' && atoi (optarg) > 0) {
+			sender_count = atoi (optarg);
+		} else if (option == 'r' && atol (optarg) >= 0) {
+			rate = atol (optarg);
+		} else if (option == 'x' && atol (optarg) >= 0) {
+			churn_rate = atol (optarg);
+		} else if (option == 'w' && atoi (optarg) > 0) {
+			window = atoi (optarg);
+		} else if (option == 'd' && atoi (optarg) > 0) {
+			duration = atoi (optarg);
+		} else if (option == 'k' && atoi (optarg) >= 0 && atoi (optarg) < 100) {
+			command_percent = atoi (optarg);
+		} else if (option == 's' && atoi (optarg) > 0 && atoi (optarg) < MAX_MESSAGE_LENGTH / 2) {
+			line_size = atoi (optarg);
+		} else if (option == 'n') {
+			name_prefix = optarg;
+		} else if (option == 'j') {
+			json_output = true;
+		} else {
+			usage_error ();
+		}
+	}
+	if (argc - optind != 2) {
+		usage_error ();
+	}
+	memset (&server_address, 0, sizeof (server_address));
+	server_address.sin_family = AF_INET;
+	server_address.sin_port = htons (atoi (argv[optind + 1]));
+	if (inet_pton (AF_INET, argv[optind], &server_address.sin_addr) != 1) {
+		load_error ("Address is not a valid IPv4 address");
+	}
+	if (sender_count == 0 || sender_count > user_count) {
+		sender_count = user_count;
+	}
+	signal (SIGPIPE, SIG_IGN);
+	raise_user_limit ();
+	users = calloc (user_count, sizeof (struct load_user));
+	retries = malloc (user_count * sizeof (unsigned));
+	if (users == NULL || retries == NULL) {
+		allocation_failed ();
+	}
+	epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		load_error ("Unable to create epoll instance");
+	}
+	connect_users ();
+	run_load ();
+	report_load ();
+	return 0;
+}
+
+/*
+ * Function: connect_users
+ * -----------------------
+ * connects every user, keeping at most LOAD_CONNECT_BATCH connects in
+ * progress and trying a refused one again, which also covers a server
+ * that is still starting. Each user sends its name once connected. The
+ * joins are broadcast to every user already in the room, so once all have
+ * connected the function waits until each pair has seen one or the
+ * traffic has stopped.
+ *
+ * returns: void
+ */
+void connect_users () {
+	for (unsigned n = 0; n < user_count; n++) {
+		users[n].fd = -1;
+		users[n].muted = -1;
+	}
+	unsigned next = 0;
+	unsigned long deadline = load_clock () + LOAD_CONNECT_TIMEOUT * 1000000000UL;
+	while (connected_total < user_count) {
+		if (load_clock () > deadline) {
+			load_error ("Unable to connect every user");
+		}
+		unsigned failed = retry_total;
+		while (connecting < LOAD_CONNECT_BATCH && (retry_total > 0 || next < user_count)) {
+			start_connect (retry_total > 0 ? retries[--retry_total] : next++);
+		}
+		wait_events (10);
+		if (failed > 0) {
+			usleep (10000);
+		}
+	}
+	unsigned long expected_joins = (unsigned long) user_count * (user_count - 1) / 2;
+	while (joins_seen < expected_joins && wait_events (LOAD_QUIET_MS) > 0);
+}
+
+/* Function that starts a nonblocking connect for user n, to be finished
+ * once its socket is writable. */
+void start_connect (unsigned n) {
+	users[n].fd = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (users[n].fd == -1) {
+		load_error ("Unable to create socket");
+	}
+	connecting++;
+	if (connect (users[n].fd, (struct sockaddr *) &server_address, sizeof (server_address)) == -1
+			&& errno != EINPROGRESS) {
+		close (users[n].fd);
+		users[n].fd = -1;
+		connecting--;
+		retries[retry_total++] = n;
+		return;
+	}
+	watch_user (n, EPOLL_CTL_ADD, EPOLLOUT);
+}
+
+/* Function that finishes the connect of user n, sending its name if it
+ * succeeded and queueing it to be tried again otherwise. */
+void finish_connect (unsigned n) {
+	connecting--;
+	int error = 0;
+	socklen_t length = sizeof (error);
+	if (getsockopt (users[n].fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0) {
+		epoll_ctl (epoll_fd, EPOLL_CTL_DEL, users[n].fd, NULL);
+		close (users[n].fd);
+		users[n].fd = -1;
+		retries[retry_total++] = n;
+		return;
+	}
+	users[n].connected = true;
+	connected_total++;
+	live_users++;
+	watch_user (n, EPOLL_CTL_MOD, EPOLLIN);
+	char name[MAX_MESSAGE_LENGTH];
+	queue_text (n, name, snprintf (name, sizeof (name), "%s%u\n", name_prefix, n));
+	flush_user (n);
+}
+
+/*
+ * Function: run_load
+ * ------------------
+ * has the users send for the configured duration. In an open loop the
+ * messages due by now are sent on every wakeup, each stamped with the
+ * time it was due rather than the time it left, so a server that falls
+ * behind shows up in the latency instead of slowing the schedule down.
+ * In a closed loop every sender fills its window at the start and sends
+ * again whenever one of its lines arrives, and lines that never arrive
+ * are given up on after LOAD_LOSS_NS. With churn, users are reconnected
+ * on a schedule of their own throughout.
+ *
+ * returns: void
+ */
+void run_load () {
+	sending = true;
+	run_start = load_clock ();
+	unsigned long deadline = run_start + duration * 1000000000UL;
+	unsigned long last_check = run_start;
+	if (rate == 0) {
+		for (unsigned n = 0; n < sender_count; n++) {
+			for (unsigned w = 0; w < window && users[n].fd != -1; w++) {
+				send_next (n, run_start);
+			}
+			if (users[n].fd != -1) {
+				flush_user (n);
+			}
+		}
+	}
+	unsigned long now = run_start;
+	while (now < deadline) {
+		wait_events (rate == 0 ? 10 : 1);
+		now = load_clock ();
+		if (rate > 0) {
+			send_scheduled (now);
+		} else if (now - last_check > LOAD_LOSS_NS / 10) {
+			check_losses (now);
+			last_check = now;
+		}
+		if (churn_rate > 0) {
+			churn_users (now);
+		}
+	}
+	sending = false;
+	run_end = now;
+	wait_quiet ();
+}
+
+/* Function that sends the messages of the open loop schedule that are due
+ * by now, handing them to the users in turn and skipping those that still
+ * have a full buffer. If every user is full the rest waits for the next
+ * wakeup. */
+void send_scheduled (unsigned long now) {
+	unsigned long due = (now - run_start) * rate / 1000000000UL;
+	while (scheduled < due) {
+		unsigned tried = 0;
+		while (tried < sender_count && (users[next_sender].fd == -1 || !users[next_sender].connected
+				|| users[next_sender].pending + MAX_MESSAGE_LENGTH > LOAD_OUTPUT_SIZE)) {
+			next_sender = (next_sender + 1) % sender_count;
+			tried++;
+		}
+		if (tried == sender_count) {
+			skipped_sends++;
+			return;
+		}
+		unsigned n = next_sender;
+		next_sender = (next_sender + 1) % sender_count;
+		if (next_random () % 100 < command_percent) {
+			send_command (n);
+		} else {
+			send_line (n, run_start + scheduled * 1000000000UL / rate);
+		}
+		scheduled++;
+		flush_user (n);
+	}
+}
+
+/* Function that gives up on the lines closed loop users have waited on
+ * for longer than LOAD_LOSS_NS and lets those users fill their windows
+ * again. */
+void check_losses (unsigned long now) {
+	for (unsigned n = 0; n < sender_count; n++) {
+		if (users[n].outstanding == 0 || now - users[n].waiting_since < LOAD_LOSS_NS || users[n].fd == -1
+				|| !users[n].connected) {
+			continue;
+		}
+		lost_lines += users[n].outstanding;
+		users[n].outstanding = 0;
+		for (unsigned w = 0; w < window; w++) {
+			send_next (n, now);
+		}
+		flush_user (n);
+	}
+}
+
+/* Function that reconnects the users due by now on the churn schedule,
+ * taking turns among those after the user that receives the lines of the
+ * last sender, so that no closed loop sender waits on a user that is
+ * away. Connects that fail are tried again as they were at the start. */
+void churn_users (unsigned long now) {
+	unsigned first = sender_count + 1 < user_count ? sender_count + 1 : 0;
+	unsigned long due = (now - run_start) * churn_rate / 1000000000UL;
+	while (churned < due) {
+		if (next_churned < first || next_churned >= user_count) {
+			next_churned = first;
+		}
+		reconnect_user (next_churned);
+		next_churned++;
+		churned++;
+	}
+	while (retry_total > 0 && connecting < LOAD_CONNECT_BATCH) {
+		start_connect (retries[--retry_total]);
+	}
+}
+
+/* Function that closes user n, forgetting whatever it had in flight, and
+ * starts connecting it again. A user that is still connecting is left
+ * alone. */
+void reconnect_user (unsigned n) {
+	struct load_user *user = &users[n];
+	if (user->fd == -1 || !user->connected) {
+		return;
+	}
+	epoll_ctl (epoll_fd, EPOLL_CTL_DEL, user->fd, NULL);
+	close (user->fd);
+	if (user->muted != -1) {
+		users[user->muted].muted_by--;
+	}
+	user->fd = -1;
+	user->connected = false;
+	user->watching_output = false;
+	user->received = 0;
+	user->pending = 0;
+	user->outstanding = 0;
+	user->muted = -1;
+	connected_total--;
+	live_users--;
+	start_connect (n);
+}
+
+/* Function that collects the lines still in flight once the run is over,
+ * until nothing has arrived for LOAD_QUIET_MS. */
+void wait_quiet () {
+	while (wait_events (LOAD_QUIET_MS) > 0);
+}
+
+/* Function that waits up to timeout ms for events and handles them.
+ * Returns the number of events. */
+unsigned wait_events (int timeout) {
+	struct epoll_event events[LOAD_EVENTS];
+	int ready = epoll_wait (epoll_fd, events, LOAD_EVENTS, timeout);
+	for (int i = 0; i < ready; i++) {
+		handle_user_event (events[i].data.u32, events[i].events);
+	}
+	return ready < 0 ? 0 : ready;
+}
+
+/* Function that handles the events reported for user n: the end of its
+ * connect, room for its queued bytes or bytes to read. */
+void handle_user_event (unsigned n, uint32_t events) {
+	if (!users[n].connected) {
+		finish_connect (n);
+		return;
+	}
+	if (users[n].fd != -1 && (events & EPOLLOUT)) {
+		flush_user (n);
+	}
+	if (users[n].fd != -1 && (events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+		read_user (n);
+	}
+}
+
+/* Function that reads what has arrived for user n and handles every whole
+ * message in it. A message too long for the buffer is thrown away. */
+void read_user (unsigned n) {
+	struct load_user *user = &users[n];
+	ssize_t length = read (user->fd, user->input + user->received, MAX_MESSAGE_LENGTH - user->received);
+	if (length == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return;
+	}
+	if (length <= 0) {
+		drop_user (n);
+		return;
+	}
+	unsigned long now = load_clock ();
+	int end = user->received + length;
+	int start = 0;
+	int positions[LINE_BATCH];
+	int found;
+	do {
+		found = find_line_ends (user->input, start, end, positions, LINE_BATCH);
+		for (int i = 0; i < found; i++) {
+			handle_load_message (n, user->input + start, positions[i] + 1 - start, now);
+			start = positions[i] + 1;
+		}
+	} while (found == LINE_BATCH);
+	if (start == 0 && end == MAX_MESSAGE_LENGTH) {
+		start = end;
+	}
+	memmove (user->input, user->input + start, end - start);
+	user->received = end - start;
+}
+
+/* Function that sorts a message received by user n into a line sent by
+ * another user, a join or anything else, which is a reply to a command. */
+void handle_load_message (unsigned n, char *msg, int length, unsigned long now) {
+	char *separator = memchr (msg, ':', length);
+	if (separator != NULL && separator + 1 < msg + length && separator[1] == LOAD_MARKER) {
+		handle_delivery (n, separator + 2, now);
+	} else if (length >= 12 && memcmp (msg + length - 12, " has joined\n", 12) == 0) {
+		joins_seen++;
+	} else {
+		replies++;
+	}
+}
+
+/*
+ * Function: handle_delivery
+ * -------------------------
+ * records the latency of a line delivered to user n. In a closed loop
+ * the user after the sender stands in for everyone it was sent to, so
+ * when that user receives the line the sender has one line fewer in
+ * flight and sends another.
+ *
+ * n: index (in `users`) of the user the line was delivered to
+ * text: the text of the line after LOAD_MARKER, the sender and the time
+ * it was meant to be sent
+ * now: the time it was read
+ *
+ * returns: void
+ */
+void handle_delivery (unsigned n, char *text, unsigned long now) {
+	char *end;
+	unsigned long sender = strtoul (text, &end, 10);
+	unsigned long stamp = strtoul (end, NULL, 10);
+	if (sender >= user_count) {
+		return;
+	}
+	delivered++;
+	record_value (&latency, now > stamp ? now - stamp : 0);
+	struct load_user *user = &users[sender];
+	if (rate == 0 && n == (sender + 1) % user_count && user->outstanding > 0) {
+		user->outstanding--;
+		user->waiting_since = now;
+		if (sending && user->fd != -1) {
+			send_next (sender, now);
+			flush_user (sender);
+		}
+	}
+}
+
+/* Function that sends user n's next line in a closed loop, preceded by
+ * commands as often as command_percent asks for. */
+void send_next (unsigned n, unsigned long now) {
+	while (next_random () % 100 < command_percent) {
+		send_command (n);
+	}
+	send_line (n, now);
+	if (users[n].outstanding == 0) {
+		users[n].waiting_since = now;
+	}
+	users[n].outstanding++;
+}
+
+/* Function that queues a line from user n carrying its index and stamp,
+ * padded to line_size, and counts the users it should reach. */
+void send_line (unsigned n, unsigned long stamp) {
+	char line[MAX_MESSAGE_LENGTH];
+	int length = snprintf (line, sizeof (line), "%c%u %lu ", LOAD_MARKER, n, stamp);
+	while ((unsigned) length < line_size) {
+		line[length++] = 'x';
+	}
+	line[length++] = '\n';
+	if (!queue_text (n, line, length)) {
+		skipped_sends++;
+		return;
+	}
+	lines_sent++;
+	expected_deliveries += live_users - 1 - users[n].muted_by;
+}
+
+/* Function that queues a random command from user n. A user mutes a random
+ * other user and unmutes it with its next \mute, never muting the user
+ * before it, which it stands in for in a closed loop. */
+void send_command (unsigned n) {
+	char command[MAX_MESSAGE_LENGTH];
+	int length;
+	unsigned choice = next_random () % 3;
+	struct load_user *user = &users[n];
+	if (choice == 2 && user->muted != -1) {
+		length = snprintf (command, sizeof (command), "\\unmute %s%d\n", name_prefix, user->muted);
+		users[user->muted].muted_by--;
+		user->muted = -1;
+	} else if (choice == 2 && user_count > 2) {
+		unsigned target = (n + 1 + next_random () % (user_count - 2)) % user_count;
+		length = snprintf (command, sizeof (command), "\\mute %s%u\n", name_prefix, target);
+		users[target].muted_by++;
+		user->muted = target;
+	} else if (choice == 1) {
+		length = snprintf (command, sizeof (command), "\\show_all_statuses %lu\n",
+			1 + next_random () % ((user_count + 99) / 100));
+	} else {
+		length = snprintf (command, sizeof (command), "\\show_status %s%lu\n", name_prefix,
+			next_random () % user_count);
+	}
+	if (queue_text (n, command, length)) {
+		commands_sent++;
+	} else {
+		skipped_sends++;
+	}
+}
+
+/* Function that appends length bytes to the output of user n. Returns
+ * false if they do not fit. */
+bool queue_text (unsigned n, char *text, int length) {
+	struct load_user *user = &users[n];
+	if (user->pending + length > LOAD_OUTPUT_SIZE) {
+		return false;
+	}
+	memcpy (user->output + user->pending, text, length);
+	user->pending += length;
+	return true;
+}
+
+/* Function that writes as much of the output of user n as its socket
+ * takes and watches the socket for writability while some is left. */
+void flush_user (unsigned n) {
+	struct load_user *user = &users[n];
+	if (user->pending > 0) {
+		ssize_t written = write (user->fd, user->output, user->pending);
+		if (written == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			drop_user (n);
+			return;
+		}
+		if (written > 0) {
+			memmove (user->output, user->output + written, user->pending - written);
+			user->pending -= written;
+		}
+	}
+	if ((user->pending > 0) != user->watching_output) {
+		user->watching_output = user->pending > 0;
+		watch_user (n, EPOLL_CTL_MOD, user->watching_output ? EPOLLIN | EPOLLOUT : EPOLLIN);
+	}
+}
+
+/* Function that adds or modifies the registration of user n. */
+void watch_user (unsigned n, int operation, uint32_t events) {
+	struct epoll_event event;
+	memset (&event, 0, sizeof (event));
+	event.events = events;
+	event.data.u32 = n;
+	if (epoll_ctl (epoll_fd, operation, users[n].fd, &event) == -1) {
+		load_error ("Unable to register socket");
+	}
+}
+
+/* Function that closes user n after the server closed it or a write
+ * failed. The user sends nothing more. */
+void drop_user (unsigned n) {
+	struct load_user *user = &users[n];
+	epoll_ctl (epoll_fd, EPOLL_CTL_DEL, user->fd, NULL);
+	close (user->fd);
+	user->fd = -1;
+	user->pending = 0;
+	live_users--;
+	disconnects++;
+}
+
+/*
+ * Function: report_load
+ * ---------------------
+ * outputs the messages sent and delivered, their rates over the duration
+ * of the run and the percentiles of the end-to-end latency in us. The
+ * deliveries include those collected after the run, so they may be a
+ * little ahead of the lines sent. Lines a sender gave up on, sends skipped
+ * because a buffer was full and users the server disconnected are shown
+ * since they mean the server did not keep up.
+ *
+ * returns: void
+ */
+void report_load () {
+	double seconds = (run_end - run_start) / 1e9;
+	double mean = latency.total == 0 ? 0 : (double) latency.sum / latency.total / 1e3;
+	if (json_output) {
+		printf ("{\"users\":%u,\"senders\":%u,\"rate\":%lu,\"churn\":%lu,\"window\":%u,\"command_percent\":%u,\"line_size\":%u,"
+			"\"seconds\":%.3f,\"lines\":%lu,\"commands\":%lu,\"delivered\":%lu,\"expected\":%lu,"
+			"\"lines_per_s\":%.1f,\"messages_per_s\":%.1f,\"deliveries_per_s\":%.1f,\"replies\":%lu,"
+			"\"lost\":%lu,\"skipped\":%lu,\"disconnects\":%lu,\"reconnects\":%lu,\"latency_us\":{\"mean\":%.1f,\"p50\":%.1f,"
+			"\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}\n",
+			user_count, sender_count, rate, churn_rate, window, command_percent, line_size, seconds, lines_sent, commands_sent, delivered,
+			expected_deliveries, lines_sent / seconds, (lines_sent + commands_sent) / seconds, delivered / seconds,
+			replies, lost_lines, skipped_sends, disconnects, churned, mean, histogram_percentile (&latency, 0.5) / 1e3,
+			histogram_percentile (&latency, 0.9) / 1e3, histogram_percentile (&latency, 0.99) / 1e3,
+			histogram_percentile (&latency, 0.999) / 1e3, latency.max / 1e3);
+		return;
+	}
+	if (rate > 0) {
+		printf ("%u users, %u sending, open loop at %lu messages/s, %.2f s\n", user_count, sender_count, rate, seconds);
+	} else {
+		printf ("%u users, %u sending, closed loop with %u lines in flight each, %.2f s\n", user_count, sender_count,
+			window, seconds);
+	}
+	if (churn_rate > 0) {
+		printf ("Reconnected %lu users (%.0f/s)\n", churned, churned / seconds);
+	}
+	printf ("Sent %lu lines (%.0f/s) and %lu commands, %lu replies\n", lines_sent, lines_sent / seconds,
+		commands_sent, replies);
+	printf ("Delivered %lu of %lu expected (%.0f/s)\n", delivered, expected_deliveries, delivered / seconds);
+	printf ("Latency us mean %.1f p50 %.1f p90 %.1f p99 %.1f p999 %.1f max %.1f\n", mean,
+		histogram_percentile (&latency, 0.5) / 1e3, histogram_percentile (&latency, 0.9) / 1e3,
+		histogram_percentile (&latency, 0.99) / 1e3, histogram_percentile (&latency, 0.999) / 1e3,
+		latency.max / 1e3);
+	if (lost_lines > 0 || skipped_sends > 0 || disconnects > 0) {
+		printf ("Lost %lu lines, skipped %lu sends, %lu users disconnected\n", lost_lines, skipped_sends, disconnects);
+	}
+}
+
+/* Function that returns the time of the monotonic clock in ns. */
+unsigned long load_clock () {
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/* Function that returns the next value of a xorshift generator, which is
+ * seeded the same way every run so that runs send the same messages. */
+unsigned long next_random () {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return random_state;
+}
+
+/* Function that raises the limit on open descriptors to fit every user. */
+void raise_user_limit () {
+	struct rlimit limit;
+	if (getrlimit (RLIMIT_NOFILE, &limit) == -1) {
+		return;
+	}
+	rlim_t needed = (rlim_t) user_count + 64;
+	if (limit.rlim_cur < needed) {
+		limit.rlim_cur = needed < limit.rlim_max ? needed : limit.rlim_max;
+		setrlimit (RLIMIT_NOFILE, &limit);
+	}
+}
+
+/* Function that terminates the load generator when a step fails. */
+void load_error (char *reason) {
+	fprintf (stderr, "%s\n", reason);
+	exit (1);
+}
+
+/* Function to handle the load generator being started with the wrong
+ * arguments. */
+void usage_error () {
+	fprintf (stderr, "Usage: ./loadgen [-u users] [-a senders] [-r rate] [-x reconnects] [-w window] [-d seconds] [-k command_percent] [-s line_size] [-n name_prefix] [-j] ip_address port\n");
+	exit (1);
+}
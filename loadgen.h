@@ -0,0 +1,82 @@
+/* A headless client that puts load on the server. Where ./client drives one
+ * user from stdin, ./loadgen connects thousands of users from one process,
+ * watches all of them with a single epoll instance and has them send chat
+ * lines and commands, either at a fixed total rate (open loop) or each as
+ * soon as its previous lines have been delivered (closed loop). Every line
+ * carries the index of its sender and the time it was meant to be sent,
+ * so every copy the server broadcasts to the other users yields one
+ * end-to-end latency. When the run is over the throughput and the latency
+ * percentiles are printed, as text or as one line of JSON.
+ * Author: Yuriy Bash */
+
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <stdbool.h>
+#include "client_server_utils.h"
+
+#define DEFAULT_USERS 100
+
+#define DEFAULT_SECONDS 10
+
+#define DEFAULT_LINE_SIZE 32
+
+/* The bytes waiting to be sent that a user may have. A user whose buffer
+ * is full skips its turn. */
+#define LOAD_OUTPUT_SIZE 2048
+
+/* The most connections being established at once, which keeps a burst of
+ * thousands of connects from overflowing the server's accept queue. */
+#define LOAD_CONNECT_BATCH 256
+
+/* The time the users have to connect, in seconds. */
+#define LOAD_CONNECT_TIMEOUT 60
+
+/* The time after which a line a closed loop user is waiting on counts as
+ * lost and the user moves on, in ns. */
+#define LOAD_LOSS_NS 1000000000UL
+
+/* The time without traffic after which the joins, or what is left in
+ * flight at the end of the run, are considered delivered, in ms. */
+#define LOAD_QUIET_MS 300
+
+/* The most events handled per wakeup. */
+#define LOAD_EVENTS 256
+
+/* The first byte of the text of every line the load generator sends, by
+ * which the copies broadcast to the other users are told apart from the
+ * other messages they receive. */
+#define LOAD_MARKER '#'
+
+/* One simulated user. fd is -1 once the server has closed it. Received
+ * bytes wait in input until a whole message has arrived and the bytes
+ * the socket did not take wait in output. outstanding is the number of
+ * its lines a closed loop user is waiting on, of which the first was sent
+ * at waiting_since. muted is the user it has muted, -1 if none. */
+struct load_user {
+	fd_t fd;
+	bool connected;
+	bool watching_output;
+	unsigned received;
+	char input[MAX_MESSAGE_LENGTH + 1];
+	unsigned pending;
+	char output[LOAD_OUTPUT_SIZE];
+	unsigned outstanding;
+	unsigned long waiting_since;
+	int muted;
+	unsigned muted_by;
+};
+
+/* Function that connects every user, LOAD_CONNECT_BATCH at a time, sends
+ * their names and waits until the joins have been delivered. */
+void connect_users ();
+
+/* Function that runs the load for the configured duration and then waits
+ * for the lines still in flight. */
+void run_load ();
+
+/* Function that outputs the throughput and latency of the run to stdout,
+ * as text or as one line of JSON. */
+void report_load ();
+
+#endif
@@ -0,0 +1,272 @@
+/* File that contains the counters and histograms the server keeps about
+ * its own work. Every shard counts into its own shard_metrics, which the
+ * shard table points to, and a reader adds up those of every shard while
+ * they may still be changing, which can only make what it reads slightly
+ * stale. Messages written and sends are taken from the output statistics
+ * rather than counted twice.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "metrics.h"
+#include "shards.h"
+#include "server.h"
+#include "output.h"
+#include "client_server_utils.h"
+
+void *run_metrics_dump (void *argument);
+
+int format_metrics_dump (char *buffer, size_t size);
+
+int format_histogram (char *buffer, size_t size, int length, char *name, struct histogram *histogram);
+
+int format_latency (char *buffer, size_t size, int length, char *name, struct histogram *histogram);
+
+int append_metrics (char *buffer, size_t size, int length, char *format, ...);
+
+void metrics_error (char *reason);
+
+/* The most bytes of a dump or of the reply to \stats. */
+#define METRICS_BUFFER_SIZE 4096
+
+/* The counters of the shard run by the calling thread. */
+__thread struct metrics shard_metrics;
+
+/* The time the bytes being handled by the calling shard were read. */
+__thread unsigned long received_at;
+
+/* The start of the work of the current iteration of the event loop. */
+__thread unsigned long iteration_start;
+
+/* The number of seconds between dumps of the metrics, 0 if they are not
+ * dumped. */
+unsigned metrics_interval = 0;
+
+/* The time the dump thread started, from which the uptime is counted. */
+unsigned long metrics_start;
+
+/* Function that returns the time of the monotonic clock in ns. */
+unsigned long metrics_clock () {
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/* Function that marks the start of the work of one iteration of the event
+ * loop. */
+void begin_iteration () {
+	iteration_start = metrics_clock ();
+}
+
+/* Function that records the length of the current iteration of the event
+ * loop. */
+void end_iteration () {
+	record_value (&shard_metrics.loop_time, metrics_clock () - iteration_start);
+}
+
+/*
+ * Function: collect_metrics
+ * -------------------------
+ * adds the counters and histograms of every shard that has started into
+ * total.
+ *
+ * total: where the metrics are added, which must start zeroed
+ *
+ * returns: void
+ */
+void collect_metrics (struct metrics *total) {
+	for (unsigned i = 0; shards != NULL && i < shard_count; i++) {
+		struct metrics *metrics = shards[i].metrics;
+		if (metrics == NULL) {
+			continue;
+		}
+		total->messages_in += metrics->messages_in;
+		total->bytes_in += metrics->bytes_in;
+		total->bytes_out += metrics->bytes_out;
+		total->read_calls += metrics->read_calls;
+		total->poll_calls += metrics->poll_calls;
+		total->broadcasts += metrics->broadcasts;
+		for (unsigned c = 0; c < COMMAND_COUNT; c++) {
+			total->commands[c] += metrics->commands[c];
+		}
+		total->unknown_commands += metrics->unknown_commands;
+		total->invalid_commands += metrics->invalid_commands;
+		merge_histogram (&total->fan_out, &metrics->fan_out);
+		merge_histogram (&total->delivery_latency, &metrics->delivery_latency);
+		merge_histogram (&total->loop_time, &metrics->loop_time);
+	}
+}
+
+/*
+ * Function: output_metrics
+ * ------------------------
+ * replies to the user at index n with the metrics of every shard combined,
+ * one line each for the traffic, the system calls, the fan-out, the two
+ * latencies and the commands. Latencies are shown in microseconds.
+ *
+ * n: index (in `users`) of the user who asked
+ *
+ * returns: void
+ */
+void output_metrics (unsigned n) {
+	struct metrics *total = calloc (1, sizeof (struct metrics));
+	if (total == NULL) {
+		allocation_failed ();
+	}
+	collect_metrics (total);
+	struct output_statistics output;
+	collect_output_statistics (&output);
+	char buffer[METRICS_BUFFER_SIZE];
+	int length = append_metrics (buffer, sizeof (buffer), 0,
+		"%cMessages in %lu (%lu bytes), out %lu (%lu bytes), %lu broadcasts\n"
+		"%cSystem calls: %lu reads, %lu sends, %lu polls\n"
+		"%cFan-out p50 %lu p99 %lu max %lu\n",
+		Standard_Message, total->messages_in, total->bytes_in, output.written_messages, total->bytes_out, total->broadcasts,
+		Standard_Message, total->read_calls, output.write_calls, total->poll_calls,
+		Standard_Message, histogram_percentile (&total->fan_out, 0.5), histogram_percentile (&total->fan_out, 0.99),
+		total->fan_out.max);
+	length = format_latency (buffer, sizeof (buffer), length, "Delivery latency", &total->delivery_latency);
+	length = format_latency (buffer, sizeof (buffer), length, "Loop iteration", &total->loop_time);
+	length = append_metrics (buffer, sizeof (buffer), length, "%cCommands:", Standard_Message);
+	for (unsigned c = 0; c < COMMAND_COUNT; c++) {
+		length = append_metrics (buffer, sizeof (buffer), length, " %s %lu", commands[c], total->commands[c]);
+	}
+	length = append_metrics (buffer, sizeof (buffer), length, ", unknown %lu, invalid %lu\n",
+		total->unknown_commands, total->invalid_commands);
+	free (total);
+	struct outbound *message = create_outbound (buffer, length);
+	reply_message (message, n);
+	release_outbound (message);
+}
+
+/* Function that appends one line of the reply to \stats for a histogram of
+ * times, in microseconds, to the length bytes already in buffer. Returns
+ * the new length. */
+int format_latency (char *buffer, size_t size, int length, char *name, struct histogram *histogram) {
+	return append_metrics (buffer, size, length, "%c%s us p50 %.1f p99 %.1f p999 %.1f max %.1f\n", Standard_Message, name,
+		histogram_percentile (histogram, 0.5) / 1e3, histogram_percentile (histogram, 0.99) / 1e3,
+		histogram_percentile (histogram, 0.999) / 1e3, histogram->max / 1e3);
+}
+
+/*
+ * Function: start_metrics_dump
+ * ----------------------------
+ * starts the thread that writes the metrics to stderr every
+ * metrics_interval seconds, unless no interval was given.
+ *
+ * returns: void
+ */
+void start_metrics_dump () {
+	metrics_start = metrics_clock ();
+	if (metrics_interval == 0) {
+		return;
+	}
+	pthread_t thread;
+	if (pthread_create (&thread, NULL, run_metrics_dump, NULL) != 0) {
+		metrics_error ("Unable to start metrics dump");
+	}
+	pthread_detach (thread);
+}
+
+/* Function that runs the dump thread, which writes one line of JSON with
+ * the metrics of the whole server to stderr every metrics_interval
+ * seconds. */
+void *run_metrics_dump (void *argument) {
+	char buffer[METRICS_BUFFER_SIZE];
+	while (true) {
+		sleep (metrics_interval);
+		int length = format_metrics_dump (buffer, sizeof (buffer));
+		if (write (STDERR_FILENO, buffer, length) == -1) {
+			return NULL;
+		}
+	}
+}
+
+/*
+ * Function: format_metrics_dump
+ * -----------------------------
+ * formats the metrics of the whole server as one line of JSON. Times are
+ * in ns and every histogram has its count, mean, percentiles and maximum.
+ *
+ * buffer: where the line is written
+ * size: the size of buffer
+ *
+ * returns: the length of the line, cut short to fit in buffer
+ */
+int format_metrics_dump (char *buffer, size_t size) {
+	struct metrics *total = calloc (1, sizeof (struct metrics));
+	if (total == NULL) {
+		allocation_failed ();
+	}
+	collect_metrics (total);
+	struct output_statistics output;
+	collect_output_statistics (&output);
+	int length = append_metrics (buffer, size, 0,
+		"{\"uptime_ns\":%lu,\"messages_in\":%lu,\"bytes_in\":%lu,\"messages_out\":%lu,\"bytes_out\":%lu,"
+		"\"broadcasts\":%lu,\"read_calls\":%lu,\"send_calls\":%lu,\"poll_calls\":%lu",
+		metrics_clock () - metrics_start, total->messages_in, total->bytes_in, output.written_messages, total->bytes_out,
+		total->broadcasts, total->read_calls, output.write_calls, total->poll_calls);
+	length = format_histogram (buffer, size, length, "fan_out", &total->fan_out);
+	length = format_histogram (buffer, size, length, "delivery_latency_ns", &total->delivery_latency);
+	length = format_histogram (buffer, size, length, "loop_time_ns", &total->loop_time);
+	length = append_metrics (buffer, size, length, ",\"commands\":{");
+	for (unsigned c = 0; c < COMMAND_COUNT; c++) {
+		length = append_metrics (buffer, size, length, "\"%s\":%lu,", commands[c], total->commands[c]);
+	}
+	length = append_metrics (buffer, size, length, "\"unknown\":%lu,\"invalid\":%lu}}\n",
+		total->unknown_commands, total->invalid_commands);
+	free (total);
+	return length;
+}
+
+/* Function that appends a histogram as a member of the JSON dump to the
+ * length bytes already in buffer. Returns the new length. */
+int format_histogram (char *buffer, size_t size, int length, char *name, struct histogram *histogram) {
+	double mean = histogram->total == 0 ? 0 : (double) histogram->sum / histogram->total;
+	return append_metrics (buffer, size, length, ",\"%s\":{\"count\":%lu,\"mean\":%.1f,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,"
+		"\"p999\":%lu,\"max\":%lu}", name, histogram->total, mean, histogram_percentile (histogram, 0.5),
+		histogram_percentile (histogram, 0.9), histogram_percentile (histogram, 0.99),
+		histogram_percentile (histogram, 0.999), histogram->max);
+}
+
+/*
+ * Function: append_metrics
+ * ------------------------
+ * formats the arguments as printf does after the length bytes already in
+ * buffer. Text that does not fit is cut short, and once buffer is full
+ * nothing more is written, so a chain of calls never writes past its end.
+ *
+ * buffer: where the text is written
+ * size: the size of buffer
+ * length: the number of bytes of buffer already used, below size
+ * format: the format of the text
+ *
+ * returns: the new length, at most size - 1
+ */
+int append_metrics (char *buffer, size_t size, int length, char *format, ...) {
+	va_list arguments;
+	va_start (arguments, format);
+	int written = vsnprintf (buffer + length, size - length, format, arguments);
+	va_end (arguments);
+	if (written < 0) {
+		return length;
+	}
+	if ((size_t) written >= size - length) {
+		return size - 1;
+	}
+	return length + written;
+}
+
+/* Function that terminates the server when the dump cannot be started. */
+void metrics_error (char *reason) {
+	fprintf (stderr, "%s\n", reason);
+	exit (1);
+}
@@ -0,0 +1,68 @@
+/* File that contains the counters and histograms the server keeps about
+ * its own work: the messages and bytes it reads and writes, the system
+ * calls it makes for them, how many clients each broadcast reaches, how
+ * often every command is used, how long a chat line takes from being read
+ * to being written to its last recipient and how long every iteration of
+ * the event loop takes. Every shard keeps its own in thread local storage,
+ * so counting never touches memory another thread writes, and they are
+ * combined when read, either by the \stats command or by the dump written
+ * to stderr every interval given with -s.
+ * Author: Yuriy Bash */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "histogram.h"
+#include "command_parse.h"
+
+/* The counters and histograms of one shard. Latencies and times are in
+ * ns. messages_out and the sends are kept by the output statistics. */
+struct metrics {
+	unsigned long messages_in;
+	unsigned long bytes_in;
+	unsigned long bytes_out;
+	unsigned long read_calls;
+	unsigned long poll_calls;
+	unsigned long broadcasts;
+	unsigned long commands[COMMAND_COUNT];
+	unsigned long unknown_commands;
+	unsigned long invalid_commands;
+	struct histogram fan_out;
+	struct histogram delivery_latency;
+	struct histogram loop_time;
+};
+
+/* The counters of the shard run by the calling thread. */
+extern __thread struct metrics shard_metrics;
+
+/* The time the bytes being handled by the calling shard were read. */
+extern __thread unsigned long received_at;
+
+/* The number of seconds between dumps of the metrics, 0 if they are not
+ * dumped. */
+extern unsigned metrics_interval;
+
+/* Function that returns the time of the monotonic clock in ns. */
+unsigned long metrics_clock ();
+
+/* Function that marks the start of the work of one iteration of the event
+ * loop, once the wait for events has returned. */
+void begin_iteration ();
+
+/* Function that records the time since begin_iteration as the length of
+ * one iteration of the event loop. */
+void end_iteration ();
+
+/* Function that adds the counters and histograms of every shard into
+ * total, which must start zeroed. */
+void collect_metrics (struct metrics *total);
+
+/* Function that starts the thread that dumps the metrics to stderr every
+ * metrics_interval seconds, if there is an interval. */
+void start_metrics_dump ();
+
+/* Function that replies to the user at index n with the metrics of the
+ * whole server. */
+void output_metrics (unsigned n);
+
+#endif
@@ -0,0 +1,712 @@
+/* File that contains how the server sends to its clients. A message that
+ * goes to several clients is copied once into an outbound message, which
+ * is reference counted and never modified, and every recipient holds a
+ * reference for as long as it still has bytes of the message to send. A
+ * message is queued on the connection and the connection scheduled for a
+ * flush, which happens once the current wakeup of the event loop has been
+ * handled, so everything a client is sent during one wakeup leaves in a
+ * single writev-style system call. Whatever the socket does not take is
+ * sent once the event loop reports the socket writable, so a client that
+ * reads slowly never makes the server wait. Each queue is bounded in bytes
+ * and a connection that reaches the bound loses its oldest or newest
+ * messages or is disconnected, depending on the slow consumer policy.
+ * Large writes may be made with MSG_ZEROCOPY, in which case the messages
+ * are held until the kernel reports through the socket's error queue that
+ * it no longer needs them, even after the connection has closed.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include "output.h"
+#include "connections.h"
+#include "event_loop.h"
+#include "uring_loop.h"
+#include "client_server_utils.h"
+#include "shards.h"
+#include "server.h"
+#include "metrics.h"
+
+bool queue_output (unsigned n, struct outbound *message);
+
+bool enable_zerocopy (unsigned n);
+
+void hold_zerocopy (struct output_queue *queue, size_t written);
+
+bool read_zerocopy (fd_t fd, struct zerocopy_write **head, struct zerocopy_write **tail);
+
+void release_zerocopy (struct zerocopy_write **head, struct zerocopy_write **tail, unsigned first, unsigned last);
+
+void orphan_zerocopy (unsigned n);
+
+void reap_zerocopy_orphans ();
+
+void free_zerocopy_write (struct zerocopy_write *write);
+
+void drop_oldest_output (struct output_queue *queue, unsigned length);
+
+/* The most bytes queued for one connection. */
+unsigned output_limit = DEFAULT_OUTPUT_LIMIT;
+
+/* The slow consumer policy. */
+enum OUTPUT_POLICY output_policy = Disconnect_Slow;
+
+/* Whether a flush that cannot write a whole queue in one call tells the
+ * kernel more is coming with MSG_MORE. */
+bool output_more = false;
+
+/* The number of bytes from which a write is made with MSG_ZEROCOPY, 0 if
+ * none is. */
+unsigned zerocopy_threshold = 0;
+
+/* The output counters of the shard run by the calling thread. */
+__thread struct output_statistics output_stats;
+
+/* The spare outbound messages of the calling shard, each with room for
+ * OUTBOUND_BLOCK_SIZE bytes. Messages released by a shard go to its own
+ * pool, whichever shard allocated them. */
+__thread struct outbound *spare_outbounds;
+__thread unsigned spare_outbound_count;
+
+/* The sockets of the calling shard kept open after their connection
+ * closed until their zerocopy writes are complete. */
+__thread struct zerocopy_orphan *zerocopy_orphans;
+
+/* The connections of the calling shard scheduled for a flush at the end of
+ * the current wakeup, in the order they were first sent to. */
+__thread unsigned *flush_list;
+__thread unsigned flush_count;
+__thread unsigned flush_capacity;
+
+/*
+ * Function: select_output_policy
+ * ------------------------------
+ * sets output_policy from the name given on the command line.
+ *
+ * name: either "oldest", "newest" or "disconnect"
+ *
+ * returns: false if the name is not a known policy
+ */
+bool select_output_policy (char *name) {
+	if (strcmp (name, "oldest") == 0) {
+		output_policy = Drop_Oldest;
+	} else if (strcmp (name, "newest") == 0) {
+		output_policy = Drop_Newest;
+	} else if (strcmp (name, "disconnect") == 0) {
+		output_policy = Disconnect_Slow;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Function: collect_output_statistics
+ * -----------------------------------
+ * adds up the output counters of all shards, taking the deepest queue of
+ * any of them. The counters of other shards are read while they may be
+ * changing, which can only make the total slightly stale.
+ *
+ * total: where the counters are written
+ *
+ * returns: void
+ */
+void collect_output_statistics (struct output_statistics *total) {
+	memset (total, 0, sizeof (struct output_statistics));
+	for (unsigned i = 0; shards != NULL && i < shard_count; i++) {
+		struct output_statistics *stats = shards[i].output_stats;
+		if (stats == NULL) {
+			continue;
+		}
+		total->queued_messages += stats->queued_messages;
+		total->dropped_messages += stats->dropped_messages;
+		total->dropped_bytes += stats->dropped_bytes;
+		total->slow_disconnects += stats->slow_disconnects;
+		total->write_calls += stats->write_calls;
+		total->written_messages += stats->written_messages;
+		total->zerocopy_writes += stats->zerocopy_writes;
+		total->zerocopy_copied += stats->zerocopy_copied;
+		total->zerocopy_orphans += stats->zerocopy_orphans;
+		total->zerocopy_resets += stats->zerocopy_resets;
+		if (stats->peak_bytes > total->peak_bytes) {
+			total->peak_bytes = stats->peak_bytes;
+		}
+		total->queued_bytes += stats->queued_bytes;
+		total->pooled_outbounds += stats->pooled_outbounds;
+		total->allocated_outbounds += stats->allocated_outbounds;
+		total->spare_outbounds += stats->spare_outbounds;
+	}
+}
+
+/* Function that outputs the output counters of all shards combined to
+ * stderr. */
+void report_output_statistics () {
+	struct output_statistics total;
+	collect_output_statistics (&total);
+	fprintf (stderr, "Queued %lu messages for slow sockets, deepest queue %u of %u bytes\n",
+		total.queued_messages, total.peak_bytes, output_limit);
+	fprintf (stderr, "Dropped %lu messages (%lu bytes), disconnected %lu slow consumers\n",
+		total.dropped_messages, total.dropped_bytes, total.slow_disconnects);
+	double average = total.write_calls == 0 ? 0 : (double) total.written_messages / total.write_calls;
+	fprintf (stderr, "Sent %lu messages in %lu writes (%.2f per write)\n",
+		total.written_messages, total.write_calls, average);
+	if (zerocopy_threshold > 0) {
+		fprintf (stderr, "Made %lu writes of at least %u bytes with MSG_ZEROCOPY, %lu of them copied by the kernel\n",
+			total.zerocopy_writes, zerocopy_threshold, total.zerocopy_copied);
+		fprintf (stderr, "Kept %lu closed sockets open for their zerocopy writes, %lu of them reset\n",
+			total.zerocopy_orphans, total.zerocopy_resets);
+	}
+}
+
+/*
+ * Function: allocate_outbound
+ * ---------------------------
+ * returns an outbound message with room for length bytes, taken from the
+ * calling shard's pool if it fits a block. A message that fits is always
+ * given a whole block so that it can join a pool once released. The caller
+ * holds the only reference and fills in the data.
+ *
+ * length: the number of bytes the message will hold
+ *
+ * returns: the outbound message
+ */
+struct outbound *allocate_outbound (int length) {
+	struct outbound *outbound = spare_outbounds;
+	if (length <= OUTBOUND_BLOCK_SIZE && outbound != NULL) {
+		spare_outbounds = outbound->next;
+		spare_outbound_count--;
+		output_stats.spare_outbounds = spare_outbound_count;
+		output_stats.pooled_outbounds++;
+	} else {
+		outbound = malloc (sizeof (struct outbound) + (length <= OUTBOUND_BLOCK_SIZE ? OUTBOUND_BLOCK_SIZE : length));
+		if (outbound == NULL) {
+			allocation_failed ();
+		}
+		output_stats.allocated_outbounds++;
+	}
+	outbound->next = NULL;
+	outbound->references = 1;
+	outbound->length = length;
+	outbound->received_at = 0;
+	return outbound;
+}
+
+/* Function that copies the first length bytes of message into a new
+ * outbound message, of which the caller holds the only reference. */
+struct outbound *create_outbound (char *message, int length) {
+	struct outbound *outbound = allocate_outbound (length);
+	memcpy (outbound->data, message, length);
+	return outbound;
+}
+
+/* Function that adds a reference to message. References may be held by
+ * several shards at once. */
+void hold_outbound (struct outbound *message) {
+	__atomic_add_fetch (&message->references, 1, __ATOMIC_RELAXED);
+}
+
+/* Function that drops a reference to message. With the last the message
+ * joins the calling shard's pool if it has a whole block and the pool has
+ * room, and is freed otherwise. */
+void release_outbound (struct outbound *message) {
+	if (__atomic_sub_fetch (&message->references, 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+	if (message->received_at != 0) {
+		record_value (&shard_metrics.delivery_latency, metrics_clock () - message->received_at);
+	}
+	if (message->length <= OUTBOUND_BLOCK_SIZE && spare_outbound_count < OUTBOUND_POOL_LIMIT) {
+		message->next = spare_outbounds;
+		spare_outbounds = message;
+		spare_outbound_count++;
+		output_stats.spare_outbounds = spare_outbound_count;
+	} else {
+		free (message);
+	}
+}
+
+/*
+ * Function: send_outbound
+ * -----------------------
+ * queues an outbound message for the connection in index n and schedules
+ * the connection to be flushed at the end of the current wakeup, or
+ * flushes it right away once OUTPUT_BATCH messages are waiting. With the
+ * io_uring backend the message is queued on the ring's send chain instead.
+ *
+ * n: index (in `sockets`) of the recipient
+ * message: the message to send
+ *
+ * returns: false if the connection failed or went over its limit under
+ * the disconnect policy
+ */
+bool send_outbound (unsigned n, struct outbound *message) {
+	if (event_backend == Uring_Backend) {
+		return uring_send (n, message);
+	}
+	if (!queue_output (n, message)) {
+		return false;
+	}
+	/* A full batch gains nothing from waiting for the end of the wakeup,
+	 * and flushing it keeps a long burst from piling up in the queue. */
+	if (!outputs[n].watching && outputs[n].count >= OUTPUT_BATCH) {
+		return flush_output (n);
+	}
+	schedule_flush (n);
+	return true;
+}
+
+/* Function that sends bytes that only go to the connection in index n by
+ * copying them into an outbound message of their own. */
+bool send_bytes (unsigned n, char *message, int length) {
+	struct outbound *outbound = create_outbound (message, length);
+	bool sending = send_outbound (n, outbound);
+	release_outbound (outbound);
+	return sending;
+}
+
+/* Function that adds the connection in index n to the connections flushed
+ * at the end of the current wakeup, unless it is already there. */
+void schedule_flush (unsigned n) {
+	if (outputs[n].scheduled) {
+		return;
+	}
+	if (flush_count == flush_capacity) {
+		flush_capacity = flush_capacity == 0 ? INITIAL_OUTPUT_CAPACITY : flush_capacity * 2;
+		flush_list = realloc (flush_list, sizeof (unsigned) * flush_capacity);
+		if (flush_list == NULL) {
+			allocation_failed ();
+		}
+	}
+	outputs[n].scheduled = true;
+	flush_list[flush_count] = n;
+	flush_count++;
+}
+
+/*
+ * Function: flush_scheduled_output
+ * --------------------------------
+ * flushes every connection scheduled since the last call. Called by the
+ * event loop once the current wakeup has been handled. A connection that
+ * fails is closed, which may schedule more connections for the departure
+ * notice, and those are flushed in the same call. The sockets kept open
+ * for their zerocopy writes are checked first.
+ *
+ * returns: void
+ */
+void flush_scheduled_output () {
+	if (zerocopy_orphans != NULL) {
+		reap_zerocopy_orphans ();
+	}
+	for (unsigned i = 0; i < flush_count; i++) {
+		unsigned n = flush_list[i];
+		if (!outputs[n].scheduled) {
+			continue;
+		}
+		outputs[n].scheduled = false;
+		if (sockets[n] == -1) {
+			continue;
+		}
+		bool flushed = event_backend == Uring_Backend ? uring_flush (n) : flush_output (n);
+		if (!flushed) {
+			close_connection (n);
+		}
+	}
+	flush_count = 0;
+}
+
+/*
+ * Function: flush_output
+ * ----------------------
+ * writes the queued messages of the connection in index n, oldest first,
+ * up to OUTPUT_BATCH of them per sendmsg, until the queue is empty or the
+ * socket stops taking them. A sendmsg of at least zerocopy_threshold bytes
+ * is made with MSG_ZEROCOPY, falling back to copying if the kernel is out
+ * of memory to pin the pages. The event loop watches the socket for
+ * writability for as long as something is left.
+ *
+ * n: index (in `sockets`) of the connection
+ *
+ * returns: false if the connection failed
+ */
+bool flush_output (unsigned n) {
+	struct output_queue *queue = &outputs[n];
+	unsigned mask = queue->capacity - 1;
+	bool blocked = false;
+	while (queue->count > 0 && !blocked) {
+		struct iovec parts[OUTPUT_BATCH];
+		unsigned total = queue->count < OUTPUT_BATCH ? queue->count : OUTPUT_BATCH;
+		size_t length = 0;
+		for (unsigned i = 0; i < total; i++) {
+			struct outbound *message = queue->entries[(queue->head + i) & mask];
+			int skipped = i == 0 ? queue->sent : 0;
+			parts[i].iov_base = message->data + skipped;
+			parts[i].iov_len = message->length - skipped;
+			length += parts[i].iov_len;
+		}
+		struct msghdr header;
+		memset (&header, 0, sizeof (header));
+		header.msg_iov = parts;
+		header.msg_iovlen = total;
+		int flags = MSG_NOSIGNAL;
+		if (output_more && total < queue->count) {
+			flags |= MSG_MORE;
+		}
+		bool zerocopy = zerocopy_threshold > 0 && length >= zerocopy_threshold && enable_zerocopy (n);
+		ssize_t written = sendmsg (sockets[n], &header, zerocopy ? flags | MSG_ZEROCOPY : flags);
+		if (written == -1 && zerocopy && errno == ENOBUFS) {
+			zerocopy = false;
+			written = sendmsg (sockets[n], &header, flags);
+		}
+		if (written == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				return false;
+			}
+			written = 0;
+		}
+		output_stats.write_calls++;
+		shard_metrics.bytes_out += written;
+		if (zerocopy && written > 0) {
+			hold_zerocopy (queue, written);
+		}
+		blocked = (size_t) written < length;
+		queue->bytes -= written;
+		output_stats.queued_bytes -= written;
+		while (written > 0) {
+			struct outbound *message = queue->entries[queue->head];
+			int left = message->length - queue->sent;
+			if (written < left) {
+				queue->sent += written;
+				break;
+			}
+			written -= left;
+			release_outbound (message);
+			queue->head = (queue->head + 1) & mask;
+			queue->count--;
+			queue->sent = 0;
+			output_stats.written_messages++;
+		}
+	}
+	if (queue->watching != (queue->count > 0)) {
+		queue->watching = queue->count > 0;
+		event_loop_watch_output (n);
+	}
+	return true;
+}
+
+/* Function that determines if the connection in index n has messages
+ * waiting for its socket to become writable. */
+bool has_output (unsigned n) {
+	return outputs[n].watching;
+}
+
+/* Function that determines if the connection in index n has zerocopy
+ * writes the kernel has not reported complete yet. */
+bool has_zerocopy (unsigned n) {
+	return outputs[n].zerocopy_head != NULL;
+}
+
+/*
+ * Function: reap_zerocopy
+ * -----------------------
+ * reads every notification waiting in the error queue of the socket in
+ * index n. Each one reports a range of zerocopy writes complete, whose
+ * messages are then released, and whether the kernel had to copy them
+ * after all, which it always does over loopback.
+ *
+ * n: index (in `sockets`) of the connection
+ *
+ * returns: false if the error queue held a real error
+ */
+bool reap_zerocopy (unsigned n) {
+	return read_zerocopy (sockets[n], &outputs[n].zerocopy_head, &outputs[n].zerocopy_tail);
+}
+
+/* Function that reads the notifications in the error queue of socket fd
+ * and releases the zerocopy writes they report complete from the list
+ * from head to tail. Returns false if the error queue held a real error. */
+bool read_zerocopy (fd_t fd, struct zerocopy_write **head, struct zerocopy_write **tail) {
+	char control[CMSG_SPACE (sizeof (struct sock_extended_err))];
+	while (*head != NULL) {
+		struct msghdr header;
+		memset (&header, 0, sizeof (header));
+		header.msg_control = control;
+		header.msg_controllen = sizeof (control);
+		if (recvmsg (fd, &header, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		struct cmsghdr *message = CMSG_FIRSTHDR (&header);
+		if (message == NULL || message->cmsg_level != SOL_IP || message->cmsg_type != IP_RECVERR) {
+			return false;
+		}
+		struct sock_extended_err *error = (struct sock_extended_err *) CMSG_DATA (message);
+		if (error->ee_origin != SO_EE_ORIGIN_ZEROCOPY || error->ee_errno != 0) {
+			return false;
+		}
+		if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+			output_stats.zerocopy_copied += error->ee_data - error->ee_info + 1;
+		}
+		release_zerocopy (head, tail, error->ee_info, error->ee_data);
+	}
+	return true;
+}
+
+/* Function that drops every message queued for the connection in index n
+ * and frees its queue, resetting its counters for the next connection.
+ * Pinning only keeps the pages of a zerocopy write from going away, not
+ * from changing, and a socket that is closed gracefully goes on sending
+ * from them, so messages it may still be sending cannot go back to the
+ * pool. Such a socket is handed to orphan_zerocopy along with its zerocopy
+ * writes and true is returned, so that the caller does not close it. */
+bool clear_output (unsigned n) {
+	struct output_queue *queue = &outputs[n];
+	for (unsigned i = 0; i < queue->count; i++) {
+		release_outbound (queue->entries[(queue->head + i) & (queue->capacity - 1)]);
+	}
+	bool orphaned = false;
+	if (queue->zerocopy_head != NULL && reap_zerocopy (n) && queue->zerocopy_head != NULL) {
+		orphan_zerocopy (n);
+		orphaned = true;
+	}
+	/* A socket with a real error has been reset, so the kernel dropped
+	 * what it had not sent. */
+	while (queue->zerocopy_head != NULL) {
+		struct zerocopy_write *write = queue->zerocopy_head;
+		queue->zerocopy_head = write->next;
+		free_zerocopy_write (write);
+	}
+	free (queue->entries);
+	output_stats.queued_bytes -= queue->bytes;
+	memset (queue, 0, sizeof (struct output_queue));
+	return orphaned;
+}
+
+/* Function that takes over the socket in index n and its zerocopy writes
+ * as an orphan of the calling shard. The socket is shut down for writing,
+ * so the client sees the connection end once the data before it arrives,
+ * but stays open so that its completions can still be read. */
+void orphan_zerocopy (unsigned n) {
+	struct output_queue *queue = &outputs[n];
+	struct zerocopy_orphan *orphan = malloc (sizeof (struct zerocopy_orphan));
+	if (orphan == NULL) {
+		allocation_failed ();
+	}
+	shutdown (sockets[n], SHUT_WR);
+	orphan->fd = sockets[n];
+	orphan->deadline = metrics_clock () + ZEROCOPY_ORPHAN_NS;
+	orphan->zerocopy_head = queue->zerocopy_head;
+	orphan->zerocopy_tail = queue->zerocopy_tail;
+	orphan->next = zerocopy_orphans;
+	zerocopy_orphans = orphan;
+	queue->zerocopy_head = NULL;
+	queue->zerocopy_tail = NULL;
+	output_stats.zerocopy_orphans++;
+}
+
+/*
+ * Function: reap_zerocopy_orphans
+ * -------------------------------
+ * reads the completions of every orphan of the calling shard and closes
+ * those whose zerocopy writes are all complete, releasing their messages.
+ * An orphan still waiting at its deadline, or whose socket failed, is
+ * reset instead: with SO_LINGER set to 0 the close discards what the
+ * kernel has not sent, after which it no longer reads the pages. Orphans
+ * are only checked when the event loop wakes up, so an idle shard keeps
+ * them a little longer.
+ *
+ * returns: void
+ */
+void reap_zerocopy_orphans () {
+	unsigned long now = metrics_clock ();
+	struct zerocopy_orphan **link = &zerocopy_orphans;
+	while (*link != NULL) {
+		struct zerocopy_orphan *orphan = *link;
+		bool failed = !read_zerocopy (orphan->fd, &orphan->zerocopy_head, &orphan->zerocopy_tail);
+		if (orphan->zerocopy_head != NULL && !failed && now < orphan->deadline) {
+			link = &orphan->next;
+			continue;
+		}
+		if (orphan->zerocopy_head != NULL) {
+			struct linger linger = {1, 0};
+			setsockopt (orphan->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof (linger));
+			output_stats.zerocopy_resets++;
+		}
+		close (orphan->fd);
+		while (orphan->zerocopy_head != NULL) {
+			struct zerocopy_write *write = orphan->zerocopy_head;
+			orphan->zerocopy_head = write->next;
+			free_zerocopy_write (write);
+		}
+		*link = orphan->next;
+		free (orphan);
+	}
+}
+
+/* Function that appends message to the queue of the connection in index n,
+ * doubling the ring when it is full. The slow consumer policy is applied
+ * first if the queue would grow past output_limit, where a message that
+ * was partly written is never dropped so the client never sees half a
+ * message. Returns false if the connection should be closed. */
+bool queue_output (unsigned n, struct outbound *message) {
+	struct output_queue *queue = &outputs[n];
+	unsigned length = message->length;
+	if (queue->bytes + length > output_limit) {
+		if (output_policy == Disconnect_Slow) {
+			output_stats.slow_disconnects++;
+			return false;
+		}
+		if (output_policy == Drop_Oldest) {
+			drop_oldest_output (queue, length);
+		}
+		if (queue->bytes + length > output_limit) {
+			queue->dropped++;
+			output_stats.dropped_messages++;
+			output_stats.dropped_bytes += length;
+			return true;
+		}
+	}
+	if (queue->count == queue->capacity) {
+		unsigned capacity = queue->capacity == 0 ? INITIAL_OUTPUT_CAPACITY : queue->capacity * 2;
+		struct outbound **entries = malloc (sizeof (struct outbound *) * capacity);
+		if (entries == NULL) {
+			allocation_failed ();
+		}
+		for (unsigned i = 0; i < queue->count; i++) {
+			entries[i] = queue->entries[(queue->head + i) & (queue->capacity - 1)];
+		}
+		free (queue->entries);
+		queue->entries = entries;
+		queue->capacity = capacity;
+		queue->head = 0;
+	}
+	hold_outbound (message);
+	queue->entries[(queue->head + queue->count) & (queue->capacity - 1)] = message;
+	queue->count++;
+	queue->bytes += length;
+	output_stats.queued_bytes += length;
+	if (queue->bytes > queue->peak_bytes) {
+		queue->peak_bytes = queue->bytes;
+	}
+	if (queue->bytes > output_stats.peak_bytes) {
+		output_stats.peak_bytes = queue->bytes;
+	}
+	if (queue->watching) {
+		output_stats.queued_messages++;
+	}
+	return true;
+}
+
+/* Function that discards the oldest messages of a queue until length more
+ * bytes fit under output_limit or only a partly written message is left.
+ * A partly written first message is kept by moving it into the place of
+ * the message after it. */
+void drop_oldest_output (struct output_queue *queue, unsigned length) {
+	unsigned mask = queue->capacity - 1;
+	while (queue->count > 0 && queue->bytes + length > output_limit) {
+		unsigned oldest = queue->head;
+		if (queue->sent > 0) {
+			if (queue->count == 1) {
+				return;
+			}
+			oldest = (queue->head + 1) & mask;
+		}
+		struct outbound *dropped = queue->entries[oldest];
+		queue->entries[oldest] = queue->entries[queue->head];
+		queue->head = (queue->head + 1) & mask;
+		queue->count--;
+		queue->bytes -= dropped->length;
+		output_stats.queued_bytes -= dropped->length;
+		queue->dropped++;
+		output_stats.dropped_messages++;
+		output_stats.dropped_bytes += dropped->length;
+		release_outbound (dropped);
+	}
+}
+
+/* Function that sets SO_ZEROCOPY on the socket in index n the first time
+ * it is needed. Returns false if the kernel does not allow it. */
+bool enable_zerocopy (unsigned n) {
+	struct output_queue *queue = &outputs[n];
+	if (queue->zerocopy == Zerocopy_Unset) {
+		int enable = 1;
+		bool enabled = setsockopt (sockets[n], SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof (enable)) == 0;
+		queue->zerocopy = enabled ? Zerocopy_On : Zerocopy_Off;
+	}
+	return queue->zerocopy == Zerocopy_On;
+}
+
+/* Function that records a zerocopy write of written bytes, starting at the
+ * first queued message, holding a reference to every message it sent
+ * from. Must be called before the written messages leave the queue. */
+void hold_zerocopy (struct output_queue *queue, size_t written) {
+	unsigned count = 0;
+	size_t covered = 0;
+	while (covered < written) {
+		struct outbound *message = queue->entries[(queue->head + count) & (queue->capacity - 1)];
+		covered += message->length - (count == 0 ? queue->sent : 0);
+		count++;
+	}
+	struct zerocopy_write *write = malloc (sizeof (struct zerocopy_write) + sizeof (struct outbound *) * count);
+	if (write == NULL) {
+		allocation_failed ();
+	}
+	write->next = NULL;
+	write->sequence = queue->zerocopy_sequence;
+	write->count = count;
+	for (unsigned i = 0; i < count; i++) {
+		write->messages[i] = queue->entries[(queue->head + i) & (queue->capacity - 1)];
+		hold_outbound (write->messages[i]);
+	}
+	if (queue->zerocopy_tail == NULL) {
+		queue->zerocopy_head = write;
+	} else {
+		queue->zerocopy_tail->next = write;
+	}
+	queue->zerocopy_tail = write;
+	queue->zerocopy_sequence++;
+	output_stats.zerocopy_writes++;
+}
+
+/* Function that releases the zerocopy writes of the list from head to
+ * tail whose sequence numbers lie between first and last, inclusive, as
+ * the kernel counts them with wraparound. The writes are kept in order, so
+ * the search stops at the first one after last. */
+void release_zerocopy (struct zerocopy_write **head, struct zerocopy_write **tail, unsigned first, unsigned last) {
+	struct zerocopy_write *previous = NULL;
+	struct zerocopy_write *write = *head;
+	while (write != NULL && (int) (write->sequence - last) <= 0) {
+		struct zerocopy_write *next = write->next;
+		if (write->sequence - first > last - first) {
+			previous = write;
+			write = next;
+			continue;
+		}
+		if (previous == NULL) {
+			*head = next;
+		} else {
+			previous->next = next;
+		}
+		if (*tail == write) {
+			*tail = previous;
+		}
+		free_zerocopy_write (write);
+		write = next;
+	}
+}
+
+/* Function that frees a zerocopy write, dropping its references to the
+ * messages it sent from. */
+void free_zerocopy_write (struct zerocopy_write *write) {
+	for (unsigned i = 0; i < write->count; i++) {
+		release_outbound (write->messages[i]);
+	}
+	free (write);
+}
@@ -0,0 +1,234 @@
+/* File that contains how the server sends to its clients. A message that
+ * goes to several clients is copied once into an outbound message, which
+ * is reference counted and never modified, and every recipient holds a
+ * reference for as long as it still has bytes of the message to send. A
+ * message is queued on the connection and the connection scheduled for a
+ * flush, which happens once the current wakeup of the event loop has been
+ * handled, so everything a client is sent during one wakeup leaves in a
+ * single writev-style system call. Whatever the socket does not take is
+ * sent once the event loop reports the socket writable, so a client that
+ * reads slowly never makes the server wait. Each queue is bounded in bytes
+ * and a connection that reaches the bound loses its oldest or newest
+ * messages or is disconnected, depending on the slow consumer policy.
+ * Large writes may be made with MSG_ZEROCOPY, in which case the messages
+ * are held until the kernel reports through the socket's error queue that
+ * it no longer needs them. Messages of up to OUTBOUND_BLOCK_SIZE bytes are
+ * taken from a pool kept by every shard, so building and sending a chat
+ * line or a reply allocates nothing once the pool has filled.
+ * Author: Yuriy Bash */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include "client_server_utils.h"
+
+/* The number of messages an output queue has room for when it is first
+ * used. */
+#define INITIAL_OUTPUT_CAPACITY 8
+
+/* The most queued messages handed to the kernel in one system call. */
+#define OUTPUT_BATCH 64
+
+/* The most bytes of a message that fit a pooled outbound message, enough
+ * for any chat line with the name of its sender, and the most spare
+ * outbound messages a shard keeps in its pool. */
+#define OUTBOUND_BLOCK_SIZE 1536
+#define OUTBOUND_POOL_LIMIT 1024
+
+/* The time a closed socket is kept open for its zerocopy writes to be
+ * reported complete before it is reset, in ns. */
+#define ZEROCOPY_ORPHAN_NS 30000000000UL
+
+/* The number of bytes that may be queued for a connection when no limit is
+ * given on the command line. */
+#define DEFAULT_OUTPUT_LIMIT (1 << 20)
+
+/* What happens to a connection whose queue would grow past output_limit.
+ * Drop_Oldest discards queued messages that have not been started, oldest
+ * first, Drop_Newest discards the new message and Disconnect_Slow closes
+ * the connection. */
+enum OUTPUT_POLICY {Drop_Oldest=0, Drop_Newest=1, Disconnect_Slow=2};
+
+/* Whether SO_ZEROCOPY has been set on a socket. It is set the first time
+ * a write is large enough and never tried again if the kernel refuses. */
+enum ZEROCOPY_STATE {Zerocopy_Unset=0, Zerocopy_On=1, Zerocopy_Off=2};
+
+/* Counters describing the output queues of a shard. zerocopy_orphans
+ * counts the sockets kept open after their connection closed for their
+ * zerocopy writes to complete and zerocopy_resets those of them that were
+ * reset when the writes did not complete in time. queued_bytes is the
+ * number of bytes waiting in all of its queues right now, and the outbound
+ * counters how many messages were taken from the pool or the heap and how
+ * many spare ones the pool holds. */
+struct output_statistics {
+	unsigned long queued_messages;
+	unsigned long dropped_messages;
+	unsigned long dropped_bytes;
+	unsigned long slow_disconnects;
+	unsigned long write_calls;
+	unsigned long written_messages;
+	unsigned long zerocopy_writes;
+	unsigned long zerocopy_copied;
+	unsigned long zerocopy_orphans;
+	unsigned long zerocopy_resets;
+	unsigned peak_bytes;
+	unsigned long queued_bytes;
+	unsigned long pooled_outbounds;
+	unsigned long allocated_outbounds;
+	unsigned spare_outbounds;
+};
+
+/* A message built once and shared by every connection it is sent to. It is
+ * freed, or returned to the pool of the shard that released it, when the
+ * last reference is released. next links the spare messages of a pool.
+ * received_at is the time the line a broadcast carries was read, or 0, and
+ * the time from then until the last reference is released, once the last
+ * recipient has been written to, is recorded as its delivery latency. */
+struct outbound {
+	struct outbound *next;
+	unsigned references;
+	int length;
+	unsigned long received_at;
+	char data[];
+};
+
+/* A write made with MSG_ZEROCOPY, holding references to the messages it
+ * sent from until the kernel reports the write with the given sequence
+ * number complete. */
+struct zerocopy_write {
+	struct zerocopy_write *next;
+	unsigned sequence;
+	unsigned count;
+	struct outbound *messages[];
+};
+
+/* A socket whose connection was closed while the kernel could still be
+ * sending from the messages of its zerocopy writes. It is shut down for
+ * writing but kept open, so that the completions can still be read from
+ * its error queue, until its writes are complete or deadline passes. */
+struct zerocopy_orphan {
+	struct zerocopy_orphan *next;
+	fd_t fd;
+	unsigned long deadline;
+	struct zerocopy_write *zerocopy_head;
+	struct zerocopy_write *zerocopy_tail;
+};
+
+/* The messages still to be sent to one connection, held in a ring. entries
+ * is allocated the first time the connection is sent to. sent counts the
+ * bytes of the first message already written and bytes the bytes still to
+ * be written. scheduled is set while the connection waits for the flush at
+ * the end of the wakeup and watching while the event loop watches its
+ * socket for writability. peak_bytes and dropped describe the connection
+ * since it was accepted. The zerocopy writes not yet reported complete are
+ * kept oldest first, and zerocopy_sequence is the sequence number the
+ * kernel gives the next one. */
+struct output_queue {
+	struct outbound **entries;
+	unsigned capacity;
+	unsigned head;
+	unsigned count;
+	int sent;
+	unsigned bytes;
+	bool scheduled;
+	bool watching;
+	unsigned peak_bytes;
+	unsigned long dropped;
+	enum ZEROCOPY_STATE zerocopy;
+	unsigned zerocopy_sequence;
+	struct zerocopy_write *zerocopy_head;
+	struct zerocopy_write *zerocopy_tail;
+};
+
+/* The most bytes queued for one connection. */
+extern unsigned output_limit;
+
+/* The slow consumer policy. */
+extern enum OUTPUT_POLICY output_policy;
+
+/* Whether flushes that leave messages for another call pass MSG_MORE. */
+extern bool output_more;
+
+/* The number of bytes from which a write is made with MSG_ZEROCOPY, 0 if
+ * none is. */
+extern unsigned zerocopy_threshold;
+
+/* The output counters of the shard run by the calling thread. */
+extern __thread struct output_statistics output_stats;
+
+/* Function that takes the name of a policy from the command line, one of
+ * "oldest", "newest" or "disconnect", and sets output_policy accordingly.
+ * Returns false if the name is unknown. */
+bool select_output_policy (char *name);
+
+/* Function that writes the output statistics of all shards combined to
+ * total, with the deepest queue of any of them as peak_bytes. */
+void collect_output_statistics (struct output_statistics *total);
+
+/* Function that outputs the output statistics of all shards combined to
+ * stderr. */
+void report_output_statistics ();
+
+/* Function that returns an outbound message with room for length bytes
+ * that the caller fills in, holding one reference. */
+struct outbound *allocate_outbound (int length);
+
+/* Function that copies the first length bytes of message into a new
+ * outbound message holding one reference. */
+struct outbound *create_outbound (char *message, int length);
+
+/* Function that adds a reference to message. */
+void hold_outbound (struct outbound *message);
+
+/* Function that drops a reference to message, freeing it with the last. */
+void release_outbound (struct outbound *message);
+
+/* Function that queues message for the connection in index n with a
+ * reference of its own and schedules the connection to be flushed at the
+ * end of the current wakeup, or sooner once OUTPUT_BATCH messages wait.
+ * Returns false if the connection failed or went over its limit under the
+ * disconnect policy and should be closed. */
+bool send_outbound (unsigned n, struct outbound *message);
+
+/* Function that sends the first length bytes of message to the connection
+ * in index n like send_outbound, copying them first. */
+bool send_bytes (unsigned n, char *message, int length);
+
+/* Function that schedules the connection in index n to be flushed at the
+ * end of the current wakeup. */
+void schedule_flush (unsigned n);
+
+/* Function that flushes every scheduled connection, closing those that
+ * fail. Called by the event loop after each wakeup. */
+void flush_scheduled_output ();
+
+/* Function that writes as much of the queue of the connection in index n
+ * as its socket takes, several messages per system call. Called when the
+ * connection is flushed and when its socket is writable. Returns false if
+ * the connection failed and should be closed. */
+bool flush_output (unsigned n);
+
+/* Function that determines if the connection in index n has messages
+ * waiting for its socket to become writable. */
+bool has_output (unsigned n);
+
+/* Function that determines if the connection in index n has zerocopy
+ * writes the kernel has not reported complete yet. */
+bool has_zerocopy (unsigned n);
+
+/* Function that reads the completions waiting in the error queue of the
+ * socket in index n and releases the messages of the writes they report.
+ * Called when the event loop finds an error pending on a socket with
+ * zerocopy writes. Returns false if the queue held a real error and the
+ * connection should be closed. */
+bool reap_zerocopy (unsigned n);
+
+/* Function that drops every message queued for the connection in index n
+ * and frees its queue, resetting its counters and flags. Returns true if
+ * the kernel may still be sending from its zerocopy writes, in which case
+ * the socket has been taken over until they are complete and must not be
+ * closed by the caller. */
+bool clear_output (unsigned n);
+
+#endif
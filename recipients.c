@@ -0,0 +1,102 @@
+/* File that contains the recipient lists of senders somebody muted. A
+ * broadcast from a sender nobody muted goes to every client of the shard,
+ * while one from a sender with muters goes to the clients in the sender's
+ * list, which every shard keeps for its own clients: every connection
+ * except those whose user muted the sender. A list is rebuilt the first
+ * time it is needed after it went stale, so a room that chats far more than
+ * it mutes or changes only pays for the sends. A list goes stale when one
+ * of the shard's users mutes or unmutes its sender and when a connection of
+ * the shard opens or closes. Lists are kept by the id of the sender's name
+ * info and are thread local like the connection table they are built from.
+ * Author: Yuriy Bash */
+
+#include <stdlib.h>
+#include <string.h>
+#include "recipients.h"
+#include "connections.h"
+#include "user_utils.h"
+#include "client_server_utils.h"
+
+void build_recipients (struct recipient_list *list, struct name_info *sender);
+
+/* The recipient lists of the current shard, indexed by the id of the
+ * sender's name info. */
+__thread struct recipient_list *recipient_lists;
+
+/* The number of ids recipient_lists has room for. */
+__thread unsigned recipient_list_capacity;
+
+/*
+ * Function: recipients_of
+ * -----------------------
+ * returns the recipient list of sender on the current shard, growing the
+ * table of lists to the sender's id and rebuilding the list if any
+ * connection opened or closed since it was built or it was marked stale.
+ * An id that is reused by a new user keeps its list, which is still
+ * correct since every mute set bit of the old user was cleared, marking
+ * it stale, before the id was freed.
+ *
+ * sender: the name info of the user whose broadcast is delivered
+ * count: set to the number of connections in the list
+ *
+ * returns: the indices of the connections in the list
+ */
+unsigned *recipients_of (struct name_info *sender, unsigned *count) {
+	if (sender->id >= recipient_list_capacity) {
+		unsigned capacity = recipient_list_capacity == 0 ? INITIAL_ROOM_CAPACITY : recipient_list_capacity;
+		while (capacity <= sender->id) {
+			capacity *= 2;
+		}
+		recipient_lists = realloc (recipient_lists, sizeof (struct recipient_list) * capacity);
+		if (recipient_lists == NULL) {
+			allocation_failed ();
+		}
+		memset (recipient_lists + recipient_list_capacity, 0,
+			sizeof (struct recipient_list) * (capacity - recipient_list_capacity));
+		recipient_list_capacity = capacity;
+	}
+	struct recipient_list *list = &recipient_lists[sender->id];
+	if (list->generation != connection_generation) {
+		build_recipients (list, sender);
+	}
+	*count = list->count;
+	return list->connections;
+}
+
+/*
+ * Function: invalidate_recipients
+ * -------------------------------
+ * marks the recipient list of sender as stale so that the next broadcast
+ * from sender rebuilds it.
+ *
+ * sender: the name info of the user who was muted or unmuted
+ *
+ * returns: void
+ */
+void invalidate_recipients (struct name_info *sender) {
+	if (sender->id < recipient_list_capacity) {
+		recipient_lists[sender->id].generation = 0;
+	}
+}
+
+/* Function that fills list with every connection of the current shard
+ * whose user did not mute sender, including connections that have not
+ * named a user yet. */
+void build_recipients (struct recipient_list *list, struct name_info *sender) {
+	if (list->capacity < socket_total) {
+		list->capacity = connection_capacity;
+		list->connections = realloc (list->connections, sizeof (unsigned) * list->capacity);
+		if (list->connections == NULL) {
+			allocation_failed ();
+		}
+	}
+	list->count = 0;
+	for (unsigned i = 0; i < socket_total - 1; i++) {
+		unsigned ctr = active_connections[i];
+		if (users[ctr] == NULL || !ismuted_name (users[ctr], sender)) {
+			list->connections[list->count] = ctr;
+			list->count++;
+		}
+	}
+	list->generation = connection_generation;
+}
@@ -0,0 +1,39 @@
+/* File that contains the recipient lists of senders somebody muted. A
+ * broadcast from a sender nobody muted goes to every client of the shard,
+ * while one from a sender with muters goes to the clients in the sender's
+ * list, which every shard keeps for its own clients: every connection
+ * except those whose user muted the sender. A list is rebuilt the first
+ * time it is needed after it went stale, so a room that chats far more than
+ * it mutes or changes only pays for the sends. A list goes stale when one
+ * of the shard's users mutes or unmutes its sender and when a connection of
+ * the shard opens or closes. Lists are kept by the id of the sender's name
+ * info and are thread local like the connection table they are built from.
+ * Author: Yuriy Bash */
+
+#ifndef RECIPIENTS_H
+#define RECIPIENTS_H
+
+struct name_info;
+
+/* The connections a broadcast from a sender is delivered to by the current
+ * shard. generation is the connection_generation the list was built at, 0
+ * if it was never built or went stale since. */
+struct recipient_list {
+	unsigned *connections;
+	unsigned count;
+	unsigned capacity;
+	unsigned long generation;
+};
+
+/* Function that returns the indices of the connections of the current
+ * shard whose user did not mute sender, storing their number in count. The
+ * list is rebuilt if it went stale. It stays valid until a connection of
+ * the shard opens or closes or a user of the shard mutes or unmutes
+ * sender. */
+unsigned *recipients_of (struct name_info *sender, unsigned *count);
+
+/* Function that marks the recipient list of sender as stale after a user of
+ * the current shard muted or unmuted sender. */
+void invalidate_recipients (struct name_info *sender);
+
+#endif
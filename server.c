@@ -1,8 +1,12 @@
 /* A simple implementation of a server to host a chatroom. The chatroom 
- * consists of up to 10 clients connected at one time and supports both
- * normal messages and the commands found in commands.h. 
+ * consists of up to 10 clients connected at one time, or as many as are
+ * given with -c, and supports both normal messages and the commands found
+ * in commands.h. The clients may be spread over several reactor threads,
+ * see shards.h.
  * Author: Nick Riasanovsky */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,9 +14,13 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include "server.h"
 #include "commands.h"
@@ -20,48 +28,129 @@
 #include "user_utils.h"
 #include "server_utils.h"
 #include "client_server_utils.h"
+#include "event_loop.h"
+#include "uring_loop.h"
+#include "shards.h"
+#include "line_scan.h"
+#include "output.h"
+#include "recipients.h"
+#include "chat_log.h"
+#include "metrics.h"
+#include "admin.h"
 
 void socket_error ();
 
-/* Array of sockets that will be used to send information. 
- * A socket will be initialized and reset to -1 if there
- * is not active connection and index 0 will always contain
- * the socket the server uses to receive connections. */
-fd_t sockets[MAX_CONNECTIONS];
+void usage_error ();
+
+void raise_descriptor_limit ();
+
+long read_listen_overflows ();
+
+void request_report (int signum);
+
+/* The backlog passed to listen. */
+int backlog = DEFAULT_BACKLOG;
+
+/* The maximum number of connections accepted per wakeup. */
+unsigned accept_budget = DEFAULT_ACCEPT_BUDGET;
 
-/* Array of messages that have been received from each user but
- * are not yet complete. */
-char *messages [MAX_CONNECTIONS];
+/* The accept counters of the shard run by the calling thread. */
+__thread struct accept_statistics accept_stats;
 
-/* Array of user information about users who have connected. */
-struct user_info *users [MAX_CONNECTIONS];
+/* The connections of the calling shard whose writes failed during the
+ * deliveries in progress. Closing one delivers its departure, so
+ * deliveries nest and each uses the entries past those of the one it was
+ * called from. */
+__thread unsigned *closure_list;
+__thread unsigned closure_count;
+__thread unsigned closure_capacity;
 
-/* Array of offsets into the messages. */
-unsigned offsets [MAX_CONNECTIONS];
+/* The kernel's count of listen overflows when the server started, -1 if
+ * it is not available. */
+long initial_listen_overflows;
 
-/* The number have sockets that have currently connected. Includes
- * the servers socket that receives connections. */
-unsigned socket_total;
+/* Set by SIGUSR1 to have the statistics reported once the current wakeup
+ * is done. */
+volatile sig_atomic_t report_requested = 0;
 
 /* This is a simple chat server which will host up to 10 clients to communicate
- * in a single location. */
+ * in a single location. The backend used to wait on sockets can be chosen
+ * with -b, edge triggered epoll notifications enabled with -e, the
+ * number of clients changed with -c, the listen backlog with -l, the
+ * number of connections accepted per wakeup with -a, the number of
+ * reactor threads with -t, the bytes queued per slow client with -q,
+ * what happens once a client reaches it with -p, whether MSG_MORE is
+ * passed when a flush takes several writes with -m and the size from
+ * which writes use MSG_ZEROCOPY with -z. What happens when the log
+ * cannot keep up is chosen with -o, the format of the log with -f and the
+ * number of seconds between dumps of the metrics to stderr with -s. An
+ * admin listener serving the metrics is opened with -A. */
 int main (int argc, char *argv[]) {
-	if (argc != 2) {
-		fprintf (stderr, "Server takes exactly 1 argument, the port\n");
-		exit (1);
+	int option;
+	while ((option = getopt (argc, argv, "b:ec:l:a:t:q:p:mz:o:f:s:A:")) != -1) {
+		if (option == 'b' && select_backend (optarg)) {
+			continue;
+		} else if (option == 'e') {
+			edge_triggered = true;
+		} else if (option == 'c' && atoi (optarg) > 0) {
+			max_connections = atoi (optarg);
+		} else if (option == 'l' && atoi (optarg) > 0) {
+			backlog = atoi (optarg);
+		} else if (option == 'a' && atoi (optarg) > 0) {
+			accept_budget = atoi (optarg);
+		} else if (option == 't' && atoi (optarg) > 0 && atoi (optarg) <= MAX_SHARDS) {
+			shard_count = atoi (optarg);
+		} else if (option == 'q' && atoi (optarg) > 0) {
+			output_limit = atoi (optarg);
+		} else if (option == 'p' && select_output_policy (optarg)) {
+			continue;
+		} else if (option == 'm') {
+			output_more = true;
+		} else if (option == 'z' && atoi (optarg) > 0) {
+			zerocopy_threshold = atoi (optarg);
+		} else if (option == 'o' && select_log_policy (optarg)) {
+			continue;
+		} else if (option == 'f' && select_log_format (optarg)) {
+			continue;
+		} else if (option == 's' && atoi (optarg) > 0) {
+			metrics_interval = atoi (optarg);
+		} else if (option == 'A') {
+			admin_address = optarg;
+		} else {
+			usage_error ();
+		}
+	}
+	if (argc - optind != 1) {
+		usage_error ();
 	}
-	int port = atoi (argv[1]);
-	handle_connections (port);
+	int port = atoi (argv[optind]);
+	/* A peer closing while a message is written to it must show up as a
+	 * failed write rather than terminating the server. */
+	signal (SIGPIPE, SIG_IGN);
+	signal (SIGUSR1, request_report);
+	raise_descriptor_limit ();
+	report_connection_memory ();
+	initial_listen_overflows = read_listen_overflows ();
+	atexit (report_statistics);
+	start_log ();
+	start_metrics_dump ();
+	start_shards (port);
+	return 0;
 }
 
 /* Function that will handle all connections to the server. It first will
  * initialize the server socket and then transitions into a loop where it will
- * attempt to receive information from its outstanding sockets. */
+ * attempt to receive information from its outstanding sockets. Called once
+ * by every shard, whose server sockets share the port. */
 void handle_connections (int port) {
 	fd_t main_socket = socket (AF_INET, SOCK_STREAM, 0);
 	if (main_socket == -1) {
 		socket_error ();
 	}
+	int reuse = 1;
+	if (shard_count > 1 && setsockopt (main_socket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof (reuse)) == -1) {
+		socket_error ();
+	}
 	int flags = fcntl (main_socket, F_GETFL, 0);
 	if (flags == -1) {
 		socket_error ();
@@ -77,164 +166,184 @@ void handle_connections (int port) {
 	if (bind (main_socket, (struct sockaddr *) &info, sizeof (info)) == -1) {
 		socket_error ();
 	}
-	if (listen (main_socket, 10) == -1) {
+	if (listen (main_socket, backlog) == -1) {
 		socket_error ();
 	}
-	memset (offsets, 0, sizeof (unsigned) * MAX_CONNECTIONS);
-	messages[0] = malloc (sizeof (char) * (MAX_MESSAGE_LENGTH + 1));
-	if (messages[0] == NULL) {
-		allocation_failed ();
+	init_connections (main_socket);
+	event_loop_init ();
+	if (current_shard->id == 0) {
+		admin_init ();
 	}
-	memset (sockets + 1, -1, sizeof (fd_t) * 10);
-	sockets[0] = main_socket;	
-	socket_total = 1;
-	fd_set read_set;
-	fd_set except_set;
-	printf ("Server messages:\n");
-	fflush (stdout);
 	while (1) {
-		FD_ZERO (&read_set);
-		FD_ZERO (&except_set);
-		fd_t socket = 0;
-		unsigned fd_max = 0;
-		unsigned count = 0;
-		unsigned n = 0;
-		while (count < socket_total) {
-			if ((socket = sockets[n]) != -1) {
-				count++;
-				FD_SET (socket, &read_set);
-				FD_SET (socket, &except_set);
-				if (socket > fd_max) {
-					fd_max = socket;
-				}
-			}
-			n++;
+		event_loop_wait ();
+		if (report_requested) {
+			report_requested = 0;
+			report_statistics ();
 		}
-		n = 1;
-		count = 1;
-		unsigned temp = 0;
-		select (fd_max + 1, &read_set, NULL, &except_set, NULL);
-		while (count < socket_total) {
-			if (sockets[n] != -1) {
-				count++;
-				if (FD_ISSET (sockets[n], &except_set)) {
-					close (sockets[n]);
-					sockets[n] = -1;
-					temp++;
-					free (messages[n]);
-					messages[n] = NULL;
-					if (users[n] != NULL) {
-						handle_disconnect (n);
-						cleanup_user (users[n]);
-					}
-				}
-			}
-			n++;
+	}
+}
+
+/* Function that handles new users connecting to the server. It accepts
+ * pending connections until none are left, accept_budget have been accepted
+ * or the server is full, placing each file descriptor in the socket array,
+ * setting its corresponding location in the users array list to NULL and
+ * allocating space for it to store messages. Returns true if it stopped
+ * because the budget ran out or the server is full, so connections may
+ * still be pending. */
+bool establish_connection () {
+	struct tcp_info queue;
+	socklen_t size = sizeof (queue);
+	/* For a listening socket the kernel reports the length of the accept
+	 * queue in tcpi_unacked and the backlog in tcpi_sacked. */
+	if (getsockopt (sockets[0], IPPROTO_TCP, TCP_INFO, &queue, &size) == 0) {
+		if (queue.tcpi_unacked > accept_stats.peak_queue) {
+			accept_stats.peak_queue = queue.tcpi_unacked;
+		}
+		if (queue.tcpi_unacked > 0 && queue.tcpi_unacked >= queue.tcpi_sacked) {
+			accept_stats.full_queue++;
 		}
-		socket_total -= temp;
-		n = 0;
-		count = 0;
-		while (count < socket_total) {
-			if (sockets[n] != -1) {
-				count++;
-				if (FD_ISSET (sockets[n], &read_set)) {
-					if (n == 0) {
-						if (socket_total < MAX_CONNECTIONS) {
-							establish_connection ();
-						}
-					} else {
-						handle_client (n);
-					}
-				}
+	}
+	unsigned accepted = 0;
+	while (accepted < accept_budget && !connections_full ()) {
+		fd_t new_fd = accept4 (sockets[0], NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (new_fd == -1) {
+			if (errno == ECONNABORTED || errno == EINTR) {
+				continue;
 			}
-			n++;
+			break;
 		}
+		accepted++;
+		/* select cannot watch descriptors past FD_SETSIZE. */
+		if (event_backend == Select_Backend && new_fd >= FD_SETSIZE) {
+			close (new_fd);
+			continue;
+		}
+		add_connection (new_fd);
+	}
+	record_accept_wakeup (accepted);
+	if (accepted == accept_budget) {
+		accept_stats.budget_exhausted++;
+		return true;
 	}
+	return connections_full ();
 }
 
-/* Function that handles a new user connecting to the server. It will first
- * accept the new connection and will then place the file descriptor in the
- * socket array. Then it will set its corresponding location in the users
- * array list to NULL and allocate space for it to store messages. */
-void establish_connection () {
-	struct sockaddr_in info;
-	unsigned size = sizeof (info);
-	fd_t new_fd = accept (sockets[0], (struct sockaddr *) &info, &size);
-	if (new_fd > 0) {
-		socket_total++;
-		bool success = false;
-		unsigned counter = 1;
-		while (!success) {
-			if (sockets[counter] == -1) {
-				success = true;
-				sockets[counter] = new_fd;
-				messages[counter] = malloc (sizeof (char) * (MAX_MESSAGE_LENGTH + 1));
-				if (messages[counter] == NULL) {
-					allocation_failed ();
-				}
-				users[counter] = NULL;
-				int flags = fcntl (new_fd, F_GETFL, 0);
-				if (flags == -1) {
-					socket_error ();
-				}
-				flags = fcntl (new_fd, F_SETFL, flags | O_NONBLOCK);
-				if (flags == -1) {
-					socket_error ();
-				}
-			} else {
-				counter++;
-			}
-		}
+/* Function that records that one wakeup of the event loop accepted
+ * accepted connections. */
+void record_accept_wakeup (unsigned accepted) {
+	accept_stats.wakeups++;
+	accept_stats.accepted += accepted;
+	if (accepted > accept_stats.most_accepted) {
+		accept_stats.most_accepted = accepted;
 	}
 }
 
+/* Function that places the already accepted, nonblocking socket new_fd in
+ * the first free index of the socket array, allocates space for it to store
+ * messages and starts watching it. Returns the index used. */
+unsigned add_connection (fd_t new_fd) {
+	unsigned counter = claim_connection ();
+	sockets[counter] = new_fd;
+	messages[counter] = malloc (sizeof (char) * (MAX_MESSAGE_LENGTH + 1));
+	if (messages[counter] == NULL) {
+		allocation_failed ();
+	}
+	users[counter] = NULL;
+	offsets[counter] = 0;
+	starts[counter] = 0;
+	event_loop_add (counter);
+	return counter;
+}
+
 /* Function that handles the client that is connected with the file descriptor
  * in index n. It will attempt to read information if it exists and will 
  * process the information accordingly. If it contains the first full message
  * it will create a user with the name being the message contents. It also
  * handles possible client disconnects and informs other clients of the
- * disconnect. */
-void handle_client (unsigned n) {
+ * disconnect. Returns true if data was read, so a caller draining an edge
+ * triggered socket knows to read again. */
+bool handle_client (unsigned n) {
+	int space = receive_space (n);
+	if (space == 0) {
+		close_connection (n);
+		return false;
+	}
 	errno = 0;
-	int length = read (sockets[n], messages[n] + offsets[n], MAX_MESSAGE_LENGTH - offsets[n]);
-	int location;
+	int length = read (sockets[n], messages[n] + offsets[n], space);
+	shard_metrics.read_calls++;
 	if (length > 0) {
-		messages[n][length + offsets[n]] = 0;
-		while ((location = find_message_end (messages[n], offsets[n])) != -1) {
-			char *message = generate_message (messages[n], location + 1);
-			if (users[n] == NULL) {
-				message [strlen(message) - 1] = 0;
-				users[n] = create_user (message);
-				char* message_parts[2];
-				message_parts[0] = message;
-				message_parts[1] = " has joined\n";
-				printf ("%s%s", message_parts[0], message_parts[1]);
-				fflush (stdout);
-				char *entry_message = create_message (message_parts, 2);
-				share_message (entry_message, n, false);
-				free (entry_message);
-			} else {
-				printf ("%s", message);
-				fflush (stdout);
-				if (iscommand (message)) {
-					parse_command (message, n);
-				} else {
-					share_user_message (message, n);
-				}
+		handle_received (n, length);
+		return true;
+	} else if (length == 0 || (errno && errno != EAGAIN && errno != EWOULDBLOCK)) {
+		close_connection (n);
+	}
+	return false;
+}
+
+/* Function that processes length bytes which were just placed in messages[n]
+ * at offsets[n]. Every complete message is handed to handle_line in order as
+ * a view into the buffer, without being copied, and whatever remains of an
+ * incomplete message is kept for the next read. Only the new bytes are
+ * searched for the ends of messages, up to LINE_BATCH at a time. */
+void handle_received (unsigned n, int length) {
+	received_at = metrics_clock ();
+	shard_metrics.bytes_in += length;
+	int scan = offsets[n];
+	offsets[n] += length;
+	int positions[LINE_BATCH];
+	int found;
+	do {
+		found = find_line_ends (messages[n], scan, offsets[n], positions, LINE_BATCH);
+		for (int i = 0; i < found; i++) {
+			char *line = messages[n] + starts[n];
+			int line_length = positions[i] + 1 - starts[n];
+			starts[n] = positions[i] + 1;
+			/* The byte after the line belongs to the next message, if any,
+			 * and is put back once the line has been handled. */
+			char next = line[line_length];
+			line[line_length] = 0;
+			handle_line (n, line, line_length);
+			if (messages[n] == NULL) {
+				return;
 			}
-			free (message);
-			offsets[n] = 0;
+			line[line_length] = next;
 		}
-		offsets[n] = strlen (messages[n]);
-	} else if (length == 0 || (errno && errno != EAGAIN && errno != EWOULDBLOCK)) {
-		close (sockets[n]);
-		sockets[n] = -1;
-		socket_total--;
-		free (messages[n]);
-		messages[n] = NULL;
-		if (users[n] != NULL) {
-			handle_disconnect (n);
-			cleanup_user (users[n]);
+		scan = starts[n];
+	} while (found == LINE_BATCH);
+	if (starts[n] == offsets[n]) {
+		starts[n] = 0;
+		offsets[n] = 0;
+	}
+}
+
+/* Function that handles the complete message line of length bytes, ending
+ * in a newline and followed by a null terminator, sent by the client in
+ * index n. The line lives in the receive buffer of the client and must not
+ * be kept once the function returns. The first line of a client is its
+ * name, every later one a command or a message for the room. */
+void handle_line (unsigned n, char *line, int length) {
+	shard_metrics.messages_in++;
+	if (users[n] == NULL) {
+		line[length - 1] = 0;
+		lock_room ();
+		users[n] = create_user (line);
+		char* message_parts[2];
+		message_parts[0] = line;
+		message_parts[1] = " has joined\n";
+		log_join (line);
+		struct outbound *entry_message = create_message (message_parts, 2);
+		entry_message->received_at = received_at;
+		share_message (entry_message, n, false);
+		release_outbound (entry_message);
+		unlock_room ();
+	} else {
+		log_line (line, length);
+		if (iscommand (line)) {
+			lock_room ();
+			parse_command (line, n);
+			unlock_room ();
+		} else {
+			share_user_message (line, n);
 		}
 	}
 }
@@ -247,57 +356,76 @@ void share_user_message (char *message, unsigned n) {
     messages[0] = users[n]->name_info->name;
 	messages[1] = ":";
 	messages[2] = message;
-	char *new_message = create_message (messages, 3);
+	struct outbound *new_message = create_message (messages, 3);
+	new_message->received_at = received_at;
 	share_message (new_message, n, true);
-	free (new_message);
+	release_outbound (new_message);
 }
 
 /* Shares a message to all users except the one located in index
  * n. If isuser then a check for if the user is muted should
  * occur. Should also handle the case where at least 1 of the
- * users disconnected. */
-void share_message (char *message, unsigned n, bool isuser) {
-	errno = 0;
-	int length;
-	int ctr = 1;
-	int count = 1;
-	int size;
-	int total_length = strlen (message);
-	unsigned closures = 0;
-	unsigned closure_list[socket_total];
-	while (count < socket_total) {
-		if (sockets[ctr] != -1) {
-			count++;
-			if (ctr != n) {
-				if (!isuser ||(users[n] != NULL && !ismuted (users[ctr], users[n]))) {
-					length = 0;
-					while (length < total_length) {
-						size = write (sockets[ctr], message + length, total_length - length);
-						if (size == 0 || (errno && errno != EAGAIN && errno != EWOULDBLOCK)) {
-							close (sockets[ctr]);
-							sockets[ctr] = -1;
-							closure_list [closures] = ctr;
-							closures++;
-							break;
-						} else {
-							length += size;
-						}
-					}
-				}	
-			}
+ * users disconnected. Every recipient shares the message. Users
+ * on other shards are reached through their mailboxes, which are
+ * posted to first so that a departure caused by a failed write
+ * here cannot overtake the message. */
+void share_message (struct outbound *message, unsigned n, bool isuser) {
+	struct name_info *sender = NULL;
+	if (isuser) {
+		if (users[n] == NULL) {
+			return;
 		}
-		ctr++;	
-	}
-	socket_total -= closures;
-	for (int i = 0; i < closures; i++) {
-		free (messages[n]);
-		messages[n] = NULL;
-		messages[closure_list [i]] = NULL;
-		if (users[closure_list [i]] != NULL) {
-			handle_disconnect (closure_list [i]);
-			cleanup_user (users[closure_list [i]]);
+		sender = users[n]->name_info;
+	}
+	shard_metrics.broadcasts++;
+	if (shard_count > 1) {
+		post_broadcast (message, sender);
+	}
+	deliver_message (message, n, sender);
+}
+
+/* Function that sends message to every client of the current shard except
+ * the one in index n and those whose user muted sender. Mutes are ignored
+ * if sender is NULL. A sender nobody muted reaches every connection, and
+ * one with muters the connections in its recipient list, so no mute is
+ * looked up per recipient. Clients whose connection failed are closed once
+ * everyone has been sent to. */
+void deliver_message (struct outbound *message, unsigned n, struct name_info *sender) {
+	unsigned first = closure_count;
+	if (closure_count + socket_total > closure_capacity) {
+		closure_capacity = 2 * (closure_count + socket_total);
+		closure_list = realloc (closure_list, sizeof (unsigned) * closure_capacity);
+		if (closure_list == NULL) {
+			allocation_failed ();
 		}
 	}
+	unsigned *recipients = active_connections;
+	unsigned recipient_total = socket_total - 1;
+	if (sender != NULL && has_muters (sender)) {
+		recipients = recipients_of (sender, &recipient_total);
+	}
+	unsigned width = 0;
+	for (unsigned i = 0; i < recipient_total; i++) {
+		unsigned ctr = recipients[i];
+		if (ctr == n) {
+			continue;
+		}
+		width++;
+		if (!send_outbound (ctr, message)) {
+			closure_list [closure_count] = ctr;
+			closure_count++;
+		}
+	}
+	/* A shard none of whose clients hear the broadcast has nothing to add
+	 * to how widely it fans out. */
+	if (width > 0) {
+		record_value (&shard_metrics.fan_out, width);
+	}
+	unsigned last = closure_count;
+	for (unsigned i = first; i < last; i++) {
+		close_connection (closure_list [i]);
+	}
+	closure_count = first;
 }
 
 /* Function to send message to the user located in index n. Should
@@ -306,24 +434,19 @@ void reply (char *message, unsigned n) {
 	if (sockets[n] == -1) {
 		return;
 	}
-	int size;
-	int length = 0;
-	int total_length = strlen (message);
-	while (length < total_length) {
-		size = write (sockets[n], message + length, total_length - length);
-		if (size == -1) {
-			close (sockets[n]);
-			free (messages[n]);
-			messages[n] = NULL;
-			sockets[n] = -1;
-			socket_total--;
-			if (users[n] != NULL) {
-				handle_disconnect (n);
-				cleanup_user (users[n]);
-			}
-			return;
-		}
-		length += size;
+	if (!send_bytes (n, message, strlen (message))) {
+		close_connection (n);
+	}
+}
+
+/* Function to send a message built with create_message to the user
+ * located in index n, which holds a reference of its own. */
+void reply_message (struct outbound *message, unsigned n) {
+	if (sockets[n] == -1) {
+		return;
+	}
+	if (!send_outbound (n, message)) {
+		close_connection (n);
 	}
 }
 
@@ -332,9 +455,38 @@ void handle_disconnect (unsigned n) {
 	char *messages[2];
 	messages[0] = users[n]->name_info->name;
 	messages[1] = " has left\n";
-	char *message = create_message (messages, 2);
+	struct outbound *message = create_message (messages, 2);
 	share_message (message, n, false);
-	free (message);
+	release_outbound (message);
+}
+
+/* Function that closes the connection in index n, releases its message
+ * buffer and, if the client had joined, informs the other users and cleans
+ * up its user information. A server socket that stopped accepting because
+ * the server was full is then watched again. Does nothing if index n is
+ * already closed. */
+void close_connection (unsigned n) {
+	if (sockets[n] == -1) {
+		return;
+	}
+	event_loop_remove (n);
+	if (!clear_output (n)) {
+		close (sockets[n]);
+	}
+	sockets[n] = -1;
+	release_connection (n);
+	free (messages[n]);
+	messages[n] = NULL;
+	offsets[n] = 0;
+	starts[n] = 0;
+	if (users[n] != NULL) {
+		lock_room ();
+		handle_disconnect (n);
+		cleanup_user (users[n]);
+		users[n] = NULL;
+		unlock_room ();
+	}
+	event_loop_released ();
 }
 
 /* Function to handle an error that occurs when setting up the server. */
@@ -342,3 +494,102 @@ void socket_error () {
 	fprintf (stderr, "Unable to create server socket\n");
 	exit (1);
 }
+
+/* Function that raises the limit on open descriptors so that max_connections
+ * clients fit, as far as the hard limit allows. */
+void raise_descriptor_limit () {
+	struct rlimit limit;
+	if (getrlimit (RLIMIT_NOFILE, &limit) == -1) {
+		return;
+	}
+	rlim_t needed = (rlim_t) max_connections + 64;
+	if (limit.rlim_cur < needed) {
+		limit.rlim_cur = needed < limit.rlim_max ? needed : limit.rlim_max;
+		setrlimit (RLIMIT_NOFILE, &limit);
+	}
+}
+
+/* Function that outputs the accept, output and log statistics to stderr. */
+void report_statistics () {
+	report_accept_statistics ();
+	report_output_statistics ();
+	report_log_statistics ();
+}
+
+/* Function that outputs the accept statistics of all shards combined to
+ * stderr. Listen overflows are counted by the kernel for every socket on
+ * the machine, so only the change since the server started is shown. */
+void report_accept_statistics () {
+	struct accept_statistics total;
+	memset (&total, 0, sizeof (total));
+	for (unsigned i = 0; shards != NULL && i < shard_count; i++) {
+		struct accept_statistics *stats = shards[i].accept_stats;
+		if (stats == NULL) {
+			continue;
+		}
+		total.wakeups += stats->wakeups;
+		total.accepted += stats->accepted;
+		total.budget_exhausted += stats->budget_exhausted;
+		total.full_queue += stats->full_queue;
+		if (stats->most_accepted > total.most_accepted) {
+			total.most_accepted = stats->most_accepted;
+		}
+		if (stats->peak_queue > total.peak_queue) {
+			total.peak_queue = stats->peak_queue;
+		}
+	}
+	double average = total.wakeups == 0 ? 0 : (double) total.accepted / total.wakeups;
+	fprintf (stderr, "Accepted %lu connections over %lu wakeups (%.2f per wakeup, at most %u)\n",
+		total.accepted, total.wakeups, average, total.most_accepted);
+	fprintf (stderr, "Accept budget of %u exhausted %lu times, accept queue full on %lu wakeups, peak queue %u of %d\n",
+		accept_budget, total.budget_exhausted, total.full_queue, total.peak_queue, backlog);
+	long overflows = read_listen_overflows ();
+	if (overflows >= 0 && initial_listen_overflows >= 0) {
+		fprintf (stderr, "Listen overflows since start: %ld\n", overflows - initial_listen_overflows);
+	}
+}
+
+/* Function that reads the number of times a connection was dropped because
+ * an accept queue was full from /proc/net/netstat. Returns -1 if the counter
+ * is not available. */
+long read_listen_overflows () {
+	FILE *netstat = fopen ("/proc/net/netstat", "r");
+	if (netstat == NULL) {
+		return -1;
+	}
+	char names[4096];
+	char values[4096];
+	long overflows = -1;
+	while (overflows == -1 && fgets (names, sizeof (names), netstat) != NULL
+			&& fgets (values, sizeof (values), netstat) != NULL) {
+		if (strncmp (names, "TcpExt:", 7) != 0) {
+			continue;
+		}
+		char *name_state;
+		char *value_state;
+		char *name = strtok_r (names, " \n", &name_state);
+		char *value = strtok_r (values, " \n", &value_state);
+		while (name != NULL && value != NULL) {
+			if (strcmp (name, "ListenOverflows") == 0) {
+				overflows = atol (value);
+				break;
+			}
+			name = strtok_r (NULL, " \n", &name_state);
+			value = strtok_r (NULL, " \n", &value_state);
+		}
+	}
+	fclose (netstat);
+	return overflows;
+}
+
+/* Function that handles SIGUSR1 by asking the main loop to report the
+ * accept statistics. */
+void request_report (int signum) {
+	report_requested = 1;
+}
+
+/* Function to handle the server being started with the wrong arguments. */
+void usage_error () {
+	fprintf (stderr, "Usage: ./server [-b select|epoll|uring] [-e] [-c max_connections] [-l backlog] [-a accept_budget] [-t shards] [-q output_limit] [-p oldest|newest|disconnect] [-m] [-z zerocopy_threshold] [-o drop|block] [-f text|binary] [-s metrics_interval] [-A admin_port|admin_socket] port\n");
+	exit (1);
+}
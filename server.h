@@ -1,56 +1,100 @@
 /* A simple implementation of a server to host a chatroom. The chatroom 
- * consists of up to 10 clients connected at one time and supports both
- * normal messages and the commands found in commands.h. 
+ * consists of up to 10 clients connected at one time, or as many as are
+ * given with -c, and supports both normal messages and the commands found
+ * in commands.h. 
  * Author: Nick Riasanovsky */
 
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <stdbool.h>
+#include <sys/socket.h>
 #include "client_server_utils.h"
+#include "connections.h"
 
-#define MAX_NAME_LENGTH 251
+struct name_info;
+
+struct outbound;
 
-#define MAX_CONNECTIONS 11
+#define MAX_NAME_LENGTH 251
 
+/* The backlog of the server socket when none is given on the command
+ * line. */
+#define DEFAULT_BACKLOG SOMAXCONN
 
-/* Array of sockets that will be used to send information.
- * A socket will be initialized and reset to -1 if there
- * is not active connection and index 0 will always contain
- * the socket the server uses to receive connections. */
-extern fd_t sockets[MAX_CONNECTIONS];
+/* The number of connections accepted per wakeup when no budget is given
+ * on the command line. */
+#define DEFAULT_ACCEPT_BUDGET 64
 
-/* Array of messages that have been received from each user but
- * are not yet complete. */
-extern char *messages [MAX_CONNECTIONS];
+/* Counters describing how connections are accepted. */
+struct accept_statistics {
+	unsigned long wakeups;
+	unsigned long accepted;
+	unsigned most_accepted;
+	unsigned long budget_exhausted;
+	unsigned long full_queue;
+	unsigned peak_queue;
+};
 
-/* Array of user information about users who have connected. */
-extern struct user_info *users [MAX_CONNECTIONS];
+/* The backlog passed to listen. */
+extern int backlog;
 
-/* Array of offsets into the messages. */
-extern unsigned offsets [MAX_CONNECTIONS];
+/* The maximum number of connections accepted per wakeup of the event
+ * loop, so that a reconnect storm cannot starve connected clients. */
+extern unsigned accept_budget;
 
-/* The number have sockets that have currently connected. Includes
- * the servers socket that receives connections. */
-extern unsigned socket_total;
+/* The accept counters of the shard run by the calling thread. */
+extern __thread struct accept_statistics accept_stats;
 
 /* Function that will handle all connections to the server. It first will
  * initialize the server socket and then transitions into a loop where it will
  * attempt to receive information from its outstanding sockets. */
 void handle_connections (int port);
 
-/* Function that handles a new user connecting to the server. It will first
- * accept the new connection and will then place the file descriptor in the
- * socket array. Then it will set its corresponding location in the users
- * array list to NULL and allocate space for it to store messages. */
-void establish_connection ();
+/* Function that handles new users connecting to the server. It accepts
+ * pending connections until none are left, accept_budget have been accepted
+ * or the server is full, placing each file descriptor in the socket array,
+ * setting its corresponding location in the users array list to NULL and
+ * allocating space for it to store messages. Returns true if it stopped
+ * because the budget ran out, so connections may still be pending. */
+bool establish_connection ();
+
+/* Function that records that one wakeup of the event loop accepted
+ * accepted connections. */
+void record_accept_wakeup (unsigned accepted);
+
+/* Function that outputs the accept statistics to stderr. */
+void report_accept_statistics ();
+
+/* Function that outputs the accept, output and log statistics to stderr. Done
+ * on SIGUSR1 and when the server exits. */
+void report_statistics ();
+
+/* Function that places the already accepted, nonblocking socket new_fd in
+ * the first free index of the socket array, allocates space for it to store
+ * messages and starts watching it. Returns the index used. */
+unsigned add_connection (fd_t new_fd);
 
 /* Function that handles the client that is connected with the file descriptor
  * in index n. It will attempt to read information if it exists and will
  * process the information accordingly. If it contains the first full message
  * it will create a user with the name being the message contents. It also
  * handles possible client disconnects and informs other clients of the
- * disconnect. */
-void handle_client (unsigned n);
+ * disconnect. Returns true if data was read, so a caller draining an edge
+ * triggered socket knows to read again. */
+bool handle_client (unsigned n);
+
+/* Function that processes length bytes which were just placed in messages[n]
+ * at offsets[n]. Every complete message is handed to handle_line in order as
+ * a view into the buffer, without being copied, and whatever remains of an
+ * incomplete message is kept for the next read. */
+void handle_received (unsigned n, int length);
+
+/* Function that handles the complete message line of length bytes, ending
+ * in a newline and followed by a null terminator, sent by the client in
+ * index n. The line lives in the receive buffer of the client and must not
+ * be kept once the function returns. */
+void handle_line (unsigned n, char *line, int length);
 
 /* Shares a message sent from the user in index n with all other users. */
 void share_user_message (char *message, unsigned n);
@@ -58,14 +102,32 @@ void share_user_message (char *message, unsigned n);
 /* Shares a message to all users except the one located in index
  * n. If isuser then a check for if the user is muted should
  * occur. Should also handle the case where at least 1 of the
- * users disconnected. */
-void share_message (char *message, unsigned n, bool isuser);
+ * users disconnected. The message is shared by every recipient,
+ * each holding a reference of its own, so the caller still
+ * releases its reference. Users on other shards are reached
+ * through their mailboxes. */
+void share_message (struct outbound *message, unsigned n, bool isuser);
+
+/* Function that sends message to every client of the current shard
+ * except the one in index n and those whose user muted sender. Mutes
+ * are ignored if sender is NULL. */
+void deliver_message (struct outbound *message, unsigned n, struct name_info *sender);
 
 /* Function to send message to the user located in index n. Should
  * also handle the case in which the user disconnected. */
 void reply (char *message, unsigned n);
 
+/* Function to send a message built with create_message to the
+ * user located in index n. The caller still releases its
+ * reference. */
+void reply_message (struct outbound *message, unsigned n);
+
 /* Functiont to handle notifying other users that user n disconnected. */
 void handle_disconnect (unsigned n);
 
+/* Function that closes the connection in index n, releases its message
+ * buffer and, if the client had joined, informs the other users and cleans
+ * up its user information. Does nothing if index n is already closed. */
+void close_connection (unsigned n);
+
 #endif
@@ -8,6 +8,7 @@
 #include <ctype.h>
 #include "client_server_utils.h"
 #include "server_utils.h"
+#include "output.h"
 
 /* Function to determine if a character is part of a valid c indentifier,
  * meaning it is a letter (upper or lower case), a number, or an underscore.
@@ -32,22 +33,25 @@ bool isword (char *message) {
 
 /* Function that takes in a char ** consisting of count
  * char * (each of which is a message part) and returns a new
- * message which is the result of concatenating all the msgs
- * together after first appending the Standard_Message
- * character to the front (see client_server_utils.h). */
-char *create_message (char **parts, unsigned count) {
-        unsigned total_length = 2;
-        for (int i = 0; i < count; i++) {
-                total_length += strlen (parts[i]);
+ * outbound message which is the result of concatenating all the
+ * msgs together after first appending the Standard_Message
+ * character to the front (see client_server_utils.h). Each part
+ * is measured once and copied straight to its place in the
+ * message, which comes from the shard's pool of outbound
+ * messages. The caller holds the only reference. */
+struct outbound *create_message (char **parts, unsigned count) {
+        unsigned lengths[count];
+        int total_length = 1;
+        for (unsigned i = 0; i < count; i++) {
+                lengths[i] = strlen (parts[i]);
+                total_length += lengths[i];
         }
-        char *new_message = malloc (sizeof(char) * total_length);
-        if (new_message == NULL) {
-                allocation_failed ();
-        }
-        new_message[0] = Standard_Message;
-        new_message[1] = 0;
-        for (int i = 0; i < count; i++) {
-                strcat (new_message, parts[i]);
+        struct outbound *new_message = allocate_outbound (total_length);
+        new_message->data[0] = Standard_Message;
+        int offset = 1;
+        for (unsigned i = 0; i < count; i++) {
+                memcpy (new_message->data + offset, parts[i], lengths[i]);
+                offset += lengths[i];
         }
         return new_message;
 }
@@ -5,6 +5,8 @@
 #ifndef SERVER_UTILS_H
 #define SERVER_UTILS_H
 
+struct outbound;
+
 /* Function to determine if a character is part of a valid c indentifier,
  * meaning it is a letter (upper or lower case), a number, or an underscore.
  * This function is used to check if the names passed in to commands are
@@ -17,9 +19,10 @@ bool isword (char *message);
 
 /* Function that takes in a char ** consisting of count
  * char * (each of which is a message part) and returns a new
- * message which is the result of concatenating all the msgs
- * together after first appending the Standard_Message
- * character to the front (see client_server_utitls.h). */
-char *create_message (char **parts, unsigned count);
+ * outbound message which is the result of concatenating all the
+ * msgs together after first appending the Standard_Message
+ * character to the front (see client_server_utitls.h). The
+ * caller holds the only reference and releases it once sent. */
+struct outbound *create_message (char **parts, unsigned count);
 
 #endif
@@ -0,0 +1,331 @@
+/* File that contains the sharded mode of the server. With -t the server
+ * runs several reactor threads. Each binds its own listening socket to the
+ * port with SO_REUSEPORT, so the kernel spreads new connections between
+ * them, and owns its own connection table and event loop. A broadcast is
+ * written to the shard's own clients directly and handed to every other
+ * shard through that shard's mailbox, a lock-free queue with a single
+ * consumer, so the messages of every sender arrive in the order they were
+ * sent. Joins, departures and commands may touch users on any shard and
+ * therefore hold the room lock.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "shards.h"
+#include "server.h"
+#include "connections.h"
+#include "event_loop.h"
+#include "user_utils.h"
+#include "client_server_utils.h"
+#include "metrics.h"
+
+void *run_shard (void *argument);
+
+void init_mailbox (struct mailbox *box);
+
+void link_mail (struct mailbox *box, struct mail *mail);
+
+void post_mail (struct mailbox *box, struct mail *mail);
+
+struct mail *take_mail (struct mailbox *box);
+
+struct mail_payload *create_payload (enum MAIL_TYPE type, struct name_info *sender, struct outbound *message);
+
+void post_payload (struct mail_payload *payload);
+
+void release_payload (struct mail_payload *payload);
+
+void shard_error (char *reason);
+
+/* The number of reactor threads. */
+unsigned shard_count = 1;
+
+/* Array of every shard. */
+struct shard *shards;
+
+/* The shard run by the calling thread. */
+__thread struct shard *current_shard;
+
+/* Lock held while joining, leaving or handling a command. */
+pthread_mutex_t room_lock;
+
+/* The spare payloads of the calling shard. A payload goes to the pool of
+ * the shard that handles it last, whichever shard posted it. */
+__thread struct mail_payload *spare_payloads;
+__thread unsigned spare_payload_count;
+
+/*
+ * Function: start_shards
+ * ----------------------
+ * creates every shard along with its mailbox, starts a thread for each
+ * shard but the first and runs the first on the calling thread. Each
+ * thread uses the backend that was selected on the command line.
+ *
+ * port: the port every shard listens on
+ *
+ * returns: never
+ */
+void start_shards (int port) {
+	pthread_mutexattr_t attributes;
+	pthread_mutexattr_init (&attributes);
+	pthread_mutexattr_settype (&attributes, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init (&room_lock, &attributes);
+	pthread_mutexattr_destroy (&attributes);
+	shards = calloc (shard_count, sizeof (struct shard));
+	if (shards == NULL) {
+		allocation_failed ();
+	}
+	for (unsigned i = 0; i < shard_count; i++) {
+		shards[i].id = i;
+		shards[i].port = port;
+		shards[i].backend = event_backend;
+		init_mailbox (&shards[i].mailbox);
+	}
+	for (unsigned i = 1; i < shard_count; i++) {
+		if (pthread_create (&shards[i].thread, NULL, run_shard, &shards[i]) != 0) {
+			shard_error ("Unable to start shard thread");
+		}
+	}
+	shards[0].thread = pthread_self ();
+	run_shard (&shards[0]);
+}
+
+/* Function that runs one shard on the calling thread. */
+void *run_shard (void *argument) {
+	current_shard = argument;
+	event_backend = current_shard->backend;
+	current_shard->accept_stats = &accept_stats;
+	current_shard->output_stats = &output_stats;
+	current_shard->metrics = &shard_metrics;
+	handle_connections (current_shard->port);
+	return NULL;
+}
+
+/* Function that takes the room lock. */
+void lock_room () {
+	pthread_mutex_lock (&room_lock);
+}
+
+/* Function that releases the room lock. */
+void unlock_room () {
+	pthread_mutex_unlock (&room_lock);
+}
+
+/*
+ * Function: post_broadcast
+ * ------------------------
+ * posts a message to the mailbox of every other shard. The shards share
+ * the message with the current one rather than copying it.
+ *
+ * message: the message to send
+ * sender: name of the user whose mutes apply, or NULL
+ *
+ * returns: void
+ */
+void post_broadcast (struct outbound *message, struct name_info *sender) {
+	post_payload (create_payload (Broadcast_Mail, sender, message));
+}
+
+/*
+ * Function: release_name_info
+ * ---------------------------
+ * frees the name info of a user who left once no shard refers to it any
+ * longer. The forget is queued behind every broadcast the user sent, so no
+ * shard sees the name after it was freed.
+ *
+ * info: the name info of the user who left
+ *
+ * returns: void
+ */
+void release_name_info (struct name_info *info) {
+	if (shard_count == 1) {
+		cleanup_name_info (info);
+		return;
+	}
+	post_payload (create_payload (Forget_Mail, info, NULL));
+}
+
+/*
+ * Function: handle_mailbox
+ * ------------------------
+ * reads the eventfd of the current shard's mailbox, resetting it, and then
+ * handles all mail.
+ *
+ * returns: void
+ */
+void handle_mailbox () {
+	uint64_t count;
+	if (read (current_shard->mailbox.event_fd, &count, sizeof (count)) == -1) {
+		return;
+	}
+	drain_mailbox ();
+}
+
+/*
+ * Function: drain_mailbox
+ * -----------------------
+ * handles every mail in the current shard's mailbox. A broadcast is
+ * written to the local clients and a forget removes the name from the mute
+ * lists of the local users. signalled is cleared before the queue is read
+ * so a producer that finds it clear afterwards wakes the shard again.
+ *
+ * returns: void
+ */
+void drain_mailbox () {
+	struct mailbox *box = &current_shard->mailbox;
+	__atomic_store_n (&box->signalled, 0, __ATOMIC_SEQ_CST);
+	struct mail *mail;
+	while ((mail = take_mail (box)) != NULL) {
+		struct mail_payload *payload = mail->payload;
+		if (payload->type == Broadcast_Mail) {
+			deliver_message (payload->message, MAILBOX_INDEX, payload->sender);
+		} else {
+			forget_muted (payload->sender);
+		}
+		if (__atomic_sub_fetch (&payload->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+			if (payload->type == Forget_Mail) {
+				cleanup_name_info (payload->sender);
+			}
+			release_payload (payload);
+		}
+	}
+}
+
+/* Function that creates the eventfd of a mailbox and empties it. */
+void init_mailbox (struct mailbox *box) {
+	box->stub.next = NULL;
+	box->head = &box->stub;
+	box->tail = &box->stub;
+	box->signalled = 0;
+	box->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (box->event_fd == -1) {
+		shard_error ("Unable to create shard mailbox");
+	}
+}
+
+/* Function that appends mail to a mailbox. Safe to call from any number of
+ * threads at once. */
+void link_mail (struct mailbox *box, struct mail *mail) {
+	__atomic_store_n (&mail->next, NULL, __ATOMIC_RELAXED);
+	struct mail *previous = __atomic_exchange_n (&box->head, mail, __ATOMIC_ACQ_REL);
+	__atomic_store_n (&previous->next, mail, __ATOMIC_SEQ_CST);
+}
+
+/* Function that appends mail to a mailbox and wakes its shard unless it
+ * was already woken. */
+void post_mail (struct mailbox *box, struct mail *mail) {
+	link_mail (box, mail);
+	if (__atomic_exchange_n (&box->signalled, 1, __ATOMIC_SEQ_CST) == 0) {
+		uint64_t one = 1;
+		if (write (box->event_fd, &one, sizeof (one)) == -1) {
+			shard_error ("Unable to wake shard");
+		}
+	}
+}
+
+/* Function that wakes shard through its mailbox without giving it any
+ * mail, so that its event loop runs its mailbox handler. */
+void wake_shard (struct shard *shard) {
+	uint64_t one = 1;
+	if (write (shard->mailbox.event_fd, &one, sizeof (one)) == -1) {
+		shard_error ("Unable to wake shard");
+	}
+}
+
+/* Function that removes the oldest mail from a mailbox. Returns NULL if it
+ * is empty or if the next mail is still being linked, in which case its
+ * producer wakes the shard again once it is done. Must only be called by
+ * the shard owning the mailbox. */
+struct mail *take_mail (struct mailbox *box) {
+	struct mail *tail = box->tail;
+	struct mail *next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+	if (tail == &box->stub) {
+		if (next == NULL) {
+			return NULL;
+		}
+		box->tail = next;
+		tail = next;
+		next = __atomic_load_n (&next->next, __ATOMIC_ACQUIRE);
+	}
+	if (next != NULL) {
+		box->tail = next;
+		return tail;
+	}
+	if (tail != __atomic_load_n (&box->head, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	link_mail (box, &box->stub);
+	next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+	if (next != NULL) {
+		box->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/* Function that takes a payload for every other shard along with its
+ * mails in a single block from the pool, allocating one if the pool is
+ * empty. A broadcast holds a reference to its message until the last
+ * shard is done with it. */
+struct mail_payload *create_payload (enum MAIL_TYPE type, struct name_info *sender, struct outbound *message) {
+	struct mail_payload *payload = spare_payloads;
+	if (payload != NULL) {
+		spare_payloads = payload->next;
+		spare_payload_count--;
+	} else {
+		payload = malloc (sizeof (struct mail_payload) + sizeof (struct mail) * shard_count);
+		if (payload == NULL) {
+			allocation_failed ();
+		}
+	}
+	payload->remaining = shard_count - 1;
+	payload->type = type;
+	payload->sender = sender;
+	payload->message = message;
+	if (message != NULL) {
+		hold_outbound (message);
+	}
+	return payload;
+}
+
+/* Function that posts a payload to the mailbox of every shard other than
+ * the current one. */
+void post_payload (struct mail_payload *payload) {
+	for (unsigned i = 0; i < shard_count; i++) {
+		if (i == current_shard->id) {
+			continue;
+		}
+		payload->mails[i].payload = payload;
+		post_mail (&shards[i].mailbox, &payload->mails[i]);
+	}
+}
+
+/* Function that keeps a payload every shard is done with in the pool of
+ * the calling shard, dropping the reference to its message, or frees it
+ * if the pool is full. */
+void release_payload (struct mail_payload *payload) {
+	if (payload->message != NULL) {
+		release_outbound (payload->message);
+	}
+	if (spare_payload_count < PAYLOAD_POOL_LIMIT) {
+		payload->next = spare_payloads;
+		spare_payloads = payload;
+		spare_payload_count++;
+	} else {
+		free (payload);
+	}
+}
+
+/* Function to handle an error that occurs when running the shards. */
+void shard_error (char *reason) {
+	fprintf (stderr, "%s\n", reason);
+	exit (1);
+}
@@ -0,0 +1,131 @@
+/* File that contains the sharded mode of the server. With -t the server
+ * runs several reactor threads. Each binds its own listening socket to the
+ * port with SO_REUSEPORT, so the kernel spreads new connections between
+ * them, and owns its own connection table and event loop. A broadcast is
+ * written to the shard's own clients directly and handed to every other
+ * shard through that shard's mailbox, a lock-free queue with a single
+ * consumer, so the messages of every sender arrive in the order they were
+ * sent. Joins, departures and commands may touch users on any shard and
+ * therefore hold the room lock.
+ * Author: Yuriy Bash */
+
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include "client_server_utils.h"
+#include "server.h"
+#include "user_utils.h"
+#include "event_loop.h"
+#include "output.h"
+
+/* The maximum number of shards that can be requested with -t. */
+#define MAX_SHARDS 64
+
+/* The most spare payloads a shard keeps for the broadcasts it posts. */
+#define PAYLOAD_POOL_LIMIT 256
+
+/* The index the event loops use for the mailbox, which is not a
+ * connection. */
+#define MAILBOX_INDEX 0xffffffff
+
+enum MAIL_TYPE {Broadcast_Mail=0, Forget_Mail=1};
+
+/* An entry in a mailbox. One is allocated per receiving shard together
+ * with the payload it points to. */
+struct mail {
+	struct mail *next;
+	struct mail_payload *payload;
+};
+
+/* What is sent to the other shards. A broadcast carries a reference to
+ * the outbound message and the name of the user who sent it, or NULL if
+ * mutes do not apply. A forget carries the name of a user who left so that
+ * every shard can drop it from the mute lists of its users. remaining
+ * counts the shards that have not yet handled the payload; the last one
+ * frees it, or keeps it in its pool of spare payloads, which next links. */
+struct mail_payload {
+	struct mail_payload *next;
+	unsigned remaining;
+	enum MAIL_TYPE type;
+	struct name_info *sender;
+	struct outbound *message;
+	struct mail mails[];
+};
+
+/* A queue with many producers and one consumer. Producers exchange head
+ * and then link the previous entry to theirs, the consumer follows the
+ * links from tail. stub keeps the queue from ever being empty. event_fd is
+ * an eventfd watched by the shard's event loop, written only when
+ * signalled was clear so a burst of mail costs one wakeup. */
+struct mailbox {
+	struct mail *head;
+	struct mail *tail;
+	struct mail stub;
+	fd_t event_fd;
+	int signalled;
+};
+
+/* State of one reactor thread. epoll_fd and listener are the epoll
+ * instance and server socket of an epoll shard, and accept_stalled is set
+ * while an edge triggered server socket or an io_uring accept has stopped
+ * accepting because the server is full, so that whichever shard releases a
+ * connection can resume it. */
+struct shard {
+	pthread_t thread;
+	unsigned id;
+	int port;
+	enum EVENT_BACKEND backend;
+	fd_t epoll_fd;
+	fd_t listener;
+	bool accept_stalled;
+	struct mailbox mailbox;
+	struct accept_statistics *accept_stats;
+	struct output_statistics *output_stats;
+	struct metrics *metrics;
+};
+
+/* The number of reactor threads, 1 unless given with -t. */
+extern unsigned shard_count;
+
+/* Array of every shard. */
+extern struct shard *shards;
+
+/* The shard run by the calling thread. */
+extern __thread struct shard *current_shard;
+
+/* Function that creates shard_count shards listening on port, runs every
+ * shard but the first on its own thread and then runs the first on the
+ * calling thread. Never returns. */
+void start_shards (int port);
+
+/* Function that takes the room lock, which must be held while joining,
+ * leaving or handling a command. The lock is recursive. */
+void lock_room ();
+
+/* Function that releases the room lock. */
+void unlock_room ();
+
+/* Function that hands message to every other shard to be delivered to its
+ * clients, skipping those who muted sender unless sender is NULL. */
+void post_broadcast (struct outbound *message, struct name_info *sender);
+
+/* Function that tells every other shard that the user with name info left
+ * and frees info once all of them have removed it from their mute lists.
+ * With a single shard info is freed right away. */
+void release_name_info (struct name_info *info);
+
+/* Function that wakes shard through its mailbox without giving it any
+ * mail, so that its event loop runs its mailbox handler. */
+void wake_shard (struct shard *shard);
+
+/* Function that consumes the wakeup of the mailbox of the current shard
+ * and then handles all of its mail. Used by the readiness backends. */
+void handle_mailbox ();
+
+/* Function that handles all mail of the current shard once its wakeup
+ * has already been consumed. */
+void drain_mailbox ();
+
+#endif
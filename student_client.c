@@ -60,14 +60,13 @@ void process_input () {
  * Exit_Message, see the enum in client_server_utils.h). If exit, handle_exit
  * is called, otherwise the message is output (without leading byte).
  *
- * msg: an entire message from the server
+ * msg: an entire message from the server, which stays owned by the caller
  *
  * returns: void
  */
 void handle_server_message (char *msg) {
         clear_prefix ();
         if (msg[0] == Exit_Message) {
-		free (msg);
                 handle_exit ();
         } else {
             clear_prefix();
@@ -0,0 +1,222 @@
+/* Benchmark that counts the heap allocations the server makes per chat
+ * message and per command. It runs testing/counting_server, the server
+ * linked with malloc_count.c, joins a set of clients and has every client
+ * send chat lines and then status commands while reading everything sent
+ * back. Both phases are run once first so that the queues and pools of the
+ * server have grown to what the load needs before anything is counted.
+ * The allocation count is read before and after each phase by sending the
+ * server SIGUSR2. Run the benchmark from the top of the repository.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include "bench_utils.h"
+
+#define DEFAULT_MESSAGES 1000
+
+#define CLIENTS 8
+
+#define ROUND 10
+
+#define TIMEOUT_SECONDS 60
+
+/* The configurations the server is run with. */
+char *configurations[][4] = {
+	{"select", "-b", "select", "1"},
+	{"epoll", "-b", "epoll", "1"},
+	{"uring", "-b", "uring", "1"},
+	{"epoll x2", "-b", "epoll", "2"},
+};
+
+/* The client sockets. */
+int clients[CLIENTS];
+
+/* The pipe the stderr of the server goes to. */
+int server_errors;
+
+void start_counting_server (char **configuration, int port);
+
+void join_clients (int port);
+
+unsigned long read_allocations ();
+
+void run_phase (unsigned messages, bool commands);
+
+void send_all (int fd, char *data, size_t length);
+
+int main (int argc, char *argv[]) {
+	unsigned messages = DEFAULT_MESSAGES;
+	if (argc == 2) {
+		messages = atoi (argv[1]);
+	}
+	signal (SIGPIPE, SIG_IGN);
+	printf ("%d clients, %u messages and %u commands per client, %d at a time\n", CLIENTS, messages, messages, ROUND);
+	printf ("%-10s %16s %16s\n", "server", "mallocs/message", "mallocs/command");
+	fflush (stdout);
+	for (unsigned i = 0; i < sizeof (configurations) / sizeof (configurations[0]); i++) {
+		int port = 20000 + (getpid () % 20000) + i;
+		start_counting_server (configurations[i], port);
+		join_clients (port);
+		run_phase (messages, false);
+		run_phase (messages, true);
+		unsigned long before = read_allocations ();
+		run_phase (messages, false);
+		unsigned long between = read_allocations ();
+		run_phase (messages, true);
+		unsigned long after = read_allocations ();
+		unsigned long sent = (unsigned long) CLIENTS * messages;
+		printf ("%-10s %16.3f %16.3f\n", configurations[i][0], (double) (between - before) / sent,
+			(double) (after - between) / sent);
+		fflush (stdout);
+		for (unsigned n = 0; n < CLIENTS; n++) {
+			close (clients[n]);
+		}
+		stop_server (NULL);
+		close (server_errors);
+	}
+	return 0;
+}
+
+/* Function that starts testing/counting_server with the given backend and
+ * number of shards, discarding its output but keeping its stderr, where the
+ * allocation counts are written. */
+void start_counting_server (char **configuration, int port) {
+	int errors[2];
+	if (pipe2 (errors, O_CLOEXEC) == -1) {
+		bench_error ("Unable to create pipe");
+	}
+	char connection_arg[16];
+	char port_arg[16];
+	sprintf (connection_arg, "%d", CLIENTS + 8);
+	sprintf (port_arg, "%d", port);
+	char *arguments[] = {"counting_server", configuration[1], configuration[2], "-t", configuration[3],
+		"-c", connection_arg, port_arg, NULL};
+	start_server ("./testing/counting_server", arguments, errors[1]);
+	close (errors[1]);
+	server_errors = errors[0];
+}
+
+/* Function that connects and names every client and then empties what the
+ * joins sent them. */
+void join_clients (int port) {
+	connect_clients (clients, CLIENTS, port);
+	for (unsigned n = 0; n < CLIENTS; n++) {
+		fcntl (clients[n], F_SETFL, fcntl (clients[n], F_GETFL) | O_NONBLOCK);
+	}
+	/* Give the last join time to reach everyone before counting starts. */
+	usleep (300000);
+	char buffer[65536];
+	for (unsigned n = 0; n < CLIENTS; n++) {
+		while (read (clients[n], buffer, sizeof (buffer)) > 0);
+	}
+}
+
+/* Function that has the server write its allocation count and returns it. */
+unsigned long read_allocations () {
+	kill (server, SIGUSR2);
+	char line[256];
+	size_t length = 0;
+	while (true) {
+		ssize_t received = read (server_errors, line + length, 1);
+		if (received != 1) {
+			bench_error ("Unable to read allocation count");
+		}
+		if (line[length] != '\n') {
+			length = length + 1 < sizeof (line) - 1 ? length + 1 : 0;
+			continue;
+		}
+		line[length] = 0;
+		length = 0;
+		unsigned long count;
+		if (sscanf (line, "allocations %lu", &count) == 1) {
+			return count;
+		}
+	}
+}
+
+/* Function that has every client send messages chat lines, or messages
+ * status commands, ROUND at a time, reading after each round until every
+ * line the server sent back has arrived, the way a busy room talks rather
+ * than a flood. A chat line reaches every other client, a \show_status
+ * brings back three lines and every tenth command is a \show_all_statuses,
+ * which brings back three lines per client. */
+void run_phase (unsigned messages, bool commands) {
+	struct pollfd polled[CLIENTS];
+	for (unsigned n = 0; n < CLIENTS; n++) {
+		polled[n].fd = clients[n];
+		polled[n].events = POLLIN;
+	}
+	char line[64];
+	char buffer[65536];
+	time_t start = time (NULL);
+	for (unsigned first = 0; first < messages; first += ROUND) {
+		unsigned long expected = 0;
+		for (unsigned i = first; i < messages && i < first + ROUND; i++) {
+			for (unsigned n = 0; n < CLIENTS; n++) {
+				int length;
+				if (!commands) {
+					length = sprintf (line, "message %u\n", i);
+					expected += CLIENTS - 1;
+				} else if (i % 10 == 9) {
+					length = sprintf (line, "\\show_all_statuses\n");
+					expected += 3 * CLIENTS;
+				} else {
+					length = sprintf (line, "\\show_status bench%u\n", (n + i) % CLIENTS);
+					expected += 3;
+				}
+				send_all (clients[n], line, length);
+			}
+		}
+		unsigned long received_lines = 0;
+		while (received_lines < expected) {
+			if (time (NULL) - start > TIMEOUT_SECONDS) {
+				bench_error ("Timed out waiting for the server");
+			}
+			if (poll (polled, CLIENTS, 1000) <= 0) {
+				continue;
+			}
+			for (unsigned n = 0; n < CLIENTS; n++) {
+				if (!(polled[n].revents & POLLIN)) {
+					continue;
+				}
+				ssize_t received = read (clients[n], buffer, sizeof (buffer));
+				if (received == 0 || (received == -1 && errno != EAGAIN)) {
+					bench_error ("Server closed a client");
+				}
+				for (ssize_t i = 0; i < received; i++) {
+					received_lines += buffer[i] == '\n';
+				}
+			}
+		}
+	}
+}
+
+/* Function that writes all of data to a client, waiting while its socket
+ * is full. The server keeps reading while clients write, so the wait never
+ * lasts. */
+void send_all (int fd, char *data, size_t length) {
+	while (length > 0) {
+		ssize_t written = write (fd, data, length);
+		if (written == -1 && errno == EAGAIN) {
+			struct pollfd polled = {fd, POLLOUT, 0};
+			poll (&polled, 1, 1000);
+			continue;
+		}
+		if (written <= 0) {
+			bench_error ("Unable to send to server");
+		}
+		data += written;
+		length -= written;
+	}
+}
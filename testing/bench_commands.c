@@ -0,0 +1,173 @@
+/* Benchmark that measures how many commands per second the server can
+ * split and look up. The way the server used to do it, with strtok over
+ * the receive buffer, isknowncommand comparing the name with every command
+ * and handle_command comparing it again, is timed against split_command,
+ * which tokenizes in one pass without modifying the message and finds the
+ * command with a perfect hash. Both are given the same mix of commands,
+ * including unknown and malformed ones, and must agree on every one of
+ * them. Every message is copied before it is parsed since strtok writes
+ * into it, and the copy is made for both so only the parsing differs.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "../command_parse.h"
+
+#define DEFAULT_ITERATIONS 200000
+
+#define WHITESPACE_SET " \f\n\r\t\v"
+
+/* The commands parsed, in the proportions a busy room might send them. */
+char *lines[] = {
+	"\\show_status alice\n",
+	"\\show_all_statuses\n",
+	"\\mute bob\n",
+	"\\unmute bob\n",
+	"\\set_nickname alice al\n",
+	"\\clear_nickname alice\n",
+	"\\rename carol\n",
+	"  \\show_status   some_long_user_name_42  \n",
+	"\\show_all_statuses 3\n",
+	"\\exit\n",
+	"\\bogus a b\n",
+	"\\mute al!ce\n",
+	"\\set_nickname a b c\n",
+	"\\show-status x\n",
+};
+
+#define LINE_COUNT (sizeof (lines) / sizeof (lines[0]))
+
+/* The copy of a line that is parsed. */
+char scratch[MAX_MESSAGE_LENGTH + 1];
+
+/* Sum of every command index and argument count found, printed so the
+ * work cannot be skipped. */
+long checksum;
+
+enum COMMAND_PARSE strtok_command (char *message, struct parsed_command *parsed);
+
+int strcmp_find_command (char *name);
+
+double time_parser (enum COMMAND_PARSE (*parser) (char *, struct parsed_command *), unsigned iterations);
+
+void check_parsers ();
+
+double elapsed_ns (struct timespec *start, struct timespec *end);
+
+int main (int argc, char *argv[]) {
+	unsigned iterations = DEFAULT_ITERATIONS;
+	if (argc == 2) {
+		iterations = atoi (argv[1]);
+	}
+	check_parsers ();
+	double old = time_parser (strtok_command, iterations);
+	double new = time_parser (split_command, iterations);
+	printf ("%u commands of %zu kinds\n", iterations * (unsigned) LINE_COUNT, LINE_COUNT);
+	printf ("%-14s %14s %16s\n", "parser", "ns/command", "commands/s");
+	printf ("%-14s %14.1f %16.0f\n", "strtok+strcmp", old, 1e9 / old);
+	printf ("%-14s %14.1f %16.0f\n", "split+hash", new, 1e9 / new);
+	fprintf (stderr, "checksum %ld\n", checksum);
+	return 0;
+}
+
+/* Function that returns the average time to parse one of the lines with
+ * parser in ns. */
+double time_parser (enum COMMAND_PARSE (*parser) (char *, struct parsed_command *), unsigned iterations) {
+	struct parsed_command parsed;
+	struct timespec start;
+	struct timespec end;
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (unsigned i = 0; i < iterations; i++) {
+		for (unsigned l = 0; l < LINE_COUNT; l++) {
+			strcpy (scratch, lines[l]);
+			checksum += parser (scratch, &parsed) + parsed.command + parsed.count;
+		}
+	}
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	return elapsed_ns (&start, &end) / ((double) iterations * LINE_COUNT);
+}
+
+/* Function that makes sure both parsers give the same result for every
+ * line, exiting if they do not. */
+void check_parsers () {
+	struct parsed_command old;
+	struct parsed_command new;
+	for (unsigned l = 0; l < LINE_COUNT; l++) {
+		strcpy (scratch, lines[l]);
+		enum COMMAND_PARSE old_result = strtok_command (scratch, &old);
+		enum COMMAND_PARSE new_result = split_command (lines[l], &new);
+		bool same = old_result == new_result && strcmp (old.name, new.name) == 0;
+		if (same && old_result == Parsed_Command) {
+			same = old.command == new.command && old.count == new.count;
+			for (unsigned i = 0; same && i < old.count; i++) {
+				same = strcmp (old.args[i], new.args[i]) == 0;
+			}
+		}
+		if (!same) {
+			fprintf (stderr, "Parsers disagree on %s", lines[l]);
+			exit (1);
+		}
+	}
+}
+
+/* Function that splits a command the way parse_command used to, leaving the
+ * name and the arguments in the message, which strtok modifies. */
+enum COMMAND_PARSE strtok_command (char *message, struct parsed_command *parsed) {
+	int i = 0;
+	while (message[i] != '\\') {
+		i++;
+	}
+	char *name = strtok (message + i + 1, WHITESPACE_SET);
+	parsed->name = name;
+	parsed->count = 0;
+	parsed->command = -1;
+	int end = 0;
+	while (isalnum ((unsigned char) name[end]) || name[end] == '_') {
+		end++;
+	}
+	if (name[end] != 0) {
+		name[end] = 0;
+		return strcmp_find_command (name) == -1 ? Unknown_Command : Invalid_Arguments;
+	}
+	if (strcmp_find_command (name) == -1) {
+		return Unknown_Command;
+	}
+	char *arg;
+	while (parsed->count < ARGUMENT_LIMIT && (arg = strtok (NULL, WHITESPACE_SET)) != NULL) {
+		parsed->args[parsed->count] = arg;
+		parsed->count++;
+		for (int c = 0; arg[c] != 0; c++) {
+			if (!isalnum ((unsigned char) arg[c]) && arg[c] != '_') {
+				return Invalid_Arguments;
+			}
+		}
+	}
+	if (parsed->count == ARGUMENT_LIMIT) {
+		return Invalid_Arguments;
+	}
+	/* handle_command searched the list a second time. */
+	parsed->command = strcmp_find_command (name);
+	return Parsed_Command;
+}
+
+/* Function that finds a command by comparing its name with every command,
+ * as isknowncommand and handle_command did. */
+int strcmp_find_command (char *name) {
+	for (int i = 0; i < COMMAND_COUNT; i++) {
+		if (strcmp (name, commands[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Function that returns the time between start and end in ns. */
+double elapsed_ns (struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
@@ -0,0 +1,71 @@
+"""Compares two result files written by testing/bench_suite and flags the
+scenarios that got worse. Throughput that fell, or CPU per delivery or peak
+RSS that grew, by more than the threshold is a regression, as is latency
+that grew by more than the latency threshold, which is looser since
+latency percentiles are noisier. Exits with status 1 if anything regressed.
+Author: Yuriy Bash"""
+
+from __future__ import print_function
+
+import argparse, json, sys
+
+# (label, path within a scenario, whether higher is better, whether it is a
+# latency)
+METRICS = [
+    ("messages/s", ("load", "messages_per_s"), True, False),
+    ("deliveries/s", ("load", "deliveries_per_s"), True, False),
+    ("p50 us", ("load", "latency_us", "p50"), False, True),
+    ("p99 us", ("load", "latency_us", "p99"), False, True),
+    ("p999 us", ("load", "latency_us", "p999"), False, True),
+    ("cpu us/delivery", ("server_cpu_us_per_delivery",), False, False),
+    ("rss kb", ("server_rss_kb",), False, False),
+]
+
+
+def lookup (scenario, path):
+    value = scenario
+    for key in path:
+        value = value.get (key) if isinstance (value, dict) else None
+    return value
+
+
+def load_scenarios (filename):
+    with open (filename) as results:
+        return dict ((scenario["name"], scenario) for scenario in json.load (results)["scenarios"])
+
+
+def main ():
+    parser = argparse.ArgumentParser (description="Compare two benchmark result files.")
+    parser.add_argument ("baseline", help="results of the earlier run")
+    parser.add_argument ("current", help="results of the run being checked")
+    parser.add_argument ("--threshold", type=float, default=10.0,
+        help="percent change in throughput, CPU or RSS that is a regression (default 10)")
+    parser.add_argument ("--latency-threshold", type=float, default=25.0,
+        help="percent growth in a latency percentile that is a regression (default 25)")
+    arguments = parser.parse_args ()
+    baseline = load_scenarios (arguments.baseline)
+    current = load_scenarios (arguments.current)
+    regressions = 0
+    print ("%-14s %-16s %14s %14s %9s" % ("scenario", "metric", "baseline", "current", "change"))
+    for name in sorted (set (baseline) & set (current)):
+        for label, path, higher_better, is_latency in METRICS:
+            before = lookup (baseline[name], path)
+            after = lookup (current[name], path)
+            if before is None or after is None:
+                continue
+            change = (after - before) * 100.0 / before if before else 0.0
+            threshold = arguments.latency_threshold if is_latency else arguments.threshold
+            worse = -change if higher_better else change
+            flag = ""
+            if worse > threshold:
+                flag = "REGRESSION"
+                regressions += 1
+            print ("%-14s %-16s %14.2f %14.2f %+8.1f%% %s" % (name, label, before, after, change, flag))
+    for name in sorted (set (baseline) ^ set (current)):
+        print ("%-14s only in %s" % (name, arguments.baseline if name in baseline else arguments.current))
+    print ("%d regressions" % regressions)
+    sys.exit (1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main ()
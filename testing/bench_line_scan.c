@@ -0,0 +1,148 @@
+/* Benchmark that measures how long it takes to find every message in a full
+ * receive buffer as the size of the messages changes. find_message_end is
+ * timed the way the server used to call it, restarting after every message,
+ * both alone and together with generate_message, which copied each message
+ * out and shifted the rest of the buffer. Every implementation behind
+ * find_line_ends the processor supports is then timed on the same buffer.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "../client_server_utils.h"
+#include "../line_scan.h"
+
+#define DEFAULT_ITERATIONS 200000
+
+unsigned message_sizes[] = {4, 16, 64, 256, 1024};
+
+typedef int (*line_scanner) (char *buffer, int start, int end, int *positions, int capacity);
+
+/* A full receive buffer of messages of a single size. */
+char contents[MAX_MESSAGE_LENGTH + 1];
+
+/* A copy of contents that generate_message may modify. */
+char scratch[MAX_MESSAGE_LENGTH + 1];
+
+/* Sum of every position found, printed so the work cannot be skipped. */
+long checksum;
+
+void fill_contents (unsigned size);
+
+double time_find_message_end (unsigned iterations);
+
+double time_generate_message (unsigned iterations);
+
+double time_scanner (line_scanner scanner, unsigned iterations);
+
+double elapsed_ns (struct timespec *start, struct timespec *end);
+
+int main (int argc, char *argv[]) {
+	unsigned iterations = DEFAULT_ITERATIONS;
+	if (argc == 2) {
+		iterations = atoi (argv[1]);
+	}
+	char *names[] = {"scalar", "sse2", "avx2"};
+	line_scanner scanners[] = {find_line_ends_scalar, find_line_ends_sse2, find_line_ends_avx2};
+	printf ("ns per %d byte buffer, find_line_ends uses %s\n", MAX_MESSAGE_LENGTH, line_scan_implementation ());
+	printf ("%-8s %12s %12s", "size", "find_end", "find+gen");
+	for (unsigned i = 0; i < 3; i++) {
+		printf (" %12s", names[i]);
+	}
+	printf ("\n");
+	for (unsigned s = 0; s < sizeof (message_sizes) / sizeof (unsigned); s++) {
+		fill_contents (message_sizes[s]);
+		printf ("%-8u %12.0f %12.0f", message_sizes[s], time_find_message_end (iterations),
+			time_generate_message (iterations / 10 + 1));
+		for (unsigned i = 0; i < 3; i++) {
+			if (line_scan_supports (names[i])) {
+				printf (" %12.0f", time_scanner (scanners[i], iterations));
+			} else {
+				printf (" %12s", "n/a");
+			}
+		}
+		printf ("\n");
+		fflush (stdout);
+	}
+	fprintf (stderr, "checksum %ld\n", checksum);
+	return 0;
+}
+
+/* Function that fills the buffer with messages of size bytes, each ending in
+ * a newline, followed by part of one more. */
+void fill_contents (unsigned size) {
+	for (unsigned i = 0; i < MAX_MESSAGE_LENGTH; i++) {
+		contents[i] = i % size == size - 1 ? '\n' : 'a' + i % 26;
+	}
+	contents[MAX_MESSAGE_LENGTH] = 0;
+}
+
+/* Function that returns the average time to find every message with
+ * find_message_end in ns. */
+double time_find_message_end (unsigned iterations) {
+	struct timespec start;
+	struct timespec end;
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (unsigned i = 0; i < iterations; i++) {
+		int location;
+		int from = 0;
+		while ((location = find_message_end (contents, from)) != -1) {
+			checksum += location;
+			from = location + 1;
+		}
+	}
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	return elapsed_ns (&start, &end) / iterations;
+}
+
+/* Function that returns the average time to take every message out of the
+ * buffer with find_message_end and generate_message in ns. */
+double time_generate_message (unsigned iterations) {
+	struct timespec start;
+	struct timespec end;
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (unsigned i = 0; i < iterations; i++) {
+		memcpy (scratch, contents, sizeof (contents));
+		int location;
+		while ((location = find_message_end (scratch, 0)) != -1) {
+			char *message = generate_message (scratch, location + 1);
+			checksum += message[0];
+			free (message);
+		}
+	}
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	return elapsed_ns (&start, &end) / iterations;
+}
+
+/* Function that returns the average time to find every message with one
+ * of the implementations of find_line_ends in ns. */
+double time_scanner (line_scanner scanner, unsigned iterations) {
+	int positions[LINE_BATCH];
+	struct timespec start;
+	struct timespec end;
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (unsigned i = 0; i < iterations; i++) {
+		int from = 0;
+		int found;
+		do {
+			found = scanner (contents, from, MAX_MESSAGE_LENGTH, positions, LINE_BATCH);
+			for (int p = 0; p < found; p++) {
+				checksum += positions[p];
+			}
+			if (found > 0) {
+				from = positions[found - 1] + 1;
+			}
+		} while (found == LINE_BATCH);
+	}
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	return elapsed_ns (&start, &end) / iterations;
+}
+
+/* Function that returns the time between start and end in ns. */
+double elapsed_ns (struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
@@ -0,0 +1,411 @@
+/* Benchmark of the small helpers every message passes through: finding
+ * message ends and cutting messages out of a receive buffer the way the
+ * client used to, building outbound messages, checking names and commands,
+ * tokenizing commands and checking mutes. Each is fed inputs drawn once,
+ * with a fixed seed, from distributions a busy room might produce: chat
+ * lines that are mostly short with a long tail, names that are mostly
+ * valid, lines that are now and then commands and a room of users that
+ * have each muted a few others. The benchmark pins itself to one CPU and
+ * reports, for each helper, the time, the cycles and the allocations per
+ * operation. Cycles are read from the hardware counter when perf events
+ * are available and from the time stamp counter otherwise, which counts
+ * at a fixed rate rather than the core's. Allocations are counted by
+ * linking with testing/malloc_count.c, like bench_allocations, and the
+ * whole server is linked in so that each helper runs exactly as the
+ * server runs it.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined (__x86_64__) || defined (__i386__)
+#include <x86intrin.h>
+#endif
+#include "../client_server_utils.h"
+#include "../server_utils.h"
+#include "../command_utils.h"
+#include "../command_parse.h"
+#include "../user_utils.h"
+#include "../output.h"
+
+#define DEFAULT_ITERATIONS 1000000
+
+/* The number of inputs drawn for each helper, a power of two. */
+#define INPUT_COUNT 4096
+
+/* The bytes of chat lines the client cuts apart per refill, about what one
+ * read returns under load. */
+#define BUFFER_BYTES 4096
+
+/* The users in the room ismuted is asked about and the chance, one in
+ * this many, that one has muted another. */
+#define ROOM_USERS 1024
+#define MUTE_ODDS 64
+
+/* Where the cycles come from. */
+enum CYCLE_SOURCE {Perf_Cycles=0, Tsc_Cycles=1, No_Cycles=2};
+
+/* A helper being measured. run performs the given number of operations
+ * and returns how many it performed. */
+struct benchmark {
+	char *name;
+	unsigned long (*run) (unsigned long operations);
+};
+
+/* Provided by testing/malloc_count.c. */
+extern unsigned long allocations;
+
+unsigned long run_find_message_end (unsigned long operations);
+
+unsigned long run_generate_message (unsigned long operations);
+
+unsigned long run_create_message (unsigned long operations);
+
+unsigned long run_isword (unsigned long operations);
+
+unsigned long run_iscommand (unsigned long operations);
+
+unsigned long run_split_command (unsigned long operations);
+
+unsigned long run_ismuted (unsigned long operations);
+
+void prepare_inputs ();
+
+unsigned draw_line_length ();
+
+void draw_word (char *word, unsigned length);
+
+void pin_cpu (int cpu);
+
+void open_cycle_counter ();
+
+unsigned long read_cycles ();
+
+unsigned long next_random ();
+
+double elapsed_ns (struct timespec *start, struct timespec *end);
+
+struct benchmark benchmarks[] = {
+	{"find_message_end", run_find_message_end},
+	{"generate_message", run_generate_message},
+	{"create_message", run_create_message},
+	{"isword", run_isword},
+	{"iscommand", run_iscommand},
+	{"split_command", run_split_command},
+	{"ismuted", run_ismuted},
+};
+
+/* Chat lines, each ending in a newline, packed into a null terminated
+ * buffer as a client receives them, and the number of lines in it. */
+char line_buffer[BUFFER_BYTES + MAX_MESSAGE_LENGTH + 1];
+unsigned buffer_lines;
+
+/* The copy of line_buffer that generate_message cuts apart. */
+char scratch[sizeof (line_buffer)];
+
+/* Chat lines without their newline, names and whole messages as they
+ * reach the server's command check. */
+char *lines[INPUT_COUNT];
+char *names[INPUT_COUNT];
+char *received_messages[INPUT_COUNT];
+
+/* Commands in the proportions bench_commands uses. */
+char *commands_mix[] = {
+	"\\show_status alice\n", "\\show_all_statuses\n", "\\mute bob\n", "\\unmute bob\n",
+	"\\set_nickname alice al\n", "\\clear_nickname alice\n", "\\rename carol\n",
+	"  \\show_status   some_long_user_name_42  \n", "\\show_all_statuses 3\n", "\\exit\n",
+	"\\bogus a b\n", "\\mute al!ce\n", "\\set_nickname a b c\n", "\\show-status x\n",
+};
+
+#define COMMAND_MIX_COUNT (sizeof (commands_mix) / sizeof (commands_mix[0]))
+
+/* The room and the pairs of users ismuted is asked about. */
+struct user_info *room_users[ROOM_USERS];
+unsigned short receivers[INPUT_COUNT];
+unsigned short senders[INPUT_COUNT];
+
+enum CYCLE_SOURCE cycle_source = No_Cycles;
+int cycle_counter = -1;
+
+unsigned long random_state = 0x2545f4914f6cdd1dUL;
+
+/* Sum of the results of every helper, printed so the work cannot be
+ * skipped. */
+long checksum;
+
+int main (int argc, char *argv[]) {
+	unsigned long iterations = DEFAULT_ITERATIONS;
+	if (argc >= 2) {
+		iterations = atol (argv[1]);
+	}
+	int cpu = argc >= 3 ? atoi (argv[2]) : sched_getcpu ();
+	pin_cpu (cpu);
+	open_cycle_counter ();
+	prepare_inputs ();
+	char *sources[] = {"hardware cycles", "time stamp counter ticks", "no cycle counter"};
+	printf ("Pinned to CPU %d, %lu operations per helper, %s\n", cpu, iterations, sources[cycle_source]);
+	printf ("%-18s %12s %12s %12s\n", "helper", "ns/op", "cycles/op", "allocs/op");
+	for (unsigned i = 0; i < sizeof (benchmarks) / sizeof (struct benchmark); i++) {
+		benchmarks[i].run (iterations / 10 + 1);
+		unsigned long allocated = __atomic_load_n (&allocations, __ATOMIC_RELAXED);
+		struct timespec start;
+		struct timespec end;
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		unsigned long cycles = read_cycles ();
+		unsigned long operations = benchmarks[i].run (iterations);
+		cycles = read_cycles () - cycles;
+		clock_gettime (CLOCK_MONOTONIC, &end);
+		allocated = __atomic_load_n (&allocations, __ATOMIC_RELAXED) - allocated;
+		double ns = elapsed_ns (&start, &end) / operations;
+		if (cycle_source == No_Cycles) {
+			printf ("%-18s %12.2f %12s %12.3f\n", benchmarks[i].name, ns, "n/a", (double) allocated / operations);
+		} else {
+			printf ("%-18s %12.2f %12.1f %12.3f\n", benchmarks[i].name, ns, (double) cycles / operations,
+				(double) allocated / operations);
+		}
+	}
+	fprintf (stderr, "checksum %ld\n", checksum);
+	return 0;
+}
+
+/* Function that finds one message end per operation, walking the lines of
+ * line_buffer from the start of each to its newline. */
+unsigned long run_find_message_end (unsigned long operations) {
+	int start = 0;
+	for (unsigned long i = 0; i < operations; i++) {
+		int end = find_message_end (line_buffer, start);
+		if (end == -1) {
+			start = 0;
+			end = find_message_end (line_buffer, 0);
+		}
+		checksum += end;
+		start = end + 1;
+	}
+	return operations;
+}
+
+/* Function that cuts one message out of a copy of line_buffer per
+ * operation, as the client used to, freeing each one and copying the
+ * buffer again once it is empty. */
+unsigned long run_generate_message (unsigned long operations) {
+	scratch[0] = 0;
+	for (unsigned long i = 0; i < operations; i++) {
+		if (scratch[0] == 0) {
+			memcpy (scratch, line_buffer, sizeof (line_buffer));
+		}
+		char *message = generate_message (scratch, find_message_end (scratch, 0) + 1);
+		checksum += message[0];
+		free (message);
+	}
+	return operations;
+}
+
+/* Function that builds and releases one chat message per operation, from
+ * a name, the separator and a line, as the server broadcasts them. */
+unsigned long run_create_message (unsigned long operations) {
+	for (unsigned long i = 0; i < operations; i++) {
+		char *parts[] = {names[i & (INPUT_COUNT - 1)], ":", lines[i & (INPUT_COUNT - 1)]};
+		struct outbound *message = create_message (parts, 3);
+		checksum += message->data[1];
+		release_outbound (message);
+	}
+	return operations;
+}
+
+/* Function that checks one name per operation. */
+unsigned long run_isword (unsigned long operations) {
+	for (unsigned long i = 0; i < operations; i++) {
+		checksum += isword (names[i & (INPUT_COUNT - 1)]);
+	}
+	return operations;
+}
+
+/* Function that checks one received message per operation. */
+unsigned long run_iscommand (unsigned long operations) {
+	for (unsigned long i = 0; i < operations; i++) {
+		checksum += iscommand (received_messages[i & (INPUT_COUNT - 1)]);
+	}
+	return operations;
+}
+
+/* Function that tokenizes one command per operation. */
+unsigned long run_split_command (unsigned long operations) {
+	struct parsed_command parsed;
+	for (unsigned long i = 0; i < operations; i++) {
+		checksum += split_command (commands_mix[i % COMMAND_MIX_COUNT], &parsed);
+		checksum += parsed.count;
+	}
+	return operations;
+}
+
+/* Function that checks one pair of users per operation. */
+unsigned long run_ismuted (unsigned long operations) {
+	for (unsigned long i = 0; i < operations; i++) {
+		unsigned pair = i & (INPUT_COUNT - 1);
+		checksum += ismuted (room_users[receivers[pair]], room_users[senders[pair]]);
+	}
+	return operations;
+}
+
+/*
+ * Function: prepare_inputs
+ * ------------------------
+ * draws the inputs of every helper. Chat lines are 8 to 48 bytes 70% of
+ * the time, up to 200 25% of the time and up to 1000 otherwise. Names are
+ * 3 to 16 characters, one in ten with a character no name may have.
+ * Messages are chat lines, one in five of them a command, some with
+ * leading spaces. The room fills a user index like the server's and every
+ * user mutes each other one with odds of 1 in MUTE_ODDS.
+ *
+ * returns: void
+ */
+void prepare_inputs () {
+	for (unsigned i = 0; i < INPUT_COUNT; i++) {
+		unsigned length = draw_line_length ();
+		lines[i] = malloc (length + 2);
+		names[i] = malloc (17);
+		received_messages[i] = malloc (MAX_MESSAGE_LENGTH + 1);
+		if (lines[i] == NULL || names[i] == NULL || received_messages[i] == NULL) {
+			allocation_failed ();
+		}
+		for (unsigned c = 0; c < length; c++) {
+			lines[i][c] = 'a' + next_random () % 26;
+			if (next_random () % 6 == 0) {
+				lines[i][c] = ' ';
+			}
+		}
+		lines[i][length] = '\n';
+		lines[i][length + 1] = 0;
+		draw_word (names[i], 3 + next_random () % 14);
+		if (next_random () % 10 == 0) {
+			names[i][next_random () % strlen (names[i])] = '!';
+		}
+		unsigned kind = next_random () % 10;
+		if (kind < 2) {
+			strcpy (received_messages[i], commands_mix[next_random () % COMMAND_MIX_COUNT]);
+		} else if (kind == 2) {
+			sprintf (received_messages[i], "  %s", lines[i]);
+		} else {
+			strcpy (received_messages[i], lines[i]);
+		}
+	}
+	unsigned offset = 0;
+	buffer_lines = 0;
+	for (unsigned i = 0; offset < BUFFER_BYTES; i++) {
+		unsigned length = strlen (lines[i]);
+		memcpy (line_buffer + offset, lines[i], length);
+		offset += length;
+		buffer_lines++;
+	}
+	line_buffer[offset] = 0;
+	for (unsigned n = 0; n < ROOM_USERS; n++) {
+		char name[24];
+		sprintf (name, "user_%u", n);
+		room_users[n] = create_user (name);
+	}
+	for (unsigned n = 0; n < ROOM_USERS; n++) {
+		for (unsigned m = 0; m < ROOM_USERS; m++) {
+			if (m != n && next_random () % MUTE_ODDS == 0) {
+				add_muted (room_users[n], room_users[m]->name_info);
+			}
+		}
+	}
+	for (unsigned i = 0; i < INPUT_COUNT; i++) {
+		receivers[i] = next_random () % ROOM_USERS;
+		senders[i] = next_random () % ROOM_USERS;
+	}
+}
+
+/* Function that draws the length of a chat line without its newline. */
+unsigned draw_line_length () {
+	unsigned kind = next_random () % 100;
+	if (kind < 70) {
+		return 8 + next_random () % 41;
+	} else if (kind < 95) {
+		return 49 + next_random () % 152;
+	}
+	return 201 + next_random () % 800;
+}
+
+/* Function that fills word with length random characters a name may have,
+ * followed by a null terminator. */
+void draw_word (char *word, unsigned length) {
+	char *characters = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+	for (unsigned c = 0; c < length; c++) {
+		word[c] = characters[next_random () % 63];
+	}
+	word[length] = 0;
+}
+
+/* Function that keeps the benchmark on cpu so that it is neither moved
+ * between cores nor its caches shared with its own past. */
+void pin_cpu (int cpu) {
+	cpu_set_t set;
+	CPU_ZERO (&set);
+	CPU_SET (cpu, &set);
+	if (sched_setaffinity (0, sizeof (set), &set) == -1) {
+		fprintf (stderr, "Unable to pin to CPU %d, running unpinned\n", cpu);
+	}
+}
+
+/* Function that opens a counter of the cycles the benchmark spends in
+ * user space, falling back to the time stamp counter where perf events are
+ * not allowed, and to nothing where there is no such counter. */
+void open_cycle_counter () {
+	struct perf_event_attr attributes;
+	memset (&attributes, 0, sizeof (attributes));
+	attributes.type = PERF_TYPE_HARDWARE;
+	attributes.size = sizeof (attributes);
+	attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+	attributes.exclude_kernel = 1;
+	attributes.exclude_hv = 1;
+	cycle_counter = syscall (SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+	if (cycle_counter != -1) {
+		cycle_source = Perf_Cycles;
+		return;
+	}
+#if defined (__x86_64__) || defined (__i386__)
+	cycle_source = Tsc_Cycles;
+#endif
+}
+
+/* Function that returns the cycles counted so far by whichever counter is
+ * used. */
+unsigned long read_cycles () {
+	if (cycle_source == Perf_Cycles) {
+		uint64_t cycles;
+		if (read (cycle_counter, &cycles, sizeof (cycles)) == sizeof (cycles)) {
+			return cycles;
+		}
+		return 0;
+	}
+#if defined (__x86_64__) || defined (__i386__)
+	if (cycle_source == Tsc_Cycles) {
+		return __rdtsc ();
+	}
+#endif
+	return 0;
+}
+
+/* Function that returns the next value of a xorshift generator. */
+unsigned long next_random () {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return random_state;
+}
+
+/* Function that returns the time between start and end in ns. */
+double elapsed_ns (struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
@@ -0,0 +1,195 @@
+/* Benchmark that measures the broadcast throughput of the server over
+ * loopback as the number of shards grows. A fixed set of clients joins and
+ * then every client sends the same number of messages as fast as the
+ * server takes them, while the benchmark reads everything the server
+ * broadcasts. Every message is delivered to every other client, so the
+ * result is reported as deliveries per second. The server is started from
+ * ./server, so run the benchmark from the top of the repository. The
+ * benchmark drives every client from a single thread, which caps what it
+ * can measure on machines with many cores.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include "bench_utils.h"
+
+#define DEFAULT_MESSAGES 2000
+
+#define CLIENTS 32
+
+#define TIMEOUT_SECONDS 60
+
+unsigned shard_counts[] = {1, 2, 4, 8};
+
+/* The client sockets. */
+int clients[CLIENTS];
+
+void start_shard_server (unsigned shards, int port);
+
+void join_clients (int port);
+
+void drain_clients (int quiet_ms);
+
+double run_broadcasts (unsigned messages, unsigned long *delivered);
+
+double elapsed_s (struct timespec *start, struct timespec *end);
+
+int main (int argc, char *argv[]) {
+	unsigned messages = DEFAULT_MESSAGES;
+	if (argc == 2) {
+		messages = atoi (argv[1]);
+	}
+	signal (SIGPIPE, SIG_IGN);
+	printf ("%ld cores, %d clients, %u messages per client\n", sysconf (_SC_NPROCESSORS_ONLN), CLIENTS, messages);
+	printf ("%-8s %14s %14s\n", "shards", "seconds", "deliveries/s");
+	for (unsigned i = 0; i < sizeof (shard_counts) / sizeof (unsigned); i++) {
+		int port = 20000 + (getpid () % 20000) + i;
+		start_shard_server (shard_counts[i], port);
+		join_clients (port);
+		unsigned long delivered;
+		double seconds = run_broadcasts (messages, &delivered);
+		unsigned long expected = (unsigned long) CLIENTS * messages * (CLIENTS - 1);
+		if (delivered < expected) {
+			printf ("%-8u %14s %14s (%lu of %lu delivered)\n", shard_counts[i], "timeout", "n/a", delivered, expected);
+		} else {
+			printf ("%-8u %14.3f %14.0f\n", shard_counts[i], seconds, delivered / seconds);
+		}
+		fflush (stdout);
+		for (unsigned n = 0; n < CLIENTS; n++) {
+			close (clients[n]);
+		}
+		stop_server (NULL);
+	}
+	return 0;
+}
+
+/* Function that starts ./server with the given number of shards, discarding
+ * its output. */
+void start_shard_server (unsigned shards, int port) {
+	char shard_arg[16];
+	char connection_arg[16];
+	char port_arg[16];
+	sprintf (shard_arg, "%u", shards);
+	sprintf (connection_arg, "%d", CLIENTS + 8);
+	sprintf (port_arg, "%d", port);
+	char *arguments[] = {"server", "-t", shard_arg, "-c", connection_arg, port_arg, NULL};
+	start_server ("./server", arguments, -1);
+}
+
+/* Function that connects and names every client and then waits for the
+ * join messages to stop arriving. */
+void join_clients (int port) {
+	connect_clients (clients, CLIENTS, port);
+	drain_clients (300);
+	for (unsigned n = 0; n < CLIENTS; n++) {
+		fcntl (clients[n], F_SETFL, fcntl (clients[n], F_GETFL) | O_NONBLOCK);
+	}
+}
+
+/* Function that reads from every client until none has received anything
+ * for quiet_ms milliseconds. */
+void drain_clients (int quiet_ms) {
+	struct pollfd polled[CLIENTS];
+	char buffer[65536];
+	for (unsigned n = 0; n < CLIENTS; n++) {
+		polled[n].fd = clients[n];
+		polled[n].events = POLLIN;
+	}
+	while (poll (polled, CLIENTS, quiet_ms) > 0) {
+		for (unsigned n = 0; n < CLIENTS; n++) {
+			if ((polled[n].revents & POLLIN) && read (clients[n], buffer, sizeof (buffer)) <= 0) {
+				bench_error ("Server closed a client");
+			}
+		}
+	}
+}
+
+/* Function that has every client send messages lines to the server while
+ * counting the lines broadcast back. Returns the seconds taken until every
+ * line was delivered, or the timeout ran out, and stores the number of
+ * lines delivered in delivered. */
+double run_broadcasts (unsigned messages, unsigned long *delivered) {
+	int epoll_fd = epoll_create1 (0);
+	if (epoll_fd == -1) {
+		bench_error ("Unable to create epoll instance");
+	}
+	for (unsigned n = 0; n < CLIENTS; n++) {
+		struct epoll_event event;
+		memset (&event, 0, sizeof (event));
+		event.events = EPOLLIN;
+		event.data.u32 = n;
+		if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, clients[n], &event) == -1) {
+			bench_error ("Unable to register client");
+		}
+	}
+	/* Lines are two bytes, so the offset of the next byte to send within
+	 * lines is the number of bytes sent so far modulo two. */
+	char lines[1024];
+	for (unsigned i = 0; i < sizeof (lines); i += 2) {
+		lines[i] = 'm';
+		lines[i + 1] = '\n';
+	}
+	unsigned long sent[CLIENTS];
+	memset (sent, 0, sizeof (sent));
+	unsigned long total = (unsigned long) messages * 2;
+	unsigned long expected = (unsigned long) CLIENTS * messages * (CLIENTS - 1);
+	*delivered = 0;
+	char buffer[65536];
+	struct epoll_event events[CLIENTS];
+	struct timespec start;
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	now = start;
+	while (*delivered < expected && now.tv_sec - start.tv_sec < TIMEOUT_SECONDS) {
+		bool sending = false;
+		for (unsigned n = 0; n < CLIENTS; n++) {
+			if (sent[n] == total) {
+				continue;
+			}
+			sending = true;
+			unsigned long offset = sent[n] % 2;
+			unsigned long length = total - sent[n];
+			if (length > sizeof (lines) - offset) {
+				length = sizeof (lines) - offset;
+			}
+			ssize_t written = write (clients[n], lines + offset, length);
+			if (written > 0) {
+				sent[n] += written;
+			} else if (written == -1 && errno != EAGAIN) {
+				bench_error ("Unable to send message");
+			}
+		}
+		int ready = epoll_wait (epoll_fd, events, CLIENTS, sending ? 0 : 100);
+		for (int e = 0; e < ready; e++) {
+			ssize_t received;
+			while ((received = read (clients[events[e].data.u32], buffer, sizeof (buffer))) > 0) {
+				for (ssize_t i = 0; i < received; i++) {
+					*delivered += buffer[i] == '\n';
+				}
+			}
+			if (received == 0 || (received == -1 && errno != EAGAIN)) {
+				bench_error ("Server closed a client");
+			}
+		}
+		clock_gettime (CLOCK_MONOTONIC, &now);
+	}
+	close (epoll_fd);
+	return elapsed_s (&start, &now);
+}
+
+/* Function that returns the time between start and end in seconds. */
+double elapsed_s (struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,277 @@
+/* Benchmark suite that runs the standard load scenarios against the server
+ * over loopback with ./loadgen and writes the results as JSON. Every
+ * scenario starts a fresh ./server, lets the load generator connect its
+ * users and run for the configured time, and then stops the server, whose
+ * CPU time and peak RSS come from wait4. The scenarios are broadcast
+ * fan-out to 10, 100, 1000 and 10000 users with eight senders, those
+ * senders while receivers keep disconnecting and connecting again, a mix
+ * that is mostly \show_all_statuses, \show_status, \mute and \unmute, and
+ * a few users pipelining many small lines each. Run it from the top of the
+ * repository; testing/bench_compare.py compares two result files. The
+ * joins of 10000 users alone are fifty million messages, so that scenario
+ * takes far longer to set up than to run.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "bench_utils.h"
+
+#define DEFAULT_SECONDS 5
+
+#define DEFAULT_OUTPUT "bench_results.json"
+
+/* The most bytes of output taken from the load generator. */
+#define LOAD_OUTPUT_SIZE 4096
+
+/* The most arguments passed to either program. */
+#define MAX_ARGUMENTS 32
+
+/* A scenario: the load generator's arguments, without the duration and
+ * the address, and the number of users, from which the server's
+ * connection limit follows. */
+struct scenario {
+	char *name;
+	unsigned users;
+	char *load_options;
+};
+
+struct scenario scenarios[] = {
+	{"fanout_10", 10, "-a 8"},
+	{"fanout_100", 100, "-a 8"},
+	{"fanout_1000", 1000, "-a 8"},
+	{"fanout_10000", 10000, "-a 8"},
+	{"churn", 500, "-a 8 -x 200"},
+	{"commands", 200, "-a 8 -k 90"},
+	{"pipelined", 16, "-w 32 -s 8"},
+};
+
+/* The results of one scenario. */
+struct result {
+	char load[LOAD_OUTPUT_SIZE];
+	double server_cpu;
+	long server_rss;
+	double load_cpu;
+};
+
+/* The process running the server. */
+unsigned duration = DEFAULT_SECONDS;
+
+/* Options added to every server, e.g. the backend or the shards. */
+char *server_options = "";
+
+bool run_scenario (struct scenario *scenario, int port, struct result *result);
+
+void start_scenario_server (struct scenario *scenario, int port);
+
+void stop_scenario_server (struct result *result);
+
+bool run_load (struct scenario *scenario, int port, struct result *result);
+
+unsigned split_options (char *options, char **arguments, unsigned count);
+
+double json_number (char *json, char *key);
+
+double cpu_seconds (struct rusage *usage);
+
+bool selected (struct scenario *scenario, int argc, char *argv[]);
+
+int main (int argc, char *argv[]) {
+	char *output = DEFAULT_OUTPUT;
+	int option;
+	while ((option = getopt (argc, argv, "o:d:s:")) != -1) {
+		if (option == 'o') {
+			output = optarg;
+		} else if (option == 'd' && atoi (optarg) > 0) {
+			duration = atoi (optarg);
+		} else if (option == 's') {
+			server_options = optarg;
+		} else {
+			fprintf (stderr, "Usage: ./testing/bench_suite [-o output] [-d seconds] [-s server_options] [scenario ...]\n");
+			exit (1);
+		}
+	}
+	signal (SIGPIPE, SIG_IGN);
+	FILE *results = fopen (output, "w");
+	if (results == NULL) {
+		bench_error ("Unable to open the results file");
+	}
+	fprintf (results, "{\"time\":%ld,\"cores\":%ld,\"seconds\":%u,\"server_options\":\"%s\",\"scenarios\":[",
+		(long) time (NULL), sysconf (_SC_NPROCESSORS_ONLN), duration, server_options);
+	printf ("%ld cores, %u s per scenario, server options '%s'\n", sysconf (_SC_NPROCESSORS_ONLN), duration,
+		server_options);
+	printf ("%-14s %12s %14s %10s %10s %10s %10s %10s\n", "scenario", "messages/s", "deliveries/s", "p50 us",
+		"p99 us", "p999 us", "cpu s", "rss MiB");
+	bool first = true;
+	for (unsigned i = 0; i < sizeof (scenarios) / sizeof (struct scenario); i++) {
+		if (!selected (&scenarios[i], argc - optind, argv + optind)) {
+			continue;
+		}
+		int port = 20000 + (getpid () % 20000) + i;
+		struct result result;
+		if (!run_scenario (&scenarios[i], port, &result)) {
+			printf ("%-14s %12s\n", scenarios[i].name, "failed");
+			fflush (stdout);
+			continue;
+		}
+		printf ("%-14s %12.0f %14.0f %10.1f %10.1f %10.1f %10.2f %10.1f\n", scenarios[i].name,
+			json_number (result.load, "messages_per_s"), json_number (result.load, "deliveries_per_s"),
+			json_number (result.load, "p50"), json_number (result.load, "p99"), json_number (result.load, "p999"),
+			result.server_cpu, result.server_rss / 1024.0);
+		fflush (stdout);
+		double delivered = json_number (result.load, "delivered");
+		fprintf (results, "%s{\"name\":\"%s\",\"users\":%u,\"load_options\":\"%s\",\"server_cpu_s\":%.3f,"
+			"\"server_cpu_us_per_delivery\":%.4f,\"server_rss_kb\":%ld,\"load_cpu_s\":%.3f,\"load\":%s}",
+			first ? "" : ",", scenarios[i].name, scenarios[i].users, scenarios[i].load_options, result.server_cpu,
+			delivered > 0 ? result.server_cpu * 1e6 / delivered : 0, result.server_rss, result.load_cpu, result.load);
+		first = false;
+	}
+	fprintf (results, "]}\n");
+	fclose (results);
+	printf ("Results written to %s\n", output);
+	return 0;
+}
+
+/* Function that runs one scenario on a fresh server. Returns false if the
+ * load generator failed. */
+bool run_scenario (struct scenario *scenario, int port, struct result *result) {
+	memset (result, 0, sizeof (struct result));
+	start_scenario_server (scenario, port);
+	bool success = run_load (scenario, port, result);
+	stop_scenario_server (result);
+	return success;
+}
+
+/* Function that starts ./server with room for the scenario's users and the
+ * extra server options, discarding its output. */
+void start_scenario_server (struct scenario *scenario, int port) {
+	char connection_arg[16];
+	char port_arg[16];
+	sprintf (connection_arg, "%u", scenario->users + 64);
+	sprintf (port_arg, "%d", port);
+	char *arguments[MAX_ARGUMENTS];
+	char options[256];
+	snprintf (options, sizeof (options), "%s", server_options);
+	unsigned count = 0;
+	arguments[count++] = "server";
+	count = split_options (options, arguments, count);
+	arguments[count++] = "-c";
+	arguments[count++] = connection_arg;
+	arguments[count++] = port_arg;
+	arguments[count] = NULL;
+	start_server ("./server", arguments, -1);
+}
+
+/* Function that stops the server and takes its CPU time and peak RSS. */
+void stop_scenario_server (struct result *result) {
+	struct rusage usage;
+	stop_server (&usage);
+	result->server_cpu = cpu_seconds (&usage);
+	result->server_rss = usage.ru_maxrss;
+}
+
+/* Function that runs ./loadgen for the scenario and keeps its JSON line.
+ * Returns false if it failed or printed nothing. */
+bool run_load (struct scenario *scenario, int port, struct result *result) {
+	int output[2];
+	if (pipe (output) == -1) {
+		bench_error ("Unable to create pipe");
+	}
+	pid_t load = fork ();
+	if (load == -1) {
+		bench_error ("Unable to fork load generator");
+	}
+	if (load == 0) {
+		dup2 (output[1], STDOUT_FILENO);
+		close (output[0]);
+		close (output[1]);
+		char users_arg[16];
+		char duration_arg[16];
+		char port_arg[16];
+		sprintf (users_arg, "%u", scenario->users);
+		sprintf (duration_arg, "%u", duration);
+		sprintf (port_arg, "%d", port);
+		char *arguments[MAX_ARGUMENTS];
+		char options[256];
+		snprintf (options, sizeof (options), "%s", scenario->load_options);
+		unsigned count = 0;
+		arguments[count++] = "loadgen";
+		arguments[count++] = "-j";
+		arguments[count++] = "-u";
+		arguments[count++] = users_arg;
+		arguments[count++] = "-d";
+		arguments[count++] = duration_arg;
+		count = split_options (options, arguments, count);
+		arguments[count++] = "127.0.0.1";
+		arguments[count++] = port_arg;
+		arguments[count] = NULL;
+		execv ("./loadgen", arguments);
+		exit (1);
+	}
+	close (output[1]);
+	size_t length = 0;
+	ssize_t received;
+	while ((received = read (output[0], result->load + length, LOAD_OUTPUT_SIZE - 1 - length)) > 0) {
+		length += received;
+	}
+	close (output[0]);
+	while (length > 0 && result->load[length - 1] == '\n') {
+		length--;
+	}
+	result->load[length] = 0;
+	int status;
+	struct rusage usage;
+	if (wait4 (load, &status, 0, &usage) == -1) {
+		bench_error ("Unable to wait for load generator");
+	}
+	result->load_cpu = cpu_seconds (&usage);
+	return WIFEXITED (status) && WEXITSTATUS (status) == 0 && result->load[0] == '{';
+}
+
+/* Function that splits options at spaces, in place, and appends them to
+ * arguments after the count already there. Returns the new count. */
+unsigned split_options (char *options, char **arguments, unsigned count) {
+	for (char *option = strtok (options, " "); option != NULL && count < MAX_ARGUMENTS - 4;
+			option = strtok (NULL, " ")) {
+		arguments[count++] = option;
+	}
+	return count;
+}
+
+/* Function that returns the number following the first occurrence of
+ * "key": in json, or 0 if there is none. */
+double json_number (char *json, char *key) {
+	char pattern[64];
+	snprintf (pattern, sizeof (pattern), "\"%s\":", key);
+	char *found = strstr (json, pattern);
+	return found == NULL ? 0 : atof (found + strlen (pattern));
+}
+
+/* Function that returns the user and system time in usage in seconds. */
+double cpu_seconds (struct rusage *usage) {
+	return usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6
+		+ usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+}
+
+/* Function that determines if a scenario should run, which is every one
+ * if none are named. */
+bool selected (struct scenario *scenario, int argc, char *argv[]) {
+	for (int i = 0; i < argc; i++) {
+		if (strcmp (argv[i], scenario->name) == 0) {
+			return true;
+		}
+	}
+	return argc == 0;
+}
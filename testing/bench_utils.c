@@ -0,0 +1,104 @@
+/* File that contains the helpers the benchmarks and the server tests share
+ * to run a server in a child process and connect clients to it over
+ * loopback.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "bench_utils.h"
+
+/* The number of times a client tries to connect while the server starts,
+ * 10 ms apart. */
+#define CONNECT_ATTEMPTS 200
+
+/* The process running the server, 0 if none is running. */
+pid_t server = 0;
+
+/* Function that starts program with arguments, which end with NULL, in a
+ * child process that becomes server. Its output is discarded and its
+ * errors go to the descriptor errors, or are discarded if it is -1. */
+void start_server (char *program, char **arguments, int errors) {
+	server = fork ();
+	if (server == -1) {
+		bench_error ("Unable to fork server");
+	}
+	if (server == 0) {
+		int null = open ("/dev/null", O_WRONLY);
+		dup2 (null, STDOUT_FILENO);
+		dup2 (errors == -1 ? null : errors, STDERR_FILENO);
+		execv (program, arguments);
+		exit (1);
+	}
+}
+
+/* Function that stops the server and waits for it to exit, storing its
+ * resource usage in usage unless it is NULL. */
+void stop_server (struct rusage *usage) {
+	kill (server, SIGTERM);
+	if (wait4 (server, NULL, 0, usage) == -1) {
+		server = 0;
+		bench_error ("Unable to wait for server");
+	}
+	server = 0;
+}
+
+/* Function that connects to the server on port over loopback. Returns the
+ * socket or -1 if the connection failed. */
+int connect_client (int port) {
+	int fd = socket (AF_INET, SOCK_STREAM, 0);
+	if (fd == -1) {
+		return -1;
+	}
+	struct sockaddr_in address;
+	memset (&address, 0, sizeof (address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons (port);
+	address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	if (connect (fd, (struct sockaddr *) &address, sizeof (address)) == -1) {
+		close (fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Function that connects count clients to the server on port, retrying
+ * while the server starts, and names client n benchn. */
+void connect_clients (int *clients, unsigned count, int port) {
+	for (unsigned n = 0; n < count; n++) {
+		int attempts = 0;
+		while ((clients[n] = connect_client (port)) == -1) {
+			if (++attempts == CONNECT_ATTEMPTS) {
+				bench_error ("Unable to connect to server");
+			}
+			usleep (10000);
+		}
+		char name[32];
+		int length = sprintf (name, "bench%u\n", n);
+		if (write (clients[n], name, length) != length) {
+			bench_error ("Unable to send name");
+		}
+	}
+}
+
+/* Function that terminates the program when a step fails, stopping the
+ * server if one is running. */
+void bench_error (char *reason) {
+	fprintf (stderr, "%s\n", reason);
+	if (server > 0) {
+		kill (server, SIGTERM);
+	}
+	exit (1);
+}
@@ -0,0 +1,36 @@
+/* File that contains the helpers the benchmarks and the server tests share
+ * to run a server in a child process and connect clients to it over
+ * loopback.
+ * Author: Yuriy Bash */
+
+#ifndef BENCH_UTILS_H
+#define BENCH_UTILS_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/* The process running the server, 0 if none is running. */
+extern pid_t server;
+
+/* Function that starts program with arguments, which end with NULL, in a
+ * child process that becomes server. Its output is discarded and its
+ * errors go to the descriptor errors, or are discarded if it is -1. */
+void start_server (char *program, char **arguments, int errors);
+
+/* Function that stops the server and waits for it to exit, storing its
+ * resource usage in usage unless it is NULL. */
+void stop_server (struct rusage *usage);
+
+/* Function that connects to the server on port over loopback. Returns the
+ * socket or -1 if the connection failed. */
+int connect_client (int port);
+
+/* Function that connects count clients to the server on port, retrying
+ * while the server starts, and names client n benchn. */
+void connect_clients (int *clients, unsigned count, int port);
+
+/* Function that terminates the program when a step fails, stopping the
+ * server if one is running. */
+void bench_error (char *reason);
+
+#endif
@@ -0,0 +1,232 @@
+/* Benchmark that measures the cost of a single wakeup of the server's event
+ * loop as the number of idle connections grows. One connection is made
+ * readable per iteration while every other connection stays idle, so the
+ * time per iteration is the overhead the backend adds for each event.
+ * The select loop mirrors what the server did before the epoll backend:
+ * rebuild the descriptor set and scan every socket after each wakeup.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+
+#define DEFAULT_ITERATIONS 20000
+
+unsigned connection_counts[] = {10, 100, 1000, 10000};
+
+/* The accepted ends of the idle connections followed by the active one. */
+int *watched;
+
+/* The end of the active connection the benchmark writes to. */
+int trigger;
+
+/* The process holding the client ends of the idle connections. */
+pid_t holder;
+
+void open_connections (unsigned count);
+
+void close_connections (unsigned count);
+
+double time_select (unsigned count, unsigned iterations);
+
+double time_epoll (unsigned count, unsigned iterations, bool edge);
+
+double elapsed_ns (struct timespec *start, struct timespec *end);
+
+void bench_error (char *reason);
+
+int main (int argc, char *argv[]) {
+	unsigned iterations = DEFAULT_ITERATIONS;
+	if (argc == 2) {
+		iterations = atoi (argv[1]);
+	}
+	struct rlimit limit;
+	getrlimit (RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit (RLIMIT_NOFILE, &limit);
+	printf ("%-12s %14s %14s %14s\n", "connections", "select ns", "epoll lt ns", "epoll et ns");
+	for (unsigned i = 0; i < sizeof (connection_counts) / sizeof (unsigned); i++) {
+		unsigned count = connection_counts[i];
+		if (count + 16 > limit.rlim_cur) {
+			printf ("%-12u %14s %14s %14s\n", count, "n/a", "n/a", "n/a");
+			continue;
+		}
+		open_connections (count);
+		int fd_max = 0;
+		for (unsigned n = 0; n <= count; n++) {
+			if (watched[n] > fd_max) {
+				fd_max = watched[n];
+			}
+		}
+		/* select cannot watch descriptors past FD_SETSIZE. */
+		char select_result[32] = "n/a";
+		if (fd_max < FD_SETSIZE) {
+			sprintf (select_result, "%.0f", time_select (count, iterations));
+		}
+		double level = time_epoll (count, iterations, false);
+		double edge = time_epoll (count, iterations, true);
+		printf ("%-12u %14s %14.0f %14.0f\n", count, select_result, level, edge);
+		fflush (stdout);
+		close_connections (count);
+	}
+	return 0;
+}
+
+/* Function that opens count idle connections over a unix socket along with
+ * one active connection. A child process holds the client ends so that the
+ * benchmark only pays one descriptor per idle connection. */
+void open_connections (unsigned count) {
+	int listener = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (listener == -1) {
+		bench_error ("Unable to create listening socket");
+	}
+	struct sockaddr_un address;
+	memset (&address, 0, sizeof (address));
+	address.sun_family = AF_UNIX;
+	/* Abstract socket name, nothing is created on the filesystem. */
+	snprintf (address.sun_path + 1, sizeof (address.sun_path) - 1, "bench_wakeup_%d", getpid ());
+	if (bind (listener, (struct sockaddr *) &address, sizeof (address)) == -1
+			|| listen (listener, count) == -1) {
+		bench_error ("Unable to listen for idle connections");
+	}
+	holder = fork ();
+	if (holder == -1) {
+		bench_error ("Unable to fork connection holder");
+	}
+	if (holder == 0) {
+		close (listener);
+		for (unsigned i = 0; i < count; i++) {
+			int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+			if (fd == -1 || connect (fd, (struct sockaddr *) &address, sizeof (address)) == -1) {
+				bench_error ("Unable to open idle connection");
+			}
+		}
+		pause ();
+		exit (0);
+	}
+	watched = malloc (sizeof (int) * (count + 1));
+	if (watched == NULL) {
+		bench_error ("Unable to allocate enough memory");
+	}
+	for (unsigned i = 0; i < count; i++) {
+		watched[i] = accept (listener, NULL, NULL);
+		if (watched[i] == -1) {
+			bench_error ("Unable to accept idle connection");
+		}
+	}
+	close (listener);
+	int pair[2];
+	if (socketpair (AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+		bench_error ("Unable to create active connection");
+	}
+	watched[count] = pair[0];
+	trigger = pair[1];
+}
+
+/* Function that closes every connection opened by open_connections. */
+void close_connections (unsigned count) {
+	kill (holder, SIGTERM);
+	waitpid (holder, NULL, 0);
+	for (unsigned i = 0; i <= count; i++) {
+		close (watched[i]);
+	}
+	close (trigger);
+	free (watched);
+}
+
+/* Function that returns the average time of a select wakeup in ns. */
+double time_select (unsigned count, unsigned iterations) {
+	fd_set read_set;
+	fd_set except_set;
+	char byte = 0;
+	struct timespec start;
+	struct timespec end;
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (unsigned i = 0; i < iterations; i++) {
+		if (write (trigger, &byte, 1) != 1) {
+			bench_error ("Unable to trigger active connection");
+		}
+		FD_ZERO (&read_set);
+		FD_ZERO (&except_set);
+		int fd_max = 0;
+		for (unsigned n = 0; n <= count; n++) {
+			FD_SET (watched[n], &read_set);
+			FD_SET (watched[n], &except_set);
+			if (watched[n] > fd_max) {
+				fd_max = watched[n];
+			}
+		}
+		select (fd_max + 1, &read_set, NULL, &except_set, NULL);
+		for (unsigned n = 0; n <= count; n++) {
+			if (FD_ISSET (watched[n], &read_set)) {
+				if (read (watched[n], &byte, 1) != 1) {
+					bench_error ("Unexpected read on idle connection");
+				}
+			}
+		}
+	}
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	return elapsed_ns (&start, &end) / iterations;
+}
+
+/* Function that returns the average time of an epoll wakeup in ns. Every
+ * connection is registered once before timing starts. */
+double time_epoll (unsigned count, unsigned iterations, bool edge) {
+	int epoll_fd = epoll_create1 (0);
+	if (epoll_fd == -1) {
+		bench_error ("Unable to create epoll instance");
+	}
+	for (unsigned n = 0; n <= count; n++) {
+		struct epoll_event event;
+		memset (&event, 0, sizeof (event));
+		event.events = EPOLLIN | (edge ? EPOLLET : 0);
+		event.data.u32 = n;
+		if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, watched[n], &event) == -1) {
+			bench_error ("Unable to register connection");
+		}
+	}
+	struct epoll_event events[64];
+	char byte = 0;
+	struct timespec start;
+	struct timespec end;
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (unsigned i = 0; i < iterations; i++) {
+		if (write (trigger, &byte, 1) != 1) {
+			bench_error ("Unable to trigger active connection");
+		}
+		int ready = epoll_wait (epoll_fd, events, 64, -1);
+		for (int e = 0; e < ready; e++) {
+			if (read (watched[events[e].data.u32], &byte, 1) != 1) {
+				bench_error ("Unexpected read on idle connection");
+			}
+		}
+	}
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	close (epoll_fd);
+	return elapsed_ns (&start, &end) / iterations;
+}
+
+/* Function that returns the time between start and end in ns. */
+double elapsed_ns (struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/* Function that terminates the benchmark when a step fails. */
+void bench_error (char *reason) {
+	fprintf (stderr, "%s\n", reason);
+	exit (1);
+}
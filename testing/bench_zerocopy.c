@@ -0,0 +1,293 @@
+/* Benchmark that compares copying sends with MSG_ZEROCOPY sends of one
+ * shared buffer to a growing number of TCP connections over loopback, the
+ * way the server writes a broadcast to every client. The receiving ends are
+ * drained by a child process. Zerocopy completions are read from the error
+ * queue of each socket as the sends go, so the kernel never runs out of
+ * memory to track them. The same number of bytes is sent at every fan-out
+ * and the result is reported as bytes delivered per second. On loopback the
+ * kernel has to copy the data once it reaches the receiver, which the
+ * completions report, so the numbers show the cost of the bookkeeping
+ * rather than the savings a real network card would give.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+
+#define DEFAULT_PAYLOAD 65536
+
+#define TOTAL_BYTES (256UL << 20)
+
+#define MAX_FANOUT 64
+
+unsigned fanouts[] = {1, 4, 16, 64};
+
+/* The sending ends of the connections. */
+int senders[MAX_FANOUT];
+
+/* The receiving ends of the connections. */
+int receivers[MAX_FANOUT];
+
+/* The number of zerocopy sends not yet completed on each sender. */
+unsigned long outstanding[MAX_FANOUT];
+
+/* The number of zerocopy sends made in the current run. */
+unsigned long zerocopy_sends;
+
+/* The process draining the receivers. */
+pid_t reader;
+
+void open_connections (unsigned fanout);
+
+void close_connections (unsigned fanout);
+
+void start_reader (unsigned fanout);
+
+double time_sends (unsigned fanout, char *payload, size_t length, bool zerocopy, unsigned long *copied);
+
+void reap_completions (unsigned n, bool wait, unsigned long *copied);
+
+double elapsed_s (struct timespec *start, struct timespec *end);
+
+void bench_error (char *reason);
+
+int main (int argc, char *argv[]) {
+	size_t length = DEFAULT_PAYLOAD;
+	if (argc == 2) {
+		length = atoi (argv[1]);
+	}
+	if (length == 0 || length > TOTAL_BYTES) {
+		bench_error ("Payload must be between 1 and 268435456 bytes");
+	}
+	signal (SIGPIPE, SIG_IGN);
+	char *payload = malloc (length);
+	if (payload == NULL) {
+		bench_error ("Unable to allocate enough memory");
+	}
+	memset (payload, 'm', length);
+	printf ("%zu bytes per send, %lu bytes in total\n", length, TOTAL_BYTES);
+	printf ("%-8s %14s %14s %10s\n", "fanout", "copy MB/s", "zerocopy MB/s", "copied");
+	fflush (stdout);
+	for (unsigned i = 0; i < sizeof (fanouts) / sizeof (unsigned); i++) {
+		unsigned fanout = fanouts[i];
+		unsigned long copied;
+		open_connections (fanout);
+		double copy = time_sends (fanout, payload, length, false, &copied);
+		close_connections (fanout);
+		open_connections (fanout);
+		double zerocopy = time_sends (fanout, payload, length, true, &copied);
+		close_connections (fanout);
+		double bytes = (double) (TOTAL_BYTES / length / fanout * fanout) * length / 1e6;
+		if (zerocopy < 0) {
+			printf ("%-8u %14.0f %14s %10s\n", fanout, bytes / copy, "n/a", "n/a");
+		} else {
+			printf ("%-8u %14.0f %14.0f %9.0f%%\n", fanout, bytes / copy, bytes / zerocopy, 100.0 * copied / zerocopy_sends);
+		}
+		fflush (stdout);
+	}
+	free (payload);
+	return 0;
+}
+
+/* Function that opens fanout connections over loopback. */
+void open_connections (unsigned fanout) {
+	int listener = socket (AF_INET, SOCK_STREAM, 0);
+	if (listener == -1) {
+		bench_error ("Unable to create listening socket");
+	}
+	struct sockaddr_in address;
+	socklen_t address_length = sizeof (address);
+	memset (&address, 0, sizeof (address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	if (bind (listener, (struct sockaddr *) &address, sizeof (address)) == -1
+			|| listen (listener, fanout) == -1
+			|| getsockname (listener, (struct sockaddr *) &address, &address_length) == -1) {
+		bench_error ("Unable to listen for connections");
+	}
+	for (unsigned n = 0; n < fanout; n++) {
+		senders[n] = socket (AF_INET, SOCK_STREAM, 0);
+		if (senders[n] == -1 || connect (senders[n], (struct sockaddr *) &address, sizeof (address)) == -1) {
+			bench_error ("Unable to open connection");
+		}
+		receivers[n] = accept (listener, NULL, NULL);
+		if (receivers[n] == -1) {
+			bench_error ("Unable to accept connection");
+		}
+		outstanding[n] = 0;
+	}
+	close (listener);
+}
+
+/* Function that closes every connection opened by open_connections. */
+void close_connections (unsigned fanout) {
+	for (unsigned n = 0; n < fanout; n++) {
+		close (senders[n]);
+		close (receivers[n]);
+	}
+}
+
+/* Function that forks a process reading from every receiver until all of
+ * them are closed. */
+void start_reader (unsigned fanout) {
+	reader = fork ();
+	if (reader == -1) {
+		bench_error ("Unable to fork reader");
+	}
+	if (reader != 0) {
+		return;
+	}
+	for (unsigned n = 0; n < fanout; n++) {
+		close (senders[n]);
+	}
+	int epoll_fd = epoll_create1 (0);
+	if (epoll_fd == -1) {
+		bench_error ("Unable to create epoll instance");
+	}
+	for (unsigned n = 0; n < fanout; n++) {
+		struct epoll_event event;
+		memset (&event, 0, sizeof (event));
+		event.events = EPOLLIN;
+		event.data.u32 = n;
+		if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, receivers[n], &event) == -1) {
+			bench_error ("Unable to register receiver");
+		}
+	}
+	char buffer[262144];
+	struct epoll_event events[MAX_FANOUT];
+	unsigned open = fanout;
+	while (open > 0) {
+		int ready = epoll_wait (epoll_fd, events, MAX_FANOUT, -1);
+		for (int e = 0; e < ready; e++) {
+			unsigned n = events[e].data.u32;
+			ssize_t received = read (receivers[n], buffer, sizeof (buffer));
+			if (received <= 0) {
+				epoll_ctl (epoll_fd, EPOLL_CTL_DEL, receivers[n], NULL);
+				open--;
+			}
+		}
+	}
+	_exit (0);
+}
+
+/* Function that sends the payload to every connection in turn until
+ * TOTAL_BYTES were sent, and returns the seconds taken until the reader
+ * saw everything. Zerocopy sends fall back to reading completions and
+ * trying again when the kernel runs out of memory to track them, and
+ * copied is set to the number of sends the kernel copied after all.
+ * Returns -1 if the kernel does not support zerocopy. */
+double time_sends (unsigned fanout, char *payload, size_t length, bool zerocopy, unsigned long *copied) {
+	*copied = 0;
+	zerocopy_sends = 0;
+	if (zerocopy) {
+		int one = 1;
+		for (unsigned n = 0; n < fanout; n++) {
+			if (setsockopt (senders[n], SOL_SOCKET, SO_ZEROCOPY, &one, sizeof (one)) == -1) {
+				return -1;
+			}
+		}
+	}
+	unsigned long rounds = TOTAL_BYTES / length / fanout;
+	struct timespec start;
+	struct timespec end;
+	start_reader (fanout);
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (unsigned long round = 0; round < rounds; round++) {
+		for (unsigned n = 0; n < fanout; n++) {
+			size_t sent = 0;
+			while (sent < length) {
+				ssize_t written = send (senders[n], payload + sent, length - sent, zerocopy ? MSG_ZEROCOPY : 0);
+				if (written == -1 && errno == ENOBUFS && zerocopy) {
+					reap_completions (n, true, copied);
+					continue;
+				}
+				if (written == -1) {
+					bench_error ("Unable to send payload");
+				}
+				sent += written;
+				if (zerocopy) {
+					outstanding[n]++;
+					zerocopy_sends++;
+				}
+			}
+			if (zerocopy) {
+				reap_completions (n, false, copied);
+			}
+		}
+	}
+	for (unsigned n = 0; n < fanout; n++) {
+		while (outstanding[n] > 0) {
+			reap_completions (n, true, copied);
+		}
+		shutdown (senders[n], SHUT_WR);
+	}
+	waitpid (reader, NULL, 0);
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	return elapsed_s (&start, &end);
+}
+
+/* Function that reads the zerocopy completions queued on sender n, waiting
+ * for at least one if wait is set. Every completion covers a range of
+ * sends, and every send the kernel had to copy is counted in copied. */
+void reap_completions (unsigned n, bool wait, unsigned long *copied) {
+	while (outstanding[n] > 0) {
+		char control[128];
+		struct msghdr header;
+		memset (&header, 0, sizeof (header));
+		header.msg_control = control;
+		header.msg_controllen = sizeof (control);
+		if (recvmsg (senders[n], &header, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+			if (errno != EAGAIN) {
+				bench_error ("Unable to read completions");
+			}
+			if (!wait) {
+				return;
+			}
+			usleep (10);
+			continue;
+		}
+		struct cmsghdr *message = CMSG_FIRSTHDR (&header);
+		if (message == NULL || message->cmsg_level != SOL_IP || message->cmsg_type != IP_RECVERR) {
+			continue;
+		}
+		struct sock_extended_err error;
+		memcpy (&error, CMSG_DATA (message), sizeof (error));
+		if (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY || error.ee_errno != 0) {
+			bench_error ("Unexpected error on socket");
+		}
+		unsigned long completed = error.ee_data - error.ee_info + 1;
+		outstanding[n] -= completed;
+		if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+			*copied += completed;
+		}
+		wait = false;
+	}
+}
+
+/* Function that returns the time between start and end in seconds. */
+double elapsed_s (struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Function that terminates the benchmark when a step fails. */
+void bench_error (char *reason) {
+	fprintf (stderr, "%s\n", reason);
+	if (reader > 0) {
+		kill (reader, SIGTERM);
+	}
+	exit (1);
+}
@@ -0,0 +1,67 @@
+/* File that counts the calls the server makes to malloc, calloc and
+ * realloc when it is linked with --wrap for each of them. Sending the
+ * server SIGUSR2 writes the count so far to stderr as a line of the form
+ * "allocations N". Allocations made inside the C library, by strdup for
+ * instance, are not seen. Used by bench_allocations.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+void *__real_malloc (size_t size);
+
+void *__real_calloc (size_t count, size_t size);
+
+void *__real_realloc (void *pointer, size_t size);
+
+/* The number of allocations made by every thread of the server. */
+unsigned long allocations;
+
+void *__wrap_malloc (size_t size) {
+	__atomic_add_fetch (&allocations, 1, __ATOMIC_RELAXED);
+	return __real_malloc (size);
+}
+
+void *__wrap_calloc (size_t count, size_t size) {
+	__atomic_add_fetch (&allocations, 1, __ATOMIC_RELAXED);
+	return __real_calloc (count, size);
+}
+
+void *__wrap_realloc (void *pointer, size_t size) {
+	__atomic_add_fetch (&allocations, 1, __ATOMIC_RELAXED);
+	return __real_realloc (pointer, size);
+}
+
+/* Function that writes the count to stderr using only calls that are safe
+ * in a signal handler. */
+void report_allocations (int signum) {
+	char line[64] = "allocations ";
+	char digits[24];
+	unsigned long count = __atomic_load_n (&allocations, __ATOMIC_RELAXED);
+	int length = 0;
+	do {
+		digits[length++] = '0' + count % 10;
+		count /= 10;
+	} while (count > 0);
+	int offset = strlen (line);
+	while (length > 0) {
+		line[offset++] = digits[--length];
+	}
+	line[offset++] = '\n';
+	if (write (STDERR_FILENO, line, offset) == -1) {
+		return;
+	}
+}
+
+/* Function that installs the SIGUSR2 handler before main runs. */
+__attribute__ ((constructor)) void install_allocation_report () {
+	struct sigaction action;
+	memset (&action, 0, sizeof (action));
+	action.sa_handler = report_allocations;
+	action.sa_flags = SA_RESTART;
+	sigaction (SIGUSR2, &action, NULL);
+}
@@ -0,0 +1,186 @@
+/* Tests of server behaviour that depends on the options it is started
+ * with, which the scripted tests in testing/tests cannot pass. Each
+ * scenario is run against a fresh ./server for every backend it applies
+ * to, with clients connected over loopback, and passes if every client
+ * receives what it should within TIMEOUT_MS. Run the tests from the top of
+ * the repository.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "bench_utils.h"
+
+/* The time a client waits for a line it expects, in ms. */
+#define TIMEOUT_MS 2000
+
+/* The time after which the server is assumed to be listening, in ms. */
+#define STARTUP_MS 200
+
+/* The most bytes a client keeps while looking for a line. */
+#define RECEIVE_SIZE 4096
+
+/* The most arguments passed to the server. */
+#define MAX_ARGUMENTS 16
+
+/* The configurations every scenario is run with. */
+char *configurations[][4] = {
+	{"select", "-b", "select", NULL},
+	{"epoll", "-b", "epoll", NULL},
+	{"epoll edge triggered", "-b", "epoll", "-e"},
+	{"epoll edge triggered x2", "-e", "-t", "2"},
+	{"uring", "-b", "uring", NULL},
+};
+
+#define CONFIGURATION_COUNT (sizeof (configurations) / sizeof (configurations[0]))
+
+/* A scenario: its name, the options it adds to the configuration and the
+ * function that runs it against a server on port. */
+struct scenario {
+	char *name;
+	char *options[4];
+	bool (*run) (int port);
+};
+
+bool full_server_accepts_after_close (int port);
+
+void start_test_server (char **configuration, char **options, int port);
+
+int join_client (int port, char *name);
+
+void send_line (int fd, char *line);
+
+bool expect_line (int fd, char *line);
+
+struct scenario scenarios[] = {
+	{"full server accepts after a close", {"-c", "2", NULL}, full_server_accepts_after_close},
+};
+
+int main () {
+	signal (SIGPIPE, SIG_IGN);
+	unsigned failed = 0;
+	unsigned total = 0;
+	for (unsigned i = 0; i < sizeof (scenarios) / sizeof (struct scenario); i++) {
+		for (unsigned c = 0; c < CONFIGURATION_COUNT; c++) {
+			int port = 20000 + (getpid () * 7 + total) % 40000;
+			start_test_server (configurations[c], scenarios[i].options, port);
+			bool passed = scenarios[i].run (port);
+			stop_server (NULL);
+			printf ("%-40s %-22s %s\n", scenarios[i].name, configurations[c][0], passed ? "passed" : "FAILED");
+			failed += !passed;
+			total++;
+		}
+	}
+	printf ("%u tests ran. %u passed. %u failed\n", total, total - failed, failed);
+	return failed > 0;
+}
+
+/* Function that fills a server limited to two connections, queues a third
+ * and closes one of the first two. The third must then be accepted, join
+ * and receive the next line of the remaining one, which an edge triggered
+ * server socket or a stopped io_uring accept only does if it is resumed
+ * when the connection is released since no new connection arrives to raise
+ * an edge. */
+bool full_server_accepts_after_close (int port) {
+	int first = join_client (port, "aa");
+	int second = join_client (port, "bb");
+	if (first == -1 || second == -1 || !expect_line (first, "bb has joined")) {
+		return false;
+	}
+	int third = join_client (port, "cc");
+	if (third == -1) {
+		return false;
+	}
+	usleep (STARTUP_MS * 1000);
+	close (first);
+	bool passed = expect_line (second, "cc has joined");
+	send_line (second, "hello");
+	passed = passed && expect_line (third, "bb:hello");
+	close (second);
+	close (third);
+	return passed;
+}
+
+/* Function that starts ./server with the configuration and the options of
+ * a scenario on port, discarding its output, and waits for it to listen. */
+void start_test_server (char **configuration, char **options, int port) {
+	char port_arg[16];
+	sprintf (port_arg, "%d", port);
+	char *arguments[MAX_ARGUMENTS];
+	unsigned count = 0;
+	arguments[count++] = "server";
+	for (unsigned i = 1; i < 4 && configuration[i] != NULL; i++) {
+		arguments[count++] = configuration[i];
+	}
+	for (unsigned i = 0; i < 4 && options[i] != NULL; i++) {
+		arguments[count++] = options[i];
+	}
+	arguments[count++] = port_arg;
+	arguments[count] = NULL;
+	start_server ("./server", arguments, -1);
+	usleep (STARTUP_MS * 1000);
+}
+
+/* Function that connects to the server on port and sends name, which the
+ * server reads once it has accepted the connection. Returns the socket or
+ * -1 if the connection failed. */
+int join_client (int port, char *name) {
+	int fd = connect_client (port);
+	if (fd != -1) {
+		send_line (fd, name);
+	}
+	return fd;
+}
+
+/* Function that sends line followed by a newline. */
+void send_line (int fd, char *line) {
+	char buffer[RECEIVE_SIZE];
+	int length = snprintf (buffer, sizeof (buffer), "%s\n", line);
+	if (send (fd, buffer, length, 0) != length) {
+		fprintf (stderr, "Unable to send '%s'\n", line);
+	}
+}
+
+/* Function that reads messages from fd until one whose text, after the
+ * byte giving its type, equals line arrives. The socket is read one byte
+ * at a time so nothing after the message is taken. Returns false if the
+ * connection closes or TIMEOUT_MS passes first. */
+bool expect_line (int fd, char *line) {
+	char buffer[RECEIVE_SIZE];
+	unsigned length = 0;
+	struct timespec start;
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	while (1) {
+		struct timespec now;
+		clock_gettime (CLOCK_MONOTONIC, &now);
+		int remaining = TIMEOUT_MS - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+		struct pollfd watched = {fd, POLLIN, 0};
+		if (remaining <= 0 || poll (&watched, 1, remaining) <= 0) {
+			fprintf (stderr, "Timed out waiting for '%s'\n", line);
+			return false;
+		}
+		if (recv (fd, buffer + length, 1, 0) != 1) {
+			fprintf (stderr, "Connection closed waiting for '%s'\n", line);
+			return false;
+		}
+		if (buffer[length] != '\n') {
+			length += length < sizeof (buffer) - 1;
+			continue;
+		}
+		buffer[length] = 0;
+		if (length > 0 && strcmp (buffer + 1, line) == 0) {
+			return true;
+		}
+		length = 0;
+	}
+}
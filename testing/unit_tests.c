@@ -1,7 +1,35 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <CUnit/Basic.h>
 #include "../client_server_utils.h"
+#include "../line_scan.h"
+#include "../command_parse.h"
+#include "../histogram.h"
+#include "../user_utils.h"
+
+/* The number of users filed by the growth test. */
+#define INDEX_TEST_USERS 1000
+
+/* The number of users and of steps of the sorted index test. */
+#define SORTED_TEST_USERS 200
+#define SORTED_TEST_STEPS 2000
+
+/* The functions of user_utils.c that it does not export. */
+unsigned hash_name (char *name);
+
+void index_insert (struct user_index *index, char *key, struct user_info *user);
+
+void index_remove (struct user_index *index, char *key, struct user_info *user);
+
+struct user_info *index_find (struct user_index *index, char *key);
+
+void grow_index (struct user_index *index);
+
+void sorted_insert (struct user_info *user);
+
+void sorted_remove (struct user_info *user);
 
 void test_find_message_end () {
 	char *contents = "hello\n";
@@ -22,6 +50,56 @@ void test_find_message_end () {
 	CU_ASSERT_EQUAL (-1, find_message_end (contents, 17));
 }
 
+void check_line_ends (char *name, char *contents, int start, int end) {
+	int expected[LINE_BATCH];
+	int found[LINE_BATCH];
+	int expected_total = 0;
+	for (int i = start; i < end && expected_total < LINE_BATCH; i++) {
+		if (contents[i] == '\n') {
+			expected[expected_total] = i;
+			expected_total++;
+		}
+	}
+	int found_total = 0;
+	if (strcmp (name, "sse2") == 0) {
+		found_total = find_line_ends_sse2 (contents, start, end, found, LINE_BATCH);
+	} else if (strcmp (name, "avx2") == 0) {
+		found_total = find_line_ends_avx2 (contents, start, end, found, LINE_BATCH);
+	} else {
+		found_total = find_line_ends_scalar (contents, start, end, found, LINE_BATCH);
+	}
+	CU_ASSERT_EQUAL (expected_total, found_total);
+	CU_ASSERT_EQUAL (0, memcmp (expected, found, sizeof (int) * expected_total));
+}
+
+void test_find_line_ends () {
+	char *names[3] = {"scalar", "sse2", "avx2"};
+	char contents[200];
+	for (int i = 0; i < 200; i++) {
+		contents[i] = i % 7 == 3 || i % 31 == 0 ? '\n' : 'a' + i % 26;
+	}
+	for (int name = 0; name < 3; name++) {
+		if (!line_scan_supports (names[name])) {
+			continue;
+		}
+		for (int start = 0; start < 40; start++) {
+			for (int end = start; end <= 200; end += 13) {
+				check_line_ends (names[name], contents, start, end);
+			}
+		}
+		memset (contents, '\n', sizeof (contents));
+		check_line_ends (names[name], contents, 0, 200);
+		check_line_ends (names[name], contents, 5, 70);
+	}
+	int positions[2];
+	CU_ASSERT_EQUAL (2, find_line_ends ("a\nb\n\n", 0, 5, positions, 2));
+	CU_ASSERT_EQUAL (1, positions[0]);
+	CU_ASSERT_EQUAL (3, positions[1]);
+	CU_ASSERT_EQUAL (1, find_line_ends ("a\nb\n\n", 4, 5, positions, 2));
+	CU_ASSERT_EQUAL (4, positions[0]);
+	CU_ASSERT_EQUAL (0, find_line_ends ("a\nb\n\n", 2, 3, positions, 2));
+}
+
 void test_generate_message () {
 	char contents[100] = "I like the way you move\n";
 	char *new_message = generate_message (contents, strlen (contents));
@@ -43,6 +121,242 @@ void test_generate_message () {
 	free (new_message);
 }
 
+void test_find_command () {
+	for (int i = 0; i < COMMAND_COUNT; i++) {
+		CU_ASSERT_EQUAL (i, find_command (commands[i], strlen (commands[i])));
+	}
+	CU_ASSERT_EQUAL (5, find_command ("mute alice", 4));
+	CU_ASSERT_EQUAL (-1, find_command ("mut", 3));
+	CU_ASSERT_EQUAL (-1, find_command ("mutex", 5));
+	CU_ASSERT_EQUAL (-1, find_command ("exif", 4));
+	CU_ASSERT_EQUAL (-1, find_command ("stat", 4));
+	CU_ASSERT_EQUAL (-1, find_command ("show_statuz", 11));
+	CU_ASSERT_EQUAL (-1, find_command ("", 0));
+}
+
+void test_split_command () {
+	struct parsed_command parsed;
+	char message[100] = "  \\set_nickname  alice\tal \n";
+	CU_ASSERT_EQUAL (Parsed_Command, split_command (message, &parsed));
+	CU_ASSERT_EQUAL (2, parsed.command);
+	CU_ASSERT_EQUAL (0, strcmp (parsed.name, "set_nickname"));
+	CU_ASSERT_EQUAL (2, parsed.count);
+	CU_ASSERT_EQUAL (0, strcmp (parsed.args[0], "alice"));
+	CU_ASSERT_EQUAL (0, strcmp (parsed.args[1], "al"));
+	CU_ASSERT_EQUAL (0, strcmp (message, "  \\set_nickname  alice\tal \n"));
+	CU_ASSERT_EQUAL (Parsed_Command, split_command ("\\exit\n", &parsed));
+	CU_ASSERT_EQUAL (0, parsed.count);
+	CU_ASSERT_EQUAL (Unknown_Command, split_command ("\\bogus a b c d\n", &parsed));
+	CU_ASSERT_EQUAL (0, strcmp (parsed.name, "bogus"));
+	CU_ASSERT_EQUAL (Unknown_Command, split_command ("\\bog-us\n", &parsed));
+	CU_ASSERT_EQUAL (0, strcmp (parsed.name, "bog"));
+	CU_ASSERT_EQUAL (Invalid_Arguments, split_command ("\\mute-x\n", &parsed));
+	CU_ASSERT_EQUAL (0, strcmp (parsed.name, "mute"));
+	CU_ASSERT_EQUAL (Invalid_Arguments, split_command ("\\mute al!ce\n", &parsed));
+	CU_ASSERT_EQUAL (Invalid_Arguments, split_command ("\\mute a b c\n", &parsed));
+}
+
+/* Function that writes into keys the first count names of the form kN,
+ * counting N from *next, that a user index with mask picks slot for, and
+ * leaves *next after the last one. */
+void find_keys (unsigned slot, unsigned mask, char keys[][16], unsigned count, unsigned *next) {
+	for (unsigned found = 0; found < count; (*next)++) {
+		sprintf (keys[found], "k%u", *next);
+		if ((hash_name (keys[found]) & mask) == slot) {
+			found++;
+		}
+	}
+}
+
+void test_user_index () {
+	struct user_index index = {NULL, 0, 0};
+	struct user_info users[6];
+	char keys[6][16];
+	unsigned next = 0;
+	grow_index (&index);
+	CU_ASSERT_EQUAL (INITIAL_INDEX_CAPACITY, index.capacity);
+	unsigned mask = index.capacity - 1;
+	/* Three keys that collide in the last slot, so their run wraps to the
+	 * start, and two more whose home is the first slot. */
+	find_keys (mask, mask, keys, 3, &next);
+	find_keys (0, mask, keys + 3, 2, &next);
+	for (unsigned i = 0; i < 5; i++) {
+		index_insert (&index, keys[i], &users[i]);
+	}
+	CU_ASSERT_EQUAL (5, index.count);
+	CU_ASSERT_PTR_EQUAL (&users[0], index.entries[mask].user);
+	for (unsigned i = 1; i < 5; i++) {
+		CU_ASSERT_PTR_EQUAL (&users[i], index.entries[i - 1].user);
+	}
+	for (unsigned i = 0; i < 5; i++) {
+		CU_ASSERT_PTR_EQUAL (&users[i], index_find (&index, keys[i]));
+	}
+	/* Removing from the middle of the wrapped run shifts back every entry
+	 * after it, including those whose home is past the wrap. */
+	index_remove (&index, keys[1], &users[1]);
+	CU_ASSERT_EQUAL (4, index.count);
+	CU_ASSERT_PTR_NULL (index_find (&index, keys[1]));
+	CU_ASSERT_PTR_EQUAL (&users[2], index.entries[0].user);
+	CU_ASSERT_PTR_EQUAL (&users[3], index.entries[1].user);
+	CU_ASSERT_PTR_EQUAL (&users[4], index.entries[2].user);
+	CU_ASSERT_PTR_NULL (index.entries[3].user);
+	/* Removing the head of the run moves the entry homed in the last slot
+	 * back across the wrap and every entry after it back one slot. */
+	index_remove (&index, keys[0], &users[0]);
+	CU_ASSERT_PTR_EQUAL (&users[2], index.entries[mask].user);
+	CU_ASSERT_PTR_EQUAL (&users[3], index.entries[0].user);
+	CU_ASSERT_PTR_EQUAL (&users[4], index.entries[1].user);
+	CU_ASSERT_PTR_NULL (index.entries[2].user);
+	for (unsigned i = 2; i < 5; i++) {
+		CU_ASSERT_PTR_EQUAL (&users[i], index_find (&index, keys[i]));
+	}
+	/* Removing a user that is not filed changes nothing. */
+	index_remove (&index, keys[0], &users[0]);
+	CU_ASSERT_EQUAL (3, index.count);
+	/* The same name may be filed for two users, and removing either one
+	 * leaves the other. */
+	char duplicate[16] = "dup";
+	char same[16] = "dup";
+	index_insert (&index, duplicate, &users[0]);
+	index_insert (&index, same, &users[5]);
+	CU_ASSERT_EQUAL (5, index.count);
+	index_remove (&index, "dup", &users[5]);
+	CU_ASSERT_PTR_EQUAL (&users[0], index_find (&index, "dup"));
+	index_insert (&index, same, &users[5]);
+	index_remove (&index, "dup", &users[0]);
+	CU_ASSERT_PTR_EQUAL (&users[5], index_find (&index, "dup"));
+	index_remove (&index, "dup", &users[5]);
+	CU_ASSERT_PTR_NULL (index_find (&index, "dup"));
+	CU_ASSERT_EQUAL (3, index.count);
+	free (index.entries);
+}
+
+void test_grow_index () {
+	struct user_index index = {NULL, 0, 0};
+	struct user_info *users = calloc (INDEX_TEST_USERS, sizeof (struct user_info));
+	char (*keys)[16] = calloc (INDEX_TEST_USERS, sizeof (*keys));
+	CU_ASSERT_PTR_NULL (index_find (&index, "k0"));
+	for (unsigned i = 0; i < INDEX_TEST_USERS; i++) {
+		sprintf (keys[i], "k%u", i);
+		index_insert (&index, keys[i], &users[i]);
+		CU_ASSERT (index.count * 4 <= index.capacity * 3);
+	}
+	CU_ASSERT_EQUAL (INDEX_TEST_USERS, index.count);
+	CU_ASSERT_EQUAL (0, index.capacity & (index.capacity - 1));
+	for (unsigned i = 0; i < INDEX_TEST_USERS; i++) {
+		CU_ASSERT_PTR_EQUAL (&users[i], index_find (&index, keys[i]));
+	}
+	for (unsigned i = 0; i < INDEX_TEST_USERS; i += 2) {
+		index_remove (&index, keys[i], &users[i]);
+	}
+	CU_ASSERT_EQUAL (INDEX_TEST_USERS / 2, index.count);
+	for (unsigned i = 0; i < INDEX_TEST_USERS; i++) {
+		CU_ASSERT_PTR_EQUAL (i % 2 == 0 ? NULL : &users[i], index_find (&index, keys[i]));
+	}
+	free (index.entries);
+	free (keys);
+	free (users);
+}
+
+/* Function that orders users as the sorted index does, by name and then by
+ * when they were filed. */
+int compare_sorted (const void *first, const void *second) {
+	struct user_info *a = *(struct user_info **) first;
+	struct user_info *b = *(struct user_info **) second;
+	int order = strcmp (a->name_info->name, b->name_info->name);
+	if (order != 0) {
+		return order;
+	}
+	return a->sorted_sequence < b->sorted_sequence ? -1 : a->sorted_sequence > b->sorted_sequence;
+}
+
+/* Function that checks that every position of the sorted index holds the
+ * user at that position of expected, which has count users. */
+void check_sorted (struct user_info **expected, unsigned count) {
+	qsort (expected, count, sizeof (struct user_info *), compare_sorted);
+	CU_ASSERT_EQUAL (count, room_total);
+	for (unsigned i = 0; i < count; i++) {
+		struct sorted_node *node = sorted_user_at (i);
+		CU_ASSERT_PTR_EQUAL (expected[i], node == NULL ? NULL : node->user);
+	}
+	CU_ASSERT_PTR_NULL (sorted_user_at (count));
+}
+
+void test_sorted_index () {
+	struct user_info users[SORTED_TEST_USERS];
+	struct name_info infos[SORTED_TEST_USERS];
+	char names[SORTED_TEST_USERS][16];
+	bool filed[SORTED_TEST_USERS];
+	struct user_info *expected[SORTED_TEST_USERS];
+	memset (filed, 0, sizeof (filed));
+	for (unsigned i = 0; i < SORTED_TEST_USERS; i++) {
+		/* Few distinct names so that many users share one. */
+		sprintf (names[i], "n%u", i % 17);
+		infos[i].name = names[i];
+		users[i].name_info = &infos[i];
+	}
+	unsigned count;
+	srand (17);
+	for (unsigned step = 0; step < SORTED_TEST_STEPS; step++) {
+		unsigned i = rand () % SORTED_TEST_USERS;
+		if (!filed[i]) {
+			sorted_insert (&users[i]);
+			filed[i] = true;
+		} else if (rand () % 2 == 0) {
+			sorted_remove (&users[i]);
+			filed[i] = false;
+		} else {
+			/* A rename, which may take the name of another user and then
+			 * sorts after every user who had it already. */
+			sorted_remove (&users[i]);
+			sprintf (names[i], "n%u", rand () % 17);
+			sorted_insert (&users[i]);
+		}
+		count = 0;
+		for (unsigned u = 0; u < SORTED_TEST_USERS; u++) {
+			if (filed[u]) {
+				expected[count++] = &users[u];
+			}
+		}
+		check_sorted (expected, count);
+	}
+	for (unsigned i = 0; i < SORTED_TEST_USERS; i++) {
+		if (filed[i]) {
+			sorted_remove (&users[i]);
+		}
+	}
+	check_sorted (expected, 0);
+}
+
+void test_histogram () {
+	for (unsigned long value = 0; value < 4096; value++) {
+		unsigned bucket = histogram_bucket (value);
+		CU_ASSERT (value <= bucket_limit (bucket));
+		CU_ASSERT (bucket == 0 || value > bucket_limit (bucket - 1));
+	}
+	CU_ASSERT_EQUAL (HISTOGRAM_BUCKETS - 1, histogram_bucket (~0UL));
+	CU_ASSERT_EQUAL (~0UL, bucket_limit (HISTOGRAM_BUCKETS - 1));
+	struct histogram *histogram = calloc (1, sizeof (struct histogram));
+	CU_ASSERT_EQUAL (0, histogram_percentile (histogram, 0.5));
+	for (unsigned long value = 1; value <= 1000; value++) {
+		record_value (histogram, value * 1000);
+	}
+	CU_ASSERT_EQUAL (1000, histogram->total);
+	CU_ASSERT_EQUAL (1000000, histogram->max);
+	unsigned long median = histogram_percentile (histogram, 0.5);
+	CU_ASSERT (median >= 500000 && median < 500000 + 500000 / HISTOGRAM_SUB_BUCKETS);
+	unsigned long tail = histogram_percentile (histogram, 0.999);
+	CU_ASSERT (tail >= 999000 && tail <= 1000000);
+	CU_ASSERT_EQUAL (1000000, histogram_percentile (histogram, 1));
+	struct histogram *merged = calloc (1, sizeof (struct histogram));
+	record_value (merged, 7);
+	merge_histogram (merged, histogram);
+	CU_ASSERT_EQUAL (1001, merged->total);
+	CU_ASSERT_EQUAL (7, histogram_percentile (merged, 0));
+	free (histogram);
+	free (merged);
+}
+
 int main () {
 	CU_pSuite pSuite = NULL;
 	if (CUE_SUCCESS != CU_initialize_registry ()) {
@@ -55,9 +369,42 @@ int main () {
 	if (!CU_add_test (pSuite, "find_message_end test", test_find_message_end)) {
 		goto exit;
 	}
+	if (!CU_add_test (pSuite, "find_line_ends test", test_find_line_ends)) {
+		goto exit;
+	}
 	if (!CU_add_test (pSuite, "generate_message test", test_generate_message)) {
 		goto exit;
 	}
+	pSuite = CU_add_suite ("Testing command_parse", NULL, NULL);
+	if (!pSuite) {
+		goto exit;
+	}
+	if (!CU_add_test (pSuite, "find_command test", test_find_command)) {
+		goto exit;
+	}
+	if (!CU_add_test (pSuite, "split_command test", test_split_command)) {
+		goto exit;
+	}
+	pSuite = CU_add_suite ("Testing user_utils", NULL, NULL);
+	if (!pSuite) {
+		goto exit;
+	}
+	if (!CU_add_test (pSuite, "user index test", test_user_index)) {
+		goto exit;
+	}
+	if (!CU_add_test (pSuite, "grow_index test", test_grow_index)) {
+		goto exit;
+	}
+	if (!CU_add_test (pSuite, "sorted index test", test_sorted_index)) {
+		goto exit;
+	}
+	pSuite = CU_add_suite ("Testing histogram", NULL, NULL);
+	if (!pSuite) {
+		goto exit;
+	}
+	if (!CU_add_test (pSuite, "histogram test", test_histogram)) {
+		goto exit;
+	}
 	CU_basic_set_mode (CU_BRM_VERBOSE);
 	CU_basic_run_tests ();
 exit:
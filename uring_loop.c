@@ -0,0 +1,1026 @@
+/* File that contains the io_uring backend of the server. The server socket
+ * is watched with a multishot accept and every client with a multishot recv
+ * that picks its buffers from a ring of provided buffers registered with
+ * the kernel. Replies and broadcasts are queued on their connection and
+ * handed to the kernel together as one sendmsg submission when the
+ * connection is flushed, so that a burst of messages costs a single
+ * io_uring_enter. While the server is full the multishot accept is
+ * cancelled, so that new clients wait in the accept queue as they do with
+ * the other backends, and armed again once a connection is released. The
+ * backend talks to the kernel through the raw system calls so no extra
+ * library is needed.
+ * Author: Yuriy Bash */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "server.h"
+#include "uring_loop.h"
+#include "client_server_utils.h"
+#include "shards.h"
+#include "output.h"
+#include "metrics.h"
+#include "admin.h"
+
+/* Tags stored in the low bits of the user data of each request. */
+enum URING_REQUEST {Uring_Accept=1, Uring_Recv=2, Uring_Send=3, Uring_Cancel=4, Uring_Test=5, Uring_Mailbox=6,
+	Uring_Admin=7};
+
+#define URING_TAG_BITS 3
+#define URING_TAG_MASK ((1 << URING_TAG_BITS) - 1)
+
+/* A message waiting to be sent to a connection. It holds a reference to
+ * the outbound message until all of it has been sent. Spare sends are
+ * linked through next. */
+struct uring_send {
+	struct uring_send *next;
+	int sent;
+	struct outbound *message;
+};
+
+/* A sendmsg given to the kernel, covering the first count sends of a
+ * connection. It holds references of its own to their messages, so the
+ * memory the kernel reads from outlives the connection if it is closed
+ * before the completion arrives. A zerocopy sendmsg is kept until the
+ * notification that follows its completion. Spare batches are linked
+ * through next. */
+struct uring_batch {
+	struct uring_batch *next;
+	fd_t fd;
+	unsigned generation;
+	unsigned count;
+	struct msghdr header;
+	struct iovec parts[OUTPUT_BATCH];
+	struct outbound *messages[OUTPUT_BATCH];
+};
+
+/* State kept for every open socket, indexed by file descriptor rather than
+ * by index in the sockets array since completions only carry the
+ * descriptor. generation changes every time the descriptor is
+ * reused so completions meant for a closed connection can be recognised.
+ * queued_bytes counts the bytes not yet sent, which output_limit bounds,
+ * count the sends queued and in_flight those covered by the batch the
+ * kernel owns. */
+struct uring_connection {
+	unsigned slot;
+	unsigned generation;
+	unsigned count;
+	unsigned in_flight;
+	unsigned queued_bytes;
+	struct uring_send *head;
+	struct uring_send *tail;
+};
+
+/* File descriptor of the ring. Every shard has a ring of its own so the
+ * state of the backend is kept per thread. */
+__thread fd_t ring_fd = -1;
+
+/* The mapped submission and completion rings, which share one mapping, and
+ * the mapped submission entries. */
+__thread void *rings;
+__thread size_t rings_size;
+__thread struct io_uring_sqe *sqes;
+__thread size_t sqes_size;
+
+/* Pointers into the mapped rings. */
+__thread unsigned *sq_head;
+__thread unsigned *sq_tail;
+__thread unsigned *sq_mask;
+__thread unsigned sq_entries;
+__thread unsigned sq_local_tail;
+__thread unsigned *cq_head;
+__thread unsigned *cq_tail;
+__thread unsigned *cq_mask;
+__thread struct io_uring_cqe *cqes;
+
+/* The provided buffer ring and the memory backing its buffers. */
+__thread struct io_uring_buf_ring *buf_ring;
+__thread size_t buf_ring_size;
+__thread char *buffers;
+__thread unsigned short buf_tail;
+
+/* Per descriptor connection state and its current capacity. */
+__thread struct uring_connection *uring_connections;
+__thread unsigned uring_capacity;
+
+/* The number of connections accepted by the completions of the current
+ * wakeup. The multishot accept drains the accept queue on its own so there
+ * is no budget to apply, only the counters to keep. */
+__thread unsigned uring_accepted;
+
+/* Whether the multishot accept is armed, which it stays until its last
+ * completion arrives, and whether it has been stopped because the server is
+ * full, in which case it is not armed again. */
+__thread bool uring_accept_armed;
+__thread bool uring_accept_stopped;
+
+/* The connections the multishot accept handed over while the server was
+ * full, oldest first, which are added once there is room. */
+__thread fd_t *deferred_accepts;
+__thread unsigned deferred_count;
+__thread unsigned deferred_capacity;
+
+/* Whether the kernel supports zerocopy sendmsg. */
+__thread bool uring_zerocopy;
+
+/* The sends and batches kept for reuse, so queueing a message allocates
+ * nothing once a shard has warmed up. */
+__thread struct uring_send *spare_sends;
+__thread unsigned spare_send_count;
+__thread struct uring_batch *spare_batches;
+__thread unsigned spare_batch_count;
+
+int sys_io_uring_setup (unsigned entries, struct io_uring_params *params);
+
+int sys_io_uring_enter (unsigned to_submit, unsigned min_complete, unsigned flags);
+
+int sys_io_uring_register (unsigned opcode, void *arg, unsigned count);
+
+bool uring_map (struct io_uring_params *params);
+
+bool uring_supports_ops ();
+
+bool uring_setup_buffers ();
+
+bool uring_test_multishot ();
+
+void uring_teardown ();
+
+struct io_uring_sqe *uring_get_sqe ();
+
+void uring_submit ();
+
+void uring_submit_and_poll ();
+
+void uring_arm_accept ();
+
+void uring_stall_accept ();
+
+void uring_defer_accept (fd_t fd);
+
+void uring_arm_mailbox ();
+
+void uring_arm_recv (fd_t fd);
+
+void uring_submit_batch (fd_t fd);
+
+void uring_recycle (unsigned bid);
+
+void uring_dispatch (uint64_t data, int res, unsigned flags);
+
+void uring_handle_recv (fd_t fd, unsigned generation, int res, unsigned flags);
+
+void uring_handle_batch (struct uring_batch *batch, int res, unsigned flags);
+
+void uring_free_batch (struct uring_batch *batch);
+
+void uring_free_send (struct uring_send *send);
+
+void uring_drop_oldest (struct uring_connection *connection, unsigned length);
+
+void uring_reserve (fd_t fd);
+
+uint64_t uring_data (fd_t fd, unsigned generation, enum URING_REQUEST tag);
+
+/*
+ * Function: uring_init
+ * --------------------
+ * creates the ring, checks that every feature the backend relies on is
+ * present and arms the multishot accept on the server socket, as well as a
+ * poll on the shard's mailbox when there are several shards. Anything
+ * created is torn down again if a check fails so the caller can fall back
+ * to a readiness based backend.
+ *
+ * returns: true if the backend is ready to use
+ */
+bool uring_init () {
+	struct io_uring_params params;
+	memset (&params, 0, sizeof (params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+	params.cq_entries = URING_ENTRIES * URING_CQ_FACTOR;
+	ring_fd = sys_io_uring_setup (URING_ENTRIES, &params);
+	if (ring_fd == -1 && errno == EINVAL) {
+		memset (&params, 0, sizeof (params));
+		params.flags = IORING_SETUP_CQSIZE;
+		params.cq_entries = URING_ENTRIES * URING_CQ_FACTOR;
+		ring_fd = sys_io_uring_setup (URING_ENTRIES, &params);
+	}
+	if (ring_fd == -1) {
+		return false;
+	}
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)
+			|| !uring_map (&params) || !uring_supports_ops () || !uring_setup_buffers ()
+			|| !uring_test_multishot ()) {
+		uring_teardown ();
+		return false;
+	}
+	uring_capacity = 0;
+	uring_connections = NULL;
+	uring_accept_stopped = false;
+	uring_arm_accept ();
+	if (shard_count > 1) {
+		uring_arm_mailbox ();
+	}
+	return true;
+}
+
+/*
+ * Function: uring_add
+ * -------------------
+ * starts tracking the socket in index n and arms its multishot recv.
+ *
+ * n: index (in `sockets`) of the new connection
+ *
+ * returns: void
+ */
+void uring_add (unsigned n) {
+	fd_t fd = sockets[n];
+	uring_reserve (fd);
+	struct uring_connection *connection = &uring_connections[fd];
+	connection->slot = n;
+	connection->generation++;
+	connection->count = 0;
+	connection->in_flight = 0;
+	connection->queued_bytes = 0;
+	connection->head = NULL;
+	connection->tail = NULL;
+	uring_arm_recv (fd);
+}
+
+/*
+ * Function: uring_remove
+ * ----------------------
+ * cancels every request on the socket in index n and frees the messages that
+ * were still queued for it. The batch currently owned by the kernel, if
+ * any, is freed once its completion arrives. The cancellation is submitted
+ * right away since it is matched by descriptor, which the caller is about
+ * to close.
+ *
+ * n: index (in `sockets`) of the connection being closed
+ *
+ * returns: void
+ */
+void uring_remove (unsigned n) {
+	fd_t fd = sockets[n];
+	struct uring_connection *connection = &uring_connections[fd];
+	connection->generation++;
+	struct uring_send *send = connection->head;
+	while (send != NULL) {
+		struct uring_send *next = send->next;
+		uring_free_send (send);
+		send = next;
+	}
+	connection->head = NULL;
+	connection->tail = NULL;
+	connection->count = 0;
+	connection->in_flight = 0;
+	output_stats.queued_bytes -= connection->queued_bytes;
+	connection->queued_bytes = 0;
+	struct io_uring_sqe *sqe = uring_get_sqe ();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = fd;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	sqe->user_data = Uring_Cancel;
+	uring_submit ();
+}
+
+/*
+ * Function: uring_send
+ * --------------------
+ * adds a reference to a message to the send queue of a connection, which
+ * is handed to the kernel when the connection is flushed at the end of the
+ * wakeup, or right away once OUTPUT_BATCH messages wait and the kernel
+ * owns none of them. If the queue
+ * would grow past output_limit the slow consumer policy is applied first,
+ * where the oldest messages that can be dropped are those behind the ones
+ * the kernel is sending.
+ *
+ * n: index (in `sockets`) of the recipient
+ * message: the message to send
+ *
+ * returns: false if the connection should be closed
+ */
+bool uring_send (unsigned n, struct outbound *message) {
+	fd_t fd = sockets[n];
+	struct uring_connection *connection = &uring_connections[fd];
+	if (connection->queued_bytes + message->length > output_limit) {
+		if (output_policy == Disconnect_Slow) {
+			output_stats.slow_disconnects++;
+			return false;
+		}
+		if (output_policy == Drop_Oldest) {
+			uring_drop_oldest (connection, message->length);
+		}
+		if (connection->queued_bytes + message->length > output_limit) {
+			output_stats.dropped_messages++;
+			output_stats.dropped_bytes += message->length;
+			return true;
+		}
+	}
+	struct uring_send *send = spare_sends;
+	if (send != NULL) {
+		spare_sends = send->next;
+		spare_send_count--;
+	} else {
+		send = malloc (sizeof (struct uring_send));
+		if (send == NULL) {
+			allocation_failed ();
+		}
+	}
+	send->next = NULL;
+	send->sent = 0;
+	send->message = message;
+	hold_outbound (message);
+	if (connection->tail == NULL) {
+		connection->head = send;
+	} else {
+		connection->tail->next = send;
+	}
+	connection->tail = send;
+	connection->count++;
+	connection->queued_bytes += message->length;
+	output_stats.queued_bytes += message->length;
+	if (connection->queued_bytes > output_stats.peak_bytes) {
+		output_stats.peak_bytes = connection->queued_bytes;
+	}
+	if (connection->in_flight > 0) {
+		output_stats.queued_messages++;
+	} else if (connection->count >= OUTPUT_BATCH) {
+		uring_submit_batch (fd);
+		return true;
+	}
+	schedule_flush (n);
+	return true;
+}
+
+/* Function that hands the queued sends of the socket in index n to the
+ * kernel unless it still owns a batch of them, in which case the rest
+ * follow when that batch completes. Only one batch per connection is given
+ * to the kernel at a time so that messages arrive in the order they were
+ * queued. */
+bool uring_flush (unsigned n) {
+	struct uring_connection *connection = &uring_connections[sockets[n]];
+	if (connection->in_flight == 0 && connection->head != NULL) {
+		uring_submit_batch (sockets[n]);
+	}
+	return true;
+}
+
+/*
+ * Function: uring_wait
+ * --------------------
+ * submits everything queued since the last call and waits for at least one
+ * completion in the same system call, then dispatches every completion that
+ * is available. After every URING_COMPLETION_BATCH completions the
+ * requests they queued are submitted and the kernel asked for the
+ * completions that are ready, so that a long run of received messages is
+ * sent on while it is still being handled and the sends that finish are
+ * seen before their queues reach output_limit. The connections
+ * accepted along the way are recorded as one accept wakeup.
+ *
+ * returns: void
+ */
+void uring_wait () {
+	__atomic_store_n (sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+	unsigned pending = sq_local_tail - __atomic_load_n (sq_head, __ATOMIC_ACQUIRE);
+	sys_io_uring_enter (pending, 1, IORING_ENTER_GETEVENTS);
+	begin_iteration ();
+	uring_accepted = 0;
+	unsigned head = *cq_head;
+	unsigned handled = 0;
+	while (head != __atomic_load_n (cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+		uint64_t data = cqe->user_data;
+		int res = cqe->res;
+		unsigned flags = cqe->flags;
+		head++;
+		__atomic_store_n (cq_head, head, __ATOMIC_RELEASE);
+		uring_dispatch (data, res, flags);
+		handled++;
+		if (handled % URING_COMPLETION_BATCH == 0) {
+			flush_scheduled_output ();
+			uring_submit_and_poll ();
+		}
+	}
+	if (uring_accepted > 0) {
+		record_accept_wakeup (uring_accepted);
+	}
+}
+
+/*
+ * Function: uring_dispatch
+ * ------------------------
+ * handles one completion based on the tag in its user data.
+ *
+ * data: the user data of the request
+ * res: the result of the request
+ * flags: the completion flags
+ *
+ * returns: void
+ */
+void uring_dispatch (uint64_t data, int res, unsigned flags) {
+	enum URING_REQUEST tag = data & URING_TAG_MASK;
+	if (tag == Uring_Accept) {
+		if (res >= 0) {
+			uring_accepted++;
+			if (!connections_full ()) {
+				add_connection (res);
+			} else {
+				uring_defer_accept (res);
+			}
+		}
+		if (!(flags & IORING_CQE_F_MORE)) {
+			uring_accept_armed = false;
+			if (!uring_accept_stopped) {
+				uring_arm_accept ();
+			}
+		}
+		if (connections_full () && !uring_accept_stopped) {
+			uring_stall_accept ();
+		}
+	} else if (tag == Uring_Recv) {
+		fd_t fd = (data >> URING_TAG_BITS) & 0x1fffffff;
+		uring_handle_recv (fd, data >> 32, res, flags);
+	} else if (tag == Uring_Send) {
+		uring_handle_batch ((struct uring_batch *) (uintptr_t) (data & ~(uint64_t) URING_TAG_MASK), res, flags);
+	} else if (tag == Uring_Mailbox) {
+		handle_mailbox ();
+		uring_resume_accept ();
+		uring_arm_mailbox ();
+	} else if (tag == Uring_Admin) {
+		handle_admin (data >> URING_TAG_BITS);
+	}
+}
+
+/*
+ * Function: uring_handle_recv
+ * ---------------------------
+ * copies the received bytes out of the provided buffer into the message
+ * buffer of the connection, handing them to handle_received in pieces no
+ * larger than the space left, then gives the buffer back to the kernel.
+ *
+ * fd: the socket the data was received on
+ * generation: the generation of the connection the request was armed for
+ * res: the number of bytes received or a negative error
+ * flags: the completion flags, holding the buffer id
+ *
+ * returns: void
+ */
+void uring_handle_recv (fd_t fd, unsigned generation, int res, unsigned flags) {
+	bool current = fd < uring_capacity && uring_connections[fd].generation == generation;
+	if (res > 0 && current) {
+		char *data = buffers + (flags >> IORING_CQE_BUFFER_SHIFT) * URING_BUFFER_SIZE;
+		int remaining = res;
+		while (remaining > 0 && uring_connections[fd].generation == generation) {
+			unsigned n = uring_connections[fd].slot;
+			int room = receive_space (n);
+			if (room == 0) {
+				close_connection (n);
+				break;
+			}
+			int length = remaining < room ? remaining : room;
+			memcpy (messages[n] + offsets[n], data, length);
+			data += length;
+			remaining -= length;
+			handle_received (n, length);
+		}
+	}
+	if (flags & IORING_CQE_F_BUFFER) {
+		uring_recycle (flags >> IORING_CQE_BUFFER_SHIFT);
+	}
+	if (!current || uring_connections[fd].generation != generation) {
+		return;
+	}
+	if (res == 0 || (res < 0 && res != -ENOBUFS)) {
+		close_connection (uring_connections[fd].slot);
+	} else if (!(flags & IORING_CQE_F_MORE)) {
+		uring_arm_recv (fd);
+	}
+}
+
+/*
+ * Function: uring_handle_batch
+ * ----------------------------
+ * advances the send queue of a connection by the bytes the kernel sent
+ * from a batch, freeing every message sent in full. Anything left,
+ * including the rest of a short send, is scheduled for the next flush. A
+ * failed send closes the connection. The batch itself is freed now unless
+ * the kernel will post a zerocopy notification for it, which frees it.
+ *
+ * batch: the batch the completion is for
+ * res: the number of bytes sent or a negative error, or for a
+ * notification whether the kernel copied the data after all
+ * flags: the completion flags
+ *
+ * returns: void
+ */
+void uring_handle_batch (struct uring_batch *batch, int res, unsigned flags) {
+	if (flags & IORING_CQE_F_NOTIF) {
+		if (res & IORING_NOTIF_USAGE_ZC_COPIED) {
+			output_stats.zerocopy_copied++;
+		}
+		uring_free_batch (batch);
+		return;
+	}
+	struct uring_connection *connection = &uring_connections[batch->fd];
+	bool current = connection->generation == batch->generation;
+	if (!(flags & IORING_CQE_F_MORE)) {
+		uring_free_batch (batch);
+	}
+	if (!current) {
+		return;
+	}
+	connection->in_flight = 0;
+	if (res < 0) {
+		close_connection (connection->slot);
+		return;
+	}
+	connection->queued_bytes -= res;
+	output_stats.queued_bytes -= res;
+	shard_metrics.bytes_out += res;
+	while (res > 0) {
+		struct uring_send *send = connection->head;
+		int left = send->message->length - send->sent;
+		if (res < left) {
+			send->sent += res;
+			break;
+		}
+		res -= left;
+		connection->head = send->next;
+		connection->count--;
+		uring_free_send (send);
+		output_stats.written_messages++;
+	}
+	if (connection->head == NULL) {
+		connection->tail = NULL;
+	} else {
+		schedule_flush (connection->slot);
+	}
+}
+
+/* Function that queues a multishot accept on the server socket. */
+void uring_arm_accept () {
+	struct io_uring_sqe *sqe = uring_get_sqe ();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = sockets[0];
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->user_data = Uring_Accept;
+	uring_accept_armed = true;
+}
+
+/*
+ * Function: uring_stall_accept
+ * ----------------------------
+ * stops accepting because the server is full. The multishot accept is
+ * cancelled, so that new clients wait in the accept queue rather than
+ * being accepted and reset, and the shard is marked as stalled so that
+ * whichever shard releases a connection has it resume. If a connection was
+ * released before the mark was seen it resumes right away instead.
+ *
+ * returns: void
+ */
+void uring_stall_accept () {
+	if (!uring_accept_stopped) {
+		uring_accept_stopped = true;
+		if (uring_accept_armed) {
+			struct io_uring_sqe *sqe = uring_get_sqe ();
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = Uring_Accept;
+			sqe->user_data = Uring_Cancel;
+			uring_submit ();
+		}
+	}
+	__atomic_store_n (&current_shard->accept_stalled, true, __ATOMIC_SEQ_CST);
+	if (!connections_full ()) {
+		uring_resume_accept ();
+	}
+}
+
+/* Function that resumes accepting if the shard is stalled and the server
+ * has room, adding the deferred connections first. */
+void uring_resume_accept () {
+	if (!__atomic_exchange_n (&current_shard->accept_stalled, false, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+	unsigned added = 0;
+	while (added < deferred_count && !connections_full ()) {
+		add_connection (deferred_accepts[added]);
+		added++;
+	}
+	deferred_count -= added;
+	memmove (deferred_accepts, deferred_accepts + added, sizeof (fd_t) * deferred_count);
+	if (deferred_count > 0 || connections_full ()) {
+		uring_stall_accept ();
+		return;
+	}
+	uring_accept_stopped = false;
+	if (!uring_accept_armed) {
+		uring_arm_accept ();
+		uring_submit ();
+	}
+}
+
+/* Function that keeps a connection the multishot accept handed over while
+ * the server was full until there is room for it. Only the completions
+ * posted before the cancellation took effect end up here. */
+void uring_defer_accept (fd_t fd) {
+	if (deferred_count == deferred_capacity) {
+		unsigned capacity = deferred_capacity == 0 ? 16 : deferred_capacity * 2;
+		fd_t *grown = realloc (deferred_accepts, sizeof (fd_t) * capacity);
+		if (grown == NULL) {
+			allocation_failed ();
+		}
+		deferred_accepts = grown;
+		deferred_capacity = capacity;
+	}
+	deferred_accepts[deferred_count++] = fd;
+}
+
+/* Function that queues a poll for the mailbox of the current shard. The
+ * poll is one shot so that it is armed again only after the mail has been
+ * handled. */
+void uring_arm_mailbox () {
+	struct io_uring_sqe *sqe = uring_get_sqe ();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = current_shard->mailbox.event_fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = Uring_Mailbox;
+}
+
+/* Function that queues a one shot poll on the admin socket fd, for
+ * writability if output is true and readability otherwise. handle_admin
+ * queues the next one, if any, when it completes. */
+void uring_watch_admin (fd_t fd, bool output) {
+	struct io_uring_sqe *sqe = uring_get_sqe ();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = output ? POLLOUT : POLLIN;
+	sqe->user_data = ((uint64_t) fd << URING_TAG_BITS) | Uring_Admin;
+}
+
+/* Function that queues a multishot recv on fd which selects its buffers
+ * from the provided buffer ring. */
+void uring_arm_recv (fd_t fd) {
+	struct io_uring_sqe *sqe = uring_get_sqe ();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = uring_data (fd, uring_connections[fd].generation, Uring_Recv);
+}
+
+/* Function that queues a sendmsg of the unsent part of the first
+ * OUTPUT_BATCH sends of fd, passing MSG_MORE if output_more is set and
+ * sends are left over. A sendmsg of at least zerocopy_threshold bytes is
+ * made zerocopy when the kernel supports it. */
+void uring_submit_batch (fd_t fd) {
+	struct uring_connection *connection = &uring_connections[fd];
+	struct uring_batch *batch = spare_batches;
+	if (batch != NULL) {
+		spare_batches = batch->next;
+		spare_batch_count--;
+	} else {
+		batch = malloc (sizeof (struct uring_batch));
+		if (batch == NULL) {
+			allocation_failed ();
+		}
+	}
+	batch->fd = fd;
+	batch->generation = connection->generation;
+	batch->count = 0;
+	size_t length = 0;
+	struct uring_send *send = connection->head;
+	for (; send != NULL && batch->count < OUTPUT_BATCH; send = send->next) {
+		hold_outbound (send->message);
+		batch->messages[batch->count] = send->message;
+		batch->parts[batch->count].iov_base = send->message->data + send->sent;
+		batch->parts[batch->count].iov_len = send->message->length - send->sent;
+		length += batch->parts[batch->count].iov_len;
+		batch->count++;
+	}
+	memset (&batch->header, 0, sizeof (batch->header));
+	batch->header.msg_iov = batch->parts;
+	batch->header.msg_iovlen = batch->count;
+	connection->in_flight = batch->count;
+	struct io_uring_sqe *sqe = uring_get_sqe ();
+	sqe->opcode = IORING_OP_SENDMSG;
+	if (uring_zerocopy && zerocopy_threshold > 0 && length >= zerocopy_threshold) {
+		sqe->opcode = IORING_OP_SENDMSG_ZC;
+		sqe->ioprio = IORING_SEND_ZC_REPORT_USAGE;
+		output_stats.zerocopy_writes++;
+	}
+	sqe->fd = fd;
+	sqe->addr = (uint64_t) (uintptr_t) &batch->header;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL | (output_more && send != NULL ? MSG_MORE : 0);
+	sqe->user_data = (uint64_t) (uintptr_t) batch | Uring_Send;
+	output_stats.write_calls++;
+}
+
+/* Function that discards the oldest sends of a connection that the kernel
+ * does not own and that have not been started, until length more bytes fit
+ * under output_limit or none are left. */
+void uring_drop_oldest (struct uring_connection *connection, unsigned length) {
+	unsigned kept_total = connection->in_flight;
+	if (kept_total == 0 && connection->head != NULL && connection->head->sent > 0) {
+		kept_total = 1;
+	}
+	struct uring_send **link = &connection->head;
+	struct uring_send *kept = NULL;
+	for (unsigned i = 0; i < kept_total; i++) {
+		kept = *link;
+		link = &kept->next;
+	}
+	while (*link != NULL && connection->queued_bytes + length > output_limit) {
+		struct uring_send *dropped = *link;
+		*link = dropped->next;
+		if (connection->tail == dropped) {
+			connection->tail = kept;
+		}
+		connection->count--;
+		connection->queued_bytes -= dropped->message->length;
+		output_stats.queued_bytes -= dropped->message->length;
+		output_stats.dropped_messages++;
+		output_stats.dropped_bytes += dropped->message->length;
+		uring_free_send (dropped);
+	}
+}
+
+/* Function that frees a send once all of it has been sent or its
+ * connection closed, dropping its reference to the message. The send is
+ * kept for reuse unless enough already are. */
+void uring_free_send (struct uring_send *send) {
+	release_outbound (send->message);
+	if (spare_send_count < URING_SPARE_SENDS) {
+		send->next = spare_sends;
+		spare_sends = send;
+		spare_send_count++;
+	} else {
+		free (send);
+	}
+}
+
+/* Function that frees a batch once the kernel is done with it, dropping
+ * its references to the messages. The batch is kept for reuse unless
+ * enough already are. */
+void uring_free_batch (struct uring_batch *batch) {
+	for (unsigned i = 0; i < batch->count; i++) {
+		release_outbound (batch->messages[i]);
+	}
+	if (spare_batch_count < URING_SPARE_BATCHES) {
+		batch->next = spare_batches;
+		spare_batches = batch;
+		spare_batch_count++;
+	} else {
+		free (batch);
+	}
+}
+
+/* Function that gives the buffer with id bid back to the kernel. */
+void uring_recycle (unsigned bid) {
+	struct io_uring_buf *buf = &buf_ring->bufs[buf_tail & (URING_BUFFER_COUNT - 1)];
+	buf->addr = (uint64_t) (uintptr_t) (buffers + bid * URING_BUFFER_SIZE);
+	buf->len = URING_BUFFER_SIZE;
+	buf->bid = bid;
+	buf_tail++;
+	__atomic_store_n (&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+/* Function that returns the next free submission queue entry, cleared. If
+ * the queue is full everything queued so far is submitted first. */
+struct io_uring_sqe *uring_get_sqe () {
+	if (sq_local_tail - __atomic_load_n (sq_head, __ATOMIC_ACQUIRE) == sq_entries) {
+		uring_submit ();
+	}
+	struct io_uring_sqe *sqe = &sqes[sq_local_tail & *sq_mask];
+	memset (sqe, 0, sizeof (struct io_uring_sqe));
+	sq_local_tail++;
+	return sqe;
+}
+
+/* Function that submits every queued request without waiting. */
+void uring_submit () {
+	__atomic_store_n (sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+	unsigned pending = sq_local_tail - __atomic_load_n (sq_head, __ATOMIC_ACQUIRE);
+	if (pending > 0) {
+		sys_io_uring_enter (pending, 0, 0);
+	}
+}
+
+/* Function that submits every queued request and has the kernel post the
+ * completions that are ready without waiting for any. */
+void uring_submit_and_poll () {
+	__atomic_store_n (sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+	unsigned pending = sq_local_tail - __atomic_load_n (sq_head, __ATOMIC_ACQUIRE);
+	sys_io_uring_enter (pending, 0, IORING_ENTER_GETEVENTS);
+}
+
+/* Function that grows the per descriptor state so that fd can be used as an
+ * index into it. */
+void uring_reserve (fd_t fd) {
+	if (fd < uring_capacity) {
+		return;
+	}
+	unsigned capacity = uring_capacity == 0 ? 64 : uring_capacity;
+	while (capacity <= fd) {
+		capacity *= 2;
+	}
+	uring_connections = realloc (uring_connections, sizeof (struct uring_connection) * capacity);
+	if (uring_connections == NULL) {
+		allocation_failed ();
+	}
+	memset (uring_connections + uring_capacity, 0, sizeof (struct uring_connection) * (capacity - uring_capacity));
+	uring_capacity = capacity;
+}
+
+/* Function that packs a descriptor, its generation and a tag into the user
+ * data of a request. */
+uint64_t uring_data (fd_t fd, unsigned generation, enum URING_REQUEST tag) {
+	return ((uint64_t) generation << 32) | ((uint64_t) fd << URING_TAG_BITS) | tag;
+}
+
+/* Function that maps the submission queue, completion queue and submission
+ * entries of the ring. */
+bool uring_map (struct io_uring_params *params) {
+	rings_size = params->sq_off.array + params->sq_entries * sizeof (unsigned);
+	size_t cq_size = params->cq_off.cqes + params->cq_entries * sizeof (struct io_uring_cqe);
+	if (cq_size > rings_size) {
+		rings_size = cq_size;
+	}
+	rings = mmap (NULL, rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (rings == MAP_FAILED) {
+		rings = NULL;
+		return false;
+	}
+	sqes_size = params->sq_entries * sizeof (struct io_uring_sqe);
+	sqes = mmap (NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		sqes = NULL;
+		return false;
+	}
+	sq_head = (unsigned *) ((char *) rings + params->sq_off.head);
+	sq_tail = (unsigned *) ((char *) rings + params->sq_off.tail);
+	sq_mask = (unsigned *) ((char *) rings + params->sq_off.ring_mask);
+	sq_entries = params->sq_entries;
+	unsigned *array = (unsigned *) ((char *) rings + params->sq_off.array);
+	for (unsigned i = 0; i < sq_entries; i++) {
+		array[i] = i;
+	}
+	sq_local_tail = *sq_tail;
+	cq_head = (unsigned *) ((char *) rings + params->cq_off.head);
+	cq_tail = (unsigned *) ((char *) rings + params->cq_off.tail);
+	cq_mask = (unsigned *) ((char *) rings + params->cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *) ((char *) rings + params->cq_off.cqes);
+	return true;
+}
+
+/* Function that checks that the kernel knows every opcode the backend
+ * needs, and whether it knows zerocopy sendmsg, which is optional. */
+bool uring_supports_ops () {
+	unsigned count = 256;
+	struct io_uring_probe *probe = calloc (1, sizeof (struct io_uring_probe) + count * sizeof (struct io_uring_probe_op));
+	if (probe == NULL) {
+		allocation_failed ();
+	}
+	bool supported = sys_io_uring_register (IORING_REGISTER_PROBE, probe, count) == 0;
+	unsigned char needed[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_ASYNC_CANCEL, IORING_OP_POLL_ADD};
+	for (unsigned i = 0; supported && i < sizeof (needed); i++) {
+		supported = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+	}
+	uring_zerocopy = supported && IORING_OP_SENDMSG_ZC <= probe->last_op
+		&& (probe->ops[IORING_OP_SENDMSG_ZC].flags & IO_URING_OP_SUPPORTED);
+	free (probe);
+	return supported;
+}
+
+/* Function that allocates the buffers, registers the provided buffer ring
+ * with the kernel and fills it. */
+bool uring_setup_buffers () {
+	buf_ring_size = URING_BUFFER_COUNT * sizeof (struct io_uring_buf);
+	buf_ring = mmap (NULL, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf_ring == MAP_FAILED) {
+		buf_ring = NULL;
+		return false;
+	}
+	buffers = malloc ((size_t) URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+	if (buffers == NULL) {
+		allocation_failed ();
+	}
+	struct io_uring_buf_reg reg;
+	memset (&reg, 0, sizeof (reg));
+	reg.ring_addr = (uint64_t) (uintptr_t) buf_ring;
+	reg.ring_entries = URING_BUFFER_COUNT;
+	reg.bgid = 0;
+	if (sys_io_uring_register (IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+		return false;
+	}
+	buf_tail = 0;
+	for (unsigned bid = 0; bid < URING_BUFFER_COUNT; bid++) {
+		uring_recycle (bid);
+	}
+	return true;
+}
+
+/* Function that checks that multishot recv works by receiving one byte over
+ * a socket pair, since kernels that predate it reject the request only when
+ * it is issued. Multishot accept predates multishot recv so it is covered
+ * as well. */
+bool uring_test_multishot () {
+	fd_t pair[2];
+	if (socketpair (AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+		return false;
+	}
+	struct io_uring_sqe *sqe = uring_get_sqe ();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = pair[0];
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = Uring_Test;
+	uring_submit ();
+	bool supported = false;
+	bool finished = false;
+	bool cancelled = false;
+	if (write (pair[1], "", 1) == 1) {
+		while (!finished || !cancelled) {
+			if (sys_io_uring_enter (0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) {
+				break;
+			}
+			unsigned head = *cq_head;
+			while (head != __atomic_load_n (cq_tail, __ATOMIC_ACQUIRE)) {
+				struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+				if (cqe->user_data == Uring_Test) {
+					if (cqe->res == 1 && (cqe->flags & IORING_CQE_F_MORE)) {
+						supported = true;
+						sqe = uring_get_sqe ();
+						sqe->opcode = IORING_OP_ASYNC_CANCEL;
+						sqe->fd = pair[0];
+						sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+						sqe->user_data = Uring_Cancel;
+						uring_submit ();
+					} else if (!(cqe->flags & IORING_CQE_F_MORE)) {
+						finished = true;
+						cancelled = cancelled || !supported;
+					}
+					if (cqe->flags & IORING_CQE_F_BUFFER) {
+						uring_recycle (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+					}
+				} else if (cqe->user_data == Uring_Cancel) {
+					cancelled = true;
+				}
+				head++;
+				__atomic_store_n (cq_head, head, __ATOMIC_RELEASE);
+			}
+		}
+	}
+	close (pair[0]);
+	close (pair[1]);
+	return supported && finished;
+}
+
+/* Function that releases everything uring_init created. */
+void uring_teardown () {
+	if (sqes != NULL) {
+		munmap (sqes, sqes_size);
+		sqes = NULL;
+	}
+	if (rings != NULL) {
+		munmap (rings, rings_size);
+		rings = NULL;
+	}
+	if (buf_ring != NULL) {
+		munmap (buf_ring, buf_ring_size);
+		buf_ring = NULL;
+	}
+	free (buffers);
+	buffers = NULL;
+	close (ring_fd);
+	ring_fd = -1;
+}
+
+/* Wrappers for the io_uring system calls. */
+int sys_io_uring_setup (unsigned entries, struct io_uring_params *params) {
+	return syscall (__NR_io_uring_setup, entries, params);
+}
+
+int sys_io_uring_enter (unsigned to_submit, unsigned min_complete, unsigned flags) {
+	shard_metrics.poll_calls++;
+	return syscall (__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int sys_io_uring_register (unsigned opcode, void *arg, unsigned count) {
+	return syscall (__NR_io_uring_register, ring_fd, opcode, arg, count);
+}
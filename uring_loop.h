@@ -0,0 +1,79 @@
+/* File that contains the io_uring backend of the server. The server socket
+ * is watched with a multishot accept and every client with a multishot recv
+ * that picks its buffers from a ring of provided buffers registered with
+ * the kernel. Replies and broadcasts are queued on their connection and
+ * handed to the kernel together as one sendmsg submission when the
+ * connection is flushed, so that a burst of messages costs a single
+ * io_uring_enter. While the server is full the multishot accept is
+ * cancelled, so that new clients wait in the accept queue as they do with
+ * the other backends, and armed again once a connection is released. The
+ * backend talks to the kernel through the raw system calls so no extra
+ * library is needed.
+ * Author: Yuriy Bash */
+
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+#include <stdbool.h>
+#include "client_server_utils.h"
+#include "output.h"
+
+/* Number of submission queue entries. The completion queue is sized to
+ * URING_CQ_FACTOR times this. */
+#define URING_ENTRIES 1024
+#define URING_CQ_FACTOR 8
+
+/* Number and size of the buffers in the provided buffer ring. The number
+ * must be a power of two. */
+#define URING_BUFFER_COUNT 512
+#define URING_BUFFER_SIZE 4096
+
+/* The most spare sends and spare batches a shard keeps for reuse. A send
+ * is small and every queued message needs one, while a batch is large and
+ * a connection has at most two, one in flight and one awaiting its
+ * zerocopy notification. */
+#define URING_SPARE_SENDS 65536
+#define URING_SPARE_BATCHES 256
+
+/* The number of completions handled before the requests they queued are
+ * submitted. */
+#define URING_COMPLETION_BATCH 64
+
+/* Function that sets up the ring, registers the provided buffers and arms
+ * a multishot accept on the server socket in sockets[0]. Returns false,
+ * leaving nothing behind, if the kernel lacks any of the features used. */
+bool uring_init ();
+
+/* Function that arms a multishot recv for the socket in index n. */
+void uring_add (unsigned n);
+
+/* Function that cancels every request on the socket in index n and drops
+ * the messages still queued for it. Must be called before the socket is
+ * closed. */
+void uring_remove (unsigned n);
+
+/* Function that queues message to be sent to the socket in index n. The
+ * queue holds a reference to the message until it has been sent and is
+ * bounded by output_limit. Returns false if the connection should be
+ * closed under the slow consumer policy. */
+bool uring_send (unsigned n, struct outbound *message);
+
+/* Function that hands the messages queued for the socket in index n to the
+ * kernel in one sendmsg, unless an earlier one is still in progress. */
+bool uring_flush (unsigned n);
+
+/* Function that queues a one shot poll on the admin socket fd whose
+ * completion is handed to handle_admin. */
+void uring_watch_admin (fd_t fd, bool output);
+
+/* Function that accepts again once the server has room if the shard
+ * stopped accepting because it was full: the connections accepted while it
+ * was full are added first and the multishot accept is armed again. Does
+ * nothing unless the shard's accept_stalled is set. */
+void uring_resume_accept ();
+
+/* Function that submits every queued request, waits for at least one
+ * completion and dispatches all available completions. */
+void uring_wait ();
+
+#endif
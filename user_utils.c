@@ -9,7 +9,67 @@
 #include "user_utils.h"
 #include "client_server_utils.h"
 #include "server.h"
+#include "connections.h"
+#include "shards.h"
+#include "recipients.h"
 
+void sorted_insert (struct user_info *user);
+
+void sorted_remove (struct user_info *user);
+
+struct sorted_node *sorted_head ();
+
+unsigned sorted_height ();
+
+bool sorts_before (struct user_info *first, struct user_info *second);
+
+unsigned hash_name (char *name);
+
+void index_insert (struct user_index *index, char *key, struct user_info *user);
+
+void index_remove (struct user_index *index, char *key, struct user_info *user);
+
+struct user_info *index_find (struct user_index *index, char *key);
+
+void grow_index (struct user_index *index);
+
+void assign_name_id (struct name_info *info);
+
+void release_name_id (struct name_info *info);
+
+void release_muted (struct user_info *user);
+
+/* The node before the first user of the sorted index, NULL until the
+ * first user joins, and the number of levels in use. */
+struct sorted_node *sorted_index;
+unsigned sorted_levels;
+
+/* The sequence number the next user filed in the sorted index gets. */
+unsigned long sorted_sequence;
+
+/* The state of the generator picking the height of new nodes. */
+unsigned sorted_seed = 2463534242;
+
+/* The number of users in the room, on any shard. */
+unsigned room_total;
+
+/* The name_info holding each id, NULL for an id that is free. */
+struct name_info **id_owners;
+
+/* The ids that were given out and freed again, reused before new ones. */
+unsigned *free_ids;
+unsigned free_id_total;
+
+/* The number of ids given out so far and the number id_owners and free_ids
+ * have room for. */
+unsigned id_total;
+unsigned id_capacity;
+
+/* The users of the room by name. */
+struct user_index name_index;
+
+/* The users of the room who have a nickname by nickname. */
+struct user_index nickname_index;
 
 /*
  * Function: create_name
@@ -40,8 +100,13 @@ char *create_name (char *name) {
  */
 struct name_info *create_name_info (char *name) {
         struct name_info *ni = (struct name_info *) malloc(sizeof(struct name_info));
+        if (ni == NULL) {
+                allocation_failed();
+        }
         ni->name = create_name(name);
         ni->total_tracking = 0;
+        ni->muters = 0;
+        assign_name_id(ni);
         return ni;
 }
 
@@ -61,12 +126,12 @@ struct user_info *create_user (char *name) {
 	struct user_info *ui = (struct user_info *) malloc(sizeof(struct user_info));
 	ui->name_info = create_name_info(name);
 	ui->nickname = NULL;
-    ui->muted_total = (unsigned *) malloc(sizeof(unsigned));
-	*(ui->muted_total) = 0;
-    ui->muted_capacity = MAX_CONNECTIONS;
-
-    struct name_info **muted_users = (struct name_info**) malloc(MAX_CONNECTIONS * sizeof(struct name_info*));
-    ui->muted = muted_users;
+    ui->muted = NULL;
+    ui->muted_words = 0;
+    ui->status = NULL;
+    ui->status_length = 0;
+    ui->status_capacity = 0;
+    index_user(ui);
 
 	return ui;
 }
@@ -76,6 +141,8 @@ struct user_info *create_user (char *name) {
  *
  * frees the memory associated with a user. importantly, all references to that
  * user (through other users' collection of muted users) must be cleared first.
+ * The other users are only visited if someone muted the user, and everyone
+ * the user muted is left with one muter less.
  *
  * name: pointer to user_info struct, the user to be freed
  *
@@ -84,21 +151,595 @@ struct user_info *create_user (char *name) {
  */
 void cleanup_user (struct user_info *user) {
 
-    for(int i = 0; i < MAX_CONNECTIONS; i++){
-        if (users[i] == NULL || user == users[i]){
-            continue;
+    unindex_user(user);
+    forget_muted(user->name_info);
+    release_muted(user);
+    release_nickname(user);
+    release_name_info(user->name_info);
+    free(user->muted);
+    free(user->status);
+    free(user);
+
+}
+
+/*
+ * Function: sorted_insert
+ *
+ * files a user in the sorted index under its name, after any user with
+ * the same name that is already there. The nodes before the
+ * new one on every level are found on the way down, along with how many
+ * users precede each of them, so the spans of the links it splits can be
+ * set without another walk. Must be called with the room lock held.
+ *
+ * user: pointer to the user_info struct of the user
+ *
+ * returns: void
+ *
+ */
+void sorted_insert (struct user_info *user) {
+    struct sorted_node *update[SORTED_INDEX_LEVELS];
+    unsigned rank[SORTED_INDEX_LEVELS];
+    user->sorted_sequence = sorted_sequence;
+    sorted_sequence++;
+    struct sorted_node *node = sorted_head();
+    for (int i = sorted_levels - 1; i >= 0; i--) {
+        rank[i] = i == sorted_levels - 1 ? 0 : rank[i + 1];
+        while (node->links[i].next != NULL && sorts_before(node->links[i].next->user, user)) {
+            rank[i] += node->links[i].span;
+            node = node->links[i].next;
+        }
+        update[i] = node;
+    }
+    unsigned height = sorted_height();
+    if (height > sorted_levels) {
+        for (unsigned i = sorted_levels; i < height; i++) {
+            rank[i] = 0;
+            update[i] = sorted_head();
+            update[i]->links[i].span = room_total;
+        }
+        sorted_levels = height;
+    }
+    node = malloc(sizeof(struct sorted_node) + height * sizeof(struct sorted_link));
+    if (node == NULL) {
+        allocation_failed();
+    }
+    node->user = user;
+    for (unsigned i = 0; i < height; i++) {
+        node->links[i].next = update[i]->links[i].next;
+        update[i]->links[i].next = node;
+        node->links[i].span = update[i]->links[i].span - (rank[0] - rank[i]);
+        update[i]->links[i].span = rank[0] - rank[i] + 1;
+    }
+    for (unsigned i = height; i < sorted_levels; i++) {
+        update[i]->links[i].span++;
+    }
+    room_total++;
+}
+
+/*
+ * Function: sorted_remove
+ *
+ * removes a user from the sorted index. Must be called with the room lock
+ * held and before the name of the user changes or is freed.
+ *
+ * user: pointer to the user_info struct of the user
+ *
+ * returns: void
+ *
+ */
+void sorted_remove (struct user_info *user) {
+    struct sorted_node *update[SORTED_INDEX_LEVELS];
+    struct sorted_node *node = sorted_head();
+    for (int i = sorted_levels - 1; i >= 0; i--) {
+        while (node->links[i].next != NULL && sorts_before(node->links[i].next->user, user)) {
+            node = node->links[i].next;
+        }
+        update[i] = node;
+    }
+    node = node->links[0].next;
+    for (unsigned i = 0; i < sorted_levels; i++) {
+        if (update[i]->links[i].next == node) {
+            update[i]->links[i].span += node->links[i].span - 1;
+            update[i]->links[i].next = node->links[i].next;
+        } else {
+            update[i]->links[i].span--;
+        }
+    }
+    while (sorted_levels > 1 && sorted_head()->links[sorted_levels - 1].next == NULL) {
+        sorted_levels--;
+    }
+    free(node);
+    room_total--;
+}
+
+/*
+ * Function: sorted_user_at
+ *
+ * finds the user with the given position in the sorted index by adding up
+ * the spans of the links taken, so a page deep into a large room is found
+ * without walking the users before it. Must be called with the room lock
+ * held.
+ *
+ * position: the number of users that sort before the one wanted
+ *
+ * returns: the node of the user, NULL if the room has no more users
+ *
+ */
+struct sorted_node *sorted_user_at (unsigned position) {
+    if (position >= room_total) {
+        return NULL;
+    }
+    struct sorted_node *node = sorted_head();
+    unsigned traversed = 0;
+    for (int i = sorted_levels - 1; i >= 0; i--) {
+        while (node->links[i].next != NULL && traversed + node->links[i].span <= position + 1) {
+            traversed += node->links[i].span;
+            node = node->links[i].next;
+        }
+    }
+    return node;
+}
+
+/* Function that determines if user first comes before user second in the
+ * sorted index, by name and then, since a rename may take a name that is
+ * in use, by when they were filed. */
+bool sorts_before (struct user_info *first, struct user_info *second) {
+    int order = strcmp(first->name_info->name, second->name_info->name);
+    return order < 0 || (order == 0 && first->sorted_sequence < second->sorted_sequence);
+}
+
+/* Function that returns the node before the first user of the sorted
+ * index, which has a link on every level, allocating it on first use. */
+struct sorted_node *sorted_head () {
+    if (sorted_index == NULL) {
+        sorted_index = calloc(1, sizeof(struct sorted_node) + SORTED_INDEX_LEVELS * sizeof(struct sorted_link));
+        if (sorted_index == NULL) {
+            allocation_failed();
         }
+        sorted_levels = 1;
+    }
+    return sorted_index;
+}
+
+/* Function that picks the number of levels of a new node of the sorted
+ * index, each further level with a chance of one in four. */
+unsigned sorted_height () {
+    unsigned height = 1;
+    while (height < SORTED_INDEX_LEVELS) {
+        sorted_seed ^= sorted_seed << 13;
+        sorted_seed ^= sorted_seed >> 17;
+        sorted_seed ^= sorted_seed << 5;
+        if ((sorted_seed & 3) != 0) {
+            break;
+        }
+        height++;
+    }
+    return height;
+}
+
+/*
+ * Function: invalidate_status
+ *
+ * marks the rendered status of a user as stale, keeping its buffer for the
+ * next rendering.
+ *
+ * user: pointer to the user_info struct of the user
+ *
+ * returns: void
+ *
+ */
+void invalidate_status (struct user_info *user) {
+    user->status_length = 0;
+}
+
+/*
+ * Function: index_user
+ *
+ * files a user in the name index, the sorted index and, if the user has a
+ * nickname, in the nickname index. Must be called with the room lock held.
+ *
+ * user: pointer to the user_info struct of the user
+ *
+ * returns: void
+ *
+ */
+void index_user (struct user_info *user) {
+    index_insert(&name_index, user->name_info->name, user);
+    sorted_insert(user);
+    index_nickname(user);
+}
+
+/*
+ * Function: unindex_user
+ *
+ * removes a user from every index. Must be called with the room lock held
+ * and before the name or nickname of the user is freed.
+ *
+ * user: pointer to the user_info struct of the user
+ *
+ * returns: void
+ *
+ */
+void unindex_user (struct user_info *user) {
+    index_remove(&name_index, user->name_info->name, user);
+    sorted_remove(user);
+    unindex_nickname(user);
+}
+
+/*
+ * Function: index_nickname
+ *
+ * files a user in the nickname index if the user has a nickname. Must be
+ * called with the room lock held.
+ *
+ * user: pointer to the user_info struct of the user
+ *
+ * returns: void
+ *
+ */
+void index_nickname (struct user_info *user) {
+    if (has_nickname(user)) {
+        index_insert(&nickname_index, *user->nickname, user);
+    }
+}
+
+/*
+ * Function: unindex_nickname
+ *
+ * removes a user from the nickname index if the user has a nickname. Must
+ * be called with the room lock held and before the nickname is freed.
+ *
+ * user: pointer to the user_info struct of the user
+ *
+ * returns: void
+ *
+ */
+void unindex_nickname (struct user_info *user) {
+    if (has_nickname(user)) {
+        index_remove(&nickname_index, *user->nickname, user);
+    }
+}
+
+/*
+ * Function: release_nickname
+ *
+ * frees the nickname of a user, which is either NULL, the user's own name
+ * after the nickname was cleared, or a copy of its own.
+ *
+ * user: pointer to the user_info struct of the user
+ *
+ * returns: void
+ *
+ */
+void release_nickname (struct user_info *user) {
+    if (user->nickname != NULL && user->nickname != &user->name_info->name) {
+        free(*user->nickname);
+        free(user->nickname);
+    }
+    user->nickname = NULL;
+}
+
+/*
+ * Function: hash_name
+ *
+ * computes the 32 bit FNV-1a hash of a name.
+ *
+ * name: the name to hash
+ *
+ * returns: the hash
+ *
+ */
+unsigned hash_name (char *name) {
+    unsigned hash = 2166136261u;
+    for (unsigned char *c = (unsigned char *) name; *c != 0; c++) {
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-        for(int j = 0; j < MAX_CONNECTIONS; j++){
-            if ((*users[i]).muted[j] == user->name_info){
-                (*users[i]).muted[j] = NULL;
+/*
+ * Function: index_insert
+ *
+ * files user under key in the first empty slot from the one the hash of
+ * the key picks, doubling the index first if it would become three
+ * quarters full. A key may be filed more than once since nothing stops
+ * two users from taking the same name.
+ *
+ * index: the index to add to
+ * key: the string the user is found by, which must stay valid until the
+ * user is removed
+ * user: pointer to the user_info struct of the user
+ *
+ * returns: void
+ *
+ */
+void index_insert (struct user_index *index, char *key, struct user_info *user) {
+    if ((index->count + 1) * 4 > index->capacity * 3) {
+        grow_index(index);
+    }
+    unsigned hash = hash_name(key);
+    unsigned mask = index->capacity - 1;
+    unsigned slot = hash & mask;
+    while (index->entries[slot].user != NULL) {
+        slot = (slot + 1) & mask;
+    }
+    index->entries[slot].hash = hash;
+    index->entries[slot].key = key;
+    index->entries[slot].user = user;
+    index->count++;
+}
+
+/*
+ * Function: index_remove
+ *
+ * removes the slot of user filed under key and then shifts back every
+ * following slot of the run that may take its place, so that no lookup
+ * stops early at the hole.
+ *
+ * index: the index to remove from
+ * key: the string the user was filed under
+ * user: pointer to the user_info struct of the user
+ *
+ * returns: void
+ *
+ */
+void index_remove (struct user_index *index, char *key, struct user_info *user) {
+    if (index->count == 0) {
+        return;
+    }
+    unsigned mask = index->capacity - 1;
+    unsigned hole = hash_name(key) & mask;
+    while (index->entries[hole].user != user) {
+        if (index->entries[hole].user == NULL) {
+            return;
+        }
+        hole = (hole + 1) & mask;
+    }
+    index->count--;
+    unsigned slot = hole;
+    while (true) {
+        slot = (slot + 1) & mask;
+        struct index_entry *entry = &index->entries[slot];
+        if (entry->user == NULL) {
+            break;
+        }
+        /* An entry may fill the hole unless its home slot lies after the
+         * hole, in which case moving it would put it before its home. */
+        if (((slot - (entry->hash & mask)) & mask) >= ((slot - hole) & mask)) {
+            index->entries[hole] = *entry;
+            hole = slot;
+        }
+    }
+    index->entries[hole].user = NULL;
+}
+
+/*
+ * Function: index_find
+ *
+ * finds a user filed under key.
+ *
+ * index: the index to search
+ * key: the string to look for
+ *
+ * returns: pointer to user_info || NULL
+ *
+ */
+struct user_info *index_find (struct user_index *index, char *key) {
+    if (index->count == 0) {
+        return NULL;
+    }
+    unsigned hash = hash_name(key);
+    unsigned mask = index->capacity - 1;
+    for (unsigned slot = hash & mask; index->entries[slot].user != NULL; slot = (slot + 1) & mask) {
+        struct index_entry *entry = &index->entries[slot];
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            return entry->user;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Function: grow_index
+ *
+ * doubles the slots of an index, or gives it its first ones, and files
+ * every entry again.
+ *
+ * index: the index to grow
+ *
+ * returns: void
+ *
+ */
+void grow_index (struct user_index *index) {
+    struct index_entry *old_entries = index->entries;
+    unsigned old_capacity = index->capacity;
+    index->capacity = old_capacity == 0 ? INITIAL_INDEX_CAPACITY : old_capacity * 2;
+    index->entries = calloc(index->capacity, sizeof(struct index_entry));
+    if (index->entries == NULL) {
+        allocation_failed();
+    }
+    unsigned mask = index->capacity - 1;
+    for (unsigned i = 0; i < old_capacity; i++) {
+        if (old_entries[i].user != NULL) {
+            unsigned slot = old_entries[i].hash & mask;
+            while (index->entries[slot].user != NULL) {
+                slot = (slot + 1) & mask;
             }
+            index->entries[slot] = old_entries[i];
+        }
+    }
+    free(old_entries);
+}
 
+/*
+ * Function: forget_muted
+ *
+ * removes info from the collection of names muted by each user of the
+ * calling shard. Used when a user on another shard leaves.
+ *
+ * info: pointer to the name_info struct of the user who left
+ *
+ * returns: void
+ *
+ */
+void forget_muted (struct name_info *info) {
+    if (!has_muters(info)) {
+        return;
+    }
+    for(unsigned i = 0; i < socket_total - 1; i++){
+        struct user_info *user = users[active_connections[i]];
+        if (user != NULL){
+            remove_muted(user, info);
         }
     }
-    cleanup_name_info(user->name_info);
-    free(user);
+}
+
+/*
+ * Function: add_muted
+ *
+ * sets the bit of info in the mute set of user, growing the set up to the
+ * word that holds it, and counts user as a muter of info if it was not one
+ * already. The recipient list of info on the calling shard goes stale.
+ *
+ * user: pointer to the user_info struct of the muting user
+ * info: pointer to the name_info struct of the muted user
+ *
+ * returns: void
+ *
+ */
+void add_muted (struct user_info *user, struct name_info *info) {
+    unsigned word = info->id / MUTE_WORD_BITS;
+    unsigned long bit = 1UL << (info->id % MUTE_WORD_BITS);
+    if (word >= user->muted_words) {
+        user->muted = realloc(user->muted, (word + 1) * sizeof(unsigned long));
+        if (user->muted == NULL) {
+            allocation_failed();
+        }
+        memset(user->muted + user->muted_words, 0, (word + 1 - user->muted_words) * sizeof(unsigned long));
+        user->muted_words = word + 1;
+    }
+    if ((user->muted[word] & bit) == 0) {
+        user->muted[word] |= bit;
+        __atomic_add_fetch(&info->muters, 1, __ATOMIC_RELAXED);
+        invalidate_recipients(info);
+    }
+}
+
+/*
+ * Function: remove_muted
+ *
+ * clears the bit of info in the mute set of user, which makes the
+ * recipient list of info on the calling shard stale.
+ *
+ * user: pointer to the user_info struct of the muting user
+ * info: pointer to the name_info struct of the muted user
+ *
+ * returns: true if info was muted by user
+ *
+ */
+bool remove_muted (struct user_info *user, struct name_info *info) {
+    unsigned word = info->id / MUTE_WORD_BITS;
+    unsigned long bit = 1UL << (info->id % MUTE_WORD_BITS);
+    if (word >= user->muted_words || (user->muted[word] & bit) == 0) {
+        return false;
+    }
+    user->muted[word] &= ~bit;
+    __atomic_sub_fetch(&info->muters, 1, __ATOMIC_RELAXED);
+    invalidate_recipients(info);
+    return true;
+}
+
+/*
+ * Function: release_muted
+ *
+ * empties the mute set of a user who is leaving a word at a time, leaving
+ * every user it muted with one muter less. Must be called with the room
+ * lock held since the owners of the ids are looked up.
+ *
+ * user: pointer to the user_info struct of the user who is leaving
+ *
+ * returns: void
+ *
+ */
+void release_muted (struct user_info *user) {
+    for (unsigned word = 0; word < user->muted_words; word++) {
+        unsigned long bits = user->muted[word];
+        while (bits != 0) {
+            unsigned id = word * MUTE_WORD_BITS + __builtin_ctzl(bits);
+            bits &= bits - 1;
+            __atomic_sub_fetch(&id_owners[id]->muters, 1, __ATOMIC_RELAXED);
+            invalidate_recipients(id_owners[id]);
+        }
+        user->muted[word] = 0;
+    }
+}
 
+/*
+ * Function: has_muters
+ *
+ * checks whether any user has muted the user with the given name info. The
+ * count is changed by other shards as their users mute and unmute, but a
+ * user of the calling shard who muted info keeps it above zero.
+ *
+ * info: pointer to the name_info struct of the user
+ *
+ * returns: bool
+ *
+ */
+bool has_muters (struct name_info *info) {
+    return __atomic_load_n(&info->muters, __ATOMIC_RELAXED) != 0;
+}
+
+/*
+ * Function: assign_name_id
+ *
+ * gives info the id of a user who left if there is one, a new id
+ * otherwise, so ids stay small and the mute sets short. Must be called
+ * with the room lock held.
+ *
+ * info: pointer to the name_info struct of the user who joined
+ *
+ * returns: void
+ *
+ */
+void assign_name_id (struct name_info *info) {
+    if (free_id_total > 0) {
+        free_id_total--;
+        info->id = free_ids[free_id_total];
+    } else {
+        if (id_total == id_capacity) {
+            id_capacity = id_capacity == 0 ? INITIAL_ROOM_CAPACITY : id_capacity * 2;
+            id_owners = realloc(id_owners, id_capacity * sizeof(struct name_info *));
+            free_ids = realloc(free_ids, id_capacity * sizeof(unsigned));
+            if (id_owners == NULL || free_ids == NULL) {
+                allocation_failed();
+            }
+        }
+        info->id = id_total;
+        id_total++;
+    }
+    id_owners[info->id] = info;
+}
+
+/*
+ * Function: release_name_id
+ *
+ * frees the id of info once every shard forgot it, so no mute set has its
+ * bit set any longer. The last shard to forget a user does so without the
+ * room lock, so it is taken here.
+ *
+ * info: pointer to the name_info struct being freed
+ *
+ * returns: void
+ *
+ */
+void release_name_id (struct name_info *info) {
+    lock_room();
+    id_owners[info->id] = NULL;
+    free_ids[free_id_total] = info->id;
+    free_id_total++;
+    unlock_room();
 }
 
 /*
@@ -112,6 +753,8 @@ void cleanup_user (struct user_info *user) {
  *
  */
 void cleanup_name_info (struct name_info *info) {
+    release_name_id(info);
+    free(info->name);
     free(info);
 }
 
@@ -126,18 +769,7 @@ void cleanup_name_info (struct name_info *info) {
  *
  */
 bool istaken_name (char *name) {
-        unsigned i = 1;
-        unsigned ctr = 1;
-        while (i < socket_total) {
-                if (sockets[ctr] != -1) {
-                        i++;
-                        if (strcmp (name, users[ctr]->name_info->name) == 0) {
-                                return true;
-                        }
-                }
-                ctr++;
-        }
-        return false;
+        return find_user (name) != NULL;
 }
 
 /*
@@ -158,21 +790,11 @@ bool has_nickname (struct user_info *user) {
 	}
 }
 
-/* Function that takes in a name and determines if a user
- * has it as a nickname. You may find the global variables users,
- * socket_total, and sockets helpful here (which are defined as extern
- * in server.h). There are socket_total - 1 clients connected and they
- * can occupy indices starting at one. A client exists at an index i
- * iff sockets[i] != -1. Once you have seen all the clients you should
- * not continue checking later indices. Finally simply because a client
- * is connected does not mean they necessarily have user information
- * yet. If a client is connected at index i but does not have user
- * information yet users[i] will be NULL. */
-
 /*
  * Function: istaken_nickname
  *
- * checks if a nickname is taken by any of the existing users.
+ * checks if a nickname is taken by any of the existing users, looking it
+ * up in the nickname index.
  *
  * name: pointer to name to check
  *
@@ -180,19 +802,15 @@ bool has_nickname (struct user_info *user) {
  *
  */
 bool istaken_nickname (char *name) {
-    for(int i = 0; i < MAX_CONNECTIONS; i++){
-        if (strcmp(*users[i]->nickname, name) == 0){
-            return true;
-        }
-    }
-    return false;
+    return index_find(&nickname_index, name) != NULL;
 }
 
 /*
  * Function: find_user
  *
- * finds a user based on the name. if a user with the name exists, a pointer
- * to the user_info is returned. otherwise, NULL is returned.
+ * finds a user based on the name, looking it up in the name index. if a
+ * user with the name exists, a pointer to the user_info is returned.
+ * otherwise, NULL is returned.
  *
  * name: pointer to name to check
  *
@@ -200,18 +818,7 @@ bool istaken_nickname (char *name) {
  *
  */
 struct user_info *find_user (char *name) {
-        int start = 1;
-        int ctr = 1;
-        while (start < socket_total) {
-                if (sockets[ctr] != -1) {
-                        start++;
-                        if (strcmp (users[ctr]->name_info->name, name) == 0) {
-                                return users[ctr];
-                        }
-                }
-                ctr++;
-        }
-        return NULL;
+        return index_find (&name_index, name);
 }
 
 
@@ -227,17 +834,22 @@ struct user_info *find_user (char *name) {
  *
  */
 bool ismuted (struct user_info *receiving_user, struct user_info *possibly_muted_user) {
+    return ismuted_name(receiving_user, possibly_muted_user->name_info);
+}
 
-    struct name_info** muted_users = receiving_user->muted;
-    for(int mu_ctr = 0; mu_ctr < MAX_CONNECTIONS; mu_ctr++){
-
-        muted_users += mu_ctr;
-        if(*muted_users == possibly_muted_user->name_info){
-            return true;
-        }
-
-    }
-
-    return false;
-
+/*
+ * Function: ismuted_name
+ *
+ * checks whether a user has muted the user with the given name info
+ *
+ * receiving_user: the user
+ * info: the name info of the user who may have been muted
+ *
+ * returns: bool
+ *
+ */
+bool ismuted_name (struct user_info *receiving_user, struct name_info *info) {
+    unsigned word = info->id / MUTE_WORD_BITS;
+    return word < receiving_user->muted_words
+        && ((receiving_user->muted[word] >> (info->id % MUTE_WORD_BITS)) & 1) != 0;
 }
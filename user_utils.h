@@ -5,34 +5,103 @@
 #ifndef USER_UTILS_H
 #define USER_UTILS_H
 
+/* The number of bits in a word of a mute set. */
+#define MUTE_WORD_BITS (8 * sizeof (unsigned long))
+
+/* The number of ids the table of name ids has room for before it is first
+ * grown. */
+#define INITIAL_ROOM_CAPACITY 16
+
+/* The most levels a node of the sorted index can have, enough for far more
+ * users than a room holds. */
+#define SORTED_INDEX_LEVELS 32
+
+/* The number of slots of a user index when it is first used. Must be a
+ * power of two. */
+#define INITIAL_INDEX_CAPACITY 64
+
 /* Struct containing the information about a user. */
 struct user_info {
         struct name_info *name_info;
         char **nickname;
-        unsigned *muted_total;
-        unsigned muted_capacity;
-        struct name_info **muted; /* Contains a dynamically sized collection of 
-                                   * muted_total distinct ptrs to name_info structs, 
-                                   * each of which is either the name_info field
-                                   * of a current user or the name_info field
-                                   * of a user that has disconnected (which
-                                   * resulted in calling cleanup_user on that
-                                   * user_info struct pointer). 
-                                   * muted_capacity is the maximum number of pointers
-                                   * to name_info structs that can be stored in muted.
-                                   * This can be resized dynamically (though this is 
-                                   * not required). */
+        unsigned long *muted; /* A bitset of the users this user muted,
+                               * with bit id set for the user whose
+                               * name_info has that id. It only has as
+                               * many words as the highest id muted so
+                               * far needs, muted_words of them, and is
+                               * NULL until the user first mutes anyone. */
+        unsigned muted_words;
+        unsigned long sorted_sequence; /* Orders users with the same name
+                                        * in the sorted index. */
+        char *status; /* The first two lines of the status of the user as
+                       * show_status sends them, status_length bytes long,
+                       * or NULL until they are first shown. status_capacity
+                       * is the room the buffer has. */
+        unsigned status_length;
+        unsigned status_capacity;
 };
 
 /* Struct containing the relevant information about
  * a user's name. total_tracking tells how many users
  * have a pointer to this struct and therefore may
- * attempt to access it. */
+ * attempt to access it. id is a small number no other
+ * name_info in use has, which picks the bit of the
+ * user in mute sets, and muters counts the users
+ * whose mute set has that bit set. */
 struct name_info {
         char *name;
         unsigned total_tracking;
+        unsigned id;
+        unsigned muters;
 };
 
+/* A slot of a user index: the user, the string it is filed under and the
+ * hash of that string. A slot whose user is NULL is empty. */
+struct index_entry {
+        unsigned hash;
+        char *key;
+        struct user_info *user;
+};
+
+/* An open addressing hash table with linear probing that finds the users
+ * of the room by a string. capacity is a power of two and the table is
+ * doubled before it is three quarters full. Removal shifts the following
+ * slots back rather than leaving tombstones, so a lookup never probes
+ * further than the longest run of occupied slots. */
+struct user_index {
+        struct index_entry *entries;
+        unsigned capacity;
+        unsigned count;
+};
+
+/* A link of a node of the sorted index to the next node on its level and
+ * the number of users that link steps over, counting the one it leads to. */
+struct sorted_link {
+        struct sorted_node *next;
+        unsigned span;
+};
+
+/* A node of the sorted index, a skip list holding every user of the room
+ * in the order of their names. Every node is on level 0 and a node on a
+ * level is also on a level above it with a chance of one in four, so a
+ * user is found with about log n comparisons. The spans let a position
+ * be found the same way. */
+struct sorted_node {
+        struct user_info *user;
+        struct sorted_link links[];
+};
+
+/* The node before the first user of the sorted index. Only accessed with
+ * the room lock held. */
+extern struct sorted_node *sorted_index;
+
+/* The users of the room by name and, for those who have one, by nickname.
+ * Only accessed with the room lock held. */
+extern struct user_index name_index;
+extern struct user_index nickname_index;
+
+/* The number of users in the room, on any shard. */
+extern unsigned room_total;
 
 /* Function that takes in a name and outputs a new user_info having
  * that name. The struct should be capable or producing correct
@@ -53,10 +122,53 @@ char *create_name (char *name);
  * any pointer that will be accessed again. */
 void cleanup_user (struct user_info *user);
 
+/* Function that drops the rendered status of user so that it is rendered
+ * again the next time it is shown. Called before the name or nickname of
+ * the user changes. */
+void invalidate_status (struct user_info *user);
+
+/* Function that files user in the name index, the sorted index and, if
+ * the user has a nickname, in the nickname index. Called when a user joins
+ * and after a rename. */
+void index_user (struct user_info *user);
+
+/* Function that removes user from every index. Called when a user leaves
+ * and before a rename, while the old name is still valid. */
+void unindex_user (struct user_info *user);
+
+/* Function that returns the node of the user with the given position in
+ * the order of names, NULL if there are not that many users. The users
+ * after it follow on links[0]. */
+struct sorted_node *sorted_user_at (unsigned position);
+
+/* Function that files user in the nickname index if the user has a
+ * nickname. Called after the nickname changes. */
+void index_nickname (struct user_info *user);
+
+/* Function that removes user from the nickname index. Called before the
+ * nickname changes, while the old one is still valid. */
+void unindex_nickname (struct user_info *user);
+
+/* Function that frees the nickname of user unless it is the user's name,
+ * leaving the user without one. */
+void release_nickname (struct user_info *user);
+
 /* Function that frees the memory assoicated with a name info. Should not
  * free any pointer that will need to be accessed again. */
 void cleanup_name_info (struct name_info *info);
 
+/* Function that adds info to the names muted by user, growing the
+ * collection if it is full. */
+void add_muted (struct user_info *user, struct name_info *info);
+
+/* Function that removes info from the names muted by user. Returns false
+ * if user had not muted info. */
+bool remove_muted (struct user_info *user, struct name_info *info);
+
+/* Function that removes info from the names muted by every user of the
+ * calling shard. Does nothing if nobody muted info. */
+void forget_muted (struct name_info *info);
+
 /* Function that takes in a name and determines if it is already a user's
  * name. */
 bool istaken_name (char *name);
@@ -76,4 +188,12 @@ struct user_info *find_user (char *name);
  * user. */
 bool ismuted (struct user_info *receiving_user, struct user_info *possibly_muted_user);
 
+/* Function that determines if any user has muted the user with the given
+ * name info. */
+bool has_muters (struct name_info *info);
+
+/* Takes in a user and a name info and checks if the user has muted the
+ * user with that name info by testing its bit. */
+bool ismuted_name (struct user_info *receiving_user, struct name_info *info);
+
 #endif